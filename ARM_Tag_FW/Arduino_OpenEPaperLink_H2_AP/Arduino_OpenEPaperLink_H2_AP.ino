@@ -2,6 +2,7 @@
 
 #include "led.h"
 #include "proto.h"
+#include "ap_core.h"
 #include "radio.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
@@ -25,14 +26,10 @@
 
 const uint8_t channelList[6] = { 11, 15, 20, 25, 26, 27 };
 
-#define DATATYPE_NOUPDATE 0
 #define HW_TYPE 0xC2
 
-#define MAX_PENDING_MACS 250
 #define HOUSEKEEPING_INTERVAL 60UL
 
-struct pendingData pendingDataArr[MAX_PENDING_MACS];
-
 // VERSION GOES HERE!
 uint16_t version = 0x0019;
 
@@ -43,354 +40,54 @@ uint8_t radiorxbuffer[128];
 
 static uint32_t housekeepingTimer;
 
-struct blockRequest requestedData = { 0 };  // holds which data was requested by the tag
-
 uint8_t dstMac[8];  // target for the block transfer
 uint16_t dstPan;    //
 
-static uint32_t blockStartTimer = 0;              // reference that holds when the AP sends the next block
-uint32_t nextBlockAttempt = 0;                    // reference time for when the AP can request a new block from the ESP32
-uint8_t seq = 0;                                  // holds current sequence number for transmission
-uint8_t blockbuffer[BLOCK_XFER_BUFFER_SIZE + 5];  // block transfer buffer
+uint8_t seq = 0;  // holds current sequence number for transmission
 uint8_t lastAckMac[8] = { 0 };
 
-// these variables hold the current mac were talking to
-#define CONCURRENT_REQUEST_DELAY 1200UL
-uint32_t lastBlockRequest = 0;
-uint8_t lastBlockMac[8];
 uint8_t lastTagReturn[8];
 
 uint8_t curChannel = 25;
 uint8_t curPower = 10;
 
-uint8_t curPendingData = 0;
-uint8_t curNoUpdate = 0;
-
-bool highspeedSerial = false;
-
 void sendXferCompleteAck(uint8_t *dst);
 void sendCancelXfer(uint8_t *dst);
 void espNotifyAPInfo();
 
-// tools
-void addCRC(void *p, uint8_t len) {
-  uint8_t total = 0;
-  for (uint8_t c = 1; c < len; c++) {
-    total += ((uint8_t *)p)[c];
-  }
-  ((uint8_t *)p)[0] = total;
+static uint32_t apMillis() {
+  return millis();
 }
-bool checkCRC(void *p, uint8_t len) {
-  uint8_t total = 0;
-  for (uint8_t c = 1; c < len; c++) {
-    total += ((uint8_t *)p)[c];
-  }
-  return ((uint8_t *)p)[0] == total;
+static void apDelay(int ms) {
+  delay(ms);
 }
-
-uint8_t getPacketType(void *buffer) {
-  struct MacFcs *fcs = (MacFcs *)buffer;
-  if ((fcs->frameType == 1) && (fcs->destAddrType == 2) && (fcs->srcAddrType == 3) && (fcs->panIdCompressed == 0)) {
-    // broadcast frame
-    uint8_t type = ((uint8_t *)buffer)[sizeof(struct MacFrameBcast)];
-    return type;
-  } else if ((fcs->frameType == 1) && (fcs->destAddrType == 3) && (fcs->srcAddrType == 3) && (fcs->panIdCompressed == 1)) {
-    // normal frame
-    uint8_t type = ((uint8_t *)buffer)[sizeof(struct MacFrameNormal)];
-    return type;
-  }
-  return 0;
+static void apReset() {
+  ESP.restart();
 }
-uint8_t getBlockDataLength() {
-  uint8_t partNo = 0;
-  for (uint8_t c = 0; c < BLOCK_MAX_PARTS; c++) {
-    if (requestedData.requestedParts[c / 8] & (1 << (c % 8))) {
-      partNo++;
-    }
-  }
-  return partNo;
+static void apLog(const char *msg) {
+  Serial.printf("%s\r\n", msg);
 }
 
-// pendingdata slot stuff
-int8_t findSlotForMac(const uint8_t *mac) {
-  for (uint8_t c = 0; c < MAX_PENDING_MACS; c++) {
-    if (memcmp(mac, ((uint8_t *)&(pendingDataArr[c].targetMac)), 8) == 0) {
-      if (pendingDataArr[c].attemptsLeft != 0) {
-        return c;
+static bool setChannelPower(const struct espSetChannelPower *scp, void (*ack)(void)) {
+  for (uint8_t c = 0; c < sizeof(channelList); c++) {
+    if (channelList[c] == scp->channel) {
+      ack();
+      if (curChannel != scp->channel) {
+        radioSetChannel(scp->channel);
+        curChannel = scp->channel;
       }
+      curPower = scp->power;
+      radioSetTxPower(scp->power);
+      Serial.printf("Set channel: %d power: %d\r\n", curChannel, curPower);
+      return true;
     }
   }
-  return -1;
-}
-int8_t findFreeSlot() {
-  for (uint8_t c = 0; c < MAX_PENDING_MACS; c++) {
-    if (pendingDataArr[c].attemptsLeft == 0) {
-      return c;
-    }
-  }
-  return -1;
-}
-int8_t findSlotForVer(const uint8_t *ver) {
-  for (uint8_t c = 0; c < MAX_PENDING_MACS; c++) {
-    if (memcmp(ver, ((uint8_t *)&(pendingDataArr[c].availdatainfo.dataVer)), 8) == 0) {
-      if (pendingDataArr[c].attemptsLeft != 0) return c;
-    }
-  }
-  return -1;
-}
-void deleteAllPendingDataForVer(const uint8_t *ver) {
-  int8_t slot = -1;
-  do {
-    slot = findSlotForVer(ver);
-    if (slot != -1) pendingDataArr[slot].attemptsLeft = 0;
-  } while (slot != -1);
-}
-void deleteAllPendingDataForMac(const uint8_t *mac) {
-  int8_t slot = -1;
-  do {
-    slot = findSlotForMac(mac);
-    if (slot != -1) pendingDataArr[slot].attemptsLeft = 0;
-  } while (slot != -1);
+  return false;
 }
 
-void countSlots() {
-  curPendingData = 0;
-  curNoUpdate = 0;
-  for (uint8_t c = 0; c < MAX_PENDING_MACS; c++) {
-    if (pendingDataArr[c].attemptsLeft != 0) {
-      if (pendingDataArr[c].availdatainfo.dataType != 0) {
-        curPendingData++;
-      } else {
-        curNoUpdate++;
-      }
-    }
-  }
-}
-
-// processing serial data
-#define ZBS_RX_WAIT_HEADER 0
-#define ZBS_RX_WAIT_SDA 1     // send data avail
-#define ZBS_RX_WAIT_CANCEL 2  // cancel traffic for mac
-#define ZBS_RX_WAIT_SCP 3     // set channel power
-#define ZBS_RX_WAIT_BLOCKDATA 4
-
-bool isSame(uint8_t *in1, char *in2, int len) {
-  bool flag = 1;
-  for (int i = 0; i < len; i++) {
-    if (in1[i] != in2[i]) flag = 0;
-  }
-  return flag;
-}
-
-int blockPosition = 0;
-void processSerial(uint8_t lastchar) {
-  static uint8_t cmdbuffer[4];
-  static uint8_t RXState = 0;
-  static uint8_t serialbuffer[48];
-  static uint8_t *serialbufferp;
-  static uint8_t bytesRemain = 0;
-  static uint32_t lastSerial = 0;
-  static uint32_t blockStartTime = 0;
-  if ((RXState != ZBS_RX_WAIT_HEADER) && ((millis() - lastSerial) > 1000)) {
-    RXState = ZBS_RX_WAIT_HEADER;
-    Serial.printf("UART Timeout\r\n");
-  }
-  lastSerial = millis();
-  switch (RXState) {
-    case ZBS_RX_WAIT_HEADER:
-      // shift characters in
-      for (uint8_t c = 0; c < 3; c++) {
-        cmdbuffer[c] = cmdbuffer[c + 1];
-      }
-      cmdbuffer[3] = lastchar;
-
-      if (isSame(cmdbuffer + 1, ">D>", 3)) {
-        pr("ACK>");
-        blockStartTime = millis();
-        Serial.printf("Starting BlkData, %lu ms after request\r\n", blockStartTime - nextBlockAttempt);
-        blockPosition = 0;
-        RXState = ZBS_RX_WAIT_BLOCKDATA;
-      }
-
-      if (isSame(cmdbuffer, "SDA>", 4)) {
-        Serial.printf("SDA In\r\n");
-        RXState = ZBS_RX_WAIT_SDA;
-        bytesRemain = sizeof(struct pendingData);
-        serialbufferp = serialbuffer;
-        break;
-      }
-      if (isSame(cmdbuffer, "CXD>", 4)) {
-        Serial.printf("CXD In\r\n");
-        RXState = ZBS_RX_WAIT_CANCEL;
-        bytesRemain = sizeof(struct pendingData);
-        serialbufferp = serialbuffer;
-        break;
-      }
-      if (isSame(cmdbuffer, "SCP>", 4)) {
-        Serial.printf("SCP In\r\n");
-        RXState = ZBS_RX_WAIT_SCP;
-        bytesRemain = sizeof(struct espSetChannelPower);
-        serialbufferp = serialbuffer;
-        break;
-      }
-      if (isSame(cmdbuffer, "NFO?", 4)) {
-        pr("ACK>");
-        Serial.printf("NFO? In\r\n");
-        espNotifyAPInfo();
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      if (isSame(cmdbuffer, "RDY?", 4)) {
-        pr("ACK>");
-        Serial.printf("RDY? In\r\n");
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      if (isSame(cmdbuffer, "RSET", 4)) {
-        pr("ACK>");
-        Serial.printf("RSET In\r\n");
-        delay(100);
-        // TODO RESET US HERE
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      if (isSame(cmdbuffer, "HSPD", 4)) {
-        pr("ACK>");
-        Serial.printf("HSPD In, switching to 2000000\r\n");
-        delay(100);
-        uart_switch_speed(2000000);
-        delay(100);
-        highspeedSerial = true;
-        pr("ACK>");
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      break;
-    case ZBS_RX_WAIT_BLOCKDATA:
-      blockbuffer[blockPosition++] = 0xAA ^ lastchar;
-      if (blockPosition >= 4100) {
-        Serial.printf("Blockdata fully received in %lu ms, %lu ms after the request\r\n", millis() - blockStartTime, millis() - nextBlockAttempt);
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      break;
-
-    case ZBS_RX_WAIT_SDA:
-      *serialbufferp = lastchar;
-      serialbufferp++;
-      bytesRemain--;
-      if (bytesRemain == 0) {
-        if (checkCRC(serialbuffer, sizeof(struct pendingData))) {
-          struct pendingData *pd = (struct pendingData *)serialbuffer;
-          int8_t slot = findSlotForMac(pd->targetMac);
-          if (slot == -1) slot = findFreeSlot();
-          if (slot != -1) {
-            memcpy(&(pendingDataArr[slot]), serialbuffer, sizeof(struct pendingData));
-            pr("ACK>");
-          } else {
-            pr("NOQ>");
-          }
-        } else {
-          pr("NOK>");
-        }
-
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      break;
-    case ZBS_RX_WAIT_CANCEL:
-      *serialbufferp = lastchar;
-      serialbufferp++;
-      bytesRemain--;
-      if (bytesRemain == 0) {
-        if (checkCRC(serialbuffer, sizeof(struct pendingData))) {
-          struct pendingData *pd = (struct pendingData *)serialbuffer;
-          deleteAllPendingDataForMac((uint8_t *)&pd->targetMac);
-          pr("ACK>");
-        } else {
-          pr("NOK>");
-        }
-
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      break;
-    case ZBS_RX_WAIT_SCP:
-      *serialbufferp = lastchar;
-      serialbufferp++;
-      bytesRemain--;
-      if (bytesRemain == 0) {
-        if (checkCRC(serialbuffer, sizeof(struct espSetChannelPower))) {
-          struct espSetChannelPower *scp = (struct espSetChannelPower *)serialbuffer;
-          for (uint8_t c = 0; c < sizeof(channelList); c++) {
-            if (channelList[c] == scp->channel) goto SCPchannelFound;
-          }
-          goto SCPfailed;
-SCPchannelFound:
-          pr("ACK>");
-          if (curChannel != scp->channel) {
-            radioSetChannel(scp->channel);
-            curChannel = scp->channel;
-          }
-          curPower = scp->power;
-          radioSetTxPower(scp->power);
-          Serial.printf("Set channel: %d power: %d\r\n", curChannel, curPower);
-        } else {
-SCPfailed:
-          pr("NOK>");
-        }
-        RXState = ZBS_RX_WAIT_HEADER;
-      }
-      break;
-  }
-}
+static const struct apPlatform apPlatform = { apMillis, apDelay, uartTx, apLog, espNotifyAPInfo, uart_switch_speed, setChannelPower, apReset };
 
 // sending data to the ESP
-void espBlockRequest(const struct blockRequest *br, uint8_t *src) {
-  struct espBlockRequest *ebr = (struct espBlockRequest *)blockbuffer;
-  uartTx('R');
-  uartTx('Q');
-  uartTx('B');
-  uartTx('>');
-  memcpy(&(ebr->ver), &(br->ver), 8);
-  memcpy(&(ebr->src), src, 8);
-  ebr->blockId = br->blockId;
-  addCRC(ebr, sizeof(struct espBlockRequest));
-  for (uint8_t c = 0; c < sizeof(struct espBlockRequest); c++) {
-    uartTx(((uint8_t *)ebr)[c]);
-  }
-}
-void espNotifyAvailDataReq(const struct AvailDataReq *adr, const uint8_t *src) {
-  uartTx('A');
-  uartTx('D');
-  uartTx('R');
-  uartTx('>');
-
-  struct espAvailDataReq eadr = { 0 };
-  memcpy((void *)eadr.src, (void *)src, 8);
-  memcpy((void *)&eadr.adr, (void *)adr, sizeof(struct AvailDataReq));
-  addCRC(&eadr, sizeof(struct espAvailDataReq));
-  for (uint8_t c = 0; c < sizeof(struct espAvailDataReq); c++) {
-    uartTx(((uint8_t *)&eadr)[c]);
-  }
-}
-void espNotifyXferComplete(const uint8_t *src) {
-  struct espXferComplete exfc;
-  memcpy(&exfc.src, src, 8);
-  uartTx('X');
-  uartTx('F');
-  uartTx('C');
-  uartTx('>');
-  addCRC(&exfc, sizeof(exfc));
-  for (uint8_t c = 0; c < sizeof(exfc); c++) {
-    uartTx(((uint8_t *)&exfc)[c]);
-  }
-}
-void espNotifyTimeOut(const uint8_t *src) {
-  struct espXferComplete exfc;
-  memcpy(&exfc.src, src, 8);
-  uartTx('X');
-  uartTx('T');
-  uartTx('O');
-  uartTx('>');
-  addCRC(&exfc, sizeof(exfc));
-  for (uint8_t c = 0; c < sizeof(exfc); c++) {
-    uartTx(((uint8_t *)&exfc)[c]);
-  }
-}
 void espNotifyAPInfo() {
   pr("TYP>%02X", HW_TYPE);
   pr("VER>%04X", version);
@@ -435,69 +132,18 @@ void processBlockRequest(const uint8_t *buffer, uint8_t forceBlockDownload) {
   struct blockRequest *blockReq = (struct blockRequest *)(buffer + sizeof(struct MacFrameNormal) + 1);
   if (!checkCRC(blockReq, sizeof(struct blockRequest))) return;
 
-  // check if we're already talking to this mac
-  if (memcmp(rxHeader->src, lastBlockMac, 8) == 0) {
-    lastBlockRequest = millis();
-  } else {
-    // we weren't talking to this mac, see if there was a transfer in progress from another mac, recently
-    if ((millis() - lastBlockRequest) > CONCURRENT_REQUEST_DELAY) {
-      // mark this mac as the new current mac we're talking to
-      memcpy((void *)lastBlockMac, (void *)rxHeader->src, 8);
-      lastBlockRequest = millis();
-    } else {
-      // we're talking to another mac, let this mac know we can't accomodate another request right now
-      pr("BUSY!\n");
-      sendCancelXfer(rxHeader->src);
-      return;
-    }
-  }
-
-  // check if we have data for this mac
-  if (findSlotForMac(rxHeader->src) == -1) {
-    // no data for this mac, politely tell it to fuck off
+  uint16_t pleaseWaitMs;
+  uint8_t admit = blockRequestAdmit(rxHeader->src, blockReq, forceBlockDownload, &pleaseWaitMs);
+  if (admit == BLOCKREQ_CANCEL) {
     sendCancelXfer(rxHeader->src);
     return;
   }
 
-  bool requestDataDownload = false;
-  if ((blockReq->blockId != requestedData.blockId) || (blockReq->ver != requestedData.ver)) {
-    // requested block isn't already in the buffer
-    requestDataDownload = true;
-  } else {
-    // requested block is already in the buffer
-    if (forceBlockDownload) {
-      if ((millis() - nextBlockAttempt) > 380) {
-        requestDataDownload = true;
-        pr("FORCED\n");
-      } else {
-        pr("IGNORED\n");
-      }
-    }
-  }
-
-  // copy blockrequest into requested data
-  memcpy(&requestedData, blockReq, sizeof(struct blockRequest));
-
   struct MacFrameNormal *txHeader = (struct MacFrameNormal *)(radiotxbuffer + 1);
   struct blockRequestAck *blockRequestAck = (struct blockRequestAck *)(radiotxbuffer + sizeof(struct MacFrameNormal) + 2);
   radiotxbuffer[0] = sizeof(struct MacFrameNormal) + 1 + sizeof(struct blockRequestAck) + RAW_PKT_PADDING;
   radiotxbuffer[sizeof(struct MacFrameNormal) + 1] = PKT_BLOCK_REQUEST_ACK;
-
-  if (blockStartTimer == 0) {
-    if (requestDataDownload) {
-      if (highspeedSerial == true) {
-        blockRequestAck->pleaseWaitMs = 140;
-      } else {
-        blockRequestAck->pleaseWaitMs = 550;
-      }
-    } else {
-      // block is already in buffer
-      blockRequestAck->pleaseWaitMs = 30;
-    }
-  } else {
-    blockRequestAck->pleaseWaitMs = 30;
-  }
-  blockStartTimer = millis() + blockRequestAck->pleaseWaitMs;
+  blockRequestAck->pleaseWaitMs = pleaseWaitMs;
 
   memcpy(txHeader->src, mSelfMac, 8);
   memcpy(txHeader->dst, rxHeader->src, 8);
@@ -517,13 +163,8 @@ void processBlockRequest(const uint8_t *buffer, uint8_t forceBlockDownload) {
   memcpy(dstMac, rxHeader->src, 8);
   dstPan = rxHeader->pan;
 
-  if (requestDataDownload) {
-    blockPosition = 0;
-    espBlockRequest(&requestedData, rxHeader->src);
-    nextBlockAttempt = millis();
-  }
+  if (admit == BLOCKREQ_FETCH) fetchRequestedBlock(rxHeader->src);
 }
-
 void processAvailDataReq(uint8_t *buffer) {
   struct MacFrameBcast *rxHeader = (struct MacFrameBcast *)buffer;
   struct AvailDataReq *availDataReq = (struct AvailDataReq *)(buffer + sizeof(struct MacFrameBcast) + 1);
@@ -538,20 +179,14 @@ void processAvailDataReq(uint8_t *buffer) {
   radiotxbuffer[sizeof(struct MacFrameNormal) + 1] = PKT_AVAIL_DATA_INFO;
 
   // check to see if we have data available for this mac
-  bool haveData = false;
-  for (uint8_t c = 0; c < MAX_PENDING_MACS; c++) {
-    if (pendingDataArr[c].attemptsLeft) {
-      if (memcmp(pendingDataArr[c].targetMac, rxHeader->src, 8) == 0) {
-        haveData = true;
-        memcpy((void *)availDataInfo, &(pendingDataArr[c].availdatainfo), sizeof(struct AvailDataInfo));
-        break;
-      }
-    }
+  const struct AvailDataInfo *pendingInfo = getPendingDataInfo(rxHeader->src);
+  if (pendingInfo != NULL) {
+    memcpy((void *)availDataInfo, pendingInfo, sizeof(struct AvailDataInfo));
+  } else {
+    // couldn't find data for this mac
+    availDataInfo->dataType = DATATYPE_NOUPDATE;
   }
 
-  // couldn't find data for this mac
-  if (!haveData) availDataInfo->dataType = DATATYPE_NOUPDATE;
-
   memcpy(txHeader->src, mSelfMac, 8);
   memcpy(txHeader->dst, rxHeader->src, 8);
   txHeader->pan = rxHeader->dstPan;
@@ -571,7 +206,7 @@ void processXferComplete(uint8_t *buffer) {
   if (memcmp(lastAckMac, rxHeader->src, 8) != 0) {
     memcpy((void *)lastAckMac, (void *)rxHeader->src, 8);
     espNotifyXferComplete(rxHeader->src);
-    int8_t slot = findSlotForMac(rxHeader->src);
+    int16_t slot = findSlotForMac(rxHeader->src);
     if (slot != -1) pendingDataArr[slot].attemptsLeft = 0;
   }
 }
@@ -694,10 +329,11 @@ void setup() {
 
   init_led();
   init_second_uart();
+  apCoreInit(&apPlatform);
 
   requestedData.blockId = 0xFF;
   // clear the array with pending information
-  memset(pendingDataArr, 0, sizeof(pendingDataArr));
+  clearPendingData();
 
   radio_init(curChannel);
   radioSetTxPower(10);
@@ -715,17 +351,11 @@ void loop() {
     if (ret > 1) {
       led_flash(0);
       // received a packet, lets see what it is
-      switch (getPacketType(radiorxbuffer)) {
+      uint8_t type = getPacketType(radiorxbuffer);
+      switch (type) {
         case PKT_AVAIL_DATA_REQ:
-          if (ret == 28) {
-            // old version of the AvailDataReq struct, set all the new fields to zero, so it will pass the CRC
-            memset(radiorxbuffer + 1 + sizeof(struct MacFrameBcast) + sizeof(struct oldAvailDataReq), 0,
-                   sizeof(struct AvailDataReq) - sizeof(struct oldAvailDataReq) + 2);
-            processAvailDataReq(radiorxbuffer);
-          } else if (ret == 40) {
-            // new version of the AvailDataReq struct
-            processAvailDataReq(radiorxbuffer);
-          }
+        case PKT_AVAIL_DATA_SHORTREQ:
+          if (fixupAvailDataReq(radiorxbuffer, type, ret)) processAvailDataReq(radiorxbuffer);
           break;
         case PKT_BLOCK_REQUEST:
           processBlockRequest(radiorxbuffer, 1);
@@ -739,20 +369,11 @@ void loop() {
         case PKT_PING:
           sendPong(radiorxbuffer);
           break;
-        case PKT_AVAIL_DATA_SHORTREQ:
-          // a short AvailDataReq is basically a very short (1 byte payload) packet that requires little preparation on the tx side, for optimal
-          // battery use bytes of the struct are set 0, so it passes the checksum test, and the ESP32 can detect that no interesting payload is
-          // sent
-          if (ret == 18) {
-            memset(radiorxbuffer + 1 + sizeof(struct MacFrameBcast), 0, sizeof(struct AvailDataReq) + 2);
-            processAvailDataReq(radiorxbuffer);
-          }
-          break;
         case PKT_TAG_RETURN_DATA:
           processTagReturnData(radiorxbuffer, ret);
           break;
         default:
-          Serial.printf("t=%02X\r\n", getPacketType(radiorxbuffer));
+          Serial.printf("t=%02X\r\n", type);
           break;
       }
     } else if (blockStartTimer == 0) {
@@ -771,16 +392,6 @@ void loop() {
   }
 
   memset(&lastTagReturn, 0, 8);
-  for (uint8_t cCount = 0; cCount < MAX_PENDING_MACS; cCount++) {
-    if (pendingDataArr[cCount].attemptsLeft == 1) {
-      if (pendingDataArr[cCount].availdatainfo.dataType != DATATYPE_NOUPDATE) {
-        espNotifyTimeOut(pendingDataArr[cCount].targetMac);
-      }
-      pendingDataArr[cCount].attemptsLeft = 0;
-    } else if (pendingDataArr[cCount].attemptsLeft > 1) {
-      pendingDataArr[cCount].attemptsLeft--;
-      if (pendingDataArr[cCount].availdatainfo.nextCheckIn) pendingDataArr[cCount].availdatainfo.nextCheckIn--;
-    }
-  }
+  pendingDataHousekeeping(espNotifyTimeOut);
   housekeepingTimer = millis();
 }
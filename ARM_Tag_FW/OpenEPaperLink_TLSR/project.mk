@@ -25,6 +25,7 @@ $(OUT_PATH)/$(SRC_PATH)/drawing.o \
 $(OUT_PATH)/$(SRC_PATH)/syncedproto.o \
 $(OUT_PATH)/$(SRC_PATH)/wdt.o \
 $(OUT_PATH)/$(SRC_PATH)/powermgt.o \
+$(OUT_PATH)/$(SRC_PATH)/checkin.o \
 
 # Each subdirectory must supply rules for building sources it contributes
 $(OUT_PATH)/$(SRC_PATH)/%.o: $(SRC_PATH)/%.c 
@@ -0,0 +1,88 @@
+#include "powermgt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The check-in interval logic of the power management, kept free of the SDK drivers so it can be
+// built and simulated on a host as well
+
+uint16_t dataReqAttemptArr[POWER_SAVING_SMOOTHING] = {0}; // Holds the amount of attempts required per data_req/check-in
+uint8_t dataReqAttemptArrayIndex = 0;
+uint8_t dataReqLastAttempt = 0;
+uint16_t nextCheckInFromAP = 0;
+uint8_t scanAttempts = 0;
+
+void initPowerSaving(const uint16_t initialValue)
+{
+    for (uint8_t c = 0; c < POWER_SAVING_SMOOTHING; c++)
+    {
+        dataReqAttemptArr[c] = initialValue;
+    }
+}
+
+uint32_t getNextScanSleep(const bool increment)
+{
+    if (increment)
+    {
+        if (scanAttempts < 255)
+            scanAttempts++;
+    }
+
+    if (scanAttempts < INTERVAL_1_ATTEMPTS)
+    {
+        return INTERVAL_1_TIME;
+    }
+    else if (scanAttempts < (INTERVAL_1_ATTEMPTS + INTERVAL_2_ATTEMPTS))
+    {
+        return INTERVAL_2_TIME;
+    }
+    else
+    {
+        return INTERVAL_3_TIME;
+    }
+}
+
+void addAverageValue()
+{
+    uint16_t curval = INTERVAL_AT_MAX_ATTEMPTS - INTERVAL_BASE;
+    curval *= dataReqLastAttempt;
+    curval /= DATA_REQ_MAX_ATTEMPTS;
+    curval += INTERVAL_BASE;
+    dataReqAttemptArr[dataReqAttemptArrayIndex % POWER_SAVING_SMOOTHING] = curval;
+    dataReqAttemptArrayIndex++;
+}
+
+uint16_t getNextSleep()
+{
+    uint16_t avg = 0;
+    for (uint8_t c = 0; c < POWER_SAVING_SMOOTHING; c++)
+    {
+        avg += dataReqAttemptArr[c];
+    }
+    avg /= POWER_SAVING_SMOOTHING;
+    return avg;
+}
+
+uint32_t getNextCheckinMs()
+{
+    // The AP sets bit 15 when it has more data queued for us, the interval is in seconds then
+    if (nextCheckInFromAP & CHECKIN_HINT_SECONDS)
+    {
+        uint16_t seconds = nextCheckInFromAP & ~CHECKIN_HINT_SECONDS;
+        if (seconds < CHECKIN_MIN_SECONDS)
+            seconds = CHECKIN_MIN_SECONDS;
+        return seconds * 1000UL;
+    }
+    // The link based interval grows with the attempts we needed, so a bad link doesn't cost more awake time
+    uint32_t interval = getNextSleep() * 1000UL;
+    // Nothing will change on the AP before its hint, so there is no point in asking earlier
+    if (nextCheckInFromAP)
+    {
+        uint32_t apInterval = nextCheckInFromAP * 60000UL;
+        if (apInterval > INTERVAL_3_TIME * 1000UL)
+            apInterval = INTERVAL_3_TIME * 1000UL;
+        if (apInterval > interval)
+            interval = apInterval;
+    }
+    return interval;
+}
@@ -18,61 +18,78 @@ void drawOnOffline(uint8_t state)
 }
 
 static uint8_t mClutMap[256];
+
+#define PLANE_SIZE (SCREEN_HEIGHT * (SCREEN_WIDTH / 8))
+#define PLANE_CHUNK 1024 // larger flash reads, each read costs a full flash command sequence
+
+static uint8_t mPlaneBuf[PLANE_CHUNK];
+
+// a plane source fills the next part of a plane, new image formats only need a new source
+typedef void (*planeSource)(uint32_t addr, uint8_t *buf, uint32_t len);
+
+static void planeFromEeprom(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+    flash_read_page(addr, len, buf); // no eepromRead here, its log line costs more than the read itself
+}
+
+static void planeEmpty(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+    memset(buf, 0x00, len);
+}
+
+struct imageFormat
+{
+    uint8_t dataType;
+    planeSource black;
+    planeSource color;
+};
+
+static const struct imageFormat imageFormats[] = {
+    {DATATYPE_IMG_RAW_1BPP, planeFromEeprom, planeEmpty},
+    {DATATYPE_IMG_RAW_2BPP, planeFromEeprom, planeFromEeprom},
+};
+
+// sends one plane to the epd in PLANE_CHUNK bursts
+static void drawPlane(planeSource source, uint32_t addr, bool offlineMarker)
+{
+    for (uint32_t c = 0; c < PLANE_SIZE; c += PLANE_CHUNK)
+    {
+        uint32_t len = PLANE_SIZE - c;
+        if (len > PLANE_CHUNK)
+            len = PLANE_CHUNK;
+        source(addr + c, mPlaneBuf, len);
+        if (offlineMarker && onlineState == 0 && byteCounter < LINE_BYTE_COUNTER)
+        {
+            uint32_t marker = LINE_BYTE_COUNTER - byteCounter;
+            if (marker > len)
+                marker = len;
+            memset(mPlaneBuf, 0x55, marker);
+        }
+        EPD_Display_buffer(mPlaneBuf, len);
+        byteCounter += len;
+    }
+}
+
 void drawImageAtAddress(uint32_t addr, uint8_t lut)
 {
     byteCounter = 0;
     struct EepromImageHeader *eih = (struct EepromImageHeader *)mClutMap;
     eepromRead(addr, mClutMap, sizeof(struct EepromImageHeader));
-    switch (eih->dataType)
+    for (uint8_t i = 0; i < sizeof(imageFormats) / sizeof(imageFormats[0]); i++)
     {
-    case DATATYPE_IMG_RAW_1BPP:
-        printf("Doing raw 1bpp\r\n");
+        if (imageFormats[i].dataType != eih->dataType)
+            continue;
+        printf("Drawing image type 0x%02X\r\n", eih->dataType);
+        addr += sizeof(struct EepromImageHeader);
         EPD_Display_start(1);
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + c, mClutMap, 256);
-            }
-            if (byteCounter < LINE_BYTE_COUNTER && onlineState == 0)
-                EPD_Display_byte(0x55);
-            else
-                EPD_Display_byte(mClutMap[c % 256]);
-            byteCounter++;
-        }
+        drawPlane(imageFormats[i].black, addr, true);
         EPD_Display_color_change();
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            EPD_Display_byte(0x00);
-        }
+        drawPlane(imageFormats[i].color, addr + PLANE_SIZE, false);
         EPD_Display_end();
-        break;
-    case DATATYPE_IMG_RAW_2BPP:
-        printf("Doing raw 2bpp\r\n");
-        EPD_Display_start(1);
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + c, mClutMap, 256);
-            }
-            if (byteCounter < LINE_BYTE_COUNTER && onlineState == 0)
-                EPD_Display_byte(0x55);
-            else
-                EPD_Display_byte(mClutMap[c % 256]);
-            byteCounter++;
-        }
-        EPD_Display_color_change();
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)) + c, mClutMap, 256);
-            }
-            EPD_Display_byte(mClutMap[c % 256]);
-        }
-        EPD_Display_end();
-        break;
+        return;
+    }
+    switch (eih->dataType)
+    {
     case DATATYPE_IMG_BMP:;
         printf("sending BMP to EPD - ");
 
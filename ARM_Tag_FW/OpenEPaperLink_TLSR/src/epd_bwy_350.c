@@ -114,10 +114,7 @@ void EPD_BWY_350_Display_byte(uint8_t data)
 }
 void EPD_BWY_350_Display_buffer(unsigned char *image, int size)
 {
-    for (int i = 0; i < size; i++)
-    {
-        EPD_WriteData(image[i]);
-    }
+    EPD_WriteDataBuf(image, size);
 }
 
 void EPD_BWY_350_Display_color_change()
@@ -57,6 +57,30 @@
     }
 }
 
+// Clocks out a whole buffer while CS stays low. Unlike EPD_SPI_Write there is no
+// settle delay per byte, the controller accepts back to back data bytes
+#define EPD_SPI_BIT(mask)                 \
+    gpio_write(EPD_CLK, 0);               \
+    gpio_write(EPD_MOSI, value & (mask)); \
+    gpio_write(EPD_CLK, 1);
+
+ void EPD_SPI_WriteBuf(const unsigned char *buf, int len)
+{
+    WaitUs(10);
+    while (len--)
+    {
+        unsigned char value = *buf++;
+        EPD_SPI_BIT(0x80);
+        EPD_SPI_BIT(0x40);
+        EPD_SPI_BIT(0x20);
+        EPD_SPI_BIT(0x10);
+        EPD_SPI_BIT(0x08);
+        EPD_SPI_BIT(0x04);
+        EPD_SPI_BIT(0x02);
+        EPD_SPI_BIT(0x01);
+    }
+}
+
  uint8_t EPD_SPI_read(void)
 {
     unsigned char i;
@@ -100,6 +124,14 @@
     gpio_write(EPD_CS, 1);
 }
 
+ void EPD_WriteDataBuf(const unsigned char *data, int len)
+{
+    gpio_write(EPD_CS, 0);
+    EPD_ENABLE_WRITE_DATA();
+    EPD_SPI_WriteBuf(data, len);
+    gpio_write(EPD_CS, 1);
+}
+
  void EPD_CheckStatus(int max_ms)
 {
     unsigned long timeout_start = clock_time();
@@ -142,11 +174,7 @@
 
  void EPD_LoadImage(unsigned char *image, int size, uint8_t cmd)
 {
-    int i;
     EPD_WriteCmd(cmd);
-    for (i = 0; i < size; i++)
-    {
-        EPD_WriteData(image[i]);
-    }
+    EPD_WriteDataBuf(image, size);
     WaitMs(2);
 }
\ No newline at end of file
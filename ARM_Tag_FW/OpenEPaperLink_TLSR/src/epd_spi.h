@@ -12,9 +12,11 @@
 
 void EPD_init(void);
 void EPD_SPI_Write(unsigned char value);
+void EPD_SPI_WriteBuf(const unsigned char *buf, int len);
 uint8_t EPD_SPI_read(void);
 void EPD_WriteCmd(unsigned char cmd);
 void EPD_WriteData(unsigned char data);
+void EPD_WriteDataBuf(const unsigned char *data, int len);
 void EPD_CheckStatus(int max_ms);
 void EPD_CheckStatus_inverted(int max_ms);
 void EPD_send_lut(uint8_t lut[], int len);
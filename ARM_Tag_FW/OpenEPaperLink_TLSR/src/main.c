@@ -211,16 +211,8 @@ int main(void)
 				currentChannel = 0;
 			}
 
-			doSleep(40 * 1000UL);
-			/*// if the AP told us to sleep for a specific period, do so.
-			if (nextCheckInFromAP)
-			{
-				doSleep(nextCheckInFromAP * 60000UL);
-			}
-			else
-			{
-				doSleep(getNextSleep() * 1000UL);
-			}*/
+			// the AP hint and our own link statistics decide the next check-in
+			doSleep(getNextCheckinMs());
 		}
 		else
 		{
@@ -34,6 +34,8 @@
 #define MINIMUM_INTERVAL 45           // IMPORTANT: Minimum interval for check-in; this determines overal battery life!
 #define MAXIMUM_PING_ATTEMPTS 20      // How many attempts to discover an AP the tag should do
 #define PING_REPLY_WINDOW 5UL
+#define CHECKIN_HINT_SECONDS 0x8000   // set in nextCheckIn by the AP when the value is in seconds (more data is queued)
+#define CHECKIN_MIN_SECONDS 2         // never come back sooner than this, even if the AP asks for it
 
 #define LONG_DATAREQ_INTERVAL 300     // How often (in seconds, approximately) the tag should do a long datareq (including temperature)
 #define VOLTAGE_CHECK_INTERVAL 288    // How often the tag should do a battery voltage check (multiplied by LONG_DATAREQ_INTERVAL)
@@ -54,6 +56,7 @@ extern void doSleep(uint32_t  t);
 
 extern void addAverageValue();
 extern uint16_t getNextSleep();
+extern uint32_t getNextCheckinMs();
 
 extern uint32_t getNextScanSleep(const bool increment);
 extern void initPowerSaving(const uint16_t initialValue);
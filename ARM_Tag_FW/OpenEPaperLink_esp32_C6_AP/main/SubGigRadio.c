@@ -6,6 +6,8 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
@@ -31,6 +33,10 @@ void DumpHex(void *AdrIn,int Len);
 #define LOG_HEX(x,y)
 #endif
 
+// Longest frame the CC1101 accepts (PKTLEN), including the 2 byte CRC.
+// The callers of SubGig_commsRxUnencrypted only have room for a protocol
+// packet and it returns the length as an int8_t.
+#define RX_PKT_MAX         (RADIO_MAX_PACKET_LEN + 2)
 
 // SPI Stuff
 #if CONFIG_SPI2_HOST
@@ -52,7 +58,7 @@ void DumpHex(void *AdrIn,int Len);
 // Modulated = false
 // Modulation Format = ASK/OOK 
 // PA Ramping = false 
-// Packet Length = 255 
+// Packet Length = 127 (RX_PKT_MAX, longer packets are discarded by the CC1101)
 // Packet Length Mode = Reserved 
 // Preamble Count = 4 
 // RX Filter BW = 58.035714 
@@ -125,7 +131,7 @@ const RfSetting g915Mhz[] = {
 // Modulated = true 
 // Modulation Format = GFSK 
 // PA Ramping = false 
-// Packet Length = 61 
+// Packet Length = 255 
 // Packet Length Mode = Variable packet length mode. Packet length configured by the first byte after sync word 
 // Preamble Count = 4 
 // RX Filter BW = 101.562500 
@@ -136,7 +142,7 @@ const RfSetting g915Mhz[] = {
 const RfSetting gIDF_Basic[] = {
     {CC1101_SYNC1,0xC7},
     {CC1101_SYNC0,0x0A},
-    {CC1101_PKTLEN,0x3D},
+    {CC1101_PKTLEN,RX_PKT_MAX},
     {CC1101_PKTCTRL0,0x05},
     {CC1101_ADDR,0xFF},
     {CC1101_FSCTRL1,0x08},
@@ -211,15 +217,56 @@ const RfSetting gDmitry915[] = {
    {0xff,0}   // end of table
 };
 
+// Received packets waiting for SubGig_commsRxUnencrypted,
+// [0] = packet length, followed by the packet
+#define RX_QUEUE_LEN       4
+
 SubGigData gSubGigData;
 
+static TaskHandle_t gRxTaskHndl;
+static QueueHandle_t gRxQueue;
+// Serializes SPI access between the RX task and the callers of TX/SetChannel
+static SemaphoreHandle_t gSpiMutex;
+
 int CheckSubGigState(void);
 void SubGig_CC1101_reset(void);
 void SubGig_CC1101_SetConfig(const RfSetting *pConfig);
 
 static void IRAM_ATTR gpio_isr_handler(void *arg)
 {
-   gSubGigData.RxAvailable = true;
+   BaseType_t Woken = pdFALSE;
+
+   if(gRxTaskHndl != NULL) {
+      vTaskNotifyGiveFromISR(gRxTaskHndl,&Woken);
+   }
+   portYIELD_FROM_ISR(Woken);
+}
+
+// Woken by GDO2 when the RX FIFO reaches the threshold or a packet ends,
+// drains the FIFO while the packet is arriving and queues it.
+// The timeout catches lost interrupts.
+static void SubGig_RxTask(void *arg)
+{
+   static uint8_t RxPkt[RX_PKT_MAX + 1];
+   int RxBytes;
+
+   while(true) {
+      ulTaskNotifyTake(pdTRUE,pdMS_TO_TICKS(100));
+      if(CheckSubGigState() != SUBGIG_ERR_NONE || gSubGigData.FreqTest) {
+         continue;
+      }
+      xSemaphoreTake(gSpiMutex,portMAX_DELAY);
+      CC1101_logState();
+      RxBytes = CC1101_Rx(&RxPkt[1],RX_PKT_MAX,NULL,NULL);
+      xSemaphoreGive(gSpiMutex);
+
+      if(RxBytes >= 2) {
+         RxPkt[0] = (uint8_t) RxBytes;
+         if(xQueueSend(gRxQueue,RxPkt,0) != pdTRUE) {
+            LOGE("SubGhz RX queue full, dropping %d byte frame\n",RxBytes);
+         }
+      }
+   }
 }
 
 // return SUBGIG_ERR_NONE aka ESP_OK aka 0 if CC1101 is detected and all is good
@@ -234,7 +281,7 @@ SubGigErr SubGig_radio_init(uint8_t ch)
       .flags = SPI_DEVICE_NO_DUMMY
    };
    gpio_config_t io_conf = {
-      .intr_type = GPIO_INTR_NEGEDGE, // GPIO interrupt type : falling edge
+      .intr_type = GPIO_INTR_DISABLE,
       //bit mask of the pins
       .pin_bit_mask = 1ULL<<CONFIG_GDO0_GPIO,
       //set as input mode
@@ -269,14 +316,14 @@ SubGigErr SubGig_radio_init(uint8_t ch)
          break;
       }
 
-   // Configure GDO0, interrupt on falling edge
+   // Configure GDO0, interrupts disabled
       if((Err = gpio_config(&io_conf)) != 0) {
          ErrLine = __LINE__;
          break;
       }
 
-   // Configure GDO2, interrupts disabled
-      io_conf.intr_type = GPIO_INTR_DISABLE;
+   // Configure GDO2, interrupt on rising edge
+      io_conf.intr_type = GPIO_INTR_POSEDGE;
       io_conf.pin_bit_mask = 1ULL<<CONFIG_GDO2_GPIO;
       if((Err = gpio_config(&io_conf)) != 0) {
          ErrLine = __LINE__;
@@ -289,8 +336,8 @@ SubGigErr SubGig_radio_init(uint8_t ch)
          break;
       }
       //hook isr handler for specific gpio pin
-      Err = gpio_isr_handler_add(CONFIG_GDO0_GPIO,gpio_isr_handler,
-                                 (void*) CONFIG_GDO0_GPIO);
+      Err = gpio_isr_handler_add(CONFIG_GDO2_GPIO,gpio_isr_handler,
+                                 (void*) CONFIG_GDO2_GPIO);
       if(Err != 0) {
          ErrLine = __LINE__;
          break;
@@ -307,9 +354,21 @@ SubGigErr SubGig_radio_init(uint8_t ch)
 #if 0
       CC1101_DumpRegs();
 #endif
+      gSpiMutex = xSemaphoreCreateMutex();
+      gRxQueue = xQueueCreate(RX_QUEUE_LEN,RX_PKT_MAX + 1);
+      if(gSpiMutex == NULL || gRxQueue == NULL) {
+         ErrLine = __LINE__;
+         break;
+      }
       if(ch != 0) {
          SubGig_radioSetChannel(ch);
       }
+      if(xTaskCreate(SubGig_RxTask,"SubGigRx",3072,NULL,
+                     configMAX_PRIORITIES - 2,&gRxTaskHndl) != pdPASS)
+      {
+         ErrLine = __LINE__;
+         break;
+      }
    // good to go!
    } while(false);
 
@@ -346,6 +405,7 @@ SubGigErr SubGig_radioSetChannel(uint8_t ch)
          break;
       }
       LOG("Set channel %d\n",ch);
+      xSemaphoreTake(gSpiMutex,portMAX_DELAY);
 
       if(ch >= FIRST_866_CHAN && ch < FIRST_866_CHAN + NUM_866_CHANNELS) {
       // Base Frequency = 863.999756   
@@ -382,6 +442,7 @@ SubGigErr SubGig_radioSetChannel(uint8_t ch)
       }
       SubGig_CC1101_SetConfig(SetChannr);
       CC1101_setRxState();
+      xSemaphoreGive(gSpiMutex);
    } while(false);
 
    return Ret;
@@ -409,11 +470,11 @@ SubGigErr SubGig_radioTx(uint8_t *packet)
       packet[0] -= RAW_PKT_PADDING;
       LOG("Sending %d byte subgig frame:\n",packet[0]);
       LOG_HEX(&packet[1],packet[0]);
+      xSemaphoreTake(gSpiMutex,portMAX_DELAY);
       if(CC1101_Tx(packet)) {
          Ret = SUBGIG_TX_FAILED;
       }
-   // Clear RxAvailable, in TX GDO0 deasserts on TX FIFO underflows
-      gSubGigData.RxAvailable = false;
+      xSemaphoreGive(gSpiMutex);
    // restore original len just in case anyone cares
       packet[0] += RAW_PKT_PADDING;
    } while(false);
@@ -424,7 +485,7 @@ SubGigErr SubGig_radioTx(uint8_t *packet)
 // returns packet size in bytes data in data
 int8_t SubGig_commsRxUnencrypted(uint8_t *data)
 {
-   int RxBytes;
+   uint8_t RxPkt[RX_PKT_MAX + 1];
    int8_t Ret = 0;
 
    do {
@@ -435,27 +496,13 @@ int8_t SubGig_commsRxUnencrypted(uint8_t *data)
       if(gSubGigData.FreqTest) {
          break;
       }
-      CC1101_logState();
 
-      if(!gSubGigData.RxAvailable && gpio_get_level(CONFIG_GDO0_GPIO) == 1) {
-      // Did we miss an interrupt?
-         if(gpio_get_level(CONFIG_GDO0_GPIO) == 1) {
-         // Yup!
-            LOGE("SubGhz lost interrupt\n");
-            gSubGigData.RxAvailable = true;
-         }
-      }
-
-      if(gSubGigData.RxAvailable){
-         gSubGigData.RxAvailable = false;
-         RxBytes = CC1101_Rx(data,128,NULL,NULL);
-         
-         if(RxBytes >= 2) {
-         // NB: RxBytes includes the CRC, deduct it
-            Ret = (uint8_t) RxBytes - 2;
-            LOG("Received %d byte subgig frame:\n",Ret);
-            LOG_HEX(data,Ret);
-         }
+      if(xQueueReceive(gRxQueue,RxPkt,0) == pdTRUE) {
+         memcpy(data,&RxPkt[1],RxPkt[0]);
+      // NB: RxPkt[0] includes the CRC, deduct it
+         Ret = (uint8_t) RxPkt[0] - 2;
+         LOG("Received %d byte subgig frame:\n",Ret);
+         LOG_HEX(data,Ret);
       }
    } while(false);
 
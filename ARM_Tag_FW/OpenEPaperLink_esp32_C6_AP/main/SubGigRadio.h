@@ -23,7 +23,6 @@ typedef struct {
    uint8_t Present:1;
    uint8_t Enabled:1;
    uint8_t FreqTest:1;
-   uint8_t RxAvailable:1;
    uint8_t Initialized:1;
    uint8_t FixedRegsSet:1;
 } SubGigData;
@@ -70,9 +70,13 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "sdkconfig.h"
 
+// Give up on a packet that hasn't been completely received in this time
+#define RX_TIMEOUT_US   100000
+
 /**
  * RF STATES
  */
@@ -155,8 +159,13 @@ enum RFSTATE {
 #define CC1101_LQI_MASK                0x7f
 #define CC1101_CRC_OK_MASK             0x80
 
+// IOCFG2 GDO2: high when RX FIFO at or above the RX FIFO threshold or
+// the end of packet is reached.  Switched to CC1101_TX_IOCFG2 while
+// transmitting.
+#define CC1101_DEFVAL_IOCFG2           0x01
+
 // IOCFG2 GDO2: high when TX FIFO at or above the TX FIFO threshold
-#define CC1101_DEFVAL_IOCFG2           0x02
+#define CC1101_TX_IOCFG2               0x02
 
 // IOCFG1 GDO1: High impedance (3-state)
 #define CC1101_DEFVAL_IOCFG1           0x2E
@@ -546,6 +555,7 @@ bool CC1101_Tx(uint8_t *TxData)
 
       setIdleState();
       flushTxFifo();
+      CC1101_writeReg(CC1101_IOCFG2,CC1101_TX_IOCFG2);
 
       while(BytesSent < len) {
          Bytes2Send = len - BytesSent;
@@ -608,6 +618,7 @@ bool CC1101_Tx(uint8_t *TxData)
    } while(false);
 
    setIdleState();
+   CC1101_writeReg(CC1101_IOCFG2,CC1101_DEFVAL_IOCFG2);
    CC1101_setRxState();
 
    if(ErrLine != 0) {
@@ -617,49 +628,108 @@ bool CC1101_Tx(uint8_t *TxData)
    return Ret;
 }
 
-// Called when GDO0 goes low, i.e. end of packet.
-// Everything has been received.
-// NB: this means the entire packet must fit in the FIFO so maximum
-// message length is 64 bytes.
+// Called when GDO2 goes high, i.e. the RX FIFO reached the threshold or
+// the end of the packet was received.
+// The FIFO is drained while the packet is still arriving so packets
+// may be longer than the 64 byte FIFO.
+// Must be called from the task woken by the GDO2 interrupt, it sleeps on
+// the task notification between bursts.
+// Returns 0 if there was nothing to read.
 int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
 {
-   uint8_t rxBytes = readStatusReg(CC1101_RXBYTES);
-   uint8_t Rssi;
-   uint8_t Lqi;
-   int Ret;
+   uint8_t rxBytes;
+   uint8_t Avail;
+   uint8_t Chunk;
+   uint8_t Status[2];   // RSSI, LQI and CRC_OK appended to the packet
+   int Len = -1;        // packet length, not read yet
+   int Received = 0;    // data and status bytes read so far
+   int64_t Start = esp_timer_get_time();
+   int Ret = 0;
    int8_t FreqErr;
    int8_t FreqCorrection;
 
-// Any data waiting to be read and no overflow?
    do {
-      if(rxBytes & CC1101_RXFIFO_OVERFLOW_MASK) {
-         LOGE("RxFifo overflow\n");
-         Ret = -2;
-         break;
+      if(readStatusReg(CC1101_RXBYTES) == 0 && !getGDO0state()) {
+      // Nothing received and no packet in progress
+         return 0;
       }
 
-      if(rxBytes < 2) {
-      // should have at least 2 bytes, packet len and one byte of data
-         LOGE("Internal error, rxBytes = %d\n",rxBytes);
-         Ret = -2;
-         break;
+      while(Len < 0 || Received < Len + 2) {
+      // RXBYTES may be wrong when read while it's being updated (errata),
+      // read it until we get the same value twice
+         do {
+            rxBytes = readStatusReg(CC1101_RXBYTES);
+         } while(rxBytes != readStatusReg(CC1101_RXBYTES));
+
+         if(rxBytes & CC1101_RXFIFO_OVERFLOW_MASK) {
+            LOGE("RxFifo overflow\n");
+            Ret = -2;
+            break;
+         }
+         Avail = rxBytes & CC1101_NUM_RXBYTES_MASK;
+         if(getGDO0state() && Avail > 0) {
+         // The packet is still arriving, don't read the last byte in the
+         // FIFO (errata)
+            Avail--;
+         }
+
+         if(Avail == 0) {
+            if(!getGDO0state() && (rxBytes & CC1101_NUM_RXBYTES_MASK) == 0) {
+               LOGE("Internal error, short packet %d/%d\n",Received,Len);
+               Ret = -2;
+               break;
+            }
+            if(esp_timer_get_time() - Start > RX_TIMEOUT_US) {
+               LOGE("Timeout, received %d/%d\n",Received,Len);
+               Ret = -2;
+               break;
+            }
+         // Sleep until GDO2 signals the next threshold or the end of the
+         // packet rather than spinning on RXBYTES
+            ulTaskNotifyTake(pdTRUE,1);
+            continue;
+         }
+
+         if(Len < 0) {
+         // Get packet length
+            Len = readConfigReg(CC1101_RXFIFO);
+            if(Len > RxBufLen) {
+            // Toss the data
+               LOGE("RxBuf too small %d < %d\n",RxBufLen,Len);
+               Ret = -1;
+               break;
+            }
+            continue;
+         }
+
+         if(Received < Len) {
+         // Read the data
+            Chunk = Len - Received;
+            if(Chunk > Avail) {
+               Chunk = Avail;
+            }
+            CC1101_readBurstReg(&RxBuf[Received],CC1101_RXFIFO,Chunk);
+            Received += Chunk;
+            Avail -= Chunk;
+         }
+
+         if(Received >= Len && Avail > 0) {
+         // Read RSSI, LQI and CRC_OK
+            Chunk = Len + 2 - Received;
+            if(Chunk > Avail) {
+               Chunk = Avail;
+            }
+            CC1101_readBurstReg(&Status[Received - Len],CC1101_RXFIFO,Chunk);
+            Received += Chunk;
+         }
       }
 
-   // Get packet length
-      Ret = readConfigReg(CC1101_RXFIFO);
-      if(Ret > RxBufLen) {
-      // Toss the data
-         LOGE("RxBuf too small %d < %d\n",RxBufLen,Ret);
-         Ret = -1;
+      if(Ret < 0) {
          break;
       }
-   // Read the data
-      CC1101_readBurstReg(RxBuf,CC1101_RXFIFO,Ret);
-   // Read RSSI
-      Rssi = readConfigReg(CC1101_RXFIFO);
-   // Read LQI and CRC_OK
-      Lqi = readConfigReg(CC1101_RXFIFO);
-      if(!(Lqi & CC1101_CRC_OK_MASK)) {
+      Ret = Len;
+
+      if(!(Status[1] & CC1101_CRC_OK_MASK)) {
       // Crc error, ignore the packet
          LOG("Ignoring %d byte packet, CRC error\n",Ret);
          Ret = 0;
@@ -667,10 +737,10 @@ int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
       }
    // CRC is valid
       if(pRssi != NULL) {
-         *pRssi = Rssi;
+         *pRssi = Status[0];
       }
       if(pLqi != NULL) {
-         *pLqi = Lqi & CC1101_LQI_MASK;
+         *pLqi = Status[1] & CC1101_LQI_MASK;
       }
       FreqErr = (int8_t) CC1101_readReg(CC1101_FREQEST,CC1101_STATUS_REGISTER);
       if(FreqErr != 0 && gFreqErrSumCount < 255) {
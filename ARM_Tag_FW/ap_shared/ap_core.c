@@ -0,0 +1,435 @@
+#include "ap_core.h"
+
+#include <stdio.h>
+#include <string.h>
+
+struct pendingData pendingDataArr[MAX_PENDING_MACS];
+
+uint8_t curPendingData = 0;
+uint8_t curNoUpdate    = 0;
+
+struct blockRequest requestedData = {0};
+uint8_t  blockbuffer[BLOCK_XFER_BUFFER_SIZE + 5];
+int      blockPosition    = 0;
+uint32_t blockStartTimer  = 0;
+uint32_t nextBlockAttempt = 0;
+bool     highspeedSerial  = false;
+
+// these variables hold the current mac were talking to
+static uint32_t lastBlockRequest = 0;
+static uint8_t  lastBlockMac[8];
+
+static const struct apPlatform *ap;
+
+void apCoreInit(const struct apPlatform *platform) {
+    ap = platform;
+}
+
+static void apPrint(const char *str) {
+    while (*str) ap->uartTx((uint8_t) *str++);
+}
+static void apUartTx(const void *data, uint8_t len) {
+    for (uint8_t c = 0; c < len; c++) ap->uartTx(((const uint8_t *) data)[c]);
+}
+
+// tools
+void addCRC(void *p, uint8_t len) {
+    uint8_t total = 0;
+    for (uint8_t c = 1; c < len; c++) {
+        total += ((uint8_t *) p)[c];
+    }
+    ((uint8_t *) p)[0] = total;
+}
+bool checkCRC(void *p, uint8_t len) {
+    uint8_t total = 0;
+    for (uint8_t c = 1; c < len; c++) {
+        total += ((uint8_t *) p)[c];
+    }
+    return ((uint8_t *) p)[0] == total;
+}
+uint8_t getPacketType(void *buffer) {
+    struct MacFcs *fcs = (struct MacFcs *) buffer;
+    if ((fcs->frameType == 1) && (fcs->destAddrType == 2) && (fcs->srcAddrType == 3) && (fcs->panIdCompressed == 0)) {
+        // broadcast frame
+        uint8_t type = ((uint8_t *) buffer)[sizeof(struct MacFrameBcast)];
+        return type;
+    } else if ((fcs->frameType == 1) && (fcs->destAddrType == 3) && (fcs->srcAddrType == 3) && (fcs->panIdCompressed == 1)) {
+        // normal frame
+        uint8_t type = ((uint8_t *) buffer)[sizeof(struct MacFrameNormal)];
+        return type;
+    }
+    return 0;
+}
+uint8_t getBlockDataLength(void) {
+    uint8_t partNo = 0;
+    for (uint8_t c = 0; c < BLOCK_MAX_PARTS; c++) {
+        if (requestedData.requestedParts[c / 8] & (1 << (c % 8))) {
+            partNo++;
+        }
+    }
+    return partNo;
+}
+bool fixupAvailDataReq(uint8_t *buffer, uint8_t type, int8_t len) {
+    if (type == PKT_AVAIL_DATA_REQ) {
+        if (len == 28) {
+            // old version of the AvailDataReq struct, set all the new fields to zero, so it will pass the CRC
+            memset(buffer + 1 + sizeof(struct MacFrameBcast) + sizeof(struct oldAvailDataReq), 0,
+                   sizeof(struct AvailDataReq) - sizeof(struct oldAvailDataReq) + 2);
+            return true;
+        }
+        // new version of the AvailDataReq struct
+        return len == 40;
+    }
+    if (type == PKT_AVAIL_DATA_SHORTREQ) {
+        // a short AvailDataReq is basically a very short (1 byte payload) packet that requires little preparation on the tx side, for optimal
+        // battery use bytes of the struct are set 0, so it passes the checksum test, and the ESP32 can detect that no interesting payload is
+        // sent
+        if (len != 18) return false;
+        memset(buffer + 1 + sizeof(struct MacFrameBcast), 0, sizeof(struct AvailDataReq) + 2);
+        return true;
+    }
+    return false;
+}
+
+// pendingdata slot stuff
+void clearPendingData(void) {
+    memset(pendingDataArr, 0, sizeof(pendingDataArr));
+}
+int16_t findSlotForMac(const uint8_t *mac) {
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        if (memcmp(mac, ((uint8_t *) &(pendingDataArr[c].targetMac)), 8) == 0) {
+            if (pendingDataArr[c].attemptsLeft != 0) {
+                return c;
+            }
+        }
+    }
+    return -1;
+}
+int16_t findFreeSlot(void) {
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        if (pendingDataArr[c].attemptsLeft == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+int16_t findSlotForVer(const uint8_t *ver) {
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        if (memcmp(ver, ((uint8_t *) &(pendingDataArr[c].availdatainfo.dataVer)), 8) == 0) {
+            if (pendingDataArr[c].attemptsLeft != 0) return c;
+        }
+    }
+    return -1;
+}
+void deleteAllPendingDataForVer(const uint8_t *ver) {
+    int16_t slot = -1;
+    do {
+        slot = findSlotForVer(ver);
+        if (slot != -1) pendingDataArr[slot].attemptsLeft = 0;
+    } while (slot != -1);
+}
+void deleteAllPendingDataForMac(const uint8_t *mac) {
+    int16_t slot = -1;
+    do {
+        slot = findSlotForMac(mac);
+        if (slot != -1) pendingDataArr[slot].attemptsLeft = 0;
+    } while (slot != -1);
+}
+bool queuePendingData(const struct pendingData *pd) {
+    int16_t slot = findSlotForMac(pd->targetMac);
+    if (slot == -1) slot = findFreeSlot();
+    if (slot == -1) return false;
+    memcpy(&(pendingDataArr[slot]), pd, sizeof(struct pendingData));
+    return true;
+}
+const struct AvailDataInfo *getPendingDataInfo(const uint8_t *mac) {
+    int16_t slot = findSlotForMac(mac);
+    if (slot == -1) return NULL;
+    return &(pendingDataArr[slot].availdatainfo);
+}
+
+void countSlots(void) {
+    curPendingData = 0;
+    curNoUpdate    = 0;
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        if (pendingDataArr[c].attemptsLeft != 0) {
+            if (pendingDataArr[c].availdatainfo.dataType != 0) {
+                curPendingData++;
+            } else {
+                curNoUpdate++;
+            }
+        }
+    }
+}
+
+void pendingDataHousekeeping(void (*notifyTimeOut)(const uint8_t *mac)) {
+    for (uint16_t cCount = 0; cCount < MAX_PENDING_MACS; cCount++) {
+        if (pendingDataArr[cCount].attemptsLeft == 1) {
+            if (pendingDataArr[cCount].availdatainfo.dataType != DATATYPE_NOUPDATE) {
+                notifyTimeOut(pendingDataArr[cCount].targetMac);
+            }
+            pendingDataArr[cCount].attemptsLeft = 0;
+        } else if (pendingDataArr[cCount].attemptsLeft > 1) {
+            pendingDataArr[cCount].attemptsLeft--;
+            if (pendingDataArr[cCount].availdatainfo.nextCheckIn) pendingDataArr[cCount].availdatainfo.nextCheckIn--;
+        }
+    }
+}
+
+// block transfers
+uint8_t blockRequestAdmit(const uint8_t *src, const struct blockRequest *blockReq, uint8_t forceBlockDownload, uint16_t *pleaseWaitMs) {
+    // check if we're already talking to this mac
+    if (memcmp(src, lastBlockMac, 8) == 0) {
+        lastBlockRequest = ap->millis();
+    } else {
+        // we weren't talking to this mac, see if there was a transfer in progress from another mac, recently
+        if ((ap->millis() - lastBlockRequest) > CONCURRENT_REQUEST_DELAY) {
+            // mark this mac as the new current mac we're talking to
+            memcpy((void *) lastBlockMac, (void *) src, 8);
+            lastBlockRequest = ap->millis();
+        } else {
+            // we're talking to another mac, let this mac know we can't accomodate another request right now
+            apPrint("BUSY!\n");
+            return BLOCKREQ_CANCEL;
+        }
+    }
+
+    // check if we have data for this mac
+    if (findSlotForMac(src) == -1) {
+        // no data for this mac, politely tell it to fuck off
+        return BLOCKREQ_CANCEL;
+    }
+
+    bool requestDataDownload = false;
+    if ((blockReq->blockId != requestedData.blockId) || (blockReq->ver != requestedData.ver)) {
+        // requested block isn't already in the buffer
+        requestDataDownload = true;
+    } else {
+        // requested block is already in the buffer
+        if (forceBlockDownload) {
+            if ((ap->millis() - nextBlockAttempt) > 380) {
+                requestDataDownload = true;
+                apPrint("FORCED\n");
+            } else {
+                apPrint("IGNORED\n");
+            }
+        }
+    }
+
+    // copy blockrequest into requested data
+    memcpy(&requestedData, blockReq, sizeof(struct blockRequest));
+
+    if (blockStartTimer == 0) {
+        if (requestDataDownload) {
+            if (highspeedSerial == true) {
+                *pleaseWaitMs = 140;
+            } else {
+                *pleaseWaitMs = 550;
+            }
+        } else {
+            // block is already in buffer
+            *pleaseWaitMs = 30;
+        }
+    } else {
+        *pleaseWaitMs = 30;
+    }
+    blockStartTimer = ap->millis() + *pleaseWaitMs;
+    return requestDataDownload ? BLOCKREQ_FETCH : BLOCKREQ_ACK;
+}
+void fetchRequestedBlock(const uint8_t *src) {
+    blockPosition = 0;
+    espBlockRequest(&requestedData, src);
+    nextBlockAttempt = ap->millis();
+}
+
+// processing serial data
+#define ZBS_RX_WAIT_HEADER    0
+#define ZBS_RX_WAIT_SDA       1  // send data avail
+#define ZBS_RX_WAIT_CANCEL    2  // cancel traffic for mac
+#define ZBS_RX_WAIT_SCP       3  // set channel power
+#define ZBS_RX_WAIT_BLOCKDATA 4
+
+static void scpAck(void) {
+    apPrint("ACK>");
+}
+
+static bool isSame(const uint8_t *in1, const char *in2, int len) {
+    bool flag = 1;
+    for (int i = 0; i < len; i++) {
+        if (in1[i] != (uint8_t) in2[i]) flag = 0;
+    }
+    return flag;
+}
+
+void processSerial(uint8_t lastchar) {
+    static uint8_t  cmdbuffer[4];
+    static uint8_t  RXState = 0;
+    static uint8_t  serialbuffer[48];
+    static uint8_t *serialbufferp;
+    static uint8_t  bytesRemain    = 0;
+    static uint32_t lastSerial     = 0;
+    static uint32_t blockStartTime = 0;
+    char msg[80];
+    if ((RXState != ZBS_RX_WAIT_HEADER) && ((ap->millis() - lastSerial) > 1000)) {
+        RXState = ZBS_RX_WAIT_HEADER;
+        ap->log("UART Timeout");
+    }
+    lastSerial = ap->millis();
+    switch (RXState) {
+        case ZBS_RX_WAIT_HEADER:
+            // shift characters in
+            for (uint8_t c = 0; c < 3; c++) {
+                cmdbuffer[c] = cmdbuffer[c + 1];
+            }
+            cmdbuffer[3] = lastchar;
+
+            if (isSame(cmdbuffer + 1, ">D>", 3)) {
+                apPrint("ACK>");
+                blockStartTime = ap->millis();
+                snprintf(msg, sizeof(msg), "Starting BlkData, %lu ms after request", (unsigned long) (blockStartTime - nextBlockAttempt));
+                ap->log(msg);
+                blockPosition = 0;
+                RXState       = ZBS_RX_WAIT_BLOCKDATA;
+            }
+
+            if (isSame(cmdbuffer, "SDA>", 4)) {
+                ap->log("SDA In");
+                RXState       = ZBS_RX_WAIT_SDA;
+                bytesRemain   = sizeof(struct pendingData);
+                serialbufferp = serialbuffer;
+                break;
+            }
+            if (isSame(cmdbuffer, "CXD>", 4)) {
+                ap->log("CXD In");
+                RXState       = ZBS_RX_WAIT_CANCEL;
+                bytesRemain   = sizeof(struct pendingData);
+                serialbufferp = serialbuffer;
+                break;
+            }
+            if (isSame(cmdbuffer, "SCP>", 4)) {
+                ap->log("SCP In");
+                RXState       = ZBS_RX_WAIT_SCP;
+                bytesRemain   = sizeof(struct espSetChannelPower);
+                serialbufferp = serialbuffer;
+                break;
+            }
+            if (isSame(cmdbuffer, "NFO?", 4)) {
+                apPrint("ACK>");
+                ap->log("NFO? In");
+                ap->notifyAPInfo();
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            if (isSame(cmdbuffer, "RDY?", 4)) {
+                apPrint("ACK>");
+                ap->log("RDY? In");
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            if (isSame(cmdbuffer, "RSET", 4)) {
+                apPrint("ACK>");
+                ap->log("RSET In");
+                ap->delay(100);  // let the ACK go out first
+                ap->reset();
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            if (isSame(cmdbuffer, "HSPD", 4)) {
+                apPrint("ACK>");
+                ap->log("HSPD In, switching to 2000000");
+                ap->delay(100);
+                ap->switchSpeed(2000000);
+                ap->delay(100);
+                highspeedSerial = true;
+                apPrint("ACK>");
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            break;
+        case ZBS_RX_WAIT_BLOCKDATA:
+            blockbuffer[blockPosition++] = 0xAA ^ lastchar;
+            if (blockPosition >= 4100) {
+                snprintf(msg, sizeof(msg), "Blockdata fully received in %lu ms, %lu ms after the request",
+                         (unsigned long) (ap->millis() - blockStartTime), (unsigned long) (ap->millis() - nextBlockAttempt));
+                ap->log(msg);
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            break;
+
+        case ZBS_RX_WAIT_SDA:
+            *serialbufferp = lastchar;
+            serialbufferp++;
+            bytesRemain--;
+            if (bytesRemain == 0) {
+                if (checkCRC(serialbuffer, sizeof(struct pendingData))) {
+                    if (queuePendingData((struct pendingData *) serialbuffer)) {
+                        apPrint("ACK>");
+                    } else {
+                        apPrint("NOQ>");
+                    }
+                } else {
+                    apPrint("NOK>");
+                }
+
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            break;
+        case ZBS_RX_WAIT_CANCEL:
+            *serialbufferp = lastchar;
+            serialbufferp++;
+            bytesRemain--;
+            if (bytesRemain == 0) {
+                if (checkCRC(serialbuffer, sizeof(struct pendingData))) {
+                    struct pendingData *pd = (struct pendingData *) serialbuffer;
+                    deleteAllPendingDataForMac((uint8_t *) &pd->targetMac);
+                    apPrint("ACK>");
+                } else {
+                    apPrint("NOK>");
+                }
+
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            break;
+        case ZBS_RX_WAIT_SCP:
+            *serialbufferp = lastchar;
+            serialbufferp++;
+            bytesRemain--;
+            if (bytesRemain == 0) {
+                if (!checkCRC(serialbuffer, sizeof(struct espSetChannelPower)) || !ap->setChannelPower((struct espSetChannelPower *) serialbuffer, scpAck)) {
+                    apPrint("NOK>");
+                }
+                RXState = ZBS_RX_WAIT_HEADER;
+            }
+            break;
+    }
+}
+
+// sending data to the ESP
+void espBlockRequest(const struct blockRequest *br, const uint8_t *src) {
+    struct espBlockRequest *ebr = (struct espBlockRequest *) blockbuffer;
+    apPrint("RQB>");
+    memcpy(&(ebr->ver), &(br->ver), 8);
+    memcpy(&(ebr->src), src, 8);
+    ebr->blockId = br->blockId;
+    addCRC(ebr, sizeof(struct espBlockRequest));
+    apUartTx(ebr, sizeof(struct espBlockRequest));
+}
+void espNotifyAvailDataReq(const struct AvailDataReq *adr, const uint8_t *src) {
+    apPrint("ADR>");
+
+    struct espAvailDataReq eadr = {0};
+    memcpy((void *) eadr.src, (void *) src, 8);
+    memcpy((void *) &eadr.adr, (void *) adr, sizeof(struct AvailDataReq));
+    addCRC(&eadr, sizeof(struct espAvailDataReq));
+    apUartTx(&eadr, sizeof(struct espAvailDataReq));
+}
+void espNotifyXferComplete(const uint8_t *src) {
+    struct espXferComplete exfc;
+    memcpy(&exfc.src, src, 8);
+    apPrint("XFC>");
+    addCRC(&exfc, sizeof(exfc));
+    apUartTx(&exfc, sizeof(exfc));
+}
+void espNotifyTimeOut(const uint8_t *src) {
+    struct espXferComplete exfc;
+    memcpy(&exfc.src, src, 8);
+    apPrint("XTO>");
+    addCRC(&exfc, sizeof(exfc));
+    apUartTx(&exfc, sizeof(exfc));
+}
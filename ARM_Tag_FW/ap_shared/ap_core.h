@@ -0,0 +1,89 @@
+#pragma once
+// Radio AP logic shared by the C6 IDF, Arduino C6 and Arduino H2 access points.
+// This is the master copy, the IDF build compiles it from here. The Arduino sketches
+// can only compile files in their own folder, so they carry committed copies; change
+// it here and run make_links.bat. It only uses the target's proto.h and libc;
+// everything platform specific goes through struct apPlatform.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DATATYPE_NOUPDATE 0
+#define MAX_PENDING_MACS  250
+
+#define CONCURRENT_REQUEST_DELAY 1200UL
+
+// what the radio side should do with a block request, see blockRequestAdmit()
+#define BLOCKREQ_CANCEL 0  // send a cancel, busy with another tag or no data for this one
+#define BLOCKREQ_ACK    1  // ack, the block is already in blockbuffer
+#define BLOCKREQ_FETCH  2  // ack, then call fetchRequestedBlock() to get the block from the ESP32
+
+struct apPlatform {
+    uint32_t (*millis)(void);
+    void (*delay)(int ms);
+    void (*uartTx)(uint8_t data);                                    // to the ESP32
+    void (*log)(const char *msg);                                    // debug output
+    void (*notifyAPInfo)(void);                                      // NFO?
+    void (*switchSpeed)(int baudrate);                               // HSPD
+    // SCP, returns false for an invalid channel. Calls ack() as soon as the channel is known to be
+    // valid, before the radio is switched, so the ESP32 gets its answer on time.
+    bool (*setChannelPower)(const struct espSetChannelPower *scp, void (*ack)(void));
+    void (*reset)(void);  // RSET, doesn't return
+};
+
+extern struct pendingData pendingDataArr[MAX_PENDING_MACS];
+extern uint8_t curPendingData;
+extern uint8_t curNoUpdate;
+
+extern struct blockRequest requestedData;                    // holds which data was requested by the tag
+extern uint8_t  blockbuffer[BLOCK_XFER_BUFFER_SIZE + 5];     // block transfer buffer
+extern int      blockPosition;
+extern uint32_t blockStartTimer;                             // reference that holds when the AP sends the next block
+extern uint32_t nextBlockAttempt;                            // reference time for when the AP can request a new block from the ESP32
+extern bool     highspeedSerial;
+
+void apCoreInit(const struct apPlatform *platform);
+
+// tools
+void addCRC(void *p, uint8_t len);
+bool checkCRC(void *p, uint8_t len);
+uint8_t getPacketType(void *buffer);
+uint8_t getBlockDataLength(void);
+// zero fills the fields an old or short AvailDataReq doesn't carry, returns false if the length doesn't match either
+bool fixupAvailDataReq(uint8_t *buffer, uint8_t type, int8_t len);
+
+// pendingdata slot stuff
+void    clearPendingData(void);
+int16_t findSlotForMac(const uint8_t *mac);
+int16_t findFreeSlot(void);
+int16_t findSlotForVer(const uint8_t *ver);
+void    deleteAllPendingDataForVer(const uint8_t *ver);
+void    deleteAllPendingDataForMac(const uint8_t *mac);
+// stores (or replaces) the pending data for its mac, returns false if the table is full
+bool    queuePendingData(const struct pendingData *pd);
+// returns the pending AvailDataInfo for this mac, or NULL if there's nothing queued
+const struct AvailDataInfo *getPendingDataInfo(const uint8_t *mac);
+void    countSlots(void);
+// called every HOUSEKEEPING_INTERVAL; expires slots and reports data that timed out
+void    pendingDataHousekeeping(void (*notifyTimeOut)(const uint8_t *mac));
+
+// block transfers
+uint8_t blockRequestAdmit(const uint8_t *src, const struct blockRequest *blockReq, uint8_t forceBlockDownload, uint16_t *pleaseWaitMs);
+void    fetchRequestedBlock(const uint8_t *src);
+
+// serial link to the ESP32
+void processSerial(uint8_t lastchar);
+void espBlockRequest(const struct blockRequest *br, const uint8_t *src);
+void espNotifyAvailDataReq(const struct AvailDataReq *adr, const uint8_t *src);
+void espNotifyXferComplete(const uint8_t *src);
+void espNotifyTimeOut(const uint8_t *src);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,10 +1,13 @@
 #pragma once
 #ifdef HAS_BLE_WRITER
 #include "BLEDevice.h"
+#include "gici_stream.h"
 
 uint8_t gicToOEPLtype(uint8_t gicType);
 bool BLE_filter_add_device(BLEAdvertisedDevice advertisedDevice);
-bool BLE_is_image_pending(uint8_t address[8]);
-uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len);
+bool BLE_is_image_pending(uint8_t address[8], bool (*skip)(const uint8_t* mac) = nullptr);
+
+bool compress_image_begin(uint8_t address[8], giciStream& stream);
+void compress_image_end(giciStream& stream);
 
 #endif
@@ -2,5 +2,6 @@
 #ifdef HAS_BLE_WRITER
 
 void BLETask(void* parameter);
+void BLE_wakeup();
 
 #endif
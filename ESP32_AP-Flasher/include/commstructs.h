@@ -2,6 +2,9 @@
 #define NEWPROTO_H 
 
 #include<Arduino.h>
+
+#include "syncproto.h"
+
 #pragma pack(push, 1)
 
 #include "../../oepl-definitions.h"
@@ -28,7 +31,6 @@ struct APlist {
 #define SYNC_USERCFG 1
 #define SYNC_TAGSTATUS 2
 #define SYNC_DELETE 3
-#define SYNC_VERSION 0xAA01
 
 struct TagInfo {
     uint16_t structVersion = SYNC_VERSION;
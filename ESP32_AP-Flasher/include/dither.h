@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+// Palette matching and dithering of one pixel, shared by the sprite (spr2color) and the streaming
+// jpeg (jpgstream.h) conversion. Kept free of TFT_eSPI and Arduino so the host tests use it as is.
+
+struct Color {
+    uint8_t r, g, b;
+    Color() : r(0), g(0), b(0) {}
+    Color(uint16_t value_) : r(((value_ >> 8) & 0xF8) | ((value_ >> 13) & 0x07)), g(((value_ >> 3) & 0xFC) | ((value_ >> 9) & 0x03)), b(((value_ << 3) & 0xF8) | ((value_ >> 2) & 0x07)) {}
+    Color(uint8_t r_, uint8_t g_, uint8_t b_) : r(r_), g(g_), b(b_) {}
+};
+
+struct ditherError {
+    int32_t r;
+    int32_t g;
+    int32_t b;
+};
+
+static inline int32_t clampError(const int32_t e) {
+    return e < -255 ? -255 : (e > 255 ? 255 : e);
+}
+
+static inline uint32_t colorDistance(const Color &c1, const Color &c2, ditherError &e1) {
+    e1.r = clampError(e1.r);
+    e1.g = clampError(e1.g);
+    e1.b = clampError(e1.b);
+    int32_t r_diff = c1.r + e1.r - c2.r;
+    int32_t g_diff = c1.g + e1.g - c2.g;
+    int32_t b_diff = c1.b + e1.b - c2.b;
+    return 3 * r_diff * r_diff + 6 * g_diff * g_diff + b_diff * b_diff;
+}
+
+static inline void diffuseError(const ditherError &error, uint16_t x, ditherError *error_bufferold, ditherError *error_buffernew) {
+    error_buffernew[x].r += error.r >> 2;
+    error_buffernew[x].g += error.g >> 2;
+    error_buffernew[x].b += error.b >> 2;
+    if (x > 0) {
+        error_buffernew[x - 1].r += error.r >> 3;
+        error_buffernew[x - 1].g += error.g >> 3;
+        error_buffernew[x - 1].b += error.b >> 3;
+    }
+    if (x > 1) {
+        error_buffernew[x - 2].r += error.r >> 4;
+        error_buffernew[x - 2].g += error.g >> 4;
+        error_buffernew[x - 2].b += error.b >> 4;
+    }
+    error_buffernew[x + 1].r += error.r >> 3;
+    error_buffernew[x + 1].g += error.g >> 3;
+    error_buffernew[x + 1].b += error.b >> 3;
+
+    error_bufferold[x + 1].r += error.r >> 2;
+    error_bufferold[x + 1].g += error.g >> 2;
+    error_bufferold[x + 1].b += error.b >> 2;
+
+    error_buffernew[x + 2].r += error.r >> 4;
+    error_buffernew[x + 2].g += error.g >> 4;
+    error_buffernew[x + 2].b += error.b >> 4;
+
+    error_bufferold[x + 2].r += error.r >> 3;
+    error_bufferold[x + 2].g += error.g >> 3;
+    error_bufferold[x + 2].b += error.b >> 3;
+}
+
+// Returns the palette index for the pixel at column x of the current row. dither: 0 none, 1 Burkes
+// (error_bufferold is this row, error_buffernew the next one, both x + 4 entries), 2 ordered, using
+// the output position (outx, outy) so rotated images get the same pattern.
+static inline int ditherPixel(const Color &color, const std::vector<Color> &palette, const int num_colors, const uint8_t dither, const uint16_t x, const long outx, const long outy, ditherError *error_bufferold, ditherError *error_buffernew) {
+    static const uint8_t ditherMatrix[4][4] = {
+        {0, 9, 2, 10},
+        {12, 5, 14, 6},
+        {3, 11, 1, 8},
+        {15, 7, 13, 4}};
+
+    if (dither == 2) {
+        // Ordered dithering
+        uint8_t ditherValue = ditherMatrix[outy & 3][outx & 3];
+        error_bufferold[x].r = (ditherValue << 4) - 120;  // * 256 / 16 - 128 + 8
+        error_bufferold[x].g = (ditherValue << 4) - 120;
+        error_bufferold[x].b = (ditherValue << 4) - 120;
+    }
+
+    int best_color_index = 0;
+    uint32_t best_color_distance = colorDistance(color, palette[0], error_bufferold[x]);
+    for (int i = 1; i < num_colors; i++) {
+        if (best_color_distance == 0) break;
+        uint32_t distance = colorDistance(color, palette[i], error_bufferold[x]);
+        if (distance < best_color_distance) {
+            best_color_distance = distance;
+            best_color_index = i;
+        }
+    }
+
+    if (dither == 1) {
+        // Burkes Dithering
+        ditherError error = {
+            color.r + error_bufferold[x].r - palette[best_color_index].r,
+            color.g + error_bufferold[x].g - palette[best_color_index].g,
+            color.b + error_bufferold[x].b - palette[best_color_index].b};
+        diffuseError(error, x, error_bufferold, error_buffernew);
+    }
+    return best_color_index;
+}
+
+// rotation of the source as seen from the output buffer, from the user rotation and the rotatebuffer of the tag type
+static inline uint8_t ditherRotation(const uint8_t rotate, const uint8_t rotatebuffer) {
+    if (rotatebuffer % 2) return ((rotate + 3) % 4 + (rotatebuffer - 1)) % 4;
+    return (rotate + rotatebuffer) % 4;
+}
+
+// Dithers a whole image into one bit plane of bufw x bufh, in output order. readPixel(x, y) returns
+// the RGB565 source pixel, the source is rotated by rotate (see ditherRotation). Sets hasRed when
+// the red or yellow palette entries are used.
+template <typename ReadPixel>
+void ditherPlane(ReadPixel readPixel, const long bufw, const long bufh, const uint8_t rotate, const std::vector<Color> &palette, const int num_colors, const uint8_t dither, uint8_t *buffer, const size_t buffer_size, const bool is_red, bool &hasRed) {
+    memset(buffer, 0, buffer_size);
+    Color color;
+    ditherError *error_bufferold = new ditherError[bufw + 4];
+    ditherError *error_buffernew = new ditherError[bufw + 4];
+
+    memset(error_bufferold, 0, bufw * sizeof(ditherError));
+    for (uint16_t y = 0; y < bufh; y++) {
+        memset(error_buffernew, 0, bufw * sizeof(ditherError));
+        for (uint16_t x = 0; x < bufw; x++) {
+            switch (rotate) {
+                case 0:
+                    color = Color(readPixel(x, y));
+                    break;
+                case 1:
+                    color = Color(readPixel(y, bufw - 1 - x));
+                    break;
+                case 2:
+                    color = Color(readPixel(bufw - 1 - x, bufh - 1 - y));
+                    break;
+                case 3:
+                    color = Color(readPixel(bufh - 1 - y, x));
+                    break;
+            }
+
+            const int best_color_index = ditherPixel(color, palette, num_colors, dither, x, x, y, error_bufferold, error_buffernew);
+            uint8_t bitIndex = 7 - (x % 8);
+            uint32_t byteIndex = (y * bufw + x) / 8;
+
+            // this looks a bit ugly, but it's performing better than shorter notations
+            switch (best_color_index) {
+                case 1:
+                    if (!is_red)
+                        buffer[byteIndex] |= (1 << bitIndex);
+                    break;
+                case 2:
+                    hasRed = true;
+                    if (is_red)
+                        buffer[byteIndex] |= (1 << bitIndex);
+                    break;
+                case 3:
+                    hasRed = true;
+                    buffer[byteIndex] |= (1 << bitIndex);
+                    break;
+            }
+        }
+        memcpy(error_bufferold, error_buffernew, bufw * sizeof(ditherError));
+    }
+
+    delete[] error_buffernew;
+    delete[] error_bufferold;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The chunk loop of copyFile and copyBetweenFS, on anything with the read()/write() of fs::File, so the
+// host tests can run it. lock() and unlock() bracket every chunk: the caller doesn't hold fsMutex during
+// the copy and other tasks get the filesystem in between. progress(copied) follows every full chunk.
+// Returns the bytes written; it stops at the first short write.
+template <typename In, typename Out, typename Lock, typename Unlock, typename Progress>
+size_t copyInChunks(In& in, Out& out, uint8_t* buf, const size_t bufSize, Lock lock, Unlock unlock, Progress progress) {
+    size_t copied = 0;
+    while (true) {
+        lock();
+        const size_t n = in.read(buf, bufSize);
+        const size_t written = n ? out.write(buf, n) : 0;
+        unlock();
+        if (n == 0) break;
+        copied += written;
+        if (written != n) break;
+        progress(copied);
+    }
+    return copied;
+}
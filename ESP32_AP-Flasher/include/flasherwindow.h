@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+// The flasher side of the windowed writes (CMD_WRITE_FLASH_WINDOW / CMD_WRITE_INFOPAGE_WINDOW), without
+// the tag interfaces, so the host tests can run it. The payload is seq (4 bytes), the CRC-32 of the data
+// (4 bytes, zlib's crc32, which is esp_rom_crc32_le(0, ...)), data; all big endian. The 8 byte header
+// keeps the data word aligned for nrf_write_bank.
+
+#define FLASHER_WINDOW_HEADER 8
+
+struct flasherWindowChunk {
+    uint32_t seq;
+    uint32_t crc;
+    uint8_t* data;
+    uint32_t len;
+};
+
+enum flasherWindowAction {
+    WINDOW_WRITE,      // the next chunk in line and intact; write it, then answer with its seq
+    WINDOW_ACK_AGAIN,  // a resend of a chunk that's already written; answer with its seq, don't rewrite
+    WINDOW_GO_BACK,    // a gap or a bad CRC; answer CMD_WRITE_ERROR with the seq to resend from
+};
+
+inline uint32_t windowGetSeq(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+inline void windowPutSeq(uint8_t* buf, const uint32_t seq) {
+    for (uint8_t c = 0; c < 4; c++) buf[c] = seq >> (24 - (c * 8));
+}
+
+inline bool parseWindowChunk(uint8_t* payload, const uint32_t len, flasherWindowChunk& chunk) {
+    if (payload == nullptr || len < FLASHER_WINDOW_HEADER) return false;
+    chunk.seq = windowGetSeq(payload);
+    chunk.crc = windowGetSeq(payload + 4);
+    chunk.data = payload + FLASHER_WINDOW_HEADER;
+    chunk.len = len - FLASHER_WINDOW_HEADER;
+    return true;
+}
+
+// dataCrc is the CRC-32 of chunk.data as received, expectedSeq the next chunk to write
+inline flasherWindowAction windowAction(const flasherWindowChunk& chunk, const uint32_t dataCrc, const uint32_t expectedSeq) {
+    if (chunk.seq == expectedSeq && dataCrc == chunk.crc) return WINDOW_WRITE;
+    if (chunk.seq >= expectedSeq) return WINDOW_GO_BACK;
+    return WINDOW_ACK_AGAIN;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// The GICI image stream for the BLE writer. Its layout follows from the display type the tag
+// advertises; the stream is generated column by column while it is uploaded. No Arduino
+// dependencies, so the host tests can compare it with the buffer compress_image used to build.
+
+struct giciLayout {
+    uint8_t screenResolution;
+    uint8_t dispPtype;
+    uint8_t availColors;
+    uint8_t specialColor;
+    uint8_t singleDoubleMirror;
+    uint16_t width;
+    uint16_t height;
+    uint16_t bytePerLine;
+    bool extraColor;
+    bool mirror;
+    bool compression;
+};
+
+struct giciStream {
+    uint8_t* data;
+    uint32_t dataLen;
+    uint32_t totalLen;
+    uint32_t columns;
+    uint32_t planeColumns;
+    uint32_t cachedColumn;
+    uint16_t bytePerLine;
+    uint16_t columnLen;
+    uint8_t headerLen;
+    bool compression;
+    bool mirror;
+    uint8_t column[7 + 80];  // block header plus the longest line (640 pixels)
+};
+
+// giciType is the 16 bit display info from the advertisement, stored in the top bytes of the mac
+inline giciLayout gici_layout(const uint16_t giciType) {
+    // width, height per screenResolution; anything else is the 2.13" 104x212 panel
+    static const uint16_t resolutions[][2] = {{216, 104}, {296, 128}, {300, 400}, {640, 384}, {960, 640}, {250, 136}, {196, 96}, {640, 480}, {250, 128}, {800, 480}, {280, 480}};
+
+    giciLayout layout;
+    layout.screenResolution = (giciType >> 5) & 63;
+    layout.dispPtype = (giciType >> 3) & 3;  // 0 TFT, 1 EPA, 2 EPA1, 3 EPA2
+    layout.availColors = (giciType >> 1) & 3;  // 0 BW, 1 BWR, 2 BWY, 3 BWRY
+    layout.specialColor = (giciType >> 10) & 12;
+    layout.singleDoubleMirror = giciType & 1;
+    layout.compression = !(giciType & 0x4000);
+    layout.mirror = giciType & 0x100;  // Some special case, needs to be tested if always correct
+    layout.extraColor = layout.availColors != 0;
+    layout.width = 104;
+    layout.height = 212;
+    if (layout.screenResolution < sizeof(resolutions) / sizeof(resolutions[0])) {
+        layout.width = resolutions[layout.screenResolution][0];
+        layout.height = resolutions[layout.screenResolution][1];
+    }
+    layout.bytePerLine = (layout.height + 7) / 8;
+    return layout;
+}
+
+// data holds the black plane, then the color plane, one column of bytePerLine bytes after the other;
+// the stream only keeps the pointer
+inline void compress_image_setup(giciStream& stream, const giciLayout& layout, uint8_t* data, const uint32_t dataLen) {
+    memset(&stream, 0, sizeof(stream));
+    stream.data = data;
+    stream.dataLen = dataLen;
+    stream.bytePerLine = layout.bytePerLine;
+    stream.columns = layout.extraColor ? layout.width * 2 : layout.width;
+    stream.planeColumns = layout.width;
+    stream.compression = layout.compression;
+    stream.mirror = layout.mirror;
+    stream.headerLen = layout.compression ? 4 : 0;
+    stream.columnLen = (layout.compression ? 7 : 0) + layout.bytePerLine;
+    stream.totalLen = stream.headerLen + stream.columns * stream.columnLen;
+    stream.cachedColumn = UINT32_MAX;
+}
+
+// bit reversal lookup, built from the 2-bit reversal pattern
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const uint8_t giciBitReverse[256] = {R6(0), R6(2), R6(1), R6(3)};
+#undef R2
+#undef R4
+#undef R6
+
+// builds one column of the GICI stream: the optional 0x75 block header, then the (mirrored) plane bytes
+inline void compress_image_column(giciStream& stream, const uint32_t column) {
+    uint8_t* out = stream.column;
+    if (stream.compression) {
+        *out++ = 0x75;
+        *out++ = stream.bytePerLine + 7;
+        *out++ = stream.bytePerLine;
+        *out++ = 0x00;
+        *out++ = 0x00;
+        *out++ = 0x00;
+        *out++ = 0x00;
+    }
+    // the black plane is stored inverted, the color plane as is
+    const uint8_t invert = (column < stream.planeColumns) ? 0xFF : 0x00;
+    const uint32_t start = column * stream.bytePerLine;
+    for (uint16_t b = 0; b < stream.bytePerLine; b++) {
+        const uint32_t posi = stream.mirror ? start + stream.bytePerLine - 1 - b : start + b;
+        const uint8_t in = ((posi < stream.dataLen) ? stream.data[posi] : 0x00) ^ invert;  // Do not anything outside of the buffer!
+        out[b] = stream.mirror ? giciBitReverse[in] : in;
+    }
+    stream.cachedColumn = column;
+}
+
+// copies len bytes of the stream from offset on into buffer, returns how many there were
+inline uint32_t compress_image_read(giciStream& stream, uint32_t offset, uint8_t* buffer, uint32_t len) {
+    if (offset >= stream.totalLen) return 0;
+    if (len > stream.totalLen - offset) len = stream.totalLen - offset;
+    uint32_t done = 0;
+    while (done < len && offset < stream.headerLen) {
+        buffer[done++] = (stream.totalLen >> (8 * offset)) & 0xff;
+        offset++;
+    }
+    while (done < len) {
+        const uint32_t column = (offset - stream.headerLen) / stream.columnLen;
+        const uint32_t inColumn = (offset - stream.headerLen) % stream.columnLen;
+        if (column != stream.cachedColumn) compress_image_column(stream, column);
+        uint32_t chunk = stream.columnLen - inColumn;
+        if (chunk > len - done) chunk = len - done;
+        memcpy(&buffer[done], &stream.column[inColumn], chunk);
+        done += chunk;
+        offset += chunk;
+    }
+    return done;
+}
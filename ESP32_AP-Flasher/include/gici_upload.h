@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "gici_stream.h"
+
+// The AP side of the GICI upload, without the BLE stack, so the host tests can run it against a fake
+// tag. The tag drives the upload: every notify on the control characteristic asks for the next step,
+// and gets exactly one write as the answer. notify[0] is the notify length, the notify follows.
+
+#define GICI_PART_SIZE 240  // + 4 bytes part number, fits the 255 byte MTU
+
+#define GICI_UPLOAD_STATE_INIT 0
+#define GICI_UPLOAD_STATE_SIZE 1
+#define GICI_UPLOAD_STATE_START 2
+#define GICI_UPLOAD_STATE_UPLOAD 5
+#define GICI_UPLOAD_DONE_MARK 0x08
+
+enum giciUploadAction {
+    GICI_WRITE_CTRL,    // write buffer to the control characteristic
+    GICI_WRITE_IMG,     // write buffer to the image characteristic
+    GICI_UPLOAD_DONE,   // the tag has the image and refreshes
+    GICI_UPLOAD_ABORT,  // the tag asked for a part we didn't expect
+};
+
+inline uint32_t gici_requested_part(const uint8_t* notify) {
+    return ((uint32_t)notify[6] << 24) | ((uint32_t)notify[5] << 16) | ((uint32_t)notify[4] << 8) | notify[3];
+}
+
+// buffer needs GICI_PART_SIZE + 4 bytes, len is set to what to write; currPart is the next part to send
+inline giciUploadAction gici_upload_answer(giciStream& image, uint32_t& currPart, const uint8_t* notify, uint8_t* buffer, uint32_t& len) {
+    switch (notify[1]) {
+        default:
+        case GICI_UPLOAD_STATE_INIT:
+            buffer[0] = 0x01;
+            len = 1;
+            return GICI_WRITE_CTRL;
+        case GICI_UPLOAD_STATE_SIZE:
+            buffer[0] = 0x02;
+            buffer[1] = image.totalLen & 0xff;
+            buffer[2] = (image.totalLen >> 8) & 0xff;
+            buffer[3] = (image.totalLen >> 16) & 0xff;
+            buffer[4] = (image.totalLen >> 24) & 0xff;
+            buffer[5] = 0x00;
+            len = 6;
+            return GICI_WRITE_CTRL;
+        case GICI_UPLOAD_STATE_START:
+            buffer[0] = 0x03;
+            len = 1;
+            return GICI_WRITE_CTRL;
+        case GICI_UPLOAD_STATE_UPLOAD: {
+            if (notify[2] == GICI_UPLOAD_DONE_MARK) return GICI_UPLOAD_DONE;
+            const uint32_t requested = gici_requested_part(notify);
+            if (requested != currPart || requested * GICI_PART_SIZE >= image.totalLen) return GICI_UPLOAD_ABORT;
+            buffer[0] = currPart & 0xff;
+            buffer[1] = (currPart >> 8) & 0xff;
+            buffer[2] = (currPart >> 16) & 0xff;
+            buffer[3] = (currPart >> 24) & 0xff;
+            len = 4 + compress_image_read(image, currPart * GICI_PART_SIZE, &buffer[4], GICI_PART_SIZE);
+            currPart++;
+            return GICI_WRITE_IMG;
+        }
+    }
+}
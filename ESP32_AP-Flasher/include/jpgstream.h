@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <functional>
+#include <vector>
+
+#include "dither.h"
+
+// Streaming jpeg conversion: TJpgDec hands over one MCU block at a time, left to right, top to bottom.
+// The blocks of one MCU row are collected in a band buffer; as soon as the decoder moves on to the next
+// MCU row, the band is resampled to the tag resolution and dithered. Only two rows of dither error are
+// kept, so the full size sprite is never needed.
+//
+// The dithered pixels go either into whole bit planes (setPlanes), or, when the output isn't rotated,
+// row by row to a sink that writes them to the file (setRows). The latter needs no plane memory at all;
+// it produces one plane per decode, like spr2color.
+//
+// Burkes dithering spreads the error along the decoded rows. For a rotated output these are columns
+// of the tag, so the pattern differs from spr2color there; no dithering and ordered dithering match.
+
+#define JPGSTREAM_BAND_ROWS 16
+
+class JpgStream {
+   public:
+    typedef std::function<void(const uint8_t *data, size_t len)> RowSink;
+
+    // srcw x srch: decoded size, after the TJpgDec integer scale; dstw x dsth: size after resampling;
+    // bufw x bufh: output size, after rotation
+    JpgStream(const std::vector<Color> &palette, const int num_colors, const uint8_t dither, const uint16_t srcw, const uint16_t srch,
+              const uint16_t dstw, const uint16_t dsth, const uint8_t rotate, const long bufw, const long bufh)
+        : palette(palette), num_colors(num_colors), dither(dither), srcw(srcw), srch(srch), dstw(dstw), dsth(dsth), rotate(rotate), bufw(bufw), bufh(bufh) {
+        band = (uint16_t *)malloc(srcw * JPGSTREAM_BAND_ROWS * sizeof(uint16_t));
+        error_bufferold = new ditherError[dstw + 4]();
+        error_buffernew = new ditherError[dstw + 4]();
+    }
+    ~JpgStream() {
+        delete[] error_buffernew;
+        delete[] error_bufferold;
+        free(band);
+        free(rowBits);
+    }
+    JpgStream(const JpgStream &) = delete;
+    JpgStream &operator=(const JpgStream &) = delete;
+
+    // both planes bufw * bufh / 8 bytes and zeroed, red may be nullptr for black and white
+    void setPlanes(uint8_t *blackPlane, uint8_t *redPlane) {
+        black = blackPlane;
+        red = redPlane;
+    }
+
+    // unrotated output only: the bytes of one plane go to sink in file order
+    bool setRows(const bool is_red, RowSink sink) {
+        if (rotate != 0) return false;
+        rowRed = is_red;
+        rowSink = sink;
+        rowBits = (uint8_t *)calloc(bufw / 8 + 2, 1);
+        return rowBits != nullptr;
+    }
+
+    bool ok() const { return band != nullptr; }
+    bool hasRed() const { return red_used; }
+
+    // the memory the stream itself holds, without the planes
+    size_t memory() const { return srcw * JPGSTREAM_BAND_ROWS * sizeof(uint16_t) + 2 * (dstw + 4) * sizeof(ditherError) + (rowBits ? bufw / 8 + 2 : 0); }
+
+    // one MCU block, as handed over by the TJpgDec callback
+    void block(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint16_t *bitmap) {
+        if (y != bandY) {
+            flush();
+            bandY = y;
+        }
+        if (x >= srcw) return;
+        const uint16_t copyw = w < srcw - x ? w : srcw - x;
+        const uint16_t rows = h < JPGSTREAM_BAND_ROWS ? h : JPGSTREAM_BAND_ROWS;
+        for (uint16_t row = 0; row < rows; row++) {
+            memcpy(band + row * srcw + x, bitmap + row * w, copyw * sizeof(uint16_t));
+        }
+        if (rows > bandRows) bandRows = rows;
+    }
+
+    // after the decoder is done; rows it never delivered stay blank
+    void finish() {
+        flush();
+        if (!rowSink) return;
+        while (nextRow < dsth) {
+            emitRowBits();
+            nextRow++;
+        }
+    }
+
+   private:
+    void flush() {
+        for (uint16_t row = 0; row < bandRows; row++) {
+            const uint32_t srcRow = bandY + row;
+            // nearest neighbour resampling: emit every destination row that maps onto this source row
+            while (nextRow < dsth && (uint32_t)nextRow * srch / dsth == srcRow) {
+                ditherRow(nextRow, band + row * srcw);
+                nextRow++;
+            }
+        }
+        bandRows = 0;
+    }
+
+    void ditherRow(const uint16_t y, const uint16_t *row) {
+        memset(error_buffernew, 0, (dstw + 4) * sizeof(ditherError));
+        for (uint16_t x = 0; x < dstw; x++) {
+            const Color color = Color(row[(uint32_t)x * srcw / dstw]);
+
+            long outx, outy;
+            switch (rotate) {
+                case 1:
+                    outx = bufw - 1 - y;
+                    outy = x;
+                    break;
+                case 2:
+                    outx = bufw - 1 - x;
+                    outy = bufh - 1 - y;
+                    break;
+                case 3:
+                    outx = y;
+                    outy = bufh - 1 - x;
+                    break;
+                default:
+                    outx = x;
+                    outy = y;
+                    break;
+            }
+
+            const int best_color_index = ditherPixel(color, palette, num_colors, dither, x, outx, outy, error_bufferold, error_buffernew);
+            if (best_color_index >= 2) red_used = true;
+
+            if (rowSink) {
+                const bool set = best_color_index == 3 || best_color_index == (rowRed ? 2 : 1);
+                // same packing as the planes, see emitRowBits()
+                if (set) rowBits[(rowY * bufw + x) / 8 - rowY * bufw / 8] |= 0x80 >> (x % 8);
+            } else if (outx >= 0 && outx < bufw && outy >= 0 && outy < bufh) {
+                const uint8_t bit = 1 << (7 - (outx % 8));
+                const uint32_t byteIndex = (outy * bufw + outx) / 8;
+                if (black && (best_color_index == 1 || best_color_index == 3)) black[byteIndex] |= bit;
+                if (red && best_color_index >= 2) red[byteIndex] |= bit;
+            }
+        }
+        std::swap(error_bufferold, error_buffernew);
+        if (rowSink) emitRowBits();
+    }
+
+    // The planes are packed without padding at the end of a row, so a row can end in the middle of a
+    // byte; that byte is kept for the next row. Like spr2color, the bit within the byte follows x only.
+    void emitRowBits() {
+        const uint32_t start = rowY * bufw / 8;
+        const uint32_t next = (rowY + 1) * bufw / 8;
+        rowSink(rowBits, next - start);
+        rowBits[0] = rowBits[next - start];
+        memset(rowBits + 1, 0, bufw / 8 + 1);
+        rowY++;
+    }
+
+    std::vector<Color> palette;
+    int num_colors;
+    uint8_t dither;
+    uint16_t srcw, srch;
+    uint16_t dstw, dsth;
+    uint8_t rotate;
+    long bufw, bufh;
+
+    uint16_t *band = nullptr;  // one MCU row, srcw x JPGSTREAM_BAND_ROWS pixels
+    int16_t bandY = 0;
+    uint16_t bandRows = 0;
+    uint16_t nextRow = 0;  // next destination row to emit
+    ditherError *error_bufferold = nullptr;
+    ditherError *error_buffernew = nullptr;
+    bool red_used = false;
+
+    uint8_t *black = nullptr;
+    uint8_t *red = nullptr;
+
+    RowSink rowSink;
+    bool rowRed = false;
+    uint8_t *rowBits = nullptr;
+    uint32_t rowY = 0;  // rows handed to the sink
+};
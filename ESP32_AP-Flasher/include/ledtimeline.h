@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// The timing of ledTask, without FastLED or FreeRTOS, so the host tests can run the timeline. All
+// times are in ms; the returned waits are the time until the next frame or keyframe is due, the task
+// sleeps that long unless a new instruction wakes it up.
+//
+// An instruction fades to its value in fadeTime, then holds it for length.
+
+#define LED_FRAME_MS 20        // frame interval while something is animating
+#define LED_IDLE_CHECK_MS 250  // how often an idle black led looks for a new idle color
+
+inline bool ledStepDone(const uint16_t fadeTime, const uint16_t length, const uint32_t elapsed) {
+    return elapsed >= (uint32_t)fadeTime + length;
+}
+
+inline uint32_t ledStepLeft(const uint16_t fadeTime, const uint16_t length, const uint32_t elapsed) {
+    return (uint32_t)fadeTime + length - elapsed;
+}
+
+// the blend fraction of a fade in 8 bit fixed point, only meaningful while elapsed < fadeTime
+inline uint32_t ledFadeFrame(const uint16_t fadeTime, const uint16_t length, const uint32_t elapsed, uint8_t& fraction) {
+    if (elapsed < fadeTime) {
+        fraction = (elapsed << 8) / fadeTime;
+        const uint32_t left = fadeTime - elapsed;
+        return left < LED_FRAME_MS ? left : LED_FRAME_MS;
+    }
+    fraction = 255;
+    return ledStepLeft(fadeTime, length, elapsed);
+}
+
+// the idle breathing, a triangle of 2 * period: brightness 0..255 of the idle color
+inline uint8_t ledIdleLevel(const uint32_t now, const uint32_t period) {
+    const uint32_t phase = now % (2 * period);
+    const uint32_t step = phase < period ? phase : 2 * period - phase;
+    return step * 255 / period;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+class Print;
+
+// Lock-free counters, gauges and histograms, served in Prometheus text format at /metrics
+// All values are plain 32 bit atomics, so samples can be recorded from any task without locking
+
+enum metricCounter : uint8_t {
+    METRIC_BLOCK_REQUESTS,
+    METRIC_BLOCK_FAILED,
+    METRIC_DATA_REQUESTS,
+    METRIC_XFER_COMPLETE,
+    METRIC_XFER_TIMEOUT,
+    METRIC_RADIO_ACK,
+    METRIC_RADIO_NOK,
+    METRIC_RADIO_NOQ,
+    METRIC_RADIO_TIMEOUT,
+    METRIC_RADIO_RETRIES,
+    METRIC_RENDERS,
+    METRIC_PRESTAGED,
+    METRIC_WIFI_LOST,
+    METRIC_COUNTER_COUNT
+};
+
+enum metricGauge : uint8_t {
+    METRIC_PENDING_QUEUE,
+    METRIC_GAUGE_COUNT
+};
+
+enum metricHistogram : uint8_t {
+    METRIC_BLOCK_SERVICE_MS,
+    METRIC_RENDER_MS,
+    METRIC_FSMUTEX_WAIT_US,
+    METRIC_CHECKIN_ERROR_S,
+    METRIC_WIFI_CONNECT_MS,
+    METRIC_RENDER_WAIT_MS,
+    METRIC_HISTOGRAM_COUNT
+};
+
+#define METRIC_HISTOGRAM_BUCKETS 8
+
+struct metricHistogramData {
+    std::atomic<uint32_t> buckets[METRIC_HISTOGRAM_BUCKETS + 1];  // last one is +Inf
+    std::atomic<uint32_t> sum;
+    std::atomic<uint32_t> count;
+};
+
+extern std::atomic<uint32_t> metricCounters[METRIC_COUNTER_COUNT];
+extern std::atomic<int32_t> metricGauges[METRIC_GAUGE_COUNT];
+extern metricHistogramData metricHistograms[METRIC_HISTOGRAM_COUNT];
+extern const uint32_t metricHistogramBounds[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS];
+
+inline void metricInc(const metricCounter counter, const uint32_t value = 1) {
+    metricCounters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void metricSet(const metricGauge gauge, const int32_t value) {
+    metricGauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+inline void metricObserve(const metricHistogram histogram, const uint32_t value) {
+    const uint32_t* bounds = metricHistogramBounds[histogram];
+    uint8_t bucket = 0;
+    while (bucket < METRIC_HISTOGRAM_BUCKETS && value > bounds[bucket]) bucket++;
+    metricHistogramData& data = metricHistograms[histogram];
+    data.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    data.sum.fetch_add(value, std::memory_order_relaxed);
+    data.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metricsToStream(Print& out);
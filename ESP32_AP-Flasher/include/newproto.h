@@ -20,6 +20,7 @@ extern void prepareDataAvail(const uint8_t* dst);
 extern void prepareDataAvail(uint8_t* data, uint16_t len, uint8_t dataType, const uint8_t* dst);
 extern bool prepareDataAvail(String& filename, uint8_t dataType, uint8_t dataTypeArgument, const uint8_t* dst, uint16_t nextCheckin, bool resend = false);
 extern void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP);
+extern void finishPeerFetches();
 extern void processXferComplete(struct espXferComplete* xfc, bool local);
 extern void processXferTimeout(struct espXferComplete* xfc, bool local);
 extern void processDataReq(struct espAvailDataReq* adr, bool local, IPAddress remoteIP = IPAddress(0, 0, 0, 0));
@@ -44,3 +45,8 @@ extern PendingItem* getQueueItem(const uint8_t* targetMac, const uint64_t dataVe
 void checkQueue(const uint8_t* targetMac);
 bool queueDataAvail(struct pendingData* pending, bool local);
 uint8_t* getDataForFile(fs::File& file);
+const uint8_t* getBlockForFile(const char* filename, const uint64_t dataVer, const uint8_t blockId, const uint16_t len);
+bool cacheBlockForFile(const char* filename, const uint64_t dataVer, const uint8_t blockId, const uint16_t len);
+void releaseBlock(const uint8_t* data);
+uint32_t predictNextCheckin(const struct tagRecord* taginfo);
+void prestageBlocks(struct tagRecord* taginfo);
@@ -7,7 +7,7 @@ void handleCheckFile(AsyncWebServerRequest* request);
 void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_t index, uint8_t* data, size_t len, bool final);
 void handleUpdateOTA(AsyncWebServerRequest* request);
 void firmwareUpdateTask(void* parameter);
-void updateFirmware(const char* url, const char* expectedMd5, const size_t size);
+void updateFirmware(const char* url, const char* expectedMd5, const size_t size, const char* deltaUrl = nullptr);
 void handleRollback(AsyncWebServerRequest* request);
 void handleUpdateC6(AsyncWebServerRequest* request);
 void handleUpdateActions(AsyncWebServerRequest* request);
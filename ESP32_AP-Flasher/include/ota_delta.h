@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <functional>
+
+// Delta images start with an uncompressed OtaDeltaHeader, followed by a zlib stream of
+// bsdiff control records: diff length, extra length, seek (uint32, uint32, int32, little
+// endian), then diff length bytes that are added to the running image, then extra length
+// literal bytes. make_ota_delta.py creates them from two firmware builds.
+#define OTA_DELTA_MAGIC "OEPLDLT1"
+
+struct OtaDeltaHeader {
+    char magic[8];
+    uint32_t oldSize;
+    uint8_t oldMd5[16];
+    uint32_t newSize;
+} __attribute__((packed));
+
+// Applies the inflated record stream. It has no idea of flash or HTTP, the old image is read
+// and the new image is written through the two callbacks, so it can be fed in any piece size.
+class OtaDeltaPatcher {
+   public:
+    using ReadOld = std::function<bool(uint32_t pos, uint8_t* buffer, size_t len)>;
+    using WriteNew = std::function<bool(const uint8_t* buffer, size_t len)>;
+
+    OtaDeltaPatcher(const uint32_t oldSize, const uint32_t newSize, ReadOld readOld, WriteNew writeNew)
+        : oldSize(oldSize), newLeft(newSize), readOld(readOld), writeNew(writeNew) {}
+
+    bool write(const uint8_t* data, size_t len) {
+        while (len) {
+            if (diffLeft) {
+                uint8_t old[256];
+                const size_t chunk = minSize(len, minSize(diffLeft, sizeof(old)));
+                if (oldPos < 0 || (uint64_t)oldPos + chunk > oldSize) return false;
+                if (!readOld(oldPos, old, chunk)) return false;
+                for (size_t i = 0; i < chunk; i++) old[i] += data[i];
+                if (!writeNew(old, chunk)) return false;
+                oldPos += chunk;
+                diffLeft -= chunk;
+                newLeft -= chunk;
+                data += chunk;
+                len -= chunk;
+            } else if (extraLeft) {
+                const size_t chunk = minSize(len, extraLeft);
+                if (!writeNew(data, chunk)) return false;
+                extraLeft -= chunk;
+                newLeft -= chunk;
+                data += chunk;
+                len -= chunk;
+            } else {
+                const size_t chunk = minSize(len, sizeof(control) - controlLen);
+                memcpy(control + controlLen, data, chunk);
+                controlLen += chunk;
+                data += chunk;
+                len -= chunk;
+                if (controlLen == sizeof(control)) {
+                    // the seek of the previous record only applies once its diff bytes are done
+                    oldPos += seek;
+                    memcpy(&diffLeft, control, 4);
+                    memcpy(&extraLeft, control + 4, 4);
+                    memcpy(&seek, control + 8, 4);
+                    controlLen = 0;
+                    if ((uint64_t)diffLeft + extraLeft > newLeft) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // true when exactly the announced new size has been produced
+    bool complete() const {
+        return newLeft == 0 && diffLeft == 0 && extraLeft == 0 && controlLen == 0;
+    }
+
+   private:
+    static size_t minSize(const size_t a, const size_t b) { return a < b ? a : b; }
+
+    const uint32_t oldSize;
+    uint32_t newLeft;
+    ReadOld readOld;
+    WriteNew writeNew;
+    uint8_t control[12] = {0};
+    size_t controlLen = 0;
+    uint32_t diffLeft = 0;
+    uint32_t extraLeft = 0;
+    int32_t seek = 0;
+    int64_t oldPos = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Offset bookkeeping of a download that is resumed with Range requests after the connection
+// drops. Every reply is started with begin(), its body goes through take(), so the receiver
+// never sees a byte twice, also when the server ignores the Range header and starts over.
+class OtaResume {
+   public:
+    // the value of the Range header for the next request, 0 when starting from the beginning
+    size_t rangeStart() const { return offset; }
+
+    // call with the HTTP status and content length of every reply, false if the body is unusable
+    bool begin(const int httpCode, const int32_t size) {
+        skip = 0;
+        if (httpCode == 206 && offset) {  // partial content: the rest of the file
+            if (size > 0) total = offset + size;
+        } else if (httpCode == 200) {  // the whole file, skip what was received before
+            skip = offset;
+            total = size;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool wantsMore() const { return total < 0 || offset < (size_t)total; }
+
+    // drops the part of the body that was already received, returns how many bytes are new
+    size_t take(uint8_t* data, size_t len) {
+        if (skip) {
+            const size_t skipped = skip < len ? skip : len;
+            skip -= skipped;
+            len -= skipped;
+            if (len) memmove(data, data + skipped, len);
+        }
+        offset += len;
+        return len;
+    }
+
+    // true when the reply delivered everything, or ended normally when the size is unknown
+    bool complete() const { return total >= 0 ? offset >= (size_t)total : !skip; }
+
+   private:
+    size_t offset = 0;
+    int32_t total = -1;
+    size_t skip = 0;
+};
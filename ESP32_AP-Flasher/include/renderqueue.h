@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+// How contentRunner picks the tags to render and where they go in the render queue, without the tagDB
+// and FreeRTOS, so the host tests can run it.
+
+#define RENDERS_PER_RUN 3        // renders queued per contentRunner pass for tags that are not expected to check in soon
+#define RENDER_URGENT_WINDOW 60  // s before a predicted check-in that a render jumps the queue
+#define RENDER_QUEUE_LEN 16
+#define RENDER_BACK_LIMIT (RENDER_QUEUE_LEN / 2)  // the rest of the queue is kept free for urgent renders
+
+enum renderChoice {
+    RENDER_SKIP,
+    RENDER_BACK,   // xQueueSendToBack
+    RENDER_FRONT,  // xQueueSendToFront, the tag wakes up soon or a button asks for a redraw
+};
+
+// queued: the tag already has a job in the queue or on the worker, so it gets only one
+// renders: the jobs queued in this pass so far
+// waiting: the jobs in the render queue
+inline renderChoice chooseRender(const uint32_t now, const uint32_t nextupdate, const uint32_t predictedCheckin, const bool redraw, const bool queued, const uint8_t renders, const uint8_t waiting) {
+    if (queued || (now < nextupdate && !redraw)) return RENDER_SKIP;
+    // spread rendering over several passes, tags that wake up first go first
+    if (redraw || predictedCheckin <= now + RENDER_URGENT_WINDOW) return RENDER_FRONT;
+    return renders < RENDERS_PER_RUN && waiting < RENDER_BACK_LIMIT ? RENDER_BACK : RENDER_SKIP;
+}
+
+// The urgent renders of one pass. Each one sent to the front lands ahead of the one before, so they are
+// sent latest check-in first and the tag that wakes up first ends up at the head of the queue. The tags
+// are kept by mac, the web may delete one while contentRunner yields.
+struct urgentRenders {
+    struct job {
+        uint32_t checkin;  // predicted, or now for a redraw
+        uint8_t mac[8];
+    };
+    job jobs[RENDER_QUEUE_LEN];
+    uint8_t count = 0;
+
+    void add(const uint32_t checkin, const uint8_t mac[8]) {
+        if (count == RENDER_QUEUE_LEN) return;
+        jobs[count].checkin = checkin;
+        memcpy(jobs[count].mac, mac, sizeof(jobs[count].mac));
+        count++;
+    }
+
+    // puts the jobs in send order
+    void sort() {
+        std::sort(jobs, jobs + count, [](const job& a, const job& b) { return a.checkin > b.checkin; });
+    }
+    const job* begin() const { return jobs; }
+    const job* end() const { return jobs + count; }
+};
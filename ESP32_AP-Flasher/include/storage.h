@@ -36,7 +36,9 @@ class DynStorage {
 extern SemaphoreHandle_t fsMutex;
 extern DynStorage Storage;
 extern fs::FS *contentFS;
+// takes fsMutex per chunk, so open and close the files under fsMutex but don't hold it during the copy
 extern void copyFile(File in, File out);
+extern void takeFsMutex();
 
 #endif
 
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Multi-AP sync frames and their sequence handling. Free of Arduino and AsyncUDP, so the
+// host tests can run the same code; udp.cpp does the sending and the locking.
+
+#define PKT_SYNC_BATCH 0x83
+#define PKT_SYNC_NACK 0x84
+#define PKT_SYNC_DIGEST 0x85
+
+#define SYNC_VERSION 0xAA01
+
+// a sync batch carries several events, each as uint8 packet type, uint8 length, payload
+#define SYNC_BATCH_RETRANSMIT 0x01
+#define SYNC_DIGEST_SLICES 16
+
+// events are collected and sent as one frame of at most SYNC_MTU bytes, the last SYNC_HISTORY
+// frames are kept for retransmission
+#define SYNC_MTU 1024
+#define SYNC_HISTORY 8
+
+#pragma pack(push, 1)
+
+struct SyncBatchHeader {
+    uint8_t pktType = PKT_SYNC_BATCH;
+    uint16_t syncVersion = SYNC_VERSION;
+    uint32_t seq;
+    uint8_t flags;
+    uint8_t count;
+};
+
+struct SyncNack {
+    uint8_t pktType = PKT_SYNC_NACK;
+    uint16_t syncVersion = SYNC_VERSION;
+    uint32_t firstSeq;
+    uint8_t count;
+};
+
+struct SyncDigest {
+    uint8_t pktType = PKT_SYNC_DIGEST;
+    uint16_t syncVersion = SYNC_VERSION;
+    uint32_t lastSeq;
+    uint32_t slice[SYNC_DIGEST_SLICES];
+};
+
+#pragma pack(pop)
+
+// what the receiving side knows about the sequence of one peer
+struct syncSeqState {
+    uint32_t nextSeq;
+    bool synced;  // nextSeq is known
+};
+
+// frames to ask for again with a NACK, count 0 when nothing is missing
+struct syncGap {
+    uint32_t firstSeq;
+    uint8_t count;
+};
+
+// a batch arrived, returns the frames that went missing before it
+static inline syncGap syncSeqBatch(syncSeqState& peer, const uint32_t seq, const bool retransmit) {
+    syncGap gap = {0, 0};
+    // retransmissions were requested by us and don't move the sequence
+    if (retransmit) return gap;
+    // a larger jump, or going back, means the peer restarted: start over from here
+    if (peer.synced && seq > peer.nextSeq && seq - peer.nextSeq <= SYNC_HISTORY) {
+        gap = {peer.nextSeq, static_cast<uint8_t>(seq - peer.nextSeq)};
+    }
+    peer.nextSeq = seq + 1;
+    peer.synced = true;
+    return gap;
+}
+
+// a digest arrived; frames lost at the end of a burst don't leave a gap, the digest tells the last sequence number
+static inline syncGap syncSeqDigest(syncSeqState& peer, const uint32_t lastSeq) {
+    syncGap gap = {0, 0};
+    if (peer.synced && lastSeq >= peer.nextSeq && lastSeq - peer.nextSeq < SYNC_HISTORY) {
+        gap = {peer.nextSeq, static_cast<uint8_t>(lastSeq - peer.nextSeq + 1)};
+        peer.nextSeq = lastSeq + 1;
+    }
+    return gap;
+}
+
+// Calls event(pktType, data, len) for every event of a batch frame, false for a frame of another sync version.
+template <typename Event>
+bool syncBatchEvents(const uint8_t* data, const size_t len, Event event) {
+    if (len < sizeof(SyncBatchHeader)) return false;
+    SyncBatchHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.syncVersion != SYNC_VERSION) return false;
+    size_t pos = sizeof(SyncBatchHeader);
+    for (uint8_t i = 0; i < header.count && pos + 2 <= len; i++) {
+        const uint8_t pktType = data[pos];
+        const uint8_t eventLen = data[pos + 1];
+        pos += 2;
+        if (pos + eventLen > len) break;
+        event(pktType, data + pos, eventLen);
+        pos += eventLen;
+    }
+    return true;
+}
+
+// The sending side: the frame under construction and the last SYNC_HISTORY frames that went out.
+class SyncSender {
+   public:
+    explicit SyncSender(const uint32_t firstSeq) : seq(firstSeq) {}
+
+    bool empty() const { return bufferLen == 0; }
+    bool fits(const uint8_t len) const { return (bufferLen ? bufferLen : sizeof(SyncBatchHeader)) + 2 + len <= SYNC_MTU; }
+
+    // returns true when this is the first event of a new frame; check fits() first
+    bool add(const uint8_t pktType, const void* data, const uint8_t len) {
+        const bool first = bufferLen == 0;
+        if (first) {
+            SyncBatchHeader header;
+            header.flags = 0;
+            header.count = 0;
+            memcpy(buffer, &header, sizeof(header));
+            bufferLen = sizeof(header);
+        }
+        buffer[bufferLen++] = pktType;
+        buffer[bufferLen++] = len;
+        memcpy(buffer + bufferLen, data, len);
+        bufferLen += len;
+        ((SyncBatchHeader*)buffer)->count++;
+        return first;
+    }
+
+    // numbers the frame under construction and keeps it for retransmission; the frame to send
+    // is in frame()/frameLen() until the next add()
+    bool finish() {
+        if (bufferLen <= sizeof(SyncBatchHeader)) {
+            bufferLen = 0;
+            return false;
+        }
+        ((SyncBatchHeader*)buffer)->seq = seq;
+        historyEntry& entry = history[historyPos];
+        historyPos = (historyPos + 1) % SYNC_HISTORY;
+        entry.seq = seq++;
+        entry.len = bufferLen;
+        memcpy(entry.data, buffer, bufferLen);
+        sentLen = bufferLen;
+        bufferLen = 0;
+        return true;
+    }
+    const uint8_t* frame() const { return buffer; }
+    uint16_t frameLen() const { return sentLen; }
+
+    // the sequence number of the last frame sent, for the digest
+    uint32_t lastSeq() const { return seq - 1; }
+
+    // a frame from the history for a NACK, marked as retransmission; nullptr when it is no longer there
+    const uint8_t* retransmit(const uint32_t frameSeq, uint16_t& len) {
+        for (historyEntry& entry : history) {
+            if (entry.len && entry.seq == frameSeq) {
+                ((SyncBatchHeader*)entry.data)->flags |= SYNC_BATCH_RETRANSMIT;
+                len = entry.len;
+                return entry.data;
+            }
+        }
+        return nullptr;
+    }
+
+   private:
+    struct historyEntry {
+        uint32_t seq;
+        uint16_t len;
+        uint8_t data[SYNC_MTU];
+    };
+
+    uint32_t seq;
+    uint8_t buffer[SYNC_MTU];
+    size_t bufferLen = 0;
+    uint16_t sentLen = 0;
+    historyEntry history[SYNC_HISTORY] = {};
+    uint8_t historyPos = 0;
+};
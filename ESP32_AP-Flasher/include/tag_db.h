@@ -4,6 +4,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "dither.h"
+
 #pragma pack(push, 1)
 #pragma once
 
@@ -15,7 +17,7 @@
 #define NO_SUBGHZ_CHANNEL  255
 class tagRecord {
    public:
-    tagRecord() : mac{0}, version(0), alias(""), lastseen(0), nextupdate(0), contentMode(0), pendingCount(0), md5{0}, expectedNextCheckin(0), modeConfigJson(""), LQI(0), RSSI(0), temperature(0), batteryMv(0), hwType(0), wakeupReason(0), capabilities(0), lastfullupdate(0), isExternal(false), apIp(IPAddress(0, 0, 0, 0)), pendingIdle(0), hasCustomLUT(false), rotate(0), lut(0), tagSoftwareVersion(0), currentChannel(0), dataType(0), filename(""), data(nullptr), len(0), invert(0), updateCount(0), updateLast(0) {}
+    tagRecord() : mac{0}, version(0), alias(""), lastseen(0), nextupdate(0), contentMode(0), pendingCount(0), md5{0}, expectedNextCheckin(0), modeConfigJson(""), LQI(0), RSSI(0), temperature(0), batteryMv(0), hwType(0), wakeupReason(0), capabilities(0), lastfullupdate(0), isExternal(false), apIp(IPAddress(0, 0, 0, 0)), pendingIdle(0), hasCustomLUT(false), rotate(0), lut(0), tagSoftwareVersion(0), currentChannel(0), dataType(0), filename(""), data(nullptr), len(0), invert(0), updateCount(0), updateLast(0), checkinDrift(0), prestagedVer(0), renderQueued(false) {}
 
     uint8_t mac[8];
     uint8_t version;
@@ -46,11 +48,14 @@ class tagRecord {
     uint8_t invert;
     uint32_t updateCount;
     uint32_t updateLast;
+    int16_t checkinDrift;
+    uint64_t prestagedVer;
 
     uint8_t dataType;
     String filename;
     uint8_t* data;
     uint32_t len;
+    bool renderQueued;
 
     static tagRecord* findByMAC(const uint8_t mac[8]);
 };
@@ -76,13 +81,6 @@ struct Config {
     String env;
 };
 
-struct Color {
-    uint8_t r, g, b;
-    Color() : r(0), g(0), b(0) {}
-    Color(uint16_t value_) : r((value_ >> 8) & 0xF8 | (value_ >> 13) & 0x07), g((value_ >> 3) & 0xFC | (value_ >> 9) & 0x03), b((value_ << 3) & 0xF8 | (value_ >> 2) & 0x07) {}
-    Color(uint8_t r_, uint8_t g_, uint8_t b_) : r(r_), g(g_), b(b_) {}
-};
-
 struct HwType {
     uint8_t id;
     uint16_t width;
@@ -108,6 +106,7 @@ extern String tagDBtoJson(const uint8_t mac[8] = nullptr, uint8_t startPos = 0);
 extern bool deleteRecord(const uint8_t mac[8], bool allVersions = true);
 extern void fillNode(JsonObject& tag, const tagRecord* taginfo);
 extern void saveDB(const String& filename);
+extern void saveDBBinary(const String& filename);
 extern bool loadDB(const String& filename);
 extern void destroyDB();
 extern uint32_t getTagCount();
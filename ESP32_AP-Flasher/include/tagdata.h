@@ -14,26 +14,14 @@
 
 #include "storage.h"
 #include "system.h"
+#include "tagdatafield.h"
 #include "web.h"
 
+struct varStruct;
+
 /// @brief Functions for custom tag data parser
 namespace TagData {
 
-/// @brief All available data types
-enum class Type {
-    /// @brief Signed integer type
-    INT,
-    /// @brief Unsigned integer type
-    UINT,
-    /// @brief Float type
-    FLOAT,
-    /// @brief String type
-    STRING,
-
-    /// @brief Not a type, just a helper to determine max type
-    MAX,
-};
-
 /// @brief Field that can be parsed
 struct Field {
     /// @brief Field name
@@ -57,6 +45,10 @@ struct Parser {
     String name;
     /// @brief Parsed fields
     std::vector<Field> fields = {};
+    /// @brief Compiled fields, same order as @ref fields
+    std::vector<FieldOp> ops = {};
+    /// @brief Resolved varDB entries per tag mac, same order as @ref ops
+    std::unordered_map<uint64_t, std::vector<varStruct *>> slots = {};
 };
 
 /// @brief Maps parser id to parser
@@ -73,55 +65,6 @@ extern void loadParsers(const String &filename);
 /// @param len Payload length
 extern void parse(const uint8_t src[8], const size_t id, const uint8_t *data, const uint8_t len);
 
-/// @brief Convert the given byte array @ref data with given @ref length to an unsigned integer
-///
-/// Will also convert non standard integer sizes (e.g. 3, 5, 6, and 7 bytes)
-/// @tparam T Unsigned integer type
-/// @param data Byte array
-/// @param length Length of byte array
-/// @return Unsigned integer
-template <typename T, std::enable_if_t<std::is_unsigned_v<T> && std::is_integral_v<T>, bool> = true>
-inline T bytesTo(const uint8_t *data, const uint8_t length) {
-    T value = 0;
-    for (int i = 0; i < length; i++) {
-        value |= (data[i] & 0xFF) << (8 * i);
-    }
-    return value;
-}
-
-/// @brief Convert the given byte array @ref data with given @ref length to a signed integer
-///
-/// Will also convert non standard integer sizes (e.g. 3, 5, 6, and 7 bytes)
-/// @tparam T Signed integer type
-/// @param data Byte array
-/// @param length Length of byte array
-/// @return Signed integer
-template <typename T, std::enable_if_t<std::is_signed_v<T> && std::is_integral_v<T>, bool> = true>
-inline T bytesTo(const uint8_t *data, const uint8_t length) {
-    T value = 0;
-    for (int i = 0; i < length; ++i) {
-        value |= (data[i] & 0xFF) << (8 * i);
-    }
-
-    // If data is smaller than T and last byte is negative set all upper bytes negative
-    if (length < sizeof(T) && (data[length - 1] & 0x80) != 0) {
-        value |= ~((1 << (length * 8)) - 1);
-    }
-    return value;
-}
-
-/// @brief Convert the given byte array to a float/double
-/// @param data Byte array, should be at least 4/8 bytes long
-/// @param length Length of byte array
-/// @return float/double
-template <typename T, std::enable_if_t<std::is_floating_point_v<T>, bool> = true>
-inline T bytesTo(const uint8_t *data, const uint8_t length) {
-    const size_t len = sizeof(T) < length ? sizeof(T) : length;
-    T value;
-    memcpy(&value, data, len);
-    return value;
-}
-
 /// @brief Convert the given byte array to a string
 /// @param data Byte array representing a string
 /// @param length Length of byte array
@@ -131,14 +74,6 @@ inline T bytesTo(const uint8_t *data, int length) {
     return T(data, length);
 }
 
-/// @brief Convert the given byte array to a string
-/// @param data Byte array representing a string
-/// @param length Length of byte array
-/// @return std::string
-template <typename T, std::enable_if_t<std::is_same_v<T, std::string>, bool> = true>
-inline T bytesTo(const uint8_t *data, int length) {
-    return T(data, data + length);
-}
 }  // namespace TagData
 
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+/// @file tagdatafield.h
+/// @brief Field layout and value formatting of the custom tag data parser, kept free of Arduino so the
+/// host tests can run it
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <type_traits>
+
+namespace TagData {
+
+/// @brief All available data types
+enum class Type {
+    /// @brief Signed integer type
+    INT,
+    /// @brief Unsigned integer type
+    UINT,
+    /// @brief Float type
+    FLOAT,
+    /// @brief String type
+    STRING,
+
+    /// @brief Not a type, just a helper to determine max type
+    MAX,
+};
+
+/// @brief Field as compiled at load time, with its fixed payload offset and resolved multiplier
+struct FieldOp {
+    /// @brief Byte offset in the payload
+    uint16_t offset;
+    /// @brief Field byte length
+    uint8_t length;
+    /// @brief Field type, @ref Type::MAX for fields that can not be parsed
+    Type type;
+    /// @brief Number of decimals numeric types
+    uint8_t decimals;
+    /// @brief Multiplication, 1.0 if none was given
+    double mult;
+};
+
+/// @brief Compile one field at the given payload offset
+/// @return The field, with type @ref Type::MAX if it can not be parsed (a float that is not 4 or 8 bytes long)
+inline FieldOp compileField(const uint16_t offset, const Type type, const uint8_t length, const uint8_t decimals, const double mult) {
+    FieldOp op = {offset, length, type, decimals, mult};
+    if (type == Type::FLOAT && length != 4 && length != 8) {
+        op.type = Type::MAX;
+    }
+    return op;
+}
+
+/// @brief Convert the given byte array @ref data with given @ref length to an unsigned integer
+///
+/// Will also convert non standard integer sizes (e.g. 3, 5, 6, and 7 bytes)
+/// @tparam T Unsigned integer type
+/// @param data Byte array
+/// @param length Length of byte array
+/// @return Unsigned integer
+template <typename T, std::enable_if_t<std::is_unsigned_v<T> && std::is_integral_v<T>, bool> = true>
+inline T bytesTo(const uint8_t *data, const uint8_t length) {
+    T value = 0;
+    for (int i = 0; i < length && i < (int)sizeof(T); i++) {
+        value |= (T)data[i] << (8 * i);
+    }
+    return value;
+}
+
+/// @brief Convert the given byte array @ref data with given @ref length to a signed integer
+///
+/// Will also convert non standard integer sizes (e.g. 3, 5, 6, and 7 bytes)
+/// @tparam T Signed integer type
+/// @param data Byte array
+/// @param length Length of byte array
+/// @return Signed integer
+template <typename T, std::enable_if_t<std::is_signed_v<T> && std::is_integral_v<T>, bool> = true>
+inline T bytesTo(const uint8_t *data, const uint8_t length) {
+    using U = std::make_unsigned_t<T>;
+    U value = bytesTo<U>(data, length);
+
+    // If data is smaller than T and last byte is negative set all upper bytes negative
+    if (length > 0 && length < sizeof(T) && (data[length - 1] & 0x80) != 0) {
+        value |= ~(U)0 << (length * 8);
+    }
+    return (T)value;
+}
+
+/// @brief Convert the given byte array to a float/double
+/// @param data Byte array, should be at least 4/8 bytes long
+/// @param length Length of byte array
+/// @return float/double
+template <typename T, std::enable_if_t<std::is_floating_point_v<T>, bool> = true>
+inline T bytesTo(const uint8_t *data, const uint8_t length) {
+    const size_t len = sizeof(T) < length ? sizeof(T) : length;
+    T value = 0;
+    memcpy(&value, data, len);
+    return value;
+}
+
+/// @brief Convert the given byte array to a string
+/// @param data Byte array representing a string
+/// @param length Length of byte array
+/// @return std::string
+template <typename T, std::enable_if_t<std::is_same_v<T, std::string>, bool> = true>
+inline T bytesTo(const uint8_t *data, int length) {
+    return T(data, data + length);
+}
+
+/// @brief Format the value of one field into @ref value, without allocating
+/// @param op Compiled field
+/// @param fieldData Field bytes, @ref FieldOp::length of them
+/// @param value Output buffer, a string field is cut to its size
+/// @param size Size of @ref value
+/// @return false if the field can not be parsed
+inline bool formatField(const FieldOp &op, const uint8_t *fieldData, char *value, const size_t size) {
+    switch (op.type) {
+        case Type::INT:
+            snprintf(value, size, "%.*f", op.decimals, bytesTo<int64_t>(fieldData, op.length) * op.mult);
+            return true;
+        case Type::UINT:
+            snprintf(value, size, "%.*f", op.decimals, bytesTo<uint64_t>(fieldData, op.length) * op.mult);
+            return true;
+        case Type::FLOAT:
+            if (op.length == 4) {
+                snprintf(value, size, "%.*f", op.decimals, bytesTo<float>(fieldData, op.length) * op.mult);
+            } else {
+                snprintf(value, size, "%.*f", op.decimals, bytesTo<double>(fieldData, op.length) * op.mult);
+            }
+            return true;
+        case Type::STRING: {
+            const size_t len = op.length < size ? op.length : size - 1;
+            memcpy(value, fieldData, len);
+            value[len] = '\0';
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+}  // namespace TagData
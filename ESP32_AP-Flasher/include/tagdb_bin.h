@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// binary tagDB: 8 byte header, then per tag a sync marker (since version 2), a uint16 length, the fillNode
+// object as MessagePack and a CRC-32 of it. The marker lets the loader find the next record after a corrupt length.
+// Only the framing lives here, it works on anything with fs::File's read/write/seek/position, so the
+// host tests can run it on a memory buffer.
+#define TAGDB_BIN_MAGIC "OEDB"
+#define TAGDB_BIN_VERSION 2
+#define TAGDB_BIN_SYNC 0x7EDB
+#define TAGDB_BIN_MAX_RECORD 2500  // fillNode builds a record in a 2500 byte document, it can't be larger
+
+// same signature as esp_rom_crc32_le()
+typedef uint32_t (*tagDBCrc)(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+template <typename File>
+void tagDBBinWriteHeader(File& file) {
+    const uint8_t header[8] = {'O', 'E', 'D', 'B', TAGDB_BIN_VERSION, 0, 0, 0};
+    file.write(header, sizeof(header));
+}
+
+template <typename File>
+void tagDBBinWriteRecord(File& file, const uint8_t* record, const uint16_t len, tagDBCrc crc32) {
+    const uint16_t sync = TAGDB_BIN_SYNC;
+    const uint32_t crc = crc32(0, record, len);
+    file.write((const uint8_t*)&sync, sizeof(sync));
+    file.write((const uint8_t*)&len, sizeof(len));
+    file.write(record, len);
+    file.write((const uint8_t*)&crc, sizeof(crc));
+}
+
+template <typename File>
+class TagDBBinReader {
+   public:
+    // record has to hold TAGDB_BIN_MAX_RECORD bytes
+    TagDBBinReader(File& file, uint8_t* record, tagDBCrc crc32) : file(file), record(record), crc32(crc32) {}
+
+    // checks the header, false for files this build can't read
+    bool begin() {
+        uint8_t header[8];
+        if (file.read(header, sizeof(header)) != sizeof(header) || header[4] == 0 || header[4] > TAGDB_BIN_VERSION) return false;
+        synced = header[4] >= 2;
+        return true;
+    }
+
+    // Returns the length of the next record with a good CRC, now in record, or 0 at the end of the file.
+    // A version 1 file also ends at a corrupt length, corrupt() tells that apart.
+    uint16_t next() {
+        while (!atEnd) {
+            start = file.position();
+            uint16_t sync = TAGDB_BIN_SYNC;
+            uint16_t len;
+            uint32_t crc;
+            if (synced && file.read((uint8_t*)&sync, sizeof(sync)) != sizeof(sync)) break;
+            if (file.read((uint8_t*)&len, sizeof(len)) != sizeof(len)) break;
+            const bool framed = sync == TAGDB_BIN_SYNC && len > 0 && len <= TAGDB_BIN_MAX_RECORD;
+            const bool complete = framed && file.read(record, len) == len && file.read((uint8_t*)&crc, sizeof(crc)) == sizeof(crc);
+            if (complete && crc32(0, record, len) == crc) {
+                resyncing = false;
+                return len;
+            }
+            skip(complete);
+        }
+        atEnd = true;
+        return 0;
+    }
+
+    // for a record next() returned that can't be used anyway, like one with broken MessagePack;
+    // its frame was intact, so the next record follows right after it
+    void reject() { bad++; }
+
+    uint32_t badRecords() const { return bad; }
+    bool corrupt() const { return isCorrupt; }
+    size_t position() const { return start; }  // where the last record started
+
+   private:
+    void skip(const bool complete) {
+        if (!resyncing) bad++;  // false markers in the damaged part don't count as more records
+        if (!synced) {
+            // without markers there is no way to find the next record
+            if (!complete) atEnd = isCorrupt = true;
+            return;
+        }
+        // the length can't be trusted either, look for the next marker after this one
+        resyncing = true;
+        if (!findSync(start + 1)) atEnd = true;
+    }
+
+    // moves to the next sync marker after pos, returns false at the end of the file
+    bool findSync(const size_t pos) {
+        file.seek(pos);
+        uint16_t window = 0;
+        int c;
+        while ((c = file.read()) >= 0) {
+            window = (window >> 8) | (c << 8);
+            if (window == TAGDB_BIN_SYNC) {
+                file.seek(file.position() - sizeof(window));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    File& file;
+    uint8_t* record;
+    tagDBCrc crc32;
+    bool synced = false;
+    bool atEnd = false;
+    bool isCorrupt = false;
+    bool resyncing = false;
+    uint32_t bad = 0;
+    size_t start = 0;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "telemetry_ring.h"
+
+// Per-tag history of check-in telemetry (battery, temperature, RSSI/LQI, wakeup reason) and tag return data
+// Every tag gets a fixed ring of delta encoded records in one preallocated arena, PSRAM when available
+
+void initTelemetry();
+void telemetryAdd(const uint8_t mac[8], const uint32_t now, const uint16_t batteryMv, const int8_t temperature, const int8_t rssi, const uint8_t lqi, const uint8_t wakeupReason);
+void telemetryAddReturn(const uint8_t mac[8], const uint32_t now, const uint8_t dataType, const uint8_t* data, const uint8_t len);
+void telemetryToStream(Print& out, const uint8_t mac[8], const uint32_t since, const bool binary, const bool returnData);
+void saveTelemetry(const String& filename);
+void loadTelemetry(const String& filename);
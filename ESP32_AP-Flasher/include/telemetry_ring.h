@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The delta encoded sample rings behind telemetry.cpp, without locking, allocation or storage,
+// so the host tests can run the encoding as it is.
+//
+// Every ring is a circular byte buffer of variable length records. A record starts with a varint
+// of (seconds since the previous record << 1 | kind), so a normal check-in interval takes two bytes
+// and a tag that was away for days just takes a longer varint.
+//   check-in:     varint header, zigzag varint battery delta, temperature delta, rssi, lqi, wakeup reason
+//   return data:  varint header, data type, payload length, the first TELEMETRY_RETURN_BYTES of the payload
+
+#ifdef BOARD_HAS_PSRAM
+#define TELEMETRY_TAGS 256
+#define TELEMETRY_BYTES 2560  // a bit more than a day of check-ins at one per TELEMETRY_INTERVAL
+#else
+#define TELEMETRY_TAGS 16
+#define TELEMETRY_BYTES 384
+#endif
+#define TELEMETRY_INTERVAL 300  // seconds between two samples of a tag, unless the wakeup reason changes
+#define TELEMETRY_MIN_TIME 1672531200  // 2023-01-01, anything earlier means the clock isn't set yet
+#define TELEMETRY_RETURN_BYTES 16
+
+#define TELEMETRY_KIND_CHECKIN 0
+#define TELEMETRY_KIND_RETURN 1
+#define TELEMETRY_MAX_RECORD (5 + 2 + TELEMETRY_RETURN_BYTES)
+
+struct telemetrySample {
+    uint32_t time;
+    uint16_t batteryMv;
+    int8_t temperature;
+    int8_t rssi;
+    uint8_t lqi;
+    uint8_t wakeupReason;
+} __attribute__((packed));
+
+// what a tag sent with its tagReturnData; longer payloads are cut, len still says how long it was
+struct telemetryReturn {
+    uint32_t time;
+    uint8_t dataType;
+    uint8_t len;
+    uint8_t data[TELEMETRY_RETURN_BYTES];
+} __attribute__((packed));
+
+// base is the oldest check-in that is kept, baseTime the time the first record counts from;
+// evicting a record folds it into both
+struct telemetryRing {
+    uint8_t mac[8];
+    telemetrySample base;
+    telemetrySample last;  // the newest check-in, the next one is stored relative to it
+    uint32_t baseTime;
+    uint32_t lastTime;  // the newest record of any kind
+    uint16_t head;
+    uint16_t used;
+    uint8_t data[TELEMETRY_BYTES];
+};
+
+// returns the ring of this mac, or takes over the empty or least recently updated one
+inline telemetryRing* telemetryFindRing(telemetryRing* rings, const uint16_t tags, const uint8_t mac[8], const bool create) {
+    static const uint8_t emptyMac[8] = {0};
+    telemetryRing* empty = nullptr;
+    telemetryRing* oldest = nullptr;
+    for (uint16_t c = 0; c < tags; c++) {
+        telemetryRing* ring = &rings[c];
+        if (memcmp(ring->mac, mac, 8) == 0) return ring;
+        if (memcmp(ring->mac, emptyMac, 8) == 0) {
+            if (empty == nullptr) empty = ring;
+        } else if (oldest == nullptr || ring->lastTime < oldest->lastTime) {
+            oldest = ring;
+        }
+    }
+    if (!create) return nullptr;
+    telemetryRing* ring = empty ? empty : oldest;
+    if (ring == nullptr) return nullptr;
+    memset(ring, 0, sizeof(telemetryRing));
+    memcpy(ring->mac, mac, 8);
+    return ring;
+}
+
+inline uint8_t telemetryPutVarint(uint8_t* out, uint64_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+// reads the records of a ring, wrapping around at the end of the buffer
+struct telemetryReader {
+    const telemetryRing& ring;
+    uint16_t pos;
+    uint16_t count;  // bytes read so far
+
+    uint8_t byte() {
+        const uint8_t b = ring.data[pos];
+        pos = (pos + 1) % TELEMETRY_BYTES;
+        count++;
+        return b;
+    }
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (uint8_t shift = 0; shift < 64; shift += 7) {
+            const uint8_t b = byte();
+            value |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        return value;
+    }
+
+    // decodes the record at pos: applies a check-in to sample, or fills ret; returns the kind
+    uint8_t next(uint32_t& time, telemetrySample& sample, telemetryReturn& ret) {
+        const uint64_t header = varint();
+        time += header >> 1;
+        if ((header & 1) == TELEMETRY_KIND_RETURN) {
+            ret.time = time;
+            ret.dataType = byte();
+            ret.len = byte();
+            const uint8_t kept = ret.len < TELEMETRY_RETURN_BYTES ? ret.len : TELEMETRY_RETURN_BYTES;
+            memset(ret.data, 0, sizeof(ret.data));
+            for (uint8_t c = 0; c < kept; c++) ret.data[c] = byte();
+            return TELEMETRY_KIND_RETURN;
+        }
+        const uint32_t zigzag = varint();
+        sample.time = time;
+        sample.batteryMv += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        sample.temperature += (int8_t)byte();
+        sample.rssi = byte();
+        sample.lqi = byte();
+        sample.wakeupReason = byte();
+        return TELEMETRY_KIND_CHECKIN;
+    }
+};
+
+// appends one encoded record, evicting the oldest records until it fits
+inline void telemetryAppend(telemetryRing* ring, const uint8_t* record, const uint8_t len, const uint32_t time) {
+    while (TELEMETRY_BYTES - ring->used < len) {
+        telemetryReader reader = {*ring, ring->head, 0};
+        telemetryReturn evicted;
+        reader.next(ring->baseTime, ring->base, evicted);
+        ring->head = reader.pos;
+        ring->used -= reader.count;
+    }
+    uint16_t pos = (ring->head + ring->used) % TELEMETRY_BYTES;
+    for (uint8_t c = 0; c < len; c++) {
+        ring->data[pos] = record[c];
+        pos = (pos + 1) % TELEMETRY_BYTES;
+    }
+    ring->used += len;
+    ring->lastTime = time;
+}
+
+// the ring for a new record at time, nullptr if there is none or the clock isn't set
+inline telemetryRing* telemetryRingFor(telemetryRing* rings, const uint16_t tags, const uint8_t mac[8], const uint32_t time, const bool create) {
+    if (time < TELEMETRY_MIN_TIME) return nullptr;
+    telemetryRing* ring = telemetryFindRing(rings, tags, mac, create);
+    if (ring == nullptr) return nullptr;
+    if (ring->lastTime != 0 && time < ring->lastTime) {
+        // the clock was stepped back, the deltas can't express that; start over from this record
+        memset(&ring->base, 0, sizeof(telemetryRing) - offsetof(telemetryRing, base));
+    }
+    return ring;
+}
+
+// returns true when the sample was stored
+inline bool telemetryStore(telemetryRing* rings, const uint16_t tags, const uint8_t mac[8], const telemetrySample& sample) {
+    telemetryRing* ring = telemetryRingFor(rings, tags, mac, sample.time, true);
+    if (ring == nullptr) return false;
+
+    if (ring->base.time == 0) {
+        ring->base = sample;
+        ring->last = sample;
+        ring->baseTime = sample.time;
+        ring->lastTime = sample.time;
+        return true;
+    }
+    if (sample.time - ring->last.time < TELEMETRY_INTERVAL && sample.wakeupReason == ring->last.wakeupReason) return false;
+
+    uint8_t record[TELEMETRY_MAX_RECORD];
+    uint8_t len = telemetryPutVarint(record, ((uint64_t)(sample.time - ring->lastTime) << 1) | TELEMETRY_KIND_CHECKIN);
+    const int32_t dBatteryMv = (int32_t)sample.batteryMv - ring->last.batteryMv;
+    len += telemetryPutVarint(record + len, ((uint32_t)dBatteryMv << 1) ^ (uint32_t)(dBatteryMv >> 31));
+    record[len++] = (uint8_t)(sample.temperature - ring->last.temperature);
+    record[len++] = sample.rssi;
+    record[len++] = sample.lqi;
+    record[len++] = sample.wakeupReason;
+    telemetryAppend(ring, record, len, sample.time);
+    ring->last = sample;
+    return true;
+}
+
+// returns true when the return data was stored; only for a tag that has checked in before
+inline bool telemetryStoreReturn(telemetryRing* rings, const uint16_t tags, const uint8_t mac[8], const uint32_t time, const uint8_t dataType, const uint8_t* data, const uint8_t len) {
+    telemetryRing* ring = telemetryRingFor(rings, tags, mac, time, false);
+    if (ring == nullptr || ring->base.time == 0) return false;
+
+    uint8_t record[TELEMETRY_MAX_RECORD];
+    uint8_t recordLen = telemetryPutVarint(record, ((uint64_t)(time - ring->lastTime) << 1) | TELEMETRY_KIND_RETURN);
+    record[recordLen++] = dataType;
+    record[recordLen++] = len;
+    const uint8_t kept = len < TELEMETRY_RETURN_BYTES ? len : TELEMETRY_RETURN_BYTES;
+    memcpy(record + recordLen, data, kept);
+    telemetryAppend(ring, record, recordLen + kept, time);
+    return true;
+}
+
+// calls onSample(sample) for every check-in and onReturn(ret) for all return data of the ring
+// from since on, oldest first
+template <typename OnSample, typename OnReturn>
+void telemetryReplay(const telemetryRing& ring, const uint32_t since, OnSample onSample, OnReturn onReturn) {
+    if (ring.base.time == 0) return;
+    telemetrySample sample = ring.base;
+    telemetryReturn ret;
+    uint32_t time = ring.baseTime;
+    if (sample.time >= since) onSample(sample);
+    telemetryReader reader = {ring, ring.head, 0};
+    while (reader.count < ring.used) {
+        if (reader.next(time, sample, ret) == TELEMETRY_KIND_CHECKIN) {
+            if (sample.time >= since) onSample(sample);
+        } else if (ret.time >= since) {
+            onReturn(ret);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+
+// Single pass line breaking for drawTextBox. Glyph widths are accumulated while walking the text,
+// break opportunities are after a space, after '-' and at a soft hyphen (U+00AD). It has no idea of
+// TFT_eSPI, the glyph widths come from a callback, so the same code runs in the host tests.
+
+struct glyphMetric {
+    int16_t advance;  // pen movement when more glyphs follow on the line
+    int16_t extent;   // ink width when this is the last glyph of the line
+    int16_t lead;     // extra width when this is the first glyph of the line
+};
+
+struct textLine {
+    uint16_t start;  // first byte of the line
+    uint16_t end;    // one past the last byte to draw
+    uint16_t next;   // first byte of the next line
+    int32_t width;   // ink width of what is drawn, including the hyphen or ellipsis
+    bool hyphenate;  // broken at a soft hyphen, a '-' has to be drawn after the line
+    bool ellipsis;   // more text follows but doesn't fit, "..." has to be drawn after the line
+};
+
+class TextWrapper {
+   public:
+    using GlyphMetric = std::function<glyphMetric(uint16_t unicode)>;
+
+    TextWrapper(const uint8_t* text, const uint16_t length, const int32_t boxwidth, GlyphMetric metric)
+        : text(text), length(length), boxwidth(boxwidth), metric(metric) {
+        hyphen = metric('-');
+        const glyphMetric dot = metric('.');
+        ellipsisWidth = 2 * dot.advance + dot.extent;
+    }
+
+    bool done() const { return pos >= length; }
+
+    // Breaks off the next line. On the last line that fits in the box, pass truncate to get an
+    // ellipsis when the text doesn't end on it.
+    textLine next(const bool truncate) {
+        const uint16_t startPos = pos;
+        int32_t penX = 0;           // sum of advances of the accepted glyphs
+        int32_t lineWidth = 0;      // ink width of the accepted glyphs
+        uint16_t endPos = startPos;
+        uint16_t breakPos = 0;      // 0: no break opportunity seen yet
+        int32_t breakWidth = 0;
+        bool breakHyphen = false;
+        uint16_t cutPos = startPos;  // last position where the ellipsis still fits
+        int32_t cutWidth = 0;
+
+        while (endPos < length && text[endPos] != '\n') {
+            uint16_t nextPos = endPos;
+            const uint16_t unicode = decodeUTF8(text, &nextPos, length - endPos);
+            if (unicode == 0xAD) {
+                if (penX + hyphen.extent <= boxwidth) {
+                    breakPos = nextPos;
+                    breakWidth = penX + hyphen.extent;
+                    breakHyphen = true;
+                }
+                endPos = nextPos;
+                continue;
+            }
+            const glyphMetric glyph = metric(unicode);
+            const int32_t lead = (endPos == startPos) ? glyph.lead : 0;
+            if (endPos > startPos && penX + lead + glyph.extent > boxwidth) break;
+            if (truncate && penX + lead + ellipsisWidth <= boxwidth) {
+                cutPos = endPos;
+                cutWidth = penX + lead + ellipsisWidth;
+            }
+            if (unicode == ' ') {
+                breakPos = nextPos;
+                breakWidth = lineWidth;
+                breakHyphen = false;
+            } else {
+                lineWidth = penX + lead + glyph.extent;
+            }
+            penX += lead + glyph.advance;
+            if (unicode == '-') {
+                breakPos = nextPos;
+                breakWidth = lineWidth;
+                breakHyphen = false;
+            }
+            endPos = nextPos;
+        }
+        if (truncate && penX + ellipsisWidth <= boxwidth) {
+            cutPos = endPos;
+            cutWidth = penX + ellipsisWidth;
+        }
+
+        textLine line = {startPos, endPos, endPos, lineWidth, false, false};
+        if (endPos < length && text[endPos] != '\n' && breakPos > 0) {
+            line.end = breakPos;
+            line.width = breakWidth;
+            line.hyphenate = breakHyphen;
+        }
+
+        line.next = line.end;
+        if (line.next < length && text[line.next] == '\n') line.next++;
+        while (line.next < length && text[line.next] == ' ') line.next++;
+
+        if (truncate && line.next < length) {
+            line.end = cutPos;
+            line.width = cutWidth;
+            line.hyphenate = false;
+            line.ellipsis = true;
+        }
+        pos = line.next;
+        return line;
+    }
+
+    // the UTF-8 decoding of TFT_eSPI::decodeUTF8(), up to 16 bit code points
+    static uint16_t decodeUTF8(const uint8_t* buf, uint16_t* index, const uint16_t remaining) {
+        uint16_t c = buf[(*index)++];
+        if ((c & 0x80) == 0x00) return c;
+        if (((c & 0xE0) == 0xC0) && (remaining > 1)) return ((c & 0x1F) << 6) | (buf[(*index)++] & 0x3F);
+        if (((c & 0xF0) == 0xE0) && (remaining > 2)) {
+            c = ((c & 0x0F) << 12) | ((buf[(*index)++] & 0x3F) << 6);
+            return c | (buf[(*index)++] & 0x3F);
+        }
+        return c;
+    }
+
+   private:
+    const uint8_t* text;
+    const uint16_t length;
+    const int32_t boxwidth;
+    GlyphMetric metric;
+    glyphMetric hyphen;
+    int32_t ellipsisWidth;
+    uint16_t pos = 0;
+};
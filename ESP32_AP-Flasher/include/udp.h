@@ -16,11 +16,19 @@ class UDPcomm {
 		void netProcessXferTimeout(struct espXferComplete* xfc);
 		void netSendDataAvail(struct pendingData* pending);
 		void netTaginfo(struct TagInfo* taginfoitem);
+		void netSendDigest();
     private:
 		AsyncUDP udp;
 		void processPacket(AsyncUDPPacket packet);
+		void processEvent(uint8_t pktType, const uint8_t* data, size_t len, IPAddress senderIP);
+		void processBatch(const uint8_t* data, size_t len, IPAddress senderIP);
+		void processNack(const uint8_t* data, size_t len, IPAddress senderIP);
+		void processDigest(const uint8_t* data, size_t len, IPAddress senderIP);
+		void queueEvent(uint8_t pktType, const void* data, uint8_t len);
 };
 
-#endif
+extern UDPcomm udpsync;
 
-void init_udp();
\ No newline at end of file
+void init_udp();
+
+#endif
\ No newline at end of file
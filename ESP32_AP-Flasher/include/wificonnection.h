@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+
+// The connection state machine of the WifiManager, without the WiFi driver, so the host tests can run
+// it against a fake event source. poll() feeds it the time, the station status and whether a
+// STA_DISCONNECTED event came in, and carries out the action it returns. Nothing in here waits.
+
+#define WIFI_MAX_RECONNECTS 4  // failed reconnects before falling back to the configuration AP
+
+enum WifiStatus {
+    NOINIT,
+    WAIT_CONNECTING,
+    CONNECTED,
+    WAIT_RECONNECT,
+    AP
+};
+
+enum wifiAction {
+    WIFI_IDLE,
+    WIFI_ESTABLISHED,  // the station is connected, connectMs is how long the (re)connect took
+    WIFI_LOST,         // the connection dropped; call WiFi.reconnect()
+    WIFI_RECONNECT,    // the backoff is over; call WiFi.reconnect()
+    WIFI_BACKOFF,      // the attempt timed out, the next one is in backoff ms
+    WIFI_FAILED,       // give up and start the configuration AP
+};
+
+struct wifiConnection {
+    WifiStatus status = NOINIT;
+    uint32_t reconnectInterval = 5000;  // status check while connected, and the first backoff
+    uint32_t retryInterval = 5 * 60000;  // longest backoff, and the retry from the configuration AP
+    uint32_t connectionTimeout = 15000;
+    uint32_t nextCheck = 0;
+    uint32_t connectStart = 0;
+    uint32_t attemptStart = 0;
+    uint32_t connectMs = 0;
+    uint32_t backoff = 0;
+    uint8_t reconnectAttempts = 0;
+    bool reconnecting = false;
+
+    // WiFi.begin() was called
+    void start(const uint32_t now) {
+        reconnectAttempts = 0;
+        reconnecting = false;
+        connectStart = now;
+        attemptStart = now;
+        status = WAIT_CONNECTING;
+    }
+
+    wifiAction poll(const uint32_t now, const bool staConnected, const bool linkLost) {
+        switch (status) {
+            case WAIT_CONNECTING:
+                if (staConnected) return established(now);
+                if (now - attemptStart > connectionTimeout) return failed(now);
+                break;
+
+            case WAIT_RECONNECT:
+                // the driver reconnects on its own as well, so check for that before our next attempt
+                if (staConnected) return established(now);
+                if (now > nextCheck) {
+                    attemptStart = now;
+                    status = WAIT_CONNECTING;
+                    return WIFI_RECONNECT;
+                }
+                break;
+
+            case CONNECTED:
+                if (linkLost || (now > nextCheck && !staConnected)) {
+                    reconnectAttempts = 0;
+                    reconnecting = true;
+                    connectStart = now;
+                    attemptStart = now;
+                    status = WAIT_CONNECTING;
+                    return WIFI_LOST;
+                }
+                if (now > nextCheck) nextCheck = now + reconnectInterval;
+                break;
+
+            default:
+                break;
+        }
+        return WIFI_IDLE;
+    }
+
+   private:
+    wifiAction established(const uint32_t now) {
+        connectMs = now - connectStart;
+        reconnectAttempts = 0;
+        reconnecting = false;
+        nextCheck = now + reconnectInterval;
+        status = CONNECTED;
+        return WIFI_ESTABLISHED;
+    }
+
+    wifiAction failed(const uint32_t now) {
+        // a connection that worked before is retried with an increasing interval first
+        if (reconnecting && reconnectAttempts < WIFI_MAX_RECONNECTS) {
+            backoff = reconnectInterval << reconnectAttempts;
+            if (backoff > retryInterval) backoff = retryInterval;
+            reconnectAttempts++;
+            nextCheck = now + backoff;
+            status = WAIT_RECONNECT;
+            return WIFI_BACKOFF;
+        }
+        return WIFI_FAILED;
+    }
+};
@@ -11,25 +11,18 @@
 
 #include <WiFi.h>
 
-enum WifiStatus {
-    NOINIT,
-    WAIT_CONNECTING,
-    CONNECTED,
-    WAIT_RECONNECT,
-    AP
-};
+#include "wificonnection.h"
 
 class WifiManager {
    private:
     bool _connected;
     bool _savewhensuccessfull;
-    int _reconnectIntervalCheck;
-    int _retryIntervalCheck;
-    int _connectionTimeout;
+    wifiConnection _connection;
     String _ssid;
     String _pass;
-    unsigned long _nextReconnectCheck;
     bool _APstarted;
+    bool _scanRunning;
+    static volatile bool _linkLost;
 
     const int SERIAL_BUFFER_SIZE = 64;
     char serialBuffer[64];
@@ -38,19 +31,21 @@ class WifiManager {
     String WiFi_SSID();
     String WiFi_psk();
 
-    bool waitForConnection();
+    void connectionEstablished();
+    void connectionFailed();
+    void pollScan();
     void pollSerial();
     static void terminalLog(String text);
 
    public:
     WifiManager();
 
-    WifiStatus wifiStatus;
     static uint8_t apClients;
     bool connectToWifi();
     bool connectToWifi(String ssid, String pass, bool savewhensuccessfull);
 
     void startManagementServer();
+    void startScan();
     void poll();
     static void WiFiEvent(WiFiEvent_t event);
 };
@@ -125,5 +120,6 @@ void set_state(improv::State state);
 void send_response(std::vector<uint8_t> &response);
 void set_error(improv::Error error);
 void getAvailableWifiNetworks();
+void sendAvailableWifiNetworks(int networkNum);
 bool onCommandCallback(improv::ImprovCommand cmd);
 void onErrorCallback(improv::Error err);
@@ -174,6 +174,51 @@ esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size);
   *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
   */
 esp_loader_error_t esp_loader_flash_finish(bool reboot);
+
+/**
+  * @brief Initiates a compressed flash operation
+  *
+  * @param offset[in]           Address from which flash operation will be performed.
+  * @param image_size[in]       Size of the whole uncompressed binary.
+  * @param compressed_size[in]  Size of the zlib compressed binary.
+  * @param block_size[in]       Size of the compressed chunks passed to esp_loader_flash_defl_write.
+  *
+  * @note  The compressed data is a single zlib stream; it is split into block_size chunks
+  *        and sent in order with esp_loader_flash_defl_write.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_defl_start(uint32_t offset, uint32_t image_size,
+                                               uint32_t compressed_size, uint32_t block_size);
+
+/**
+  * @brief Writes a chunk of compressed data, the target inflates it into flash.
+  *
+  * @param payload[in]      Compressed data.
+  * @param size[in]         Size of payload in bytes, at most block_size. Only the last
+  *                         chunk may be shorter; it is not padded.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_defl_write(void *payload, uint32_t size);
+
+/**
+  * @brief Ends compressed flash operation.
+  *
+  * @param reboot[in]       reboot the target if true.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_defl_finish(bool reboot);
 #endif /* SERIAL_FLASHER_INTERFACE_UART */
 
 
@@ -287,6 +332,21 @@ esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rat
   */
 #if MD5_ENABLED
 esp_loader_error_t esp_loader_flash_verify(void);
+
+/**
+  * @brief Verify target's flash integrity against an MD5 computed by the caller,
+  *        e.g. over the uncompressed image of a compressed flash operation.
+  *
+  * @param address[in]      Start of the region to check.
+  * @param size[in]         Size of the region in bytes.
+  * @param expected_md5[in] Raw (binary) MD5 of the region.
+  *
+  * @note  This function is only available if MD5_ENABLED is set.
+  *
+  * @return Same as esp_loader_flash_verify()
+  */
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size,
+                                                     const uint8_t expected_md5[16]);
 #endif
 /**
   * @brief Toggles reset pin.
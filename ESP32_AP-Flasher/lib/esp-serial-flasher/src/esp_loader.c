@@ -250,10 +250,8 @@ static uint32_t calc_erase_size(const target_chip_t target, const uint32_t offse
     }
 }
 
-esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+static esp_loader_error_t set_flash_parameters(uint32_t image_size)
 {
-    s_flash_write_size = block_size;
-
     size_t flash_size = 0;
     if (detect_flash_size(&flash_size) == ESP_LOADER_SUCCESS) {
         if (image_size > flash_size) {
@@ -264,6 +262,14 @@ esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size,
     } else {
         loader_port_debug_print("Flash size detection failed, falling back to default");
     }
+    return ESP_LOADER_SUCCESS;
+}
+
+esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+{
+    s_flash_write_size = block_size;
+
+    RETURN_ON_ERROR( set_flash_parameters(image_size) );
 
     init_md5(offset, image_size);
 
@@ -306,6 +312,48 @@ esp_loader_error_t esp_loader_flash_finish(bool reboot)
 
     return loader_flash_end_cmd(!reboot);
 }
+
+
+esp_loader_error_t esp_loader_flash_defl_start(uint32_t offset, uint32_t image_size,
+                                               uint32_t compressed_size, uint32_t block_size)
+{
+    s_flash_write_size = block_size;
+
+    RETURN_ON_ERROR( set_flash_parameters(image_size) );
+
+    init_md5(offset, image_size);
+
+    bool encryption_in_cmd = encryption_in_begin_flash_cmd(s_target);
+    /* The ROM erases what it is told to, rounded up to whole blocks of uncompressed data */
+    const uint32_t erase_size = ROUNDUP(image_size, block_size) * block_size;
+    const uint32_t blocks_to_write = ROUNDUP(compressed_size, block_size);
+
+    const uint32_t erase_region_timeout_per_mb = 10000;
+    loader_port_start_timer(timeout_per_mb(erase_size, erase_region_timeout_per_mb));
+    return loader_flash_defl_begin_cmd(offset, erase_size, block_size, blocks_to_write, encryption_in_cmd);
+}
+
+
+esp_loader_error_t esp_loader_flash_defl_write(void *payload, uint32_t size)
+{
+    if (size > s_flash_write_size) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    /* Inflating a block can expand it a lot before it is written */
+    const uint32_t write_timeout_per_mb = 40000;
+    loader_port_start_timer(timeout_per_mb(s_flash_write_size * 32, write_timeout_per_mb));
+
+    return loader_flash_defl_data_cmd((const uint8_t *)payload, size);
+}
+
+
+esp_loader_error_t esp_loader_flash_defl_finish(bool reboot)
+{
+    loader_port_start_timer(DEFAULT_TIMEOUT);
+
+    return loader_flash_defl_end_cmd(!reboot);
+}
 #endif /* SERIAL_FLASHER_INTERFACE_UART */
 
 esp_loader_error_t esp_loader_mem_start(uint32_t offset, uint32_t size, uint32_t block_size)
@@ -373,23 +421,31 @@ static void hexify(const uint8_t raw_md5[16], uint8_t hex_md5_out[32])
 
 
 esp_loader_error_t esp_loader_flash_verify(void)
+{
+    uint8_t raw_md5[16] = {0};
+
+    md5_final(raw_md5);
+
+    return esp_loader_flash_verify_known_md5(s_start_address, s_image_size, raw_md5);
+}
+
+
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size,
+                                                     const uint8_t expected_md5[16])
 {
     if (s_target == ESP8266_CHIP) {
         return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
     }
 
-    uint8_t raw_md5[16] = {0};
-
     /* Zero termination and new line character require 2 bytes */
     uint8_t hex_md5[MD5_SIZE + 2] = {0};
     uint8_t received_md5[MD5_SIZE + 2] = {0};
 
-    md5_final(raw_md5);
-    hexify(raw_md5, hex_md5);
+    hexify(expected_md5, hex_md5);
 
-    loader_port_start_timer(timeout_per_mb(s_image_size, MD5_TIMEOUT_PER_MB));
+    loader_port_start_timer(timeout_per_mb(size, MD5_TIMEOUT_PER_MB));
 
-    RETURN_ON_ERROR( loader_md5_cmd(s_start_address, s_image_size, received_md5) );
+    RETURN_ON_ERROR( loader_md5_cmd(address, size, received_md5) );
 
     bool md5_match = memcmp(hex_md5, received_md5, MD5_SIZE) == 0;
 
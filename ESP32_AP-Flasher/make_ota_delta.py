@@ -0,0 +1,42 @@
+# Creates a firmware delta for the OTA update of the AP: make_ota_delta.py old.bin new.bin out.delta
+# The AP only applies it when old.bin is exactly the firmware it is running, otherwise it
+# falls back to downloading the full image. Requires the bsdiff4 package (pip install bsdiff4).
+import hashlib
+import struct
+import sys
+import zlib
+
+import bsdiff4.core
+
+MAGIC = b"OEPLDLT1"
+
+
+def make_delta(old, new):
+    control, diff, extra = bsdiff4.core.diff(old, new)
+    stream = bytearray()
+    diff_pos = 0
+    extra_pos = 0
+    for diff_len, extra_len, seek in control:
+        stream += struct.pack("<IIi", diff_len, extra_len, seek)
+        stream += diff[diff_pos:diff_pos + diff_len]
+        stream += extra[extra_pos:extra_pos + extra_len]
+        diff_pos += diff_len
+        extra_pos += extra_len
+    header = MAGIC + struct.pack("<I", len(old)) + hashlib.md5(old).digest() + struct.pack("<I", len(new))
+    return header + zlib.compress(bytes(stream), 9)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 4:
+        print("usage: make_ota_delta.py old.bin new.bin out.delta")
+        sys.exit(1)
+
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new = f.read()
+
+    delta = make_delta(old, new)
+    with open(sys.argv[3], "wb") as f:
+        f.write(delta)
+    print(f"{sys.argv[3]}: {len(delta)} bytes, full image {len(new)} bytes")
@@ -3,262 +3,317 @@
 
 #include "BLEDevice.h"
 #include "ble_filter.h"
+#include "gici_upload.h"
 #include "newproto.h"
 
-#define INTERVAL_BLE_SCANNING_SECONDS 60
+#define BLE_SCAN_WINDOW_SECONDS 10
 #define INTERVAL_HANDLE_PENDING_SECONDS 10
-#define BUFFER_MAX_SIZE_COMPRESSING 100000
 
-#define BLE_MAIN_STATE_IDLE 0
-#define BLE_MAIN_STATE_PREPARE 1
-#define BLE_MAIN_STATE_CONNECT 2
-#define BLE_MAIN_STATE_UPLOAD 3
+// the bluedroid controller allows 3 connections by default (CONFIG_BTDM_CTRL_BLE_MAX_CONN)
+#define BLE_MAX_UPLOADS 3
+#define BLE_CONNECT_SETTLE_MS 1000
+#define BLE_UPLOAD_TIMEOUT_MS 30000
+#define BLE_DISCONNECT_TIMEOUT_MS 5000
 
-int ble_main_state = BLE_MAIN_STATE_IDLE;
-uint32_t last_ble_scan = 0;
-
-#define BLE_UPLOAD_STATE_INIT 0
-#define BLE_UPLOAD_STATE_SIZE 1
-#define BLE_UPLOAD_STATE_START 2
-#define BLE_UPLOAD_STATE_UPLOAD 5
-int BLE_upload_state = BLE_UPLOAD_STATE_INIT;
-
-bool BLE_connected = false;
-bool BLE_new_notify = false;
+#define BLE_SLOT_IDLE 0
+#define BLE_SLOT_CONNECTING 1  // BLE_connectTask runs, the slot is its own until the result is set
+#define BLE_SLOT_CONNECTED 2
+#define BLE_SLOT_FAILED 3
+#define BLE_SLOT_UPLOADING 4
+#define BLE_SLOT_CLOSING 5  // disconnect() was called, waiting for onDisconnect
 
 static BLEUUID gicServiceUUID((uint16_t)0xfef0);
 static BLEUUID gicCtrlUUID((uint16_t)0xfef1);
 static BLEUUID gicImgUUID((uint16_t)0xfef2);
 
-BLERemoteCharacteristic* ctrlChar;
-BLERemoteCharacteristic* imgChar;
-BLEAdvertisedDevice* myDevice;
-
-BLEClient* pClient;
-
-uint8_t BLE_notify_buffer[255] = {0};
+struct bleUpload {
+    volatile uint8_t state;
+    volatile bool connected;
+    volatile bool newNotify;
+    uint8_t mac[8];
+    // created once per slot and reused, bluedroid keeps reporting events for a client after disconnect()
+    BLEClient* client;
+    BLEClientCallbacks* callbacks;
+    BLERemoteCharacteristic* ctrlChar;
+    BLERemoteCharacteristic* imgChar;
+    uint8_t notifyBuffer[255];
+    giciStream image;
+    uint32_t currPart;
+    uint32_t lastNotify;
+};
 
-uint32_t curr_part = 0;
-uint8_t BLE_buff[255];
+static bleUpload uploads[BLE_MAX_UPLOADS];
+static TaskHandle_t bleTaskHandle = nullptr;
+static SemaphoreHandle_t bleConnectMutex = nullptr;
+static bool bleScanning = false;
+static volatile bool blePendingChanged = true;
 
-uint32_t BLE_last_notify = 0;
-uint32_t BLE_last_pending_check = 0;
-uint8_t BLE_curr_address[8] = {0};
+static void BLE_notifyTask() {
+    if (bleTaskHandle) xTaskNotifyGive(bleTaskHandle);
+}
 
-uint32_t compressed_len = 0;
-uint8_t* buffer;
+void BLE_wakeup() {
+    blePendingChanged = true;
+    BLE_notifyTask();
+}
 
 static void notifyCallback(
     BLERemoteCharacteristic* pBLERemoteCharacteristic,
     uint8_t* pData,
     size_t length,
     bool isNotify) {
-    Serial.print("Notify callback for characteristic ");
-    Serial.print(pBLERemoteCharacteristic->getUUID().toString().c_str());
-    Serial.print(" of data length ");
-    Serial.println(length);
-    Serial.print("data: ");
-    for (int i = 0; i < length; i++) {
-        Serial.printf("%02X", pData[i]);
-        BLE_notify_buffer[1 + i] = pData[i];
+    for (bleUpload& upload : uploads) {
+        if (upload.state == BLE_SLOT_UPLOADING && upload.ctrlChar == pBLERemoteCharacteristic) {
+            if (length > sizeof(upload.notifyBuffer) - 1) length = sizeof(upload.notifyBuffer) - 1;
+            memcpy(&upload.notifyBuffer[1], pData, length);
+            upload.notifyBuffer[0] = length;
+            upload.newNotify = true;
+            BLE_notifyTask();
+            return;
+        }
     }
-    BLE_notify_buffer[0] = length;
-    Serial.println();
-    BLE_new_notify = true;
 }
 
 class MyClientCallback : public BLEClientCallbacks {
+   public:
+    MyClientCallback(bleUpload* upload) : upload(upload) {}
+
     void onConnect(BLEClient* pclient) {
         Serial.println("BLE onConnect");
-        BLE_connected = true;
+        upload->connected = true;
     }
 
     void onDisconnect(BLEClient* pclient) {
         Serial.println("BLE onDisconnect");
-        pclient->disconnect();
-        BLE_connected = false;
-        ble_main_state = BLE_MAIN_STATE_IDLE;
+        upload->connected = false;
+        BLE_notifyTask();
     }
+
+   private:
+    bleUpload* upload;
 };
 
-bool BLE_connect(uint8_t addr[8]) {
+// disconnecting only starts here, the slot is free again once onDisconnect reported it
+static void BLE_endUpload(bleUpload& upload) {
+    compress_image_end(upload.image);
+    upload.ctrlChar = nullptr;
+    upload.imgChar = nullptr;
+    upload.lastNotify = millis();
+    upload.state = BLE_SLOT_CLOSING;
+    if (upload.client && upload.client->isConnected()) upload.client->disconnect();
+}
+
+static bool BLE_connect(bleUpload& upload) {
+    const uint8_t* addr = upload.mac;
     uint8_t temp_Address[] = {addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]};
     Serial.printf("BLE Connecting to: %02X:%02X:%02X:%02X:%02X:%02X\r\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
-    pClient = BLEDevice::createClient();
-    pClient->setClientCallbacks(new MyClientCallback());
-    if (!pClient->connect(BLEAddress(temp_Address))) {
+    if (upload.client == nullptr) {
+        upload.client = BLEDevice::createClient();
+        upload.callbacks = new MyClientCallback(&upload);
+        upload.client->setClientCallbacks(upload.callbacks);
+    }
+    // the controller opens one connection at a time, the other slots keep uploading meanwhile
+    xSemaphoreTake(bleConnectMutex, portMAX_DELAY);
+    const bool opened = upload.client->connect(BLEAddress(temp_Address));
+    xSemaphoreGive(bleConnectMutex);
+    if (!opened) {
         Serial.printf("BLE connection failed\r\n");
-        pClient->disconnect();
         return false;
     }
+    // the tag needs a moment after connecting before it answers service discovery
     uint32_t timeStart = millis();
-    while (millis() - timeStart <= 5000) {// We wait for a few seconds as otherwise the connection might not be ready!
-        delay(100);
+    while (!upload.connected && millis() - timeStart <= 5000) {
+        delay(50);
     }
-    if (!BLE_connected)
+    delay(BLE_CONNECT_SETTLE_MS);
+    if (!upload.connected)
         return false;
     Serial.printf("BLE starting to get service\r\n");
-    BLERemoteService* pRemoteService = pClient->getService(gicServiceUUID);
+    BLERemoteService* pRemoteService = upload.client->getService(gicServiceUUID);
     if (pRemoteService == nullptr) {
         Serial.printf("BLE Service failed\r\n");
-        pClient->disconnect();
         return false;
     }
-    imgChar = pRemoteService->getCharacteristic(gicImgUUID);
-    if (imgChar == nullptr) {
+    upload.imgChar = pRemoteService->getCharacteristic(gicImgUUID);
+    if (upload.imgChar == nullptr) {
         Serial.printf("BLE IMG Char failed\r\n");
-        pClient->disconnect();
         return false;
     }
-    ctrlChar = pRemoteService->getCharacteristic(gicCtrlUUID);
-    if (ctrlChar == nullptr) {
+    upload.ctrlChar = pRemoteService->getCharacteristic(gicCtrlUUID);
+    if (upload.ctrlChar == nullptr) {
         Serial.printf("BLE ctrl Char failed\r\n");
-        pClient->disconnect();
         return false;
     }
-    if (ctrlChar->canNotify()) {
-        ctrlChar->registerForNotify(notifyCallback);
+    if (upload.ctrlChar->canNotify()) {
+        upload.ctrlChar->registerForNotify(notifyCallback);
     } else {
         Serial.printf("BLE Notify failed\r\n");
-        pClient->disconnect();
         return false;
     }
-    if (pClient->setMTU(255) == false) {
+    if (upload.client->setMTU(255) == false) {
         Serial.printf("BLE MTU failed\r\n");
-        pClient->disconnect();
         return false;
     }
     Serial.printf("BLE Connected fully to: %02X:%02X:%02X:%02X:%02X:%02X\r\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
     return true;
 }
 
+// connecting, waiting for the tag and service discovery take seconds, so every slot connects in its own task
+static void BLE_connectTask(void* parameter) {
+    bleUpload* upload = (bleUpload*)parameter;
+    upload->state = BLE_connect(*upload) ? BLE_SLOT_CONNECTED : BLE_SLOT_FAILED;
+    BLE_notifyTask();
+    vTaskDelete(NULL);
+}
+
 class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks {
     void onResult(BLEAdvertisedDevice advertisedDevice) {
         BLE_filter_add_device(advertisedDevice);
     }
 };
 
-void BLE_startScan(uint32_t timeout) {
+static void BLE_scanComplete(BLEScanResults results) {
+    bleScanning = false;
+    BLE_notifyTask();
+}
+
+// scans passively in the background, the gicisky and ATC advertisements carry all we need.
+// every window starts with cleared results, so each tag is reported once per window
+static void BLE_startScan() {
+    if (bleScanning) return;
     BLEScan* pBLEScan = BLEDevice::getScan();
-    pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
     pBLEScan->setInterval(1349);
     pBLEScan->setWindow(449);
-    pBLEScan->setActiveScan(true);
-    pBLEScan->start(timeout, false);
+    pBLEScan->setActiveScan(false);
+    bleScanning = pBLEScan->start(BLE_SCAN_WINDOW_SECONDS, BLE_scanComplete, false);
+}
+
+static void BLE_stopScan() {
+    if (!bleScanning) return;
+    BLEDevice::getScan()->stop();
+    BLEDevice::getScan()->clearResults();
+    bleScanning = false;
+}
+
+static bool BLE_uploadBusy(const uint8_t* mac) {
+    for (const bleUpload& upload : uploads) {
+        if (upload.state != BLE_SLOT_IDLE && memcmp(upload.mac, mac, 8) == 0) return true;
+    }
+    return false;
+}
+
+static void BLE_startUpload(bleUpload& upload) {
+    BLEClient* client = upload.client;
+    BLEClientCallbacks* callbacks = upload.callbacks;
+    memset(&upload, 0, sizeof(upload));
+    upload.client = client;
+    upload.callbacks = callbacks;
+    if (!BLE_is_image_pending(upload.mac, BLE_uploadBusy)) return;
+    Serial.println("BLE Image is pending");
+    // the image is converted part by part while it is uploaded
+    if (!compress_image_begin(upload.mac, upload.image)) return;
+    Serial.printf("BLE Compressed Length: %i\r\n", upload.image.totalLen);
+
+    // then we connect to BLE to send the compressed data
+    upload.state = BLE_SLOT_CONNECTING;
+    BLE_stopScan();
+    if (xTaskCreate(BLE_connectTask, "BLEconnect", 4096, &upload, 2, NULL) != pdPASS) {
+        BLE_endUpload(upload);
+    }
+}
+
+static void BLE_handleUpload(bleUpload& upload) {
+    switch (upload.state) {
+        case BLE_SLOT_CONNECTED:
+            upload.state = BLE_SLOT_UPLOADING;
+            upload.lastNotify = millis();
+            upload.newNotify = true;  // trigger the upload here
+            break;
+        case BLE_SLOT_FAILED:
+            BLE_endUpload(upload);
+            return;
+        case BLE_SLOT_CLOSING:
+            if (!upload.connected || millis() - upload.lastNotify > BLE_DISCONNECT_TIMEOUT_MS) upload.state = BLE_SLOT_IDLE;
+            return;
+        case BLE_SLOT_UPLOADING:
+            break;
+        default:
+            return;
+    }
+    if (!upload.connected) {
+        Serial.println("BLE connection lost");
+        BLE_endUpload(upload);
+        return;
+    }
+    if (!upload.newNotify) {
+        if (millis() - upload.lastNotify > BLE_UPLOAD_TIMEOUT_MS) {  // Something odd, better reset connection!
+            Serial.println("BLE err going back to IDLE");
+            BLE_endUpload(upload);
+        }
+        return;
+    }
+    upload.newNotify = false;
+    upload.lastNotify = millis();
+
+    uint8_t BLE_buff[GICI_PART_SIZE + 4];
+    uint32_t len;
+    switch (gici_upload_answer(upload.image, upload.currPart, upload.notifyBuffer, BLE_buff, len)) {
+        case GICI_WRITE_CTRL:
+            upload.ctrlChar->writeValue(BLE_buff, len);
+            break;
+        case GICI_WRITE_IMG:
+            // the tag asks for every part, so it sets the pace of the upload
+            upload.imgChar->writeValue(BLE_buff, len, false);
+            break;
+        case GICI_UPLOAD_DONE: {
+            BLE_endUpload(upload);
+            // Done and the image is refreshing now
+            struct espXferComplete reportStruct;
+            memcpy((uint8_t*)&reportStruct.src, upload.mac, 8);
+            processXferComplete(&reportStruct, true);
+            break;
+        }
+        case GICI_UPLOAD_ABORT:
+            Serial.printf("Something went wrong, expected req part: %i but got: %i we better abort here.\r\n", upload.currPart, gici_requested_part(upload.notifyBuffer));
+            BLE_endUpload(upload);
+            break;
+    }
 }
 
 void BLETask(void* parameter) {
     vTaskDelay(5000 / portTICK_PERIOD_MS);
     Serial.println("BLE task started");
+    bleTaskHandle = xTaskGetCurrentTaskHandle();
+    bleConnectMutex = xSemaphoreCreateMutex();
     BLEDevice::init("");
+    BLEDevice::getScan()->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
+    uint32_t lastPendingCheck = 0;
     while (1) {
-        switch (ble_main_state) {
-            default:
-            case BLE_MAIN_STATE_IDLE:
-                if (millis() - last_ble_scan > (INTERVAL_BLE_SCANNING_SECONDS * 1000)) {
-                    last_ble_scan = millis();
-                    Serial.println("Doing the BLE Scan");
-                    BLE_startScan(10);  // timeout in seconds, this is blocking but only for this thread!
-                }
-                if (millis() - BLE_last_pending_check >= (INTERVAL_HANDLE_PENDING_SECONDS * 1000)) {
-                    if (BLE_is_image_pending(BLE_curr_address)) {
-                        delay(4000);  // We better wait here, since the pending image needs to be created first
-                        Serial.println("BLE Image is pending");
-                        // Here we create the compressed buffer
-                        buffer = (uint8_t*)malloc(BUFFER_MAX_SIZE_COMPRESSING);
-                        if (buffer == nullptr) {
-                            Serial.println("BLE Could not create buffer!");
-                            compressed_len = 0;
-                        } else {
-                            compressed_len = compress_image(BLE_curr_address, buffer, BUFFER_MAX_SIZE_COMPRESSING);
-                            Serial.printf("BLE Compressed Length: %i\r\n", compressed_len);
-                            // then we connect to BLE to send the compressed data
-                            if (compressed_len && BLE_connect(BLE_curr_address)) {
-                                curr_part = 0;
-                                memset(BLE_notify_buffer, 0x00, sizeof(BLE_notify_buffer));
-                                BLE_upload_state = BLE_UPLOAD_STATE_INIT;
-                                ble_main_state = BLE_MAIN_STATE_UPLOAD;
-                                BLE_new_notify = true;  // trigger the upload here
-                            } else {
-                                free(buffer);
-                            }
-                        }
-                        BLE_last_pending_check = millis();
-                    }
-                }
-                break;
-            case BLE_MAIN_STATE_UPLOAD: {
-                if (BLE_connected && BLE_new_notify) {
-                    BLE_new_notify = false;
-                    BLE_last_notify = millis();
-                    BLE_upload_state = BLE_notify_buffer[1];
+        uint8_t activeUploads = 0;
+        for (bleUpload& upload : uploads) {
+            if (upload.state != BLE_SLOT_IDLE) {
+                BLE_handleUpload(upload);
+                if (upload.state != BLE_SLOT_IDLE) activeUploads++;
+            }
+        }
 
-                    switch (BLE_upload_state) {
-                        default:
-                        case BLE_UPLOAD_STATE_INIT:
-                            BLE_buff[0] = 1;
-                            ctrlChar->writeValue(BLE_buff, 1);
-                            break;
-                        case BLE_UPLOAD_STATE_SIZE:
-                            BLE_buff[0] = 0x02;
-                            BLE_buff[1] = compressed_len & 0xff;
-                            BLE_buff[2] = (compressed_len >> 8) & 0xff;
-                            BLE_buff[3] = (compressed_len >> 16) & 0xff;
-                            BLE_buff[4] = (compressed_len >> 24) & 0xff;
-                            BLE_buff[5] = 0x00;
-                            ctrlChar->writeValue(BLE_buff, 6);
-                            break;
-                        case BLE_UPLOAD_STATE_START:
-                            BLE_buff[0] = 0x03;
-                            ctrlChar->writeValue(BLE_buff, 1);
-                            break;
-                        case BLE_UPLOAD_STATE_UPLOAD:
-                            if (BLE_notify_buffer[2] == 0x08) {
-                                free(buffer);
-                                pClient->disconnect();
-                                ble_main_state = BLE_MAIN_STATE_IDLE;
-                                BLE_last_pending_check = millis();
-                                // Done and the image is refreshing now
-                                struct espXferComplete reportStruct;
-                                memcpy((uint8_t*)&reportStruct.src, BLE_curr_address, 8);
-                                processXferComplete(&reportStruct, true);
-                                curr_part = 0;
-                            } else {
-                                uint32_t req_curr_part = (BLE_notify_buffer[6] << 24) | (BLE_notify_buffer[5] << 24) | (BLE_notify_buffer[4] << 24) | BLE_notify_buffer[3];
-                                if (req_curr_part != curr_part) {
-                                    Serial.printf("Something went wrong, expected req part: %i but got: %i we better abort here.\r\n", req_curr_part, curr_part);
-                                    free(buffer);
-                                    pClient->disconnect();
-                                    ble_main_state = BLE_MAIN_STATE_IDLE;
-                                    BLE_last_pending_check = millis();
-                                }
-                                uint32_t curr_len = 240;
-                                if (compressed_len - (curr_part * 240) < 240)
-                                    curr_len = compressed_len - (curr_part * 240);
-                                BLE_buff[0] = curr_part & 0xff;
-                                BLE_buff[1] = (curr_part >> 8) & 0xff;
-                                BLE_buff[2] = (curr_part >> 16) & 0xff;
-                                BLE_buff[3] = (curr_part >> 24) & 0xff;
-                                memcpy((uint8_t*)&BLE_buff[4], (uint8_t*)&buffer[curr_part * 240], curr_len);
-                                imgChar->writeValue(BLE_buff, curr_len + 4);
-                                Serial.printf("BLE sending part: %i\r\n", curr_part);
-                                curr_part++;
-                            }
-                            break;
-                    }
-                } else {
-                    if (millis() - BLE_last_notify > 30000) {  // Something odd, better reset connection!
-                        Serial.println("BLE err going back to IDLE");
-                        free(buffer);
-                        pClient->disconnect();
-                        ble_main_state = BLE_MAIN_STATE_IDLE;
-                        BLE_last_pending_check = millis();
-                    }
+        // new pending images wake the task, the interval is only a fallback
+        if (blePendingChanged || millis() - lastPendingCheck >= (INTERVAL_HANDLE_PENDING_SECONDS * 1000)) {
+            blePendingChanged = false;
+            lastPendingCheck = millis();
+            for (bleUpload& upload : uploads) {
+                if (upload.state == BLE_SLOT_IDLE) {
+                    BLE_startUpload(upload);
+                    if (upload.state == BLE_SLOT_IDLE) break;
+                    activeUploads++;
                 }
-                break;
             }
         }
-        vTaskDelay(15 / portTICK_PERIOD_MS);
+
+        // no scanning while connections are open, connecting fails often while the radio scans
+        if (activeUploads == 0) BLE_startScan();
+
+        ulTaskNotifyTake(pdTRUE, activeUploads ? 100 / portTICK_PERIOD_MS : 1000 / portTICK_PERIOD_MS);
     }
 }
 
@@ -23,11 +23,15 @@
 #endif
 #include <time.h>
 
+#include <functional>
 #include <map>
+#include <vector>
 
 #include "commstructs.h"
 #include "makeimage.h"
+#include "metrics.h"
 #include "newproto.h"
+#include "renderqueue.h"
 #include "storage.h"
 #ifdef CONTENT_QR
 #include "QRCodeGenerator.h"
@@ -36,6 +40,7 @@
 #include "settings.h"
 #include "system.h"
 #include "tag_db.h"
+#include "textwrap.h"
 #include "truetype.h"
 #include "util.h"
 #include "web.h"
@@ -48,19 +53,129 @@ bool needRedraw(uint8_t contentMode, uint8_t wakeupReason) {
     return false;
 }
 
+#define PRESTAGE_LEAD 15
+
+// A render works on a private copy of the tag record. Everything that touches the live tagDB or
+// the pending queue is collected while rendering and done by loop() afterwards, together with
+// copying the results back, so the worker never holds a record that the web or sync may delete.
+struct renderWork {
+    tagRecord tag;
+    uint32_t queued;
+    bool rendered;
+    // live values at queue time, to notice a config that was saved while rendering
+    uint8_t contentMode;
+    String modeConfigJson;
+    uint8_t wakeupReason;
+    std::vector<std::function<void()>> actions;
+};
+
+static QueueHandle_t renderQueue = nullptr;
+static QueueHandle_t renderDoneQueue = nullptr;
+static renderWork *currentRender = nullptr;
+
+// drawNew runs on the render worker only, this hands an action on the live tagDB to loop()
+static void runOnLoop(std::function<void()> action) {
+    currentRender->actions.push_back(action);
+}
+
+// Renders run in their own task, so a slow fetch or a big template doesn't hold up loop().
+// There is one worker: the sprite, the jpg decoder and the font renderer are shared globals.
+static void renderTask(void *parameter) {
+    renderWork *work;
+    while (true) {
+        if (xQueueReceive(renderQueue, &work, portMAX_DELAY) != pdTRUE) continue;
+        metricObserve(METRIC_RENDER_WAIT_MS, millis() - work->queued);
+        if (config.runStatus == RUNSTATUS_RUN) {
+            const uint32_t t = millis();
+            tagRecord *taginfo = &work->tag;
+            currentRender = work;
+            drawNew(taginfo->mac, taginfo);
+            currentRender = nullptr;
+            work->rendered = true;
+            metricInc(METRIC_RENDERS);
+            metricObserve(METRIC_RENDER_MS, millis() - t);
+        }
+        xQueueSend(renderDoneQueue, &work, portMAX_DELAY);
+    }
+}
+
+void initRenderWorker() {
+    renderQueue = xQueueCreate(RENDER_QUEUE_LEN, sizeof(renderWork *));
+    // one more than the job queue, for the job the worker is on
+    renderDoneQueue = xQueueCreate(RENDER_QUEUE_LEN + 1, sizeof(renderWork *));
+#if CONFIG_FREERTOS_UNICORE
+    xTaskCreate(renderTask, "render", 16 * 1024, NULL, 2, NULL);
+#else
+    // the other core than loop(), the radio and web tasks keep their core free of rendering
+    xTaskCreatePinnedToCore(renderTask, "render", 16 * 1024, NULL, 2, NULL, ARDUINO_RUNNING_CORE ? 0 : 1);
+#endif
+}
+
+static bool queueRender(tagRecord *taginfo, const bool urgent) {
+    renderWork *work = new renderWork;
+    work->tag = *taginfo;
+    work->tag.data = nullptr;
+    work->queued = millis();
+    work->rendered = false;
+    work->contentMode = taginfo->contentMode;
+    work->modeConfigJson = taginfo->modeConfigJson;
+    work->wakeupReason = taginfo->wakeupReason;
+    const BaseType_t result = urgent ? xQueueSendToFront(renderQueue, &work, 0) : xQueueSendToBack(renderQueue, &work, 0);
+    if (result != pdTRUE) {
+        // queue full, the next pass tries again
+        delete work;
+        return false;
+    }
+    taginfo->renderQueued = true;
+    return true;
+}
+
+// copies finished renders back into the tagDB, on the loop task
+static void finishRenders() {
+    renderWork *work;
+    while (xQueueReceive(renderDoneQueue, &work, 0) == pdTRUE) {
+        tagRecord *taginfo = tagRecord::findByMAC(work->tag.mac);
+        if (taginfo != nullptr) {
+            if (work->rendered) {
+                if (taginfo->contentMode == work->contentMode && taginfo->modeConfigJson == work->modeConfigJson) {
+                    taginfo->contentMode = work->tag.contentMode;
+                    taginfo->modeConfigJson = work->tag.modeConfigJson;
+                    taginfo->nextupdate = work->tag.nextupdate;
+                }
+                taginfo->lastfullupdate = work->tag.lastfullupdate;
+                if (work->tag.hasCustomLUT) taginfo->hasCustomLUT = true;
+                if (taginfo->wakeupReason == work->wakeupReason) taginfo->wakeupReason = 0;
+                for (const std::function<void()> &action : work->actions) action();
+            }
+            taginfo->renderQueued = false;
+        }
+        delete work;
+    }
+}
+
 void contentRunner() {
+    if (renderQueue == nullptr) return;
+    finishRenders();
     if (config.runStatus == RUNSTATUS_STOP) return;
 
     time_t now;
     time(&now);
+    uint8_t renders = 0;
+    urgentRenders urgent;
+    const bool rendering = config.runStatus == RUNSTATUS_RUN && Storage.freeSpace() > 31000 && !util::isSleeping(config.sleepTime1, config.sleepTime2);
 
     for (tagRecord *taginfo : tagDB) {
-        if (taginfo->RSSI &&
-            (now >= taginfo->nextupdate || needRedraw(taginfo->contentMode, taginfo->wakeupReason)) &&
-            config.runStatus == RUNSTATUS_RUN &&
-            Storage.freeSpace() > 31000 && !util::isSleeping(config.sleepTime1, config.sleepTime2)) {
-            drawNew(taginfo->mac, taginfo);
-            taginfo->wakeupReason = 0;
+        const uint32_t predictedCheckin = predictNextCheckin(taginfo);
+        const bool redraw = needRedraw(taginfo->contentMode, taginfo->wakeupReason);
+        const renderChoice choice = taginfo->RSSI && rendering ? chooseRender(now, taginfo->nextupdate, predictedCheckin, redraw, taginfo->renderQueued, renders, uxQueueMessagesWaiting(renderQueue)) : RENDER_SKIP;
+        if (choice == RENDER_FRONT) {
+            urgent.add(redraw ? now : predictedCheckin, taginfo->mac);
+        } else if (choice == RENDER_BACK && queueRender(taginfo, false)) {
+            renders++;
+        }
+
+        if (taginfo->pendingCount && !taginfo->isExternal && predictedCheckin > now && predictedCheckin <= now + PRESTAGE_LEAD) {
+            prestageBlocks(taginfo);
         }
 
         if (taginfo->expectedNextCheckin > now - 10 && taginfo->expectedNextCheckin < now + 30 && taginfo->pendingIdle == 0 && taginfo->pendingCount == 0) {
@@ -89,6 +204,12 @@ void contentRunner() {
 
         vTaskDelay(1 / portTICK_PERIOD_MS);  // add a small delay to allow other threads to run
     }
+
+    urgent.sort();
+    for (const auto &job : urgent) {
+        tagRecord *taginfo = tagRecord::findByMAC(job.mac);
+        if (taginfo != nullptr) queueRender(taginfo, true);
+    }
 }
 
 void checkVars() {
@@ -297,13 +418,19 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
                     arg.lut = imageParams.lut & 0x03;
                 }
 
-                if (prepareDataAvail(filename, imageParams.dataType, *((uint8_t *)&arg), mac, cfgobj["timetolive"].as<int>())) {
-                    if (cfgobj["delete"].as<String>() == "1") {
-                        contentFS->remove("/" + configFilename);
+                const uint8_t dataType = imageParams.dataType;
+                const uint8_t dataTypeArgument = *((uint8_t *)&arg);
+                const uint16_t timetolive = cfgobj["timetolive"].as<int>();
+                const bool deleteConfig = cfgobj["delete"].as<String>() == "1";
+                runOnLoop([=]() mutable {
+                    if (prepareDataAvail(filename, dataType, dataTypeArgument, mac, timetolive)) {
+                        if (deleteConfig) {
+                            contentFS->remove("/" + configFilename);
+                        }
+                    } else {
+                        wsErr("Error accessing " + filename);
                     }
-                } else {
-                    wsErr("Error accessing " + filename);
-                }
+                });
             } else {
                 // configfilename is empty. Probably the tag needs to redisplay the image after a reboot.
                 Serial.println("Resend static image");
@@ -359,9 +486,11 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
                         cfgobj["#fetched"] = true;
                     } else {
                         file.close();
-                        if (prepareDataAvail(filename, DATATYPE_FW_UPDATE, 0, mac, cfgobj["timetolive"].as<int>())) {
-                            cfgobj["#fetched"] = true;
-                        }
+                        const uint16_t timetolive = cfgobj["timetolive"].as<int>();
+                        runOnLoop([=]() mutable {
+                            prepareDataAvail(filename, DATATYPE_FW_UPDATE, 0, mac, timetolive);
+                        });
+                        cfgobj["#fetched"] = true;
                     }
                 }
                 taginfo->nextupdate = 3216153600;
@@ -428,20 +557,36 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
 
             sprintf(buffer, "%-4.4s%-2.2s%-4.4s", cfgobj["line1"].as<const char *>(), cfgobj["line2"].as<const char *>(), cfgobj["line3"].as<const char *>());
             taginfo->nextupdate = 3216153600;
-            sendAPSegmentedData(mac, (String)buffer, 0x0000, false, (taginfo->isExternal == false));
+            {
+                const String segments = buffer;
+                const bool local = taginfo->isExternal == false;
+                runOnLoop([=]() {
+                    sendAPSegmentedData(mac, segments, 0x0000, false, local);
+                });
+            }
             break;
 
 #ifdef CONTENT_NFCLUT
         case 14:  // NFC URL
 
             taginfo->nextupdate = 3216153600;
-            prepareNFCReq(mac, cfgobj["url"].as<const char *>());
+            {
+                const String url = cfgobj["url"].as<String>();
+                runOnLoop([=]() {
+                    prepareNFCReq(mac, url.c_str());
+                });
+            }
             break;
 
         case 15:  // send gray LUT
 
             taginfo->nextupdate = 3216153600;
-            prepareLUTreq(mac, cfgobj["bytes"]);
+            {
+                const String bytes = cfgobj["bytes"].as<String>();
+                runOnLoop([=]() {
+                    prepareLUTreq(mac, bytes);
+                });
+            }
             taginfo->hasCustomLUT = true;
             break;
 #endif
@@ -459,7 +604,11 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
 
         case 17:  // tag command
         {
-            sendTagCommand(mac, cfgobj["cmd"].as<int>(), (taginfo->isExternal == false));
+            const int cmd = cfgobj["cmd"].as<int>();
+            const bool local = taginfo->isExternal == false;
+            runOnLoop([=]() {
+                sendTagCommand(mac, cmd, local);
+            });
             taginfo->nextupdate = 3216153600;
             break;
         }
@@ -467,7 +616,11 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
 #ifdef CONTENT_TAGCFG
         case 18:  // tag config
         {
-            prepareConfigFile(mac, cfgobj);
+            DynamicJsonDocument tagConfig(500);
+            tagConfig.set(cfgobj);
+            runOnLoop([=]() mutable {
+                prepareConfigFile(mac, tagConfig.as<JsonObject>());
+            });
             taginfo->nextupdate = 3216153600;
             break;
         }
@@ -551,7 +704,13 @@ void drawNew(const uint8_t mac[8], tagRecord *&taginfo) {
 
 bool updateTagImage(String &filename, const uint8_t *dst, uint16_t nextCheckin, tagRecord *&taginfo, imgParam &imageParams) {
     if (taginfo->hwType == SOLUM_SEG_UK) {
-        sendAPSegmentedData(dst, (String)imageParams.segments, imageParams.symbols, (imageParams.invert == 1), (taginfo->isExternal == false));
+        const String segments = imageParams.segments;
+        const uint16_t symbols = imageParams.symbols;
+        const bool inverted = imageParams.invert == 1;
+        const bool local = taginfo->isExternal == false;
+        runOnLoop([=]() {
+            sendAPSegmentedData(dst, segments, symbols, inverted, local);
+        });
     } else {
         if (imageParams.hasRed && imageParams.lut == EPD_LUT_NO_REPEATS && imageParams.shortlut == SHORTLUT_ONLY_BLACK) {
             imageParams.lut = EPD_LUT_DEFAULT;
@@ -565,7 +724,11 @@ bool updateTagImage(String &filename, const uint8_t *dst, uint16_t nextCheckin,
             Serial.println("datatype: DATATYPE_IMG_RAW_2BPP");
         }
         if (nextCheckin > 0x7fff) nextCheckin = 0;
-        prepareDataAvail(filename, imageParams.dataType, imageParams.lut, dst, nextCheckin);
+        const uint8_t dataType = imageParams.dataType;
+        const uint8_t lut = imageParams.lut;
+        runOnLoop([=]() mutable {
+            prepareDataAvail(filename, dataType, lut, dst, nextCheckin);
+        });
     }
     return true;
 }
@@ -676,7 +839,23 @@ void drawString(TFT_eSprite &spr, String content, int16_t posx, int16_t posy, St
     }
 }
 
-void drawTextBox(TFT_eSprite &spr, String &content, int16_t &posx, int16_t &posy, int16_t boxwidth, int16_t boxheight, String font, uint16_t color, uint16_t bgcolor, float lineheight) {
+// Same per-glyph numbers TFT_eSPI::textWidth() adds up, without re-measuring the whole string
+static glyphMetric getGlyphMetric(TFT_eSprite &spr, uint16_t unicode) {
+    if (!spr.fontLoaded) {
+        const char buf[2] = {static_cast<char>(unicode), 0};
+        const int16_t width = spr.textWidth(buf);
+        return {width, width, 0};
+    }
+    if (unicode == ' ') return {static_cast<int16_t>(spr.gFont.spaceWidth), static_cast<int16_t>(spr.gFont.spaceWidth), 0};
+    uint16_t gNum = 0;
+    if (spr.getUnicodeIndex(unicode, &gNum)) {
+        return {spr.gxAdvance[gNum], static_cast<int16_t>(spr.gdX[gNum] + spr.gWidth[gNum]), static_cast<int16_t>(spr.gdX[gNum] < 0 ? -spr.gdX[gNum] : 0)};
+    }
+    const int16_t width = spr.gFont.spaceWidth + 1;
+    return {width, width, 0};
+}
+
+void drawTextBox(TFT_eSprite &spr, String &content, int16_t &posx, int16_t &posy, int16_t boxwidth, int16_t boxheight, String font, uint16_t color, uint16_t bgcolor, float lineheight, byte align, bool ellipsis) {
     replaceVariables(content);
     switch (processFontPath(font)) {
         case 2: {
@@ -691,29 +870,26 @@ void drawTextBox(TFT_eSprite &spr, String &content, int16_t &posx, int16_t &posy
             spr.setTextWrap(false, false);
             spr.setTextColor(color, bgcolor);
 
-            int length = content.length();
-            int startPos = 0;
-            int startPosY = posy;
+            TextWrapper wrapper(reinterpret_cast<const uint8_t *>(content.c_str()), content.length(), boxwidth, [&spr](uint16_t unicode) { return getGlyphMetric(spr, unicode); });
+            const int16_t startPosY = posy;
 
-            while (startPos < length && posy + spr.gFont.yAdvance <= startPosY + boxheight) {
-                int endPos = startPos;
-                bool hasspace = false;
+            while (!wrapper.done() && posy + spr.gFont.yAdvance <= startPosY + boxheight) {
+                const bool lastLine = ellipsis && static_cast<int16_t>(posy + spr.gFont.yAdvance * lineheight) + spr.gFont.yAdvance > startPosY + boxheight;
+                const textLine wrapped = wrapper.next(lastLine);
 
-                while (endPos < length && spr.textWidth(content.substring(startPos, endPos + 1).c_str()) <= boxwidth && content.charAt(endPos) != '\n') {
-                    if (content.charAt(endPos) == ' ' || content.charAt(endPos) == '-') hasspace = true;
-                    endPos++;
-                }
-                while (endPos < length && endPos > startPos && hasspace == true && content.charAt(endPos - 1) != ' ' && content.charAt(endPos - 1) != '-' && content.charAt(endPos) != '\n') {
-                    endPos--;
+                String line = content.substring(wrapped.start, wrapped.end);
+                if (wrapped.ellipsis) {
+                    line.trim();
+                    line += "...";
                 }
-                spr.drawString(content.substring(startPos, endPos), posx, posy);
-                posy += spr.gFont.yAdvance * lineheight;
+                if (wrapped.hyphenate) line += "-";
+                line.replace("\xC2\xAD", "");
 
-                if (content.charAt(endPos) == '\n') endPos++;
-                startPos = endPos;
-                while (startPos < length && content.charAt(startPos) == ' ') {
-                    startPos++;
-                }
+                int16_t linex = posx;
+                if (align == TC_DATUM) linex += (boxwidth - wrapped.width) / 2;
+                if (align == TR_DATUM) linex += boxwidth - wrapped.width;
+                spr.drawString(line, linex, posy);
+                posy += spr.gFont.yAdvance * lineheight;
             }
             if (font != "") spr.unloadFont();
         }
@@ -1030,7 +1206,7 @@ int getImgURL(String &filename, String URL, time_t fetched, imgParam &imageParam
     http.setTimeout(5000);  // timeout in ms
     const int httpCode = http.GET();
     if (httpCode == 200) {
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        takeFsMutex();
         File f = contentFS->open("/temp/temp.jpg", "w");
         if (f) {
             http.writeToStream(&f);
@@ -1781,7 +1957,12 @@ void drawTimestamp(String &filename, JsonObject &cfgobj, tagRecord *&taginfo, im
         arg.specialType = 17;  // button 2
         arg.lut = 0;
 
-        prepareDataAvail(filename2, imageParams.dataType, *((uint8_t *)&arg), taginfo->mac, 5 | 0x8000 );
+        const uint8_t *mac = taginfo->mac;
+        const uint8_t dataType = imageParams.dataType;
+        uint8_t dataTypeArgument = *((uint8_t *)&arg);
+        runOnLoop([=]() mutable {
+            prepareDataAvail(filename2, dataType, dataTypeArgument, mac, 5 | 0x8000);
+        });
 
         spr.fillRect(0, 0, spr.width(), spr.height(), TFT_WHITE);
 
@@ -1793,7 +1974,10 @@ void drawTimestamp(String &filename, JsonObject &cfgobj, tagRecord *&taginfo, im
         arg.preloadImage = 1;
         arg.specialType = 16;  // button 1
         arg.lut = 0;
-        prepareDataAvail(filename2, imageParams.dataType, *((uint8_t *)&arg), taginfo->mac, 5 | 0x8000 );
+        dataTypeArgument = *((uint8_t *)&arg);
+        runOnLoop([=]() mutable {
+            prepareDataAvail(filename2, dataType, dataTypeArgument, mac, 5 | 0x8000);
+        });
 
         cfgobj["#init"] = "1";
     }
@@ -2151,7 +2335,9 @@ void drawElement(const JsonObject &element, TFT_eSprite &spr, imgParam &imagePar
         int16_t posx = textArray[0] | 0;
         int16_t posy = textArray[1] | 0;
         String text = textArray[4];
-        drawTextBox(spr, text, posx, posy, textArray[2], textArray[3], textArray[5], getColor(textArray[6]), TFT_WHITE, lineheight);
+        const byte align = textArray[8] | 0;
+        const bool ellipsis = textArray[9] | 0;
+        drawTextBox(spr, text, posx, posy, textArray[2], textArray[3], textArray[5], getColor(textArray[6]), TFT_WHITE, lineheight, align, ellipsis);
     } else if (element.containsKey("box")) {
         const JsonArray &boxArray = element["box"];
         spr.fillRect(boxArray[0].as<int>(), boxArray[1].as<int>(), boxArray[2].as<int>(), boxArray[3].as<int>(), getColor(boxArray[4]));
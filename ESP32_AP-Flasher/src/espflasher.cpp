@@ -2,14 +2,20 @@
 #include <ArduinoJson.h>
 #include <FS.h>
 #include <HTTPClient.h>
+#include <MD5Builder.h>
 #include <esp_loader.h>
 
 #include "esp32_port.h"
 #include "esp_littlefs.h"
+#include "miniz-oepl.h"
 #include "storage.h"
 #include "tag_db.h"
 #include "web.h"
 
+// the C6 ROM loader takes 1024 byte data packets; higher rates don't work reliably over the flasher wiring
+#define C6_FLASH_BLOCK_SIZE 1024
+#define C6_FLASH_BAUD 460800
+
 esp_loader_error_t connect_to_target(uint32_t higher_transmission_rate) {
     esp_loader_connect_args_t connect_config = ESP_LOADER_CONNECT_DEFAULT();
     esp_loader_error_t err = esp_loader_connect(&connect_config);
@@ -25,8 +31,8 @@ esp_loader_error_t connect_to_target(uint32_t higher_transmission_rate) {
             printf("ESP8266 does not support change transmission rate command.");
             return err;
         } else if (err != ESP_LOADER_SUCCESS) {
+            // target stays at the initial rate, flashing still works, just slower
             printf("Unable to change transmission rate on target.");
-            return err;
         } else {
             err = loader_port_change_transmission_rate(higher_transmission_rate);
             if (err != ESP_LOADER_SUCCESS) {
@@ -42,6 +48,49 @@ esp_loader_error_t connect_to_target(uint32_t higher_transmission_rate) {
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+// Deflates the whole image into PSRAM before the transfer starts, so sending only waits for the loader and
+// every 1024 byte packet carries more than 1024 bytes of firmware. Returns nullptr if it doesn't fit.
+uint8_t *deflate_file(File &file, size_t size, size_t &compressed_size, uint8_t md5[16]) {
+    static uint8_t inbuf[1024];
+    size_t outsize = size + size / 8 + 1024;
+    uint8_t *out = (uint8_t *)ps_malloc(outsize);
+    Miniz::tdefl_compressor *comp = (Miniz::tdefl_compressor *)malloc(sizeof(Miniz::tdefl_compressor));
+    if (out == nullptr || comp == nullptr || Miniz::tdefl_initOEPL(comp, NULL, NULL, Miniz::TDEFL_WRITE_ZLIB_HEADER | Miniz::TDEFL_DEFAULT_MAX_PROBES) != Miniz::TDEFL_STATUS_OKAY) {
+        if (out != nullptr) free(out);
+        if (comp != nullptr) free(comp);
+        return nullptr;
+    }
+
+    MD5Builder md5builder;
+    md5builder.begin();
+    size_t sizeleft = size;
+    compressed_size = 0;
+    uint32_t t = millis();
+    while (true) {
+        size_t to_read = MIN(sizeleft, sizeof(inbuf));
+        if (file.read(inbuf, to_read) != to_read) break;
+        md5builder.add(inbuf, to_read);
+        sizeleft -= to_read;
+
+        size_t inbytes = to_read;
+        size_t outbytes = outsize - compressed_size;
+        Miniz::tdefl_status status = Miniz::tdefl_compressOEPL(comp, inbuf, &inbytes, out + compressed_size, &outbytes, sizeleft ? Miniz::TDEFL_NO_FLUSH : Miniz::TDEFL_FINISH);
+        compressed_size += outbytes;
+        if (status == Miniz::TDEFL_STATUS_DONE) {
+            free(comp);
+            md5builder.calculate();
+            md5builder.getBytes(md5);
+            Serial.printf("deflated %d into %d bytes in %d ms\n", size, compressed_size, millis() - t);
+            return out;
+        }
+        // out of output space, or a compressor error
+        if (status != Miniz::TDEFL_STATUS_OKAY || inbytes != to_read || sizeleft == 0) break;
+    }
+    free(comp);
+    free(out);
+    return nullptr;
+}
+
 esp_loader_error_t flash_binary(String &file_path, size_t address) {
     esp_loader_error_t err;
 
@@ -54,43 +103,63 @@ esp_loader_error_t flash_binary(String &file_path, size_t address) {
     }
 
     size_t size = file.size();
-    static uint8_t payload[1024];
+    static uint8_t payload[C6_FLASH_BLOCK_SIZE];
     Serial.println("file size: " + String(size));
 
+    size_t compressed_size = 0;
+    uint8_t md5[16];
+    uint8_t *compressed = deflate_file(file, size, compressed_size, md5);
+    if (compressed == nullptr) {
+        wsSerial("Compression failed, sending uncompressed");
+        file.seek(0);
+    }
+
     printf("Erasing flash (this may take a while)...\n");
-    err = esp_loader_flash_start(address, size, sizeof(payload));
+    if (compressed) {
+        err = esp_loader_flash_defl_start(address, size, compressed_size, C6_FLASH_BLOCK_SIZE);
+    } else {
+        err = esp_loader_flash_start(address, size, sizeof(payload));
+    }
     if (err != ESP_LOADER_SUCCESS) {
         wsSerial("Erasing flash failed");
+        if (compressed) free(compressed);
         file.close();
         return err;
     }
     printf("Start programming\n");
 
+    // progress is counted in bytes sent, compressed or not
+    size_t total = compressed ? compressed_size : size;
     size_t written = 0;
-    size_t sizeleft = size;
+    size_t sizeleft = total;
     uint32_t t = millis();
+    uint32_t start = t;
     while (sizeleft > 0) {
-        size_t to_read = MIN(sizeleft, sizeof(payload));
-        size_t bytes_read = file.readBytes(reinterpret_cast<char *>(payload), to_read);
+        size_t to_write = MIN(sizeleft, sizeof(payload));
 
-        if (bytes_read != to_read) {
-            wsSerial("Failed to read file.");
-            file.close();
-            return ESP_LOADER_ERROR_FAIL;
+        if (compressed) {
+            err = esp_loader_flash_defl_write(compressed + written, to_write);
+        } else {
+            size_t bytes_read = file.readBytes(reinterpret_cast<char *>(payload), to_write);
+            if (bytes_read != to_write) {
+                wsSerial("Failed to read file.");
+                file.close();
+                return ESP_LOADER_ERROR_FAIL;
+            }
+            err = esp_loader_flash_write(payload, to_write);
         }
-
-        err = esp_loader_flash_write(payload, to_read);
         if (err != ESP_LOADER_SUCCESS) {
             wsSerial("Packet could not be written!");
+            if (compressed) free(compressed);
             file.close();
             return err;
         }
 
-        sizeleft -= to_read;
-        written += to_read;
+        sizeleft -= to_write;
+        written += to_write;
 
         if (millis() - t > 250) {
-            uint32_t progress = written * 100 / size;
+            uint32_t progress = written * 100 / total;
             // printf("\rProgress: %d%%", progress);
             wsSerial("Progress: " + String(progress) + "%");
             fflush(stdout);
@@ -98,12 +167,18 @@ esp_loader_error_t flash_binary(String &file_path, size_t address) {
         }
     };
     wsSerial("Progress: 100%");
+    Serial.printf("Sent %d bytes in %d ms\n", total, millis() - start);
 
     file.close();
+    if (compressed) free(compressed);
     printf("\nFinished programming\n");
 
 #if MD5_ENABLED
-    err = esp_loader_flash_verify();
+    if (compressed) {
+        err = esp_loader_flash_verify_known_md5(address, size, md5);
+    } else {
+        err = esp_loader_flash_verify();
+    }
     if (err == ESP_LOADER_ERROR_UNSUPPORTED_FUNC) {
         printf("ESP8266 does not support flash verify command.");
         return err;
@@ -128,7 +203,7 @@ bool downloadAndWriteBinary(String &filename, const char *url) {
     if (binaryResponseCode == HTTP_CODE_OK) {
         int contentLength = binaryHttp.getSize();
         Serial.println(contentLength);
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        takeFsMutex();
         File file = contentFS->open(filename, "wb");
         if (file) {
             wsSerial("downloading " + String(filename));
@@ -229,7 +304,7 @@ bool doC6flash(uint8_t doDownload) {
         return false;
     }
 
-    if (connect_to_target(115200) == ESP_LOADER_SUCCESS) {
+    if (connect_to_target(C6_FLASH_BAUD) == ESP_LOADER_SUCCESS) {
         if (esp_loader_get_target() == ESP32C6_CHIP) {
             wsSerial("Connected to ESP32-C6");
             int maxRetries = 5;
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <driver/ledc.h>
 
 #ifdef HAS_RGB_LED
 #define FASTLED_INTERNAL
@@ -6,12 +7,22 @@
 #endif
 
 #include "leds.h"
+#include "ledtimeline.h"
 #include "settings.h"
 #include "tag_db.h"
 #include "serialap.h"
 
+// the led task sleeps until the next keyframe, see ledtimeline.h
+#define LED_MONO_CHANNEL 7
+
 QueueHandle_t ledQueue;
 int maxledbrightness = 255;
+static TaskHandle_t ledTaskHandle = nullptr;
+static bool monoAttached = false;
+
+static void wakeLedTask() {
+    if (ledTaskHandle) xTaskNotifyGive(ledTaskHandle);
+}
 
 #ifdef HAS_RGB_LED
 QueueHandle_t rgbLedQueue;
@@ -47,6 +58,8 @@ void addToRGBQueue(struct ledInstructionRGB* rgb, bool requeue) {
     BaseType_t queuestatus = xQueueSend(rgbLedQueue, &rgb, 0);
     if (queuestatus == pdFALSE) {
         delete rgb;
+    } else {
+        wakeLedTask();
     }
 }
 
@@ -79,6 +92,7 @@ void shortBlink(CRGB cname) {
 
 void flushRGBQueue() {
     rgbQueueFlush = true;
+    wakeLedTask();
 }
 
 void rgbIdle() {
@@ -90,7 +104,9 @@ void showColorPattern(CRGB colorone, CRGB colortwo, CRGB colorthree) {
     const int patternLengths[] = {600, 120, 200, 120, 200, 120};
     const CRGB patternColors[] = {CRGB::Black, colorone, CRGB::Black, colortwo, CRGB::Black, colorthree};
 
-    while (xQueueReceive(rgbLedQueue, &rgb, 0) == pdPASS) { }
+    while (xQueueReceive(rgbLedQueue, &rgb, 0) == pdPASS) {
+        delete rgb;
+    }
 
     for (int i = 0; i < sizeof(patternLengths) / sizeof(patternLengths[0]); i++) {
         rgb = new struct ledInstructionRGB;
@@ -105,28 +121,19 @@ void showRGB() {
     FastLED.show();
 }
 
-void rgbIdleStep() {
-    static bool dirUp = true;
-    static uint16_t step = 0;
-
-    if (dirUp) {
-        // up
-        step++;
-        if (step >= rgbIdlePeriod) {
-            dirUp = false;
-        }
-    } else {
-        // down
-        step--;
-        if (step == 0) {
-            dirUp = true;
-        }
-    }
-    CRGB newvalue = blend(CRGB::Black, (const CRGB&)rgbIdleColor, map(step, 0, rgbIdlePeriod, 0, 255));
+// returns the time until the idle animation needs the next frame
+static uint32_t rgbIdleStep(uint32_t now) {
+    // period and color are changed from other tasks without waking this one, so read them once per frame
+    // and keep checking at a slow pace while there's nothing to show
+    const uint32_t period = rgbIdlePeriod;
+    const CRGB color = rgbIdleColor;
+    if (period == 0 || (color == CRGB(CRGB::Black) && leds[0] == CRGB(CRGB::Black))) return LED_IDLE_CHECK_MS;
+    CRGB newvalue = blend(CRGB::Black, color, ledIdleLevel(now, period));
     if (newvalue != leds[0]) {
         leds[0] = newvalue;
         showRGB();
     }
+    return LED_FRAME_MS;
 }
 #endif
 
@@ -155,6 +162,8 @@ void addToMonoQueue(struct ledInstruction* mono) {
     BaseType_t queuestatus = xQueueSend(ledQueue, &mono, 0);
     if (queuestatus == pdFALSE) {
         delete mono;
+    } else {
+        wakeLedTask();
     }
 }
 
@@ -166,14 +175,26 @@ void addFadeMono(uint8_t value) {
     addToMonoQueue(mono);
 }
 
-void showMono(uint8_t brightness) {
+static uint32_t monoDuty(uint8_t brightness) {
 #ifdef CONFIG_IDF_TARGET_ESP32
-    ledcWrite(7, 255 - gamma8[brightness]);
+    return 255 - gamma8[brightness];
 #else
-    ledcWrite(7, gamma8[brightness]);
+    return gamma8[brightness];
 #endif
 }
 
+// arduino ledc channel 7 is channel 7 of the first speed mode group on all targets
+void showMono(uint8_t brightness) {
+    if (!monoAttached) return;
+    ledc_set_duty_and_update((ledc_mode_t)0, (ledc_channel_t)LED_MONO_CHANNEL, monoDuty(brightness), 0);
+}
+
+// mono fades run in the ledc fade hardware, the led task doesn't have to wake up for them
+static void fadeMono(uint8_t brightness, uint16_t fadeTime) {
+    if (!monoAttached) return;
+    ledc_set_fade_time_and_start((ledc_mode_t)0, (ledc_channel_t)LED_MONO_CHANNEL, monoDuty(brightness), fadeTime, LEDC_FADE_NO_WAIT);
+}
+
 void quickBlink(uint8_t repeat) {
     for (int i = 0; i < repeat; i++) {
         struct ledInstruction* mono = new struct ledInstruction;
@@ -193,9 +214,8 @@ void quickBlink(uint8_t repeat) {
     }
 }
 
-volatile uint16_t monoIdlePeriod = 900;
-
 void ledTask(void* parameter) {
+    ledTaskHandle = xTaskGetCurrentTaskHandle();
 #ifdef HAS_RGB_LED
     FastLED.addLeds<WS2812B, FLASHER_RGB_LED, GRB>(leds, 1);  // GRB ordering is typical
     leds[0] = CRGB::Blue;
@@ -208,19 +228,21 @@ void ledTask(void* parameter) {
     addFadeColor(CRGB::Green);
     addFadeColor(CRGB::Blue);
     CRGB oldColor = CRGB::Black;
-    uint16_t rgbInstructionFadeTime = 0;
+    uint32_t rgbStart = 0;
 #endif
 
     ledQueue = xQueueCreate(30, sizeof(struct ledInstruction*));
 
-    ledcSetup(7, 5000, 8);
+    ledcSetup(LED_MONO_CHANNEL, 5000, 8);
     if (FLASHER_LED != -1) {
         digitalWrite(FLASHER_LED, HIGH);
         pinMode(FLASHER_LED, OUTPUT);
-        ledcAttachPin(FLASHER_LED, 7);
+        ledcAttachPin(FLASHER_LED, LED_MONO_CHANNEL);
+        monoAttached = (ledc_fade_func_install(0) == ESP_OK);
     }
 
     struct ledInstruction* monoled = nullptr;
+    uint32_t monoStart = 0;
 
     addFadeMono(0);
 #ifdef HAS_TFT
@@ -230,78 +252,81 @@ void ledTask(void* parameter) {
 #endif
     addFadeMono(0);
 
-    uint8_t oldBrightness = 0;
-
-    uint16_t monoInstructionFadeTime = 0;
-
     while (1) {
+        const uint32_t now = millis();
+        uint32_t sleepTime = portMAX_DELAY;
+
 #ifdef HAS_RGB_LED
         // handle RGB led instructions
-        if (rgb == nullptr) {
-            // fetch a led instruction
-            BaseType_t q = xQueueReceive(rgbLedQueue, &rgb, 1);
-            if (q == pdTRUE) {
-                if (rgb->reQueue && !rgbQueueFlush) {
-                    // requeue this instruction at the end of the queue, caveman style.
-                    struct ledInstructionRGB* requeue = new ledInstructionRGB;
-                    requeue->fadeTime = rgb->fadeTime;
-                    requeue->ledColor = rgb->ledColor;
-                    requeue->length = rgb->length;
-                    addToRGBQueue(requeue, true);
-                }
-
-                if (rgbQueueFlush) {
-                    delete rgb;
-                    rgb = nullptr;
-                } else {
-                    rgbInstructionFadeTime = rgb->fadeTime;
-                    if (rgb->fadeTime <= 1) {
-                        leds[0] = rgb->ledColor;
-                        showRGB();
-                    }
+        while (true) {
+            if (rgb != nullptr) {
+                if (!ledStepDone(rgb->fadeTime, rgb->length, now - rgbStart)) break;
+                oldColor = rgb->ledColor;
+                // a fade without hold time is done on its last frame, land on the target
+                if (leds[0] != oldColor) {
+                    leds[0] = oldColor;
+                    showRGB();
                 }
+                delete rgb;
+                rgb = nullptr;
+            }
+            // fetch a led instruction
+            if (xQueueReceive(rgbLedQueue, &rgb, 0) != pdTRUE) break;
+            if (rgb->reQueue && !rgbQueueFlush) {
+                // requeue this instruction at the end of the queue, caveman style.
+                struct ledInstructionRGB* requeue = new ledInstructionRGB;
+                requeue->fadeTime = rgb->fadeTime;
+                requeue->ledColor = rgb->ledColor;
+                requeue->length = rgb->length;
+                addToRGBQueue(requeue, true);
+            }
+            if (rgbQueueFlush) {
+                delete rgb;
+                rgb = nullptr;
             } else {
-                rgbQueueFlush = false;
-                // no commands, run idle led task
-                rgbIdleStep();
+                rgbStart = now;
+                if (rgb->fadeTime <= 1) {
+                    leds[0] = rgb->ledColor;
+                    showRGB();
+                }
             }
+        }
+
+        if (rgb == nullptr) {
+            rgbQueueFlush = false;
+            // no commands, run idle led task
+            sleepTime = rgbIdleStep(now);
         } else {
-            // process instruction
-            if (rgb->fadeTime) {
-                rgb->fadeTime--;
-                leds[0] = blend(rgb->ledColor, oldColor, map(rgb->fadeTime, 0, rgbInstructionFadeTime, 0, 255));
+            const uint32_t elapsed = now - rgbStart;
+            uint8_t fraction;
+            sleepTime = ledFadeFrame(rgb->fadeTime, rgb->length, elapsed, fraction);
+            const CRGB color = elapsed < rgb->fadeTime ? blend(oldColor, rgb->ledColor, fraction) : rgb->ledColor;
+            if (leds[0] != color) {
+                leds[0] = color;
                 showRGB();
-            } else if (rgb->length) {
-                rgb->length--;
-            } else {
-                oldColor = rgb->ledColor;
-                delete rgb;
-                rgb = nullptr;
             }
         }
 #endif
         // handle flasher LED (single color)
-        if (monoled == nullptr) {
-            BaseType_t q = xQueueReceive(ledQueue, &monoled, 1);
-            if (q == pdTRUE) {
-                monoInstructionFadeTime = monoled->fadeTime;
-                if (monoled->fadeTime <= 1) {
-                    showMono(monoled->value);
-                }
-            } 
-        } else {
-            if (monoled->fadeTime) {
-                monoled->fadeTime--;
-                showMono(map(monoled->fadeTime, 0, monoInstructionFadeTime, monoled->value, oldBrightness));
-            } else if (monoled->length) {
-                monoled->length--;
-            } else {
-                oldBrightness = monoled->value;
+        while (true) {
+            if (monoled != nullptr) {
+                if (!ledStepDone(monoled->fadeTime, monoled->length, now - monoStart)) break;
                 delete monoled;
                 monoled = nullptr;
             }
+            if (xQueueReceive(ledQueue, &monoled, 0) != pdTRUE) break;
+            monoStart = now;
+            if (monoled->fadeTime <= 1) {
+                showMono(monoled->value);
+            } else {
+                fadeMono(monoled->value, monoled->fadeTime);
+            }
+        }
+        if (monoled != nullptr) {
+            sleepTime = min(sleepTime, ledStepLeft(monoled->fadeTime, monoled->length, now - monoStart));
         }
 
-        vTaskDelay(1 / portTICK_PERIOD_MS);
+        // queueing a new instruction wakes the task up early
+        ulTaskNotifyTake(pdTRUE, sleepTime == portMAX_DELAY ? portMAX_DELAY : max((TickType_t)1, pdMS_TO_TICKS(sleepTime)));
     }
-}
\ No newline at end of file
+}
@@ -11,6 +11,7 @@
 #include "system.h"
 #include "tag_db.h"
 #include "tagdata.h"
+#include "telemetry.h"
 #include "wifimanager.h"
 
 #ifdef HAS_EXT_FLASHER
@@ -23,6 +24,7 @@
 
 #include "language.h"
 #include "leds.h"
+#include "newproto.h"
 #include "udp.h"
 #include "util.h"
 #include "web.h"
@@ -32,6 +34,8 @@ util::Timer intervalContentRunner(seconds(1));
 util::Timer intervalSysinfo(seconds(5));
 util::Timer intervalVars(seconds(10));
 util::Timer intervalSaveDB(minutes(5));
+util::Timer intervalSyncDigest(seconds(60));
+util::Timer intervalSaveTelemetry(minutes(30));
 
 SET_LOOP_TASK_STACK_SIZE(16 * 1024);
 
@@ -135,6 +139,9 @@ void setup() {
     } else {
         cleanupCurrent();
     }
+    initRenderWorker();
+    initTelemetry();
+    loadTelemetry("/current/telemetry.bin");
     xTaskCreate(APTask, "AP Process", 6000, NULL, 5, NULL);
     vTaskDelay(10 / portTICK_PERIOD_MS);
 
@@ -180,6 +187,13 @@ void loop() {
     if (intervalSaveDB.doRun() && config.runStatus != RUNSTATUS_STOP) {
         saveDB("/current/tagDB.json");
     }
+    if (intervalSaveTelemetry.doRun() && config.runStatus != RUNSTATUS_STOP) {
+        saveTelemetry("/current/telemetry.bin");
+    }
+    if (intervalSyncDigest.doRun() && config.runStatus != RUNSTATUS_STOP) {
+        udpsync.netSendDigest();
+    }
+    finishPeerFetches();
     if (intervalContentRunner.doRun() && (apInfo.state == AP_STATE_ONLINE || apInfo.state == AP_STATE_NORADIO)) {
         contentRunner();
     }
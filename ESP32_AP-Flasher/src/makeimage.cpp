@@ -5,6 +5,10 @@
 #include <makeimage.h>
 #include <web.h>
 
+#include <functional>
+
+#include "dither.h"
+#include "jpgstream.h"
 #include "leds.h"
 #include "miniz-oepl.h"
 #include "storage.h"
@@ -23,10 +27,9 @@ bool spr_output(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t *bitmap)
     return 1;
 }
 
+bool jpg2stream(String &filein, String &fileout, uint16_t w, uint16_t h, imgParam &imageParams);
+
 void jpg2buffer(String filein, String fileout, imgParam &imageParams) {
-    TJpgDec.setSwapBytes(true);
-    TJpgDec.setJpgScale(1);
-    TJpgDec.setCallback(spr_output);
     uint16_t w = 0, h = 0;
     if (filein.c_str()[0] != '/') {
         filein = "/" + filein;
@@ -38,6 +41,13 @@ void jpg2buffer(String filein, String fileout, imgParam &imageParams) {
     }
     Serial.println("jpeg conversion " + String(w) + "x" + String(h));
 
+    // decode and dither in bands of MCU rows, only falls back to a full sprite if that's not possible
+    if (jpg2stream(filein, fileout, w, h, imageParams)) return;
+
+    TJpgDec.setSwapBytes(true);
+    TJpgDec.setJpgScale(1);
+    TJpgDec.setCallback(spr_output);
+
 #ifdef BOARD_HAS_PSRAM
     spr.setColorDepth(16);
 #else
@@ -63,158 +73,23 @@ void jpg2buffer(String filein, String fileout, imgParam &imageParams) {
     }
 }
 
-struct Error {
-    int32_t r;
-    int32_t g;
-    int32_t b;
-};
-
-uint32_t colorDistance(Color &c1, Color &c2, Error &e1) {
-    e1.r = constrain(e1.r, -255, 255);
-    e1.g = constrain(e1.g, -255, 255);
-    e1.b = constrain(e1.b, -255, 255);
-    int32_t r_diff = c1.r + e1.r - c2.r;
-    int32_t g_diff = c1.g + e1.g - c2.g;
-    int32_t b_diff = c1.b + e1.b - c2.b;
-    return 3 * r_diff * r_diff + 6 * g_diff * g_diff + b_diff * b_diff;
-}
-
 void spr2color(TFT_eSprite &spr, imgParam &imageParams, uint8_t *buffer, size_t buffer_size, bool is_red) {
-    uint8_t rotate = imageParams.rotate;
+    const uint8_t rotate = ditherRotation(imageParams.rotate, imageParams.rotatebuffer);
     long bufw = spr.width(), bufh = spr.height();
-
     if (imageParams.rotatebuffer % 2) {
         //turn the image 90 or 270
-        rotate = (rotate + 3) % 4;
-        rotate = (rotate + (imageParams.rotatebuffer - 1)) % 4;
         bufw = spr.height();
         bufh = spr.width();
-    } else {
-        // rotate 180
-        rotate = (rotate + (imageParams.rotatebuffer)) % 4;
     }
 
-    memset(buffer, 0, buffer_size);
-
     std::vector<Color> palette = imageParams.hwdata.colortable;
     if (imageParams.invert == 1) {
         std::swap(palette[0], palette[1]);
     }
-    Color color;
     int num_colors = palette.size();
     if (imageParams.bufferbpp == 1) num_colors = 2;
-    Error *error_bufferold = new Error[bufw + 4];
-    Error *error_buffernew = new Error[bufw + 4];
-
-    const uint8_t ditherMatrix[4][4] = {
-        {0, 9, 2, 10},
-        {12, 5, 14, 6},
-        {3, 11, 1, 8},
-        {15, 7, 13, 4}};
-
-    memset(error_bufferold, 0, bufw * sizeof(Error));
-    for (uint16_t y = 0; y < bufh; y++) {
-        memset(error_buffernew, 0, bufw * sizeof(Error));
-        for (uint16_t x = 0; x < bufw; x++) {
-            switch (rotate) {
-                case 0:
-                    color = Color(spr.readPixel(x, y));
-                    break;
-                case 1:
-                    color = Color(spr.readPixel(y, bufw - 1 - x));
-                    break;
-                case 2:
-                    color = Color(spr.readPixel(bufw - 1 - x, bufh - 1 - y));
-                    break;
-                case 3:
-                    color = Color(spr.readPixel(bufh - 1 - y, x));
-                    break;
-            }
-
-            if (imageParams.dither == 2) {
-                // Ordered dithering
-                uint8_t ditherValue = ditherMatrix[y % 4][x % 4];
-                error_bufferold[x].r = (ditherValue << 4) - 120;  // * 256 / 16 - 128 + 8
-                error_bufferold[x].g = (ditherValue << 4) - 120;
-                error_bufferold[x].b = (ditherValue << 4) - 120;
-            }
 
-            int best_color_index = 0;
-            uint32_t best_color_distance = colorDistance(color, palette[0], error_bufferold[x]);
-
-            for (int i = 1; i < num_colors; i++) {
-                if (best_color_distance == 0) break;
-                uint32_t distance = colorDistance(color, palette[i], error_bufferold[x]);
-                if (distance < best_color_distance) {
-                    best_color_distance = distance;
-                    best_color_index = i;
-                }
-            }
-            uint8_t bitIndex = 7 - (x % 8);
-            uint32_t byteIndex = (y * bufw + x) / 8;
-
-            // this looks a bit ugly, but it's performing better than shorter notations
-            switch (best_color_index) {
-                case 1:
-                    if (!is_red)
-                        buffer[byteIndex] |= (1 << bitIndex);
-                    break;
-                case 2:
-                    imageParams.hasRed = true;
-                    if (is_red)
-                        buffer[byteIndex] |= (1 << bitIndex);
-                    break;
-                case 3:
-                    imageParams.hasRed = true;
-                    buffer[byteIndex] |= (1 << bitIndex);
-                    break;
-            }
-
-            if (imageParams.dither == 1) {
-                // Burkes Dithering
-
-                Error error = {
-                    color.r + error_bufferold[x].r - palette[best_color_index].r,
-                    color.g + error_bufferold[x].g - palette[best_color_index].g,
-                    color.b + error_bufferold[x].b - palette[best_color_index].b};
-
-                error_buffernew[x].r += error.r >> 2;
-                error_buffernew[x].g += error.g >> 2;
-                error_buffernew[x].b += error.b >> 2;
-                if (x > 0) {
-                    error_buffernew[x - 1].r += error.r >> 3;
-                    error_buffernew[x - 1].g += error.g >> 3;
-                    error_buffernew[x - 1].b += error.b >> 3;
-                }
-                if (x > 1) {
-                    error_buffernew[x - 2].r += error.r >> 4;
-                    error_buffernew[x - 2].g += error.g >> 4;
-                    error_buffernew[x - 2].b += error.b >> 4;
-                }
-                error_buffernew[x + 1].r += error.r >> 3;
-                error_buffernew[x + 1].g += error.g >> 3;
-                error_buffernew[x + 1].b += error.b >> 3;
-
-                error_bufferold[x + 1].r += error.r >> 2;
-                error_bufferold[x + 1].g += error.g >> 2;
-                error_bufferold[x + 1].b += error.b >> 2;
-
-                error_buffernew[x + 2].r += error.r >> 4;
-                error_buffernew[x + 2].g += error.g >> 4;
-                error_buffernew[x + 2].b += error.b >> 4;
-
-                error_bufferold[x + 2].r += error.r >> 3;
-                error_bufferold[x + 2].g += error.g >> 3;
-                error_bufferold[x + 2].b += error.b >> 3;
-            }
-        }
-        memcpy(error_bufferold, error_buffernew, bufw * sizeof(Error));
-    }
-
-    delete[] error_buffernew;
-    delete[] error_bufferold;
-
-    return;
+    ditherPlane([&spr](int32_t x, int32_t y) { return spr.readPixel(x, y); }, bufw, bufh, rotate, palette, num_colors, imageParams.dither, buffer, buffer_size, is_red, imageParams.hasRed);
 }
 
 size_t prepareHeader(uint8_t headerbuf[], uint16_t bufw, uint16_t bufh, imgParam imageParams, size_t buffer_size) {
@@ -265,6 +140,49 @@ void rewriteHeader(File &f_out) {
     f_out.write(flg);
 }
 
+// writes the black plane, followed by the red plane if it's used. getPlane() is only called for the planes that are needed
+void writePlanes(fs::File &f_out, long bufw, long bufh, size_t buffer_size, imgParam &imageParams, std::function<uint8_t *(bool is_red)> getPlane) {
+    uint8_t *buffer = getPlane(false);
+
+    if (imageParams.zlib) {
+        Miniz::tdefl_compressor *comp;
+        comp = (Miniz::tdefl_compressor *)malloc(sizeof(Miniz::tdefl_compressor));
+
+        uint8_t headerbuf[6];
+        size_t totalbytes = prepareHeader(headerbuf, bufw, bufh, imageParams, buffer_size);
+        char *zlibbuf = (char *)malloc(totalbytes * 1.3);
+
+        f_out.write(reinterpret_cast<uint8_t *>(&totalbytes), sizeof(uint32_t));
+
+        // 768 = compression level 9, 1500 = unofficial level 10
+        if (comp == NULL || zlibbuf == NULL || totalbytes == 0 || !initializeCompressor(comp, Miniz::TDEFL_WRITE_ZLIB_HEADER | 1500)) {
+            Serial.println("Failed to initialize compressor or allocate memory for zlib");
+            if (zlibbuf != NULL) free(zlibbuf);
+            if (comp != NULL) free(comp);
+            return;
+        }
+
+        size_t bufferstart = compressAndWrite(comp, headerbuf, sizeof(headerbuf), zlibbuf, buffer_size, totalbytes, f_out, Miniz::TDEFL_NO_FLUSH);
+        compressAndWrite(comp, buffer, buffer_size, zlibbuf + bufferstart, buffer_size, buffer_size, f_out, (headerbuf[5] == 2 ? Miniz::TDEFL_SYNC_FLUSH : Miniz::TDEFL_FINISH));
+
+        if (headerbuf[5] == 2) {
+            buffer = getPlane(true);
+            compressAndWrite(comp, buffer, buffer_size, zlibbuf, buffer_size, buffer_size, f_out, Miniz::TDEFL_FINISH);
+        }
+
+        free(zlibbuf);
+        free(comp);
+
+        rewriteHeader(f_out);
+    } else {
+        f_out.write(buffer, buffer_size);
+        if (imageParams.hasRed && imageParams.bpp > 1) {
+            buffer = getPlane(true);
+            f_out.write(buffer, buffer_size);
+        }
+    }
+}
+
 void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
     long t = millis();
 
@@ -288,7 +206,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
     }
 #endif
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    takeFsMutex();
     fs::File f_out = contentFS->open(fileout, "w");
 
     switch (imageParams.bpp) {
@@ -309,45 +227,10 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
                 xSemaphoreGive(fsMutex);
                 return;
             }
-            spr2color(spr, imageParams, buffer, buffer_size, false);
-
-            if (imageParams.zlib) {
-                Miniz::tdefl_compressor *comp;
-                comp = (Miniz::tdefl_compressor *)malloc(sizeof(Miniz::tdefl_compressor));
-
-                uint8_t headerbuf[6];
-                size_t totalbytes = prepareHeader(headerbuf, bufw, bufh, imageParams, buffer_size);
-                char *zlibbuf = (char *)malloc(totalbytes * 1.3);
-
-                f_out.write(reinterpret_cast<uint8_t *>(&totalbytes), sizeof(uint32_t));
-
-                // 768 = compression level 9, 1500 = unofficial level 10
-                if (comp == NULL || zlibbuf == NULL || totalbytes == 0 || !initializeCompressor(comp, Miniz::TDEFL_WRITE_ZLIB_HEADER | 1500)) {
-                    Serial.println("Failed to initialize compressor or allocate memory for zlib");
-                    if (zlibbuf != NULL) free(zlibbuf);
-                    if (comp != NULL) free(comp);
-                    break;
-                }
-
-                size_t bufferstart = compressAndWrite(comp, headerbuf, sizeof(headerbuf), zlibbuf, buffer_size, totalbytes, f_out, Miniz::TDEFL_NO_FLUSH);
-                compressAndWrite(comp, buffer, buffer_size, zlibbuf + bufferstart, buffer_size, buffer_size, f_out, (headerbuf[5] == 2 ? Miniz::TDEFL_SYNC_FLUSH : Miniz::TDEFL_FINISH));
-
-                if (headerbuf[5] == 2) {
-                    spr2color(spr, imageParams, buffer, buffer_size, true);
-                    compressAndWrite(comp, buffer, buffer_size, zlibbuf, buffer_size, buffer_size, f_out, Miniz::TDEFL_FINISH);
-                }
-
-                free(zlibbuf);
-                free(comp);
-
-                rewriteHeader(f_out);
-            } else {
-                f_out.write(buffer, buffer_size);
-                if (imageParams.hasRed && imageParams.bpp > 1) {
-                    spr2color(spr, imageParams, buffer, buffer_size, true);
-                    f_out.write(buffer, buffer_size);
-                }
-            }
+            writePlanes(f_out, bufw, bufh, buffer_size, imageParams, [&](bool is_red) {
+                spr2color(spr, imageParams, buffer, buffer_size, is_red);
+                return buffer;
+            });
 
             free(buffer);
         } break;
@@ -362,3 +245,122 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
     xSemaphoreGive(fsMutex);
     Serial.println("finished writing buffer " + String(millis() - t) + "ms");
 }
+
+static JpgStream *jpgStream = nullptr;
+
+static bool jpgStreamOutput(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t *bitmap) {
+    jpgStream->block(x, y, w, h, bitmap);
+    return 1;
+}
+
+static void jpgStreamDecode(JpgStream &stream, String &filein, uint8_t scale) {
+    jpgStream = &stream;
+    TJpgDec.setSwapBytes(false);
+    TJpgDec.setJpgScale(scale);
+    TJpgDec.setCallback(jpgStreamOutput);
+    TJpgDec.drawFsJpg(0, 0, filein, *contentFS);
+    stream.finish();
+    jpgStream = nullptr;
+    TJpgDec.setJpgScale(1);
+}
+
+bool jpg2stream(String &filein, String &fileout, uint16_t w, uint16_t h, imgParam &imageParams) {
+    if (imageParams.bpp != 1 && imageParams.bpp != 2) return false;
+#ifdef HAS_TFT
+    if (fileout == "direct") return false;
+#endif
+    long t = millis();
+
+    // use the TJpgDec 1/2, 1/4 or 1/8 scale when the source is much larger than the tag
+    uint8_t scale = 1;
+    while (scale < 8 && (w + 2 * scale - 1) / (2 * scale) >= imageParams.width && (h + 2 * scale - 1) / (2 * scale) >= imageParams.height) {
+        scale *= 2;
+    }
+
+    std::vector<Color> palette = imageParams.hwdata.colortable;
+    if (imageParams.invert == 1) {
+        std::swap(palette[0], palette[1]);
+    }
+    const uint16_t srcw = (w + scale - 1) / scale;
+    const uint16_t srch = (h + scale - 1) / scale;
+    // the rest is resampled to the tag size. Smaller images are left alone, like before.
+    uint16_t dstw = srcw, dsth = srch;
+    if (srcw >= imageParams.width && srch >= imageParams.height) {
+        dstw = imageParams.width;
+        dsth = imageParams.height;
+    }
+    const uint8_t rotate = ditherRotation(imageParams.rotate, imageParams.rotatebuffer);
+    const long bufw = (imageParams.rotatebuffer % 2) ? dsth : dstw;
+    const long bufh = (imageParams.rotatebuffer % 2) ? dstw : dsth;
+    const size_t buffer_size = (bufw * bufh) / 8;
+#ifndef BOARD_HAS_PSRAM
+    imageParams.zlib = 0;
+#endif
+    Serial.println("jpeg streaming, scale 1/" + String(scale) + ", " + String(srcw) + "x" + String(srch) + " -> " + String(dstw) + "x" + String(dsth));
+
+    if (rotate == 0 && !imageParams.zlib) {
+        // rows go to the file as they are dithered, one decode per plane. The mutex is only held
+        // per row, the decode takes too long to keep the web server waiting.
+        takeFsMutex();
+        fs::File f_out = contentFS->open(fileout, "w");
+        xSemaphoreGive(fsMutex);
+        bool result = false;
+        for (uint8_t plane = 0; plane < 2; plane++) {
+            JpgStream stream(palette, palette.size(), imageParams.dither, srcw, srch, dstw, dsth, rotate, bufw, bufh);
+            if (!stream.ok() || !stream.setRows(plane == 1, [&f_out](const uint8_t *data, size_t len) {
+                    takeFsMutex();
+                    f_out.write(data, len);
+                    xSemaphoreGive(fsMutex);
+                })) {
+                Serial.println("Failed to allocate buffers for jpeg streaming");
+                util::printLargestFreeBlock();
+                result = false;
+                break;
+            }
+            jpgStreamDecode(stream, filein, scale);
+            result = true;
+            if (stream.hasRed()) imageParams.hasRed = true;
+            if (!imageParams.hasRed || imageParams.bpp == 1) break;
+        }
+        takeFsMutex();
+        f_out.close();
+        xSemaphoreGive(fsMutex);
+        if (result) Serial.println("finished writing buffer " + String(millis() - t) + "ms");
+        return result;
+    }
+
+    // rotated or compressed output needs the whole planes
+    JpgStream stream(palette, palette.size(), imageParams.dither, srcw, srch, dstw, dsth, rotate, bufw, bufh);
+#ifdef BOARD_HAS_PSRAM
+    uint8_t *black = (uint8_t *)ps_calloc(buffer_size, 1);
+    uint8_t *red = (imageParams.bpp > 1) ? (uint8_t *)ps_calloc(buffer_size, 1) : nullptr;
+#else
+    uint8_t *black = (uint8_t *)calloc(buffer_size, 1);
+    uint8_t *red = (imageParams.bpp > 1) ? (uint8_t *)calloc(buffer_size, 1) : nullptr;
+#endif
+
+    bool result = false;
+    if (!black || (imageParams.bpp > 1 && !red) || !stream.ok()) {
+        Serial.println("Failed to allocate buffers for jpeg streaming");
+        util::printLargestFreeBlock();
+    } else {
+        stream.setPlanes(black, red);
+        jpgStreamDecode(stream, filein, scale);
+        if (stream.hasRed()) imageParams.hasRed = true;
+
+        takeFsMutex();
+        fs::File f_out = contentFS->open(fileout, "w");
+        // unrotated size, like spr2buffer: prepareHeader swaps them for rotatebuffer itself
+        writePlanes(f_out, dstw, dsth, buffer_size, imageParams, [&](bool is_red) {
+            return is_red ? red : black;
+        });
+        f_out.close();
+        xSemaphoreGive(fsMutex);
+        Serial.println("finished writing buffer " + String(millis() - t) + "ms");
+        result = true;
+    }
+
+    if (red) free(red);
+    if (black) free(black);
+    return result;
+}
@@ -0,0 +1,94 @@
+#include "metrics.h"
+
+#include <Arduino.h>
+
+std::atomic<uint32_t> metricCounters[METRIC_COUNTER_COUNT];
+std::atomic<int32_t> metricGauges[METRIC_GAUGE_COUNT];
+metricHistogramData metricHistograms[METRIC_HISTOGRAM_COUNT];
+
+const uint32_t metricHistogramBounds[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS] = {
+    {5, 10, 25, 50, 100, 250, 500, 1000},                 // METRIC_BLOCK_SERVICE_MS
+    {250, 500, 1000, 2500, 5000, 10000, 25000, 60000},    // METRIC_RENDER_MS
+    {10, 100, 1000, 10000, 50000, 100000, 500000, 1000000},  // METRIC_FSMUTEX_WAIT_US
+    {1, 2, 5, 10, 20, 30, 60, 120},                          // METRIC_CHECKIN_ERROR_S
+    {500, 1000, 2000, 5000, 10000, 15000, 30000, 60000},     // METRIC_WIFI_CONNECT_MS
+    {100, 500, 1000, 5000, 10000, 30000, 60000, 120000}      // METRIC_RENDER_WAIT_MS
+};
+
+struct metricInfo {
+    const char* name;
+    const char* help;
+};
+
+const metricInfo counterInfo[METRIC_COUNTER_COUNT] = {
+    {"oepl_block_requests_total", "Block requests received from tags"},
+    {"oepl_block_failed_total", "Block requests that could not be served"},
+    {"oepl_data_requests_total", "Data requests (check-ins) received from tags"},
+    {"oepl_xfer_complete_total", "Completed transfers"},
+    {"oepl_xfer_timeout_total", "Timed out transfers"},
+    {"oepl_radio_ack_total", "ACK replies from the radio"},
+    {"oepl_radio_nok_total", "NOK replies from the radio"},
+    {"oepl_radio_noq_total", "NOQ replies from the radio"},
+    {"oepl_radio_timeout_total", "Commands to the radio without reply"},
+    {"oepl_radio_retries_total", "Commands to the radio that had to be retried"},
+    {"oepl_renders_total", "Content renders"},
+    {"oepl_prestaged_total", "Pending images read into the block cache ahead of a predicted check-in"},
+    {"oepl_wifi_lost_total", "Lost WiFi connections"},
+};
+
+const metricInfo gaugeInfo[METRIC_GAUGE_COUNT] = {
+    {"oepl_pending_queue", "Items in the pending queue"},
+};
+
+const metricInfo histogramInfo[METRIC_HISTOGRAM_COUNT] = {
+    {"oepl_block_service_ms", "Time to serve a block request"},
+    {"oepl_render_ms", "Time to render content for a tag"},
+    {"oepl_fsmutex_wait_us", "Time spent waiting for fsMutex"},
+    {"oepl_checkin_error_s", "Difference between predicted and actual tag check-in"},
+    {"oepl_wifi_connect_ms", "Time from starting a (re)connect until the station is connected"},
+    {"oepl_render_wait_ms", "Time a render job waited in the queue"},
+};
+
+// sampled at scrape time, in the order of metricsToStream
+const metricInfo sampledInfo[] = {
+    {"oepl_uptime_seconds", "Seconds since boot"},
+    {"oepl_heap_free_bytes", "Free internal heap"},
+    {"oepl_heap_min_free_bytes", "Lowest free internal heap since boot"},
+    {"oepl_heap_max_alloc_bytes", "Largest block that can be allocated from the internal heap"},
+    {"oepl_psram_free_bytes", "Free PSRAM"},
+};
+
+void printMetricHeader(Print& out, const metricInfo& info, const char* type) {
+    out.printf("# HELP %s %s\n# TYPE %s %s\n", info.name, info.help, info.name, type);
+}
+
+void metricsToStream(Print& out) {
+    for (uint8_t c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        printMetricHeader(out, counterInfo[c], "counter");
+        out.printf("%s %u\n", counterInfo[c].name, metricCounters[c].load(std::memory_order_relaxed));
+    }
+    for (uint8_t c = 0; c < METRIC_GAUGE_COUNT; c++) {
+        printMetricHeader(out, gaugeInfo[c], "gauge");
+        out.printf("%s %d\n", gaugeInfo[c].name, metricGauges[c].load(std::memory_order_relaxed));
+    }
+    for (uint8_t c = 0; c < METRIC_HISTOGRAM_COUNT; c++) {
+        const metricInfo& info = histogramInfo[c];
+        const metricHistogramData& data = metricHistograms[c];
+        printMetricHeader(out, info, "histogram");
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b < METRIC_HISTOGRAM_BUCKETS; b++) {
+            cumulative += data.buckets[b].load(std::memory_order_relaxed);
+            out.printf("%s_bucket{le=\"%u\"} %u\n", info.name, metricHistogramBounds[c][b], cumulative);
+        }
+        cumulative += data.buckets[METRIC_HISTOGRAM_BUCKETS].load(std::memory_order_relaxed);
+        out.printf("%s_bucket{le=\"+Inf\"} %u\n", info.name, cumulative);
+        out.printf("%s_sum %u\n", info.name, data.sum.load(std::memory_order_relaxed));
+        out.printf("%s_count %u\n", info.name, data.count.load(std::memory_order_relaxed));
+    }
+
+    const uint32_t sampled[] = {millis() / 1000, ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap(), ESP.getFreePsram()};
+    for (uint8_t c = 0; c < sizeof(sampled) / sizeof(sampled[0]); c++) {
+        printMetricHeader(out, sampledInfo[c], "gauge");
+        out.printf("%s %u\n", sampledInfo[c].name, sampled[c]);
+    }
+}
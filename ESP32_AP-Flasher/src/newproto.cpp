@@ -7,22 +7,25 @@
 #include <time.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstring>
 #include <mutex>
 #include <vector>
 
+#include "ble_writer.h"
+#include "metrics.h"
 #include "serialap.h"
 #include "settings.h"
 #include "storage.h"
 #include "system.h"
 #include "tag_db.h"
 #include "tagdata.h"
+#include "telemetry.h"
 #include "udp.h"
 #include "util.h"
 #include "web.h"
 
 extern uint16_t sendBlock(const void* data, const uint16_t len);
-extern UDPcomm udpsync;
 std::vector<PendingItem> pendingQueue;
 std::mutex queueMutex;
 
@@ -55,6 +58,118 @@ uint8_t* getDataForFile(fs::File& file) {
     return ret;
 }
 
+// Small LRU cache of file blocks, shared by all pending items. Blocks are read on demand
+// from contentFS, so a queued image doesn't occupy any heap until a tag asks for it.
+// Used from the serial rx task (block requests and read-ahead) and the loop task (prestaging),
+// so every access goes through blockCacheMutex. Entries that are being read or sent are pinned.
+#define BLOCK_CACHE_ENTRIES 4
+
+struct blockCacheEntry {
+    uint64_t dataVer;
+    uint8_t blockId;
+    uint16_t len;
+    bool valid;
+    uint8_t pins;
+    uint32_t lastUsed;
+    uint8_t* data;
+};
+
+blockCacheEntry blockCache[BLOCK_CACHE_ENTRIES] = {0};
+uint32_t blockCacheCounter = 0;
+std::mutex blockCacheMutex;
+
+static const uint8_t* loadBlock(const char* filename, const uint64_t dataVer, const uint8_t blockId, const uint16_t len, const bool pin) {
+    std::unique_lock<std::mutex> lock(blockCacheMutex);
+    blockCacheEntry* entry = nullptr;
+    for (blockCacheEntry& c : blockCache) {
+        if (c.valid && c.dataVer == dataVer && c.blockId == blockId && c.len == len) {
+            c.lastUsed = ++blockCacheCounter;
+            if (pin) c.pins++;
+            return c.data;
+        }
+        if (c.pins == 0 && (entry == nullptr || c.lastUsed < entry->lastUsed)) entry = &c;
+    }
+    if (entry == nullptr) return nullptr;
+
+    if (entry->data == nullptr) {
+#ifdef BOARD_HAS_PSRAM
+        entry->data = (uint8_t*)ps_malloc(BLOCK_DATA_SIZE);
+#else
+        entry->data = (uint8_t*)malloc(BLOCK_DATA_SIZE);
+#endif
+        if (entry->data == nullptr) {
+            wsErr("malloc failed for block cache");
+            return nullptr;
+        }
+    }
+    // the old key goes before the data is overwritten, the pin keeps others from taking the entry
+    entry->valid = false;
+    entry->pins = 1;
+    entry->lastUsed = ++blockCacheCounter;
+    lock.unlock();
+
+    takeFsMutex();
+    fs::File file = contentFS->open(filename);
+    const bool ok = file && file.seek(blockId * BLOCK_DATA_SIZE) && file.read(entry->data, len) == len;
+    if (file) file.close();
+    xSemaphoreGive(fsMutex);
+
+    lock.lock();
+    if (!pin || !ok) entry->pins--;
+    if (!ok) {
+        entry->lastUsed = 0;
+        return nullptr;
+    }
+    entry->dataVer = dataVer;
+    entry->blockId = blockId;
+    entry->len = len;
+    entry->valid = true;
+    return entry->data;
+}
+
+const uint8_t* getBlockForFile(const char* filename, const uint64_t dataVer, const uint8_t blockId, const uint16_t len) {
+    return loadBlock(filename, dataVer, blockId, len, true);
+}
+
+bool cacheBlockForFile(const char* filename, const uint64_t dataVer, const uint8_t blockId, const uint16_t len) {
+    return loadBlock(filename, dataVer, blockId, len, false) != nullptr;
+}
+
+void releaseBlock(const uint8_t* data) {
+    const std::lock_guard<std::mutex> lock(blockCacheMutex);
+    for (blockCacheEntry& c : blockCache) {
+        if (c.data == data && c.pins) {
+            c.pins--;
+            return;
+        }
+    }
+}
+
+uint32_t predictNextCheckin(const tagRecord* taginfo) {
+    return taginfo->expectedNextCheckin + taginfo->checkinDrift;
+}
+
+// reads the first block of a pending image into the block cache, so the first block request doesn't wait on the filesystem
+// runs on the loop task while the serial rx task may dequeue, so the queue item is copied under queueMutex
+void prestageBlocks(tagRecord* taginfo) {
+    char filename[sizeof(PendingItem::filename)];
+    uint64_t dataVer;
+    uint16_t len;
+    {
+        const std::lock_guard<std::mutex> lock(queueMutex);
+        const PendingItem* queueItem = getQueueItem(taginfo->mac);
+        if (queueItem == nullptr || queueItem->data != nullptr || queueItem->filename[0] == 0) return;
+        memcpy(filename, queueItem->filename, sizeof(filename));
+        dataVer = queueItem->pendingdata.availdatainfo.dataVer;
+        len = std::min(queueItem->len, (uint32_t)BLOCK_DATA_SIZE);
+    }
+    if (taginfo->prestagedVer == dataVer) return;
+    if (cacheBlockForFile(filename, dataVer, 0, len)) {
+        taginfo->prestagedVer = dataVer;
+        metricInc(METRIC_PRESTAGED);
+    }
+}
+
 void prepareCancelPending(const uint8_t dst[8]) {
     struct pendingData pending = {0};
     memcpy(pending.targetMac, dst, 8);
@@ -263,120 +378,354 @@ bool prepareDataAvail(String& filename, uint8_t dataType, uint8_t dataTypeArgume
     return true;
 }
 
+// images announced by other APs are fetched by a small pool of workers and kept in a
+// content-addressed cache, so repeated announcements of the same image are served from flash
+#define PEER_FETCH_WORKERS 2
+#define PEER_FETCH_QUEUE 32
+#define PEER_FETCH_QUEUE_WAIT 200  // ms an announcement may wait for room in a full fetch queue
+#define PEER_CACHE_DIR "/peercache"
+#define PEER_CACHE_BUDGET (256 * 1024)
+
+struct peerFetchJob {
+    pendingData pending;
+    uint32_t remoteIP;
+};
+
+// what a worker fetched for a tag, applied to the tagDB by finishPeerFetches() on the loop task
+struct peerFetchResult {
+    pendingData pending;
+    String filename;  // image types
+    uint8_t* data;    // the others
+    uint32_t len;
+};
+
+struct peerCacheEntry {
+    uint64_t dataVer;
+    uint32_t size;
+    uint32_t lastUsed;
+    bool fetching;
+};
+
+// one job per tag: a newer announcement for a tag that is still waiting replaces the older one
+static std::vector<peerFetchJob> peerFetchJobs;
+static std::mutex peerFetchMutex;
+static SemaphoreHandle_t peerFetchSignal = nullptr;
+static QueueHandle_t peerFetchDoneQueue = nullptr;
+
+static std::vector<peerCacheEntry> peerCache;
+static std::mutex peerCacheMutex;
+static std::condition_variable peerCacheChanged;
+static uint32_t peerCacheCounter = 0;
+
+static peerFetchResult* fetchExternalData(const struct pendingData* pending, IPAddress remoteIP);
+
+static void peerFetchTask(void* parameter) {
+    while (true) {
+        if (xSemaphoreTake(peerFetchSignal, portMAX_DELAY) != pdTRUE) continue;
+        peerFetchJob job;
+        {
+            const std::lock_guard<std::mutex> lock(peerFetchMutex);
+            if (peerFetchJobs.empty()) continue;
+            job = peerFetchJobs.front();
+            peerFetchJobs.erase(peerFetchJobs.begin());
+        }
+        peerFetchResult* result = fetchExternalData(&job.pending, IPAddress(job.remoteIP));
+        if (result != nullptr) xQueueSend(peerFetchDoneQueue, &result, portMAX_DELAY);
+    }
+}
+
+// returns false when the queue stayed full
+static bool queuePeerFetch(const peerFetchJob& job) {
+    for (uint8_t wait = 0; wait <= PEER_FETCH_QUEUE_WAIT / 10; wait++) {
+        {
+            const std::lock_guard<std::mutex> lock(peerFetchMutex);
+            for (peerFetchJob& queued : peerFetchJobs) {
+                if (memcmp(queued.pending.targetMac, job.pending.targetMac, 8) == 0) {
+                    queued = job;
+                    return true;
+                }
+            }
+            if (peerFetchJobs.size() < PEER_FETCH_QUEUE) {
+                peerFetchJobs.push_back(job);
+                xSemaphoreGive(peerFetchSignal);
+                return true;
+            }
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    return false;
+}
+
+static peerCacheEntry* findPeerCacheEntry(const uint64_t dataVer) {
+    for (peerCacheEntry& entry : peerCache) {
+        if (entry.dataVer == dataVer) return &entry;
+    }
+    return nullptr;
+}
+
+static void peerCachePath(const uint64_t dataVer, char* path, size_t len) {
+    snprintf(path, len, PEER_CACHE_DIR "/%08X%08X.raw", (uint32_t)(dataVer >> 32), (uint32_t)dataVer);
+}
+
+// evicts the least recently used images until the cache fits its budget, call with peerCacheMutex held
+static void trimPeerCache() {
+    uint32_t total = 0;
+    for (const peerCacheEntry& entry : peerCache) total += entry.size;
+    while (total > PEER_CACHE_BUDGET) {
+        auto oldest = peerCache.end();
+        for (auto it = peerCache.begin(); it != peerCache.end(); ++it) {
+            if (!it->fetching && (oldest == peerCache.end() || it->lastUsed < oldest->lastUsed)) oldest = it;
+        }
+        if (oldest == peerCache.end()) break;
+        char path[40];
+        peerCachePath(oldest->dataVer, path, sizeof(path));
+        takeFsMutex();
+        contentFS->remove(path);
+        xSemaphoreGive(fsMutex);
+        total -= oldest->size;
+        peerCache.erase(oldest);
+    }
+}
+
+static bool downloadToFile(const char* url, const char* filename) {
+    HTTPClient http;
+    http.begin(url);
+    const int httpCode = http.GET();
+    bool result = false;
+    if (httpCode == 200) {
+        takeFsMutex();
+        File file = contentFS->open(filename, "w");
+        if (file) {
+            result = http.writeToStream(&file) > 0;
+            file.close();
+        }
+        xSemaphoreGive(fsMutex);
+    }
+    http.end();
+    return result;
+}
+
+// the announced dataVer is the start of the image md5, returns the file size if the file matches it
+static uint32_t checkDataVer(const char* path, const uint64_t dataVer) {
+    takeFsMutex();
+    fs::File file = contentFS->open(path);
+    uint32_t filesize = file ? file.size() : 0;
+    if (filesize) {
+        MD5Builder md5;
+        md5.begin();
+        md5.addStream(file, filesize);
+        md5.calculate();
+        uint8_t md5bytes[16];
+        md5.getBytes(md5bytes);
+        if (memcmp(md5bytes, &dataVer, sizeof(dataVer)) != 0) filesize = 0;
+    }
+    if (file) file.close();
+    xSemaphoreGive(fsMutex);
+    return filesize;
+}
+
+static bool fetchVerified(const char* url, const char* path, const uint64_t dataVer) {
+    wsLog("prepareExternalDataAvail GET " + String(url));
+    if (!downloadToFile(url, path)) return false;
+    if (checkDataVer(path, dataVer)) return true;
+    logLine("prepareExternalDataAvail " + String(url) + " doesn't match the announced version");
+    return false;
+}
+
+// returns the size of the cached image, fetching it from the announcing AP if needed, 0 if that failed
+static uint32_t fetchPeerCache(const uint64_t dataVer, IPAddress remoteIP, const char* hexmac, char* path, size_t len) {
+    peerCachePath(dataVer, path, len);
+
+    std::unique_lock<std::mutex> lock(peerCacheMutex);
+    // another worker is fetching the same image, wait for it to finish or fail
+    peerCacheEntry* entry;
+    peerCacheChanged.wait(lock, [&entry, dataVer]() {
+        entry = findPeerCacheEntry(dataVer);
+        return entry == nullptr || !entry->fetching;
+    });
+    if (entry != nullptr) {
+        takeFsMutex();
+        const bool exists = contentFS->exists(path);
+        xSemaphoreGive(fsMutex);
+        if (exists) {
+            entry->lastUsed = ++peerCacheCounter;
+            return entry->size;
+        }
+        peerCache.erase(peerCache.begin() + (entry - peerCache.data()));
+    }
+    peerCache.push_back({dataVer, 0, ++peerCacheCounter, true});
+    lock.unlock();
+
+    char md5[17];
+    mac2hex(reinterpret_cast<const uint8_t*>(&dataVer), md5);
+    char imageUrl[80];
+    snprintf(imageUrl, sizeof(imageUrl), "http://%s/getdata?mac=%s&md5=%s", remoteIP.toString().c_str(), hexmac, md5);
+    bool fetched = fetchVerified(imageUrl, path, dataVer);
+    if (!fetched) {
+        // older APs don't have /getdata, their current image is only right if it is still the announced one
+        snprintf(imageUrl, sizeof(imageUrl), "http://%s/current/%s.raw", remoteIP.toString().c_str(), hexmac);
+        fetched = fetchVerified(imageUrl, path, dataVer);
+    }
+
+    uint32_t filesize = 0;
+    takeFsMutex();
+    if (fetched) {
+        fs::File file = contentFS->open(path);
+        if (file) {
+            filesize = file.size();
+            file.close();
+        }
+    }
+    if (filesize == 0) contentFS->remove(path);
+    xSemaphoreGive(fsMutex);
+
+    lock.lock();
+    entry = findPeerCacheEntry(dataVer);
+    if (entry != nullptr) {
+        if (filesize == 0) {
+            peerCache.erase(peerCache.begin() + (entry - peerCache.data()));
+        } else {
+            entry->size = filesize;
+            entry->fetching = false;
+            trimPeerCache();
+        }
+    }
+    lock.unlock();
+    peerCacheChanged.notify_all();
+    return filesize;
+}
+
 void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP) {
     tagRecord* taginfo = tagRecord::findByMAC(pending->targetMac);
-    if (taginfo == nullptr) {
+    if (taginfo == nullptr || taginfo->isExternal || pending->availdatainfo.dataType == DATATYPE_FW_UPDATE) {
         return;
     }
-    if (taginfo->isExternal == false) {
-        switch (pending->availdatainfo.dataType) {
-            case DATATYPE_IMG_DIFF:
-            case DATATYPE_IMG_ZLIB:
-            case DATATYPE_IMG_RAW_1BPP:
-            case DATATYPE_IMG_RAW_2BPP: {
-                char hexmac[17];
-                mac2hex(pending->targetMac, hexmac);
-                String filename = "/current/" + String(hexmac) + "_" + String(millis() % 1000000) + ".pending";
-                char md5[17];
-                mac2hex(reinterpret_cast<uint8_t*>(&pending->availdatainfo.dataVer), md5);
-                char imageUrl[80];
-                snprintf(imageUrl, sizeof(imageUrl), "http://%s/getdata?mac=%s&md5=%s", remoteIP.toString().c_str(), hexmac, md5);
-                wsLog("prepareExternalDataAvail GET " + String(imageUrl));
-                HTTPClient http;
-                http.begin(imageUrl);
-                int httpCode = http.GET();
-                if (httpCode == 200) {
-                    xSemaphoreTake(fsMutex, portMAX_DELAY);
-                    File file = contentFS->open(filename, "w");
-                    http.writeToStream(&file);
-                    file.close();
-                    xSemaphoreGive(fsMutex);
-                } else if (httpCode == 404) {
-                    snprintf(imageUrl, sizeof(imageUrl), "http://%s/current/%s.raw", remoteIP.toString().c_str(), hexmac);
-                    // imageUrl = "http://" + remoteIP.toString() + "/current/" + String(hexmac) + ".raw";
-                    http.end();
-                    http.begin(imageUrl);
-                    httpCode = http.GET();
-                    if (httpCode == 200) {
-                        xSemaphoreTake(fsMutex, portMAX_DELAY);
-                        File file = contentFS->open(filename, "w");
-                        http.writeToStream(&file);
-                        file.close();
-                        xSemaphoreGive(fsMutex);
-                    }
-                } else {
-                    logLine("prepareExternalDataAvail " + String(imageUrl) + " error " + String(httpCode));
-                    wsLog("error " + String(httpCode));
-                }
-                http.end();
 
-                fs::File file = contentFS->open(filename);
-                uint32_t filesize = file.size();
-                if (filesize == 0) {
-                    file.close();
-                    wsErr("Remote file not found. " + filename);
-                    return;
-                }
+    if (peerFetchSignal == nullptr) {
+        // the cache index is not persistent, start with an empty cache directory
+        takeFsMutex();
+        contentFS->mkdir(PEER_CACHE_DIR);
+        // collect the names first, removing files while iterating the directory skips entries
+        std::vector<String> stale;
+        File dir = contentFS->open(PEER_CACHE_DIR);
+        File file = dir.openNextFile();
+        while (file) {
+            stale.push_back(file.path());
+            file.close();
+            file = dir.openNextFile();
+        }
+        dir.close();
+        for (const String& filename : stale) contentFS->remove(filename);
+        xSemaphoreGive(fsMutex);
+
+        // one more than the job queue for every worker, for the job it is on
+        peerFetchDoneQueue = xQueueCreate(PEER_FETCH_QUEUE + PEER_FETCH_WORKERS, sizeof(peerFetchResult*));
+        peerFetchSignal = xSemaphoreCreateCounting(PEER_FETCH_QUEUE, 0);
+        for (uint8_t i = 0; i < PEER_FETCH_WORKERS; i++) {
+            xTaskCreate(peerFetchTask, "peerfetch", 6000, NULL, 2, NULL);
+        }
+    }
 
-                uint8_t md5bytes[16];
-                {
-                    MD5Builder md5;
-                    md5.begin();
-                    md5.addStream(file, filesize);
-                    md5.calculate();
-                    md5.getBytes(md5bytes);
-                }
+    peerFetchJob job;
+    job.pending = *pending;
+    job.remoteIP = remoteIP;
+    if (!queuePeerFetch(job)) {
+        wsErr("Peer fetch queue full, dropping announcement");
+    }
+}
 
-                file.close();
-                clearPending(taginfo);
-                taginfo->filename = filename;
-                taginfo->len = filesize;
-                taginfo->dataType = pending->availdatainfo.dataType;
-                taginfo->pendingCount++;
-                break;
+// runs on a peer fetch worker and doesn't touch the tagDB, returns nullptr if there is nothing to apply
+static peerFetchResult* fetchExternalData(const struct pendingData* pending, IPAddress remoteIP) {
+    char hexmac[17];
+    mac2hex(pending->targetMac, hexmac);
+    switch (pending->availdatainfo.dataType) {
+        case DATATYPE_IMG_DIFF:
+        case DATATYPE_IMG_ZLIB:
+        case DATATYPE_IMG_RAW_1BPP:
+        case DATATYPE_IMG_RAW_2BPP: {
+            char cachePath[40];
+            const uint32_t filesize = fetchPeerCache(pending->availdatainfo.dataVer, remoteIP, hexmac, cachePath, sizeof(cachePath));
+            if (filesize == 0) {
+                wsErr("Could not fetch image " + String(cachePath) + " from " + remoteIP.toString());
+                return nullptr;
             }
-            case DATATYPE_NFC_RAW_CONTENT:
-            case DATATYPE_NFC_URL_DIRECT:
-            case DATATYPE_CUSTOM_LUT_OTA: {
-                char hexmac[17];
-                mac2hex(pending->targetMac, hexmac);
-                char dataUrl[80];
-                char md5[17];
-                mac2hex(reinterpret_cast<uint8_t*>(&pending->availdatainfo.dataVer), md5);
-                snprintf(dataUrl, sizeof(dataUrl), "http://%s/getdata?mac=%s&md5=%s", remoteIP.toString().c_str(), hexmac, md5);
-                wsLog("GET " + String(dataUrl));
-                HTTPClient http;
-                logLine("http DATATYPE_CUSTOM_LUT_OTA " + String(dataUrl));
-                http.begin(dataUrl);
-                int httpCode = http.GET();
-                if (httpCode == 200) {
-                    size_t len = http.getSize();
-                    if (len > 0) {
-                        clearPending(taginfo);
-                        taginfo->data = new uint8_t[len];
-                        WiFiClient* stream = http.getStreamPtr();
-                        stream->readBytes(taginfo->data, len);
-                        taginfo->dataType = pending->availdatainfo.dataType;
-                        taginfo->pendingCount++;
-                        taginfo->len = len;
-                    }
+
+            // the pending file is moved or removed after the transfer, so every tag gets its own copy
+            String filename = "/current/" + String(hexmac) + "_" + String(millis() % 1000000) + ".pending";
+            takeFsMutex();
+            File in = contentFS->open(cachePath, "r");
+            File out = contentFS->open(filename, "w");
+            xSemaphoreGive(fsMutex);
+            if (in && out) copyFile(in, out);
+            takeFsMutex();
+            if (in) in.close();
+            if (out) out.close();
+            xSemaphoreGive(fsMutex);
+
+            return new peerFetchResult{*pending, filename, nullptr, filesize};
+        }
+        case DATATYPE_NFC_RAW_CONTENT:
+        case DATATYPE_NFC_URL_DIRECT:
+        case DATATYPE_CUSTOM_LUT_OTA: {
+            char dataUrl[80];
+            char md5[17];
+            mac2hex(reinterpret_cast<const uint8_t*>(&pending->availdatainfo.dataVer), md5);
+            snprintf(dataUrl, sizeof(dataUrl), "http://%s/getdata?mac=%s&md5=%s", remoteIP.toString().c_str(), hexmac, md5);
+            wsLog("GET " + String(dataUrl));
+            HTTPClient http;
+            logLine("http DATATYPE_CUSTOM_LUT_OTA " + String(dataUrl));
+            http.begin(dataUrl);
+            int httpCode = http.GET();
+            peerFetchResult* result = nullptr;
+            if (httpCode == 200) {
+                size_t len = http.getSize();
+                if (len > 0) {
+                    result = new peerFetchResult{*pending, String(), new uint8_t[len], (uint32_t)len};
+                    WiFiClient* stream = http.getStreamPtr();
+                    stream->readBytes(result->data, len);
                 }
-                http.end();
-                break;
-            }
-            case DATATYPE_FW_UPDATE: {
-                return;
             }
+            http.end();
+            return result;
         }
-        checkMirror(taginfo, pending);
-        queueDataAvail(pending, !taginfo->isExternal);
+    }
+    return nullptr;
+}
 
-        wsSendTaginfo(pending->targetMac, SYNC_NOSYNC);
+// hands the finished peer fetches to their tags, on the loop task
+void finishPeerFetches() {
+    if (peerFetchDoneQueue == nullptr) return;
+    peerFetchResult* result;
+    while (xQueueReceive(peerFetchDoneQueue, &result, 0) == pdTRUE) {
+        tagRecord* taginfo = tagRecord::findByMAC(result->pending.targetMac);
+        if (taginfo == nullptr || taginfo->isExternal) {
+            // the tag was deleted or taken over by another AP while fetching
+            if (result->filename.length()) {
+                takeFsMutex();
+                contentFS->remove(result->filename);
+                xSemaphoreGive(fsMutex);
+            }
+            delete[] result->data;
+        } else {
+            clearPending(taginfo);
+            if (result->data != nullptr) {
+                taginfo->data = result->data;
+            } else {
+                taginfo->filename = result->filename;
+            }
+            taginfo->len = result->len;
+            taginfo->dataType = result->pending.availdatainfo.dataType;
+            taginfo->pendingCount++;
+            checkMirror(taginfo, &result->pending);
+            queueDataAvail(&result->pending, true);
+
+            wsSendTaginfo(result->pending.targetMac, SYNC_NOSYNC);
+        }
+        delete result;
     }
 }
 
 void processBlockRequest(struct espBlockRequest* br) {
-    uint32_t t = millis();
     if (config.runStatus == RUNSTATUS_STOP) {
         return;
     }
@@ -384,24 +733,16 @@ void processBlockRequest(struct espBlockRequest* br) {
         Serial.print("Failed CRC on a blockrequest received by the AP");
         return;
     }
+    const uint32_t t = millis();
+    metricInc(METRIC_BLOCK_REQUESTS);
 
     PendingItem* queueItem = getQueueItem(br->src, br->ver);
     if (queueItem == nullptr) {
+        metricInc(METRIC_BLOCK_FAILED);
         prepareCancelPending(br->src);
         Serial.printf("blockrequest: couldn't find taginfo %02X%02X%02X%02X%02X%02X%02X%02X\r\n", br->src[7], br->src[6], br->src[5], br->src[4], br->src[3], br->src[2], br->src[1], br->src[0]);
         return;
     }
-    if (queueItem->data == nullptr) {
-        fs::File file = contentFS->open(queueItem->filename);
-        if (!file) {
-            Serial.print("No current file. " + String(queueItem->filename) + " Canceling request\r\n");
-            prepareCancelPending(br->src);
-            return;
-        }
-        queueItem->data = getDataForFile(file);
-        Serial.println("Reading file " + String(queueItem->filename) + " in  " + String(millis() - t) + "ms");
-        file.close();
-    }
 
     // check if we're not exceeding max blocks (to prevent sendBlock from exceeding its boundary)
     uint8_t totalblocks = (queueItem->len / BLOCK_DATA_SIZE);
@@ -411,7 +752,30 @@ void processBlockRequest(struct espBlockRequest* br) {
     }
     uint32_t len = queueItem->len - (BLOCK_DATA_SIZE * br->blockId);
     if (len > BLOCK_DATA_SIZE) len = BLOCK_DATA_SIZE;
-    uint16_t checksum = sendBlock(queueItem->data + (br->blockId * BLOCK_DATA_SIZE), len);
+
+    const uint8_t* blockData;
+    if (queueItem->data != nullptr) {
+        blockData = queueItem->data + (br->blockId * BLOCK_DATA_SIZE);
+    } else {
+        blockData = getBlockForFile(queueItem->filename, queueItem->pendingdata.availdatainfo.dataVer, br->blockId, len);
+        if (blockData == nullptr) {
+            metricInc(METRIC_BLOCK_FAILED);
+            Serial.print("No current file. " + String(queueItem->filename) + " Canceling request\r\n");
+            prepareCancelPending(br->src);
+            return;
+        }
+    }
+    uint16_t checksum = sendBlock(blockData, len);
+    metricObserve(METRIC_BLOCK_SERVICE_MS, millis() - t);
+    if (queueItem->data == nullptr) {
+        releaseBlock(blockData);
+        if (br->blockId + 1 < totalblocks) {
+            // tags request blocks in order, so read the next one while this one is still going out over the UART
+            uint32_t nextlen = queueItem->len - (BLOCK_DATA_SIZE * (br->blockId + 1));
+            if (nextlen > BLOCK_DATA_SIZE) nextlen = BLOCK_DATA_SIZE;
+            cacheBlockForFile(queueItem->filename, queueItem->pendingdata.availdatainfo.dataVer, br->blockId + 1, nextlen);
+        }
+    }
     char buffer[150];
     sprintf(buffer, "%02X%02X%02X%02X%02X%02X%02X%02X block request %s block %d, len %d checksum %u\0", br->src[7], br->src[6], br->src[5], br->src[4], br->src[3], br->src[2], br->src[1], br->src[0], queueItem->filename, br->blockId, len, checksum);
     wsLog((String)buffer);
@@ -422,6 +786,7 @@ void processXferComplete(struct espXferComplete* xfc, bool local) {
     if (config.runStatus == RUNSTATUS_STOP) {
         return;
     }
+    metricInc(METRIC_XFER_COMPLETE);
     char buffer[64];
     sprintf(buffer, "%02X%02X%02X%02X%02X%02X%02X%02X reports xfer complete\r\n\0", xfc->src[7], xfc->src[6], xfc->src[5], xfc->src[4], xfc->src[3], xfc->src[2], xfc->src[1], xfc->src[0]);
     wsLog((String)buffer);
@@ -487,6 +852,7 @@ void processXferTimeout(struct espXferComplete* xfc, bool local) {
     if (config.runStatus == RUNSTATUS_STOP) {
         return;
     }
+    metricInc(METRIC_XFER_TIMEOUT);
     char buffer[64];
     sprintf(buffer, "< %02X%02X%02X%02X%02X%02X%02X%02X xfer timeout\r\n\0", xfc->src[7], xfc->src[6], xfc->src[5], xfc->src[4], xfc->src[3], xfc->src[2], xfc->src[1], xfc->src[0]);
     wsErr((String)buffer);
@@ -517,6 +883,7 @@ void processDataReq(struct espAvailDataReq* eadr, bool local, IPAddress remoteIP
     if (config.runStatus == RUNSTATUS_STOP) {
         return;
     }
+    metricInc(METRIC_DATA_REQUESTS);
     char buffer[64];
 
     char hexmac[17];
@@ -556,6 +923,15 @@ void processDataReq(struct espAvailDataReq* eadr, bool local, IPAddress remoteIP
         taginfo->apIp = IPAddress(0, 0, 0, 0);
     }
 
+    // learn how far this tag drifts from the check-in time we asked for
+    if (local && taginfo->lastseen && taginfo->expectedNextCheckin > taginfo->lastseen && taginfo->expectedNextCheckin != 3216153600) {
+        const int32_t error = now - taginfo->expectedNextCheckin;
+        if (abs(error) < 600) {
+            metricObserve(METRIC_CHECKIN_ERROR_S, abs(error - taginfo->checkinDrift));
+            taginfo->checkinDrift += (error - taginfo->checkinDrift) / 4;
+        }
+    }
+
     if (taginfo->pendingIdle == 0) {
         taginfo->expectedNextCheckin = now + 60;
     } else if (taginfo->pendingIdle == 9999) {
@@ -599,6 +975,7 @@ void processDataReq(struct espAvailDataReq* eadr, bool local, IPAddress remoteIP
         taginfo->capabilities = eadr->adr.capabilities;
         taginfo->currentChannel = eadr->adr.currentChannel;
         taginfo->tagSoftwareVersion = eadr->adr.tagSoftwareVersion;
+        telemetryAdd(eadr->src, now, eadr->adr.batteryMv, eadr->adr.temperature, eadr->adr.lastPacketRSSI, eadr->adr.lastPacketLQI, eadr->adr.wakeupReason);
     }
     if (local) {
         sprintf(buffer, "<ADR %02X%02X%02X%02X%02X%02X%02X%02X\r\n\0", eadr->src[7], eadr->src[6], eadr->src[5], eadr->src[4], eadr->src[3], eadr->src[2], eadr->src[1], eadr->src[0]);
@@ -627,6 +1004,10 @@ void processTagReturnData(struct espTagReturnData* trd, uint8_t len, bool local)
     sprintf(buffer, "TRD Data: len=%d, type=%d, ver=0x%08X\r\n", payloadLength, trd->returnData.dataType, trd->returnData.dataVer);
     wsLog((String)buffer);
 
+    time_t now;
+    time(&now);
+    telemetryAddReturn(trd->src, now, trd->returnData.dataType, trd->returnData.data, payloadLength);
+
 #ifndef SAVE_SPACE
     TagData::parse(trd->src, trd->returnData.dataType, trd->returnData.data, payloadLength);
 #endif
@@ -837,7 +1218,7 @@ bool checkMirror(struct tagRecord* taginfo, struct pendingData* pending) {
                 } else {
                     char dst_path[64];
                     sprintf(dst_path, "/current/%02X%02X%02X%02X%02X%02X%02X%02X_%lu.pending", taginfo2->mac[7], taginfo2->mac[6], taginfo2->mac[5], taginfo2->mac[4], taginfo2->mac[3], taginfo2->mac[2], taginfo2->mac[1], taginfo2->mac[0], millis() % 1000000);
-                    xSemaphoreTake(fsMutex, portMAX_DELAY);
+                    takeFsMutex();
                     File file = contentFS->open(dst_path, "w");
                     if (file) {
                         file.write(taginfo2->data, taginfo2->len);
@@ -860,6 +1241,7 @@ bool checkMirror(struct tagRecord* taginfo, struct pendingData* pending) {
 void enqueueItem(struct PendingItem& item) {
     std::lock_guard<std::mutex> lock(queueMutex);
     pendingQueue.push_back(item);
+    metricSet(METRIC_PENDING_QUEUE, pendingQueue.size());
 }
 
 bool dequeueItem(const uint8_t* targetMac) {
@@ -888,6 +1270,7 @@ bool dequeueItem(const uint8_t* targetMac, const uint64_t dataVer) {
             it->data = nullptr;
         }
         pendingQueue.erase(it);
+        metricSet(METRIC_PENDING_QUEUE, pendingQueue.size());
         return true;
     }
     return false;
@@ -952,15 +1335,9 @@ bool queueDataAvail(struct pendingData* pending, bool local) {
         newPending.data = taginfo->data;
         taginfo->data = nullptr;
     } else {
+        // blocks are read from the file when requested, see getBlockForFile
         newPending.data = nullptr;
-
-        // optional: read data early, don't wait for block request.
-        fs::File file = contentFS->open(newPending.filename);
-        if (file) {
-            newPending.data = getDataForFile(file);
-            Serial.println("Reading file " + String(newPending.filename));
-            file.close();
-        } else {
+        if (!contentFS->exists(newPending.filename)) {
             Serial.println("Warning: not found: " + String(newPending.filename));
         }
     }
@@ -986,6 +1363,9 @@ bool queueDataAvail(struct pendingData* pending, bool local) {
         Serial.printf("queue item added, total %d elements\r\n", taginfo->pendingCount);
         // to do: notify C6 to shorten the checkin time for the current SDA
     }
+#ifdef HAS_BLE_WRITER
+    if ((taginfo->hwType & 0xB0) == 0xB0) BLE_wakeup();
+#endif
 
     if (local) checkQueue(pending->targetMac);
 
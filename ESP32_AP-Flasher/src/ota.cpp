@@ -6,9 +6,15 @@
 #include <HTTPClient.h>
 #include <MD5Builder.h>
 #include <Update.h>
+#include <esp_ota_ops.h>
+#include <rom/miniz.h>
+
+#include <functional>
 
 #include "espflasher.h"
 #include "leds.h"
+#include "ota_delta.h"
+#include "ota_resume.h"
 #include "serialap.h"
 #include "storage.h"
 #include "tag_db.h"
@@ -129,7 +135,7 @@ void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_
                 memcpy(&uploadInfo->buffer[uploadInfo->bufferSize], data, len);
                 uploadInfo->bufferSize += len;
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                takeFsMutex();
                 File file = contentFS->open(uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
@@ -148,7 +154,7 @@ void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_
         }
         if (final) {
             if (uploadInfo->bufferSize > 0) {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                takeFsMutex();
                 File file = contentFS->open(uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
@@ -175,6 +181,7 @@ struct FirmwareUpdateParams {
     String url;
     String md5;
     size_t size;
+    String deltaUrl;
 };
 
 void handleUpdateOTA(AsyncWebServerRequest* request) {
@@ -183,6 +190,7 @@ void handleUpdateOTA(AsyncWebServerRequest* request) {
         params->url = request->getParam("url", true)->value();
         params->md5 = request->getParam("md5", true)->value();
         params->size = request->getParam("size", true)->value().toInt();
+        if (request->hasParam("delta", true)) params->deltaUrl = request->getParam("delta", true)->value();
         xTaskCreate(firmwareUpdateTask, "OTAUpdateTask", 6144, params, 10, NULL);
 
         request->send(200, "text/plain", "In progress");
@@ -201,73 +209,242 @@ void firmwareUpdateTask(void* parameter) {
         const char* url = params->url.c_str();
         const char* md5 = params->md5.c_str();
         const size_t size = params->size;
-        updateFirmware(url, md5, size);
+        updateFirmware(url, md5, size, params->deltaUrl.c_str());
     }
 
     delete params;
     vTaskDelete(NULL);
 }
 
-void updateFirmware(const char* url, const char* expectedMd5, const size_t size) {
-    util::printHeap();
+#define OTA_BUFFER_SIZE 4096
+#define OTA_MAX_RETRIES 5
+#define OTA_STALL_TIMEOUT 15000
+
+// Downloads url and hands the body to sink in pieces. When the connection drops, the
+// download continues from the current offset with a Range request, so the receiver
+// never sees a byte twice. Servers that ignore Range get the already received part skipped.
+static bool downloadResumable(const char* url, const std::function<bool(uint8_t*, size_t)>& sink) {
+    uint8_t* buffer = (uint8_t*)malloc(OTA_BUFFER_SIZE);
+    if (!buffer) return false;
+
+    OtaResume resume;
+    uint8_t retries = 0;
+    bool result = false;
+
+    while (retries < OTA_MAX_RETRIES) {
+        HTTPClient httpClient;
+        httpClient.begin(url);
+        httpClient.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+        httpClient.setTimeout(OTA_STALL_TIMEOUT);
+        if (resume.rangeStart()) httpClient.addHeader("Range", "bytes=" + String(resume.rangeStart()) + "-");
+
+        const int httpCode = httpClient.GET();
+        if (!resume.begin(httpCode, httpClient.getSize())) {
+            wsSerial("Download failed (HTTP code " + String(httpCode) + ")");
+            httpClient.end();
+            retries++;
+            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            continue;
+        }
 
-    config.runStatus = RUNSTATUS_STOP;
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
-    saveDB("/current/tagDB.json");
-    // destroyDB();
+        WiFiClient* stream = httpClient.getStreamPtr();
+        uint32_t lastData = millis();
+        bool sinkError = false;
+        while (resume.wantsMore() && (httpClient.connected() || stream->available())) {
+            const size_t available = stream->available();
+            if (!available) {
+                if (millis() - lastData > OTA_STALL_TIMEOUT) break;
+                vTaskDelay(10 / portTICK_PERIOD_MS);
+                continue;
+            }
+            size_t len = stream->readBytes(buffer, min(available, (size_t)OTA_BUFFER_SIZE));
+            lastData = millis();
+            len = resume.take(buffer, len);
+            if (!len) continue;
+            if (!sink(buffer, len)) {
+                sinkError = true;
+                break;
+            }
+            retries = 0;
+        }
+        httpClient.end();
 
-    HTTPClient httpClient;
+        if (sinkError) break;
+        if (resume.complete()) {
+            result = true;
+            break;
+        }
+        retries++;
+        wsSerial("Connection lost at " + String(resume.rangeStart()) + " bytes, resuming");
+        vTaskDelay(2000 / portTICK_PERIOD_MS);
+    }
 
+    free(buffer);
+    return result;
+}
+
+static void beginProgress() {
+    unsigned long progressTimer = millis();
+    Update.onProgress([progressTimer](size_t progress, size_t total) mutable {
+        if (millis() - progressTimer > 500 || progress == total) {
+            char buffer[50];
+            sprintf(buffer, "Progress: %u%% %d %d", progress * 100 / total, progress, total);
+            wsSerial(String(buffer));
+            progressTimer = millis();
+            vTaskDelay(1 / portTICK_PERIOD_MS);
+        }
+    });
+}
+
+static bool beginUpdate(const size_t size, const char* expectedMd5) {
+    if (!Update.begin(size)) {
+        wsSerial("Failed to begin firmware update");
+        wsSerial(Update.errorString());
+        return false;
+    }
+    Update.setMD5(expectedMd5);
+    beginProgress();
+    return true;
+}
+
+static bool checkDeltaBase(const OtaDeltaHeader& header, const esp_partition_t* running) {
+    if (memcmp(header.magic, OTA_DELTA_MAGIC, sizeof(header.magic)) != 0) {
+        wsSerial("Not a firmware delta file");
+        return false;
+    }
+    if (header.oldSize > running->size) return false;
+
+    uint8_t buffer[256];
+    MD5Builder md5;
+    md5.begin();
+    for (uint32_t pos = 0; pos < header.oldSize; pos += sizeof(buffer)) {
+        const size_t len = min((uint32_t)sizeof(buffer), header.oldSize - pos);
+        if (esp_partition_read(running, pos, buffer, len) != ESP_OK) return false;
+        md5.add(buffer, len);
+    }
+    md5.calculate();
+    uint8_t runningMd5[16];
+    md5.getBytes(runningMd5);
+    if (memcmp(runningMd5, header.oldMd5, sizeof(runningMd5)) != 0) {
+        wsSerial("Delta was made for a different firmware version");
+        return false;
+    }
+    return true;
+}
+
+struct OtaInflateState {
+    tinfl_decompressor inflator;
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+};
+
+// Downloads the delta, inflates it and writes the patched image. Update is begun only after
+// the header matched the running firmware, a false return with Update still running is aborted by the caller.
+static bool updateFromDelta(const char* deltaUrl, const char* expectedMd5, const size_t size) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    OtaInflateState* state = (OtaInflateState*)malloc(sizeof(OtaInflateState));
+    if (running == nullptr || state == nullptr) {
+        free(state);
+        return false;
+    }
+    tinfl_init(&state->inflator);
+    size_t dictOfs = 0;
+    bool inflated = false;
+
+    OtaDeltaHeader header;
+    size_t headerLen = 0;
+    OtaDeltaPatcher* patcher = nullptr;
+
+    wsSerial("start downloading delta");
+    wsSerial(deltaUrl);
+    const bool downloaded = downloadResumable(deltaUrl, [&](uint8_t* data, size_t len) {
+        if (headerLen < sizeof(header)) {
+            const size_t chunk = min(len, sizeof(header) - headerLen);
+            memcpy((uint8_t*)&header + headerLen, data, chunk);
+            headerLen += chunk;
+            data += chunk;
+            len -= chunk;
+            if (headerLen < sizeof(header)) return true;
+            if (header.newSize != size || !checkDeltaBase(header, running)) return false;
+            if (!beginUpdate(size, expectedMd5)) return false;
+            patcher = new OtaDeltaPatcher(
+                header.oldSize, header.newSize,
+                [running](uint32_t pos, uint8_t* buffer, size_t len) {
+                    return esp_partition_read(running, pos, buffer, len) == ESP_OK;
+                },
+                [](const uint8_t* buffer, size_t len) {
+                    return Update.write(const_cast<uint8_t*>(buffer), len) == len;
+                });
+        }
+        while (!inflated) {
+            size_t inBytes = len;
+            size_t outBytes = TINFL_LZ_DICT_SIZE - dictOfs;
+            const tinfl_status status = tinfl_decompress(&state->inflator, data, &inBytes, state->dict, state->dict + dictOfs, &outBytes,
+                                                         TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+            data += inBytes;
+            len -= inBytes;
+            if (outBytes && !patcher->write(state->dict + dictOfs, outBytes)) return false;
+            dictOfs = (dictOfs + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+            if (status < TINFL_STATUS_DONE) return false;
+            if (status == TINFL_STATUS_DONE) inflated = true;
+            if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) break;
+        }
+        return true;
+    });
+
+    const bool result = downloaded && inflated && patcher != nullptr && patcher->complete();
+    if (!result && patcher != nullptr) wsSerial("Failed to apply firmware delta");
+    delete patcher;
+    free(state);
+    return result;
+}
+
+static bool updateFromImage(const char* url, const char* expectedMd5, const size_t size) {
     wsSerial("start downloading");
     wsSerial(url);
+    if (!beginUpdate(size, expectedMd5)) return false;
+    const bool result = downloadResumable(url, [](uint8_t* data, size_t len) {
+        return Update.write(data, len) == len;
+    });
+    if (!result || Update.progress() != size) {
+        wsSerial("Error writing firmware data:");
+        wsSerial(Update.errorString());
+        return false;
+    }
+    return true;
+}
 
-    httpClient.begin(url);
-    httpClient.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-    util::printHeap();
-    const int httpCode = httpClient.GET();
+// Tries the delta first when one is offered, and falls back to the full image. The AP keeps
+// running during the download, it is only stopped once a verified image is in the OTA partition.
+void updateFirmware(const char* url, const char* expectedMd5, const size_t size, const char* deltaUrl) {
     util::printHeap();
 
-    if (httpCode == HTTP_CODE_OK) {
-        if (Update.begin(size)) {
-            Update.setMD5(expectedMd5);
-
-            unsigned long progressTimer = millis();
-            Update.onProgress([&progressTimer](size_t progress, size_t total) {
-                if (millis() - progressTimer > 500 || progress == total) {
-                    char buffer[50];
-                    sprintf(buffer, "Progress: %u%% %d %d", progress * 100 / total, progress, total);
-                    wsSerial(String(buffer));
-                    progressTimer = millis();
-                    vTaskDelay(1 / portTICK_PERIOD_MS);
-                }
-            });
-
-            const size_t written = Update.writeStream(httpClient.getStream());
-            if (written == httpClient.getSize()) {
-                if (Update.end(true)) {
-                    wsSerial("Firmware update successful");
-                    wsSerial("Reboot system now");
-                    wsSerial("[reboot]");
-                    vTaskDelay(1000 / portTICK_PERIOD_MS);
-                } else {
-                    wsSerial("Error updating firmware:");
-                    wsSerial(Update.errorString());
-                }
-            } else {
-                wsSerial("Error writing firmware data:");
-                wsSerial(Update.errorString());
-            }
-        } else {
-            wsSerial("Failed to begin firmware update");
-            wsSerial(Update.errorString());
+    bool written = false;
+    if (deltaUrl != nullptr && deltaUrl[0]) {
+        written = updateFromDelta(deltaUrl, expectedMd5, size);
+        if (!written) {
+            if (Update.isRunning()) Update.abort();
+            wsSerial("Falling back to the full firmware image");
         }
-    } else {
-        wsSerial("Failed to download firmware file (HTTP code " + String(httpCode) + ")");
-        wsSerial(httpClient.errorToString(httpCode));
     }
+    if (!written) written = updateFromImage(url, expectedMd5, size);
 
-    httpClient.end();
-    config.runStatus = RUNSTATUS_RUN;
+    if (!written) {
+        if (Update.isRunning()) Update.abort();
+        return;
+    }
+    if (!Update.end(true)) {
+        wsSerial("Error updating firmware:");
+        wsSerial(Update.errorString());
+        return;
+    }
+
+    config.runStatus = RUNSTATUS_STOP;
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    saveDB("/current/tagDB.json");
+    wsSerial("Firmware update successful");
+    wsSerial("Reboot system now");
+    wsSerial("[reboot]");
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
 }
 
 void handleRollback(AsyncWebServerRequest* request) {
@@ -7,6 +7,7 @@
 #include "contentmanager.h"
 #include "flasher.h"
 #include "leds.h"
+#include "metrics.h"
 #include "newproto.h"
 #include "powermgt.h"
 #include "settings.h"
@@ -23,6 +24,8 @@ SemaphoreHandle_t txActive;
 #define CMD_REPLY_NOK 0x02
 #define CMD_REPLY_NOQ 0x03
 volatile uint8_t cmdReplyValue = CMD_REPLY_WAIT;
+// task that holds txActive, gets notified by rxSerialTask as soon as a reply comes in
+volatile TaskHandle_t cmdReplyTask = nullptr;
 
 #define AP_SERIAL_PORT Serial1
 volatile bool rxSerialStopTask2 = false;
@@ -73,7 +76,10 @@ bool txStart() {
         if (xPortInIsrContext()) {
             if (xSemaphoreTakeFromISR(txActive, NULL) == pdTRUE) return true;
         } else {
-            if (xSemaphoreTake(txActive, portTICK_PERIOD_MS)) return true;
+            if (xSemaphoreTake(txActive, portTICK_PERIOD_MS)) {
+                cmdReplyTask = xTaskGetCurrentTaskHandle();
+                return true;
+            }
         }
         vTaskDelay(10 / portTICK_PERIOD_MS);
         Serial.println("wait... tx busy");
@@ -82,6 +88,7 @@ bool txStart() {
     return false;
 }
 void txEnd() {
+    cmdReplyTask = nullptr;
     if (xPortInIsrContext()) {
         xSemaphoreGiveFromISR(txActive, NULL);
     } else {
@@ -90,27 +97,37 @@ void txEnd() {
 }
 bool waitCmdReply() {
     uint32_t val = millis();
-    while (millis() < val + 200) {
+    while (millis() - val < 200) {
         switch (cmdReplyValue) {
             case CMD_REPLY_WAIT:
                 break;
             case CMD_REPLY_ACK:
+                metricInc(METRIC_RADIO_ACK);
                 lastAPActivity = millis();
                 if (apInfo.isOnline == false)
                     setAPstate(true, AP_STATE_ONLINE);
                 return true;
                 break;
             case CMD_REPLY_NOK:
+                metricInc(METRIC_RADIO_NOK);
                 lastAPActivity = millis();
                 return false;
                 break;
             case CMD_REPLY_NOQ:
+                metricInc(METRIC_RADIO_NOQ);
                 lastAPActivity = millis();
                 return false;
                 break;
         }
-        vTaskDelay(1 / portTICK_RATE_MS);
+        if (cmdReplyTask == xTaskGetCurrentTaskHandle()) {
+            // sleep until rxSerialTask signals a reply (or the timeout expires)
+            const TickType_t remaining = (200 - (millis() - val)) / portTICK_PERIOD_MS;
+            ulTaskNotifyTake(pdTRUE, remaining ? remaining : 1);
+        } else {
+            vTaskDelay(1 / portTICK_RATE_MS);
+        }
     }
+    metricInc(METRIC_RADIO_TIMEOUT);
     return false;
 }
 
@@ -181,74 +198,67 @@ void APTagReset() {
 }
 
 // Send data to the AP
+// Encoded block as it goes over the wire: blockData header, the data, 0x55 padding and 32 dummy bytes
+#define BLOCK_TX_DUMMY_BYTES 32
+#define BLOCK_TX_BUFFER_SIZE (sizeof(struct blockData) + BLOCK_DATA_SIZE + BLOCK_TX_DUMMY_BYTES)
+uint8_t* blockTxBuffer = nullptr;
+
 uint16_t sendBlock(const void* data, const uint16_t len) {
     time_t timeCanary = millis();
     if (apInfo.state == AP_STATE_NORADIO) return true;
     if (!apInfo.isOnline) return false;
+    if (len > BLOCK_DATA_SIZE) return 0;
+    if (blockTxBuffer == nullptr) {
+        blockTxBuffer = static_cast<uint8_t*>(heap_caps_malloc(BLOCK_TX_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT));
+        if (blockTxBuffer == nullptr) {
+            Serial.print("Failed to allocate block buffer\r\n");
+            return 0;
+        }
+    }
+
+    // prepare the encoded block before the handshake, so it can be sent out in one go
+    struct blockData* bd = reinterpret_cast<struct blockData*>(blockTxBuffer);
+    uint8_t* blockBytes = blockTxBuffer + sizeof(struct blockData);
+    const uint8_t* dataBytes = reinterpret_cast<const uint8_t*>(data);
+    uint16_t checksum = 0;
+    for (uint16_t c = 0; c < len; c++) {
+        checksum += dataBytes[c];
+        blockBytes[c] = 0xAA ^ dataBytes[c];
+    }
+    bd->size = len;
+    bd->checksum = checksum;
+    for (size_t i = 0; i < sizeof(struct blockData); i++) {
+        blockTxBuffer[i] ^= 0xAA;
+    }
+    // fill the rest of the block-length filled with something else (will end up as 0xFF in the buffer)
+    memset(blockBytes + len, 0x55, BLOCK_DATA_SIZE - len);
+    // dummy bytes in case some bytes were missed, makes sure the AP gets kicked out of data-loading mode
+    memset(blockBytes + BLOCK_DATA_SIZE, 0xF5, BLOCK_TX_DUMMY_BYTES);
+
     if (!txStart()) return 0;
     // don't retry now, as it collides with communication from the tag
     for (uint8_t attempt = 0; attempt < 1; attempt++) {
         cmdReplyValue = CMD_REPLY_WAIT;
         AP_SERIAL_PORT.print(">D>");
         if (waitCmdReply()) goto blksend;
+        metricInc(METRIC_RADIO_RETRIES);
         Serial.printf("block send failed in try %d\r\n", attempt);
     }
     Serial.print("Failed sending block...\r\n");
     txEnd();
     return 0;
 blksend:
-    uint8_t blockbuffer[sizeof(struct blockData)];
-    struct blockData* bd = (struct blockData*)blockbuffer;
-    bd->size = len;
-    bd->checksum = 0;
-
-    // calculate checksum
-    const uint8_t* dataBytes = reinterpret_cast<const uint8_t*>(data);
-    for (uint16_t c = 0; c < len; c++) {
-        bd->checksum += dataBytes[c];
-    }
-
-    // send blockData header
-    dataBytes = reinterpret_cast<const uint8_t*>(&blockbuffer);
-    const size_t bufferSize = sizeof(struct blockData);
-    uint8_t* modifiedHeader = static_cast<uint8_t*>(malloc(bufferSize));
-    if (modifiedHeader != nullptr) {
-        for (size_t i = 0; i < bufferSize; i++) {
-            modifiedHeader[i] = 0xAA ^ dataBytes[i];
-        }
-        AP_SERIAL_PORT.write(modifiedHeader, bufferSize);
-        free(modifiedHeader);
-    }
+    AP_SERIAL_PORT.write(blockTxBuffer, BLOCK_TX_BUFFER_SIZE);
 
-    // send an entire block of data
-    uint16_t c;
-    dataBytes = reinterpret_cast<const uint8_t*>(data);
-    uint8_t* modifiedBuffer = static_cast<uint8_t*>(malloc(len));
-    if (modifiedBuffer != nullptr) {
-        for (c = 0; c < len; c++) {
-            modifiedBuffer[c] = 0xAA ^ dataBytes[c];
-        }
-        AP_SERIAL_PORT.write(modifiedBuffer, len);
-        free(modifiedBuffer);
-    }
-
-    // fill the rest of the block-length filled with something else (will end up as 0xFF in the buffer)
-    const size_t remainingBytes = BLOCK_DATA_SIZE - c;
-    if (remainingBytes > 0) {
-        uint8_t fillBuffer[remainingBytes];
-        memset(fillBuffer, 0x55, remainingBytes);
-        AP_SERIAL_PORT.write(fillBuffer, remainingBytes);
+    if (apInfo.type != ESP32_C6) {
+        // the TX ring buffer now takes the whole block, so wait for it to leave the UART first;
+        // without a ring buffer write() only returned then, the settle delay followed on the wire as before
+        AP_SERIAL_PORT.flush();
+        delay(10);
     }
-
-    // dummy bytes in case some bytes were missed, makes sure the AP gets kicked out of data-loading mode
-    uint8_t dummyBuffer[32];
-    memset(dummyBuffer, 0xF5, 32);
-    AP_SERIAL_PORT.write(dummyBuffer, 32);
-
-    if (apInfo.type != ESP32_C6) delay(10);
     txEnd();
     Serial.println("Sendblock complete, " + String(millis() - timeCanary) + "ms");
-    return bd->checksum;
+    return checksum;
 }
 
 bool sendDataAvail(struct pendingData* pending) {
@@ -266,6 +276,7 @@ bool sendDataAvail(struct pendingData* pending) {
             txEnd();
             return true;
         }
+        metricInc(METRIC_RADIO_RETRIES);
         Serial.printf("SDA send failed in try %d\r\n", attempt);
         delay(200);
     }
@@ -288,6 +299,7 @@ bool sendCancelPending(struct pendingData* pending) {
             txEnd();
             return true;
         }
+        metricInc(METRIC_RADIO_RETRIES);
         Serial.printf("CXD send failed in try %d\r\n", attempt);
     }
     Serial.print("CXD failed to send...\r\n");
@@ -311,6 +323,7 @@ bool sendChannelPower(struct espSetChannelPower* scp) {
             apInfo.power = scp->power;
             return true;
         }
+        metricInc(METRIC_RADIO_RETRIES);
         Serial.printf("SCP send failed in try %d\r\n", attempt);
     }
     Serial.print("SCP failed to send...\r\n");
@@ -452,6 +465,11 @@ void rxSerialTask(void* parameter) {
                     if ((strncmp(cmdbuffer, "ACK>", 4) == 0)) cmdReplyValue = CMD_REPLY_ACK;
                     if ((strncmp(cmdbuffer, "NOK>", 4) == 0)) cmdReplyValue = CMD_REPLY_NOK;
                     if ((strncmp(cmdbuffer, "NOQ>", 4) == 0)) cmdReplyValue = CMD_REPLY_NOQ;
+                    if (cmdReplyValue != CMD_REPLY_WAIT) {
+                        // txEnd() may clear it between a check and the use
+                        const TaskHandle_t replyTask = cmdReplyTask;
+                        if (replyTask != nullptr) xTaskNotifyGive(replyTask);
+                    }
 
                     if ((strncmp(cmdbuffer, "VER>", 4) == 0)) {
                         pktindex = 0;
@@ -823,6 +841,8 @@ void APTask(void* parameter) {
         return;
     }
 
+    // room for a complete block, so sendBlock can return while the UART is still transmitting
+    AP_SERIAL_PORT.setTxBufferSize(BLOCK_TX_BUFFER_SIZE + 128);
 #if (AP_PROCESS_PORT == FLASHER_AP_PORT)
     AP_SERIAL_PORT.begin(115200, SERIAL_8N1, FLASHER_AP_RXD, FLASHER_AP_TXD);
 #endif
@@ -7,11 +7,19 @@
 #endif
 
 #include "LittleFS.h"
+#include "filecopy.h"
+#include "metrics.h"
 
 DynStorage::DynStorage() : isInited(0) {}
 
 SemaphoreHandle_t fsMutex;
 
+void takeFsMutex() {
+    const uint32_t t = micros();
+    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    metricObserve(METRIC_FSMUTEX_WAIT_US, micros() - t);
+}
+
 static void initLittleFS() {
     LittleFS.begin();
     contentFS = &LittleFS;
@@ -54,70 +62,128 @@ uint64_t DynStorage::freeSpace(){
     return LittleFS.totalBytes() - LittleFS.usedBytes();
 }
 
+#define COPY_CHUNK_SIZE 8192
+#define COPY_CHUNK_MIN 512
+#define COPY_PROGRESS_BYTES (256 * 1024)
+
+// DMA capable internal RAM, so the SD driver can transfer straight from/to it without a bounce buffer
+static uint8_t* allocCopyBuffer(size_t& size) {
+    for (size = COPY_CHUNK_SIZE; size >= COPY_CHUNK_MIN; size /= 2) {
+        uint8_t* buf = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+        if (buf) return buf;
+    }
+    return nullptr;
+}
+
+// copies in large chunks; the caller doesn't hold fsMutex, it is taken per chunk so other tasks get the
+// filesystem in between
+static size_t copyChunks(File& in, File& out) {
+    const uint32_t t = millis();
+    const size_t total = in.size();
+    size_t bufSize;
+    uint8_t* buf = allocCopyBuffer(bufSize);
+    uint8_t fallback[64];
+    if (buf == nullptr) {
+        buf = fallback;
+        bufSize = sizeof(fallback);
+    }
+
+    size_t nextProgress = COPY_PROGRESS_BYTES;
+    const size_t copied = copyInChunks(
+        in, out, buf, bufSize, []() { takeFsMutex(); }, []() { xSemaphoreGive(fsMutex); },
+        [&nextProgress, total](const size_t copied) {
+            if (copied >= nextProgress) {
+                Serial.printf("Copied %u of %u bytes\r\n", copied, total);
+                nextProgress += COPY_PROGRESS_BYTES;
+            }
+        });
+    if (copied != total) Serial.printf("Copy failed after %u of %u bytes\r\n", copied, total);
+
+    if (buf != fallback) free(buf);
+    const uint32_t elapsed = millis() - t;
+    Serial.printf("Copied %u bytes in %u ms (%u kB/s)\r\n", copied, elapsed, elapsed ? copied / elapsed : 0);
+    return copied;
+}
+
 void copyFile(File in, File out) {
     Serial.print("Copying ");
     Serial.print(in.path());
     Serial.print(" to ");
     Serial.println(out.path());
 
-    size_t n;
-    uint8_t buf[64];
-    while ((n = in.read(buf, sizeof(buf))) > 0) {
-        out.write(buf, n);
-    }
+    copyChunks(in, out);
 }
 
 #ifdef HAS_SDCARD
 
 void copyBetweenFS(FS& sourceFS, const char* source_path, FS& targetFS) {
+    takeFsMutex();
     File root = sourceFS.open(source_path);
-    char next_path[128];
+    xSemaphoreGive(fsMutex);
 
     if (root.isDirectory()) {
-        if (!contentFS->exists(root.path())) {
-            if (!contentFS->mkdir(root.path())) {
-                Serial.print("Failed to create directory ");
-                Serial.println(root.path());
-                return;
-            }
+        takeFsMutex();
+        const bool exists = targetFS.exists(root.path()) || targetFS.mkdir(root.path());
+        xSemaphoreGive(fsMutex);
+        if (!exists) {
+            Serial.print("Failed to create directory ");
+            Serial.println(root.path());
+            takeFsMutex();
+            root.close();
+            xSemaphoreGive(fsMutex);
+            return;
         }
+        takeFsMutex();
         File file = root.openNextFile();
+        xSemaphoreGive(fsMutex);
         while (file) {
             if (file.isDirectory()) {
-                sprintf(next_path, "%s/%s\0", root.path(), file.path());
-
                 copyBetweenFS(sourceFS, file.path(), targetFS);
+                takeFsMutex();
+                file.close();
+                xSemaphoreGive(fsMutex);
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
-                File target = contentFS->open(file.path(), "w");
-                if (target) {
-                    copyFile(file, target);
-                    target.close();
-                    file.close();
-                    xSemaphoreGive(fsMutex);
-                } else {
-                    xSemaphoreGive(fsMutex);
+                takeFsMutex();
+                File target = targetFS.open(file.path(), "w");
+                xSemaphoreGive(fsMutex);
+                if (!target) {
                     Serial.print("Couldn't create high target file");
                     Serial.println(file.path());
+                    takeFsMutex();
+                    file.close();
+                    root.close();
+                    xSemaphoreGive(fsMutex);
                     return;
                 }
+                Serial.printf("Copying %s\r\n", file.path());
+                copyChunks(file, target);
+                takeFsMutex();
+                target.close();
+                file.close();
+                xSemaphoreGive(fsMutex);
             }
+            takeFsMutex();
             file = root.openNextFile();
+            xSemaphoreGive(fsMutex);
         }
-    } else {
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
-        File target = contentFS->open(root.path(), "w");
+    } else if (root) {
+        takeFsMutex();
+        File target = targetFS.open(root.path(), "w");
+        xSemaphoreGive(fsMutex);
         if (target) {
-            copyFile(root, target);
+            Serial.printf("Copying %s\r\n", root.path());
+            copyChunks(root, target);
+            takeFsMutex();
             target.close();
             xSemaphoreGive(fsMutex);
         } else {
-            xSemaphoreGive(fsMutex);
             Serial.print("Couldn't create target file ");
             Serial.println(root.path());
-            return;
         }
     }
+    takeFsMutex();
+    root.close();
+    xSemaphoreGive(fsMutex);
 }
 
 void copyIfNeeded(const char* path) {
@@ -155,21 +221,21 @@ void DynStorage::begin() {
 
 void DynStorage::end() {
 #ifdef HAS_SDCARD
+    // the files come from the SD card, initLittleFS() already points contentFS away from it
+    fs::FS* sdFS = contentFS;
     initLittleFS();
     if (SD_CARD_CLK == FLASHER_AP_CLK ||
         SD_CARD_MISO == FLASHER_AP_MISO ||
         SD_CARD_MOSI == FLASHER_AP_MOSI) {
         Serial.println("Tearing down SD card connection");
 
-        copyBetweenFS(*contentFS, "/tag_md5_db.json", LittleFS);
-        copyBetweenFS(*contentFS, "/AP_FW_Pack.bin", LittleFS);
-        if (contentFS->exists("/AP_force_flash.bin")) {
-            copyBetweenFS(*contentFS, "/AP_force_flash.bin", LittleFS);
-            contentFS->remove("/AP_force_flash.bin");
+        copyBetweenFS(*sdFS, "/tag_md5_db.json", LittleFS);
+        copyBetweenFS(*sdFS, "/AP_FW_Pack.bin", LittleFS);
+        if (sdFS->exists("/AP_force_flash.bin")) {
+            copyBetweenFS(*sdFS, "/AP_force_flash.bin", LittleFS);
+            sdFS->remove("/AP_force_flash.bin");
         }
-        Serial.println("Swapping to LittleFS");
-
-        contentFS = &LittleFS;
+        Serial.println("Swapped to LittleFS");
     }
 
 #endif
@@ -49,7 +49,7 @@ void logLine(const String& text) {
     const char* format = (now < (time_t)1672531200) ? "           %H:%M:%S " : "%Y-%m-%d %H:%M:%S ";
     strftime(timeStr, sizeof(timeStr), format, localtime(&now));
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    takeFsMutex();
     File logFile = contentFS->open("/log.txt", "a");
     if (logFile) {
         if (logFile.size() >= 10 * 1024) {
@@ -3,12 +3,14 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <FS.h>
+#include <esp_rom_crc.h>
 
 #include <unordered_map>
 #include <vector>
 
 #include "language.h"
 #include "storage.h"
+#include "tagdb_bin.h"
 #include "util.h"
 
 #define STR_IMPL(x) #x
@@ -130,7 +132,7 @@ void saveDB(const String& filename) {
 
     const long t = millis();
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    takeFsMutex();
 
     fs::File existingFile = contentFS->open(filename, "r");
     if (existingFile) {
@@ -171,6 +173,129 @@ void saveDB(const String& filename) {
     Serial.println("DB saved " + String(millis() - t) + "ms");
 }
 
+static void loadNode(JsonObject tag, const time_t now) {
+    String dst = tag["mac"].as<String>();
+    uint8_t mac[8];
+    if (hex2mac(dst, mac)) {
+        tagRecord* taginfo = tagRecord::findByMAC(mac);
+        if (taginfo == nullptr) {
+            taginfo = new tagRecord;
+            memcpy(taginfo->mac, mac, sizeof(taginfo->mac));
+            tagDB.push_back(taginfo);
+        }
+        String md5 = tag["hash"].as<String>();
+        if (md5.length() >= 32) {
+            for (uint8_t i = 0; i < 16; i++) {
+                taginfo->md5[i] = strtoul(md5.substring(i * 2, i * 2 + 2).c_str(), NULL, 16);
+            }
+        }
+        taginfo->lastseen = (uint32_t)tag["lastseen"];
+        taginfo->nextupdate = (uint32_t)tag["nextupdate"];
+        taginfo->expectedNextCheckin = (uint32_t)tag["nextcheckin"];
+        if (taginfo->expectedNextCheckin < now) {
+            taginfo->expectedNextCheckin = now + 1800;
+        }
+        taginfo->pendingCount = 0;
+        taginfo->alias = tag["alias"].as<String>();
+        taginfo->contentMode = tag["contentMode"];
+        taginfo->LQI = tag["LQI"];
+        taginfo->RSSI = tag["RSSI"];
+        taginfo->temperature = tag["temperature"];
+        taginfo->batteryMv = tag["batteryMv"];
+        taginfo->hwType = (uint8_t)tag["hwType"];
+        taginfo->wakeupReason = tag["wakeupReason"];
+        taginfo->capabilities = tag["capabilities"];
+        taginfo->modeConfigJson = tag["modecfgjson"].as<String>();
+        taginfo->isExternal = tag["isexternal"].as<bool>();
+        taginfo->apIp.fromString(tag["apip"].as<String>());
+        taginfo->rotate = tag["rotate"] | 0;
+        taginfo->lut = tag["lut"] | 0;
+        taginfo->invert = tag["invert"] | 0;
+        taginfo->updateCount = tag["updatecount"] | 0;
+        taginfo->updateLast = tag["updatelast"] | 0;
+        taginfo->currentChannel = tag["ch"] | 0;
+        taginfo->tagSoftwareVersion = tag["ver"] | 0;
+    }
+}
+
+static bool loadDBBinary(fs::File& readfile, const time_t now) {
+    DynamicJsonDocument doc(2500);
+    uint8_t* record = (uint8_t*)malloc(TAGDB_BIN_MAX_RECORD);
+    if (!record) {
+        Serial.println("loadDB: no memory for binary tagDB");
+        return false;
+    }
+    TagDBBinReader<fs::File> reader(readfile, record, esp_rom_crc32_le);
+    if (!reader.begin()) {
+        free(record);
+        Serial.println("loadDB: unsupported binary tagDB");
+        return false;
+    }
+    while (const uint16_t len = reader.next()) {
+        if (deserializeMsgPack(doc, record, len)) {
+            reader.reject();
+            continue;
+        }
+        loadNode(doc.as<JsonObject>(), now);
+    }
+    free(record);
+    if (reader.corrupt()) {
+        logLine("loadDB: corrupt record at " + String(reader.position()) + " in binary tagDB");
+        return false;
+    }
+    if (reader.badRecords()) {
+        logLine("loadDB: skipped " + String(reader.badRecords()) + " corrupt tagDB records");
+    }
+    return true;
+}
+
+void saveDBBinary(const String& filename) {
+    DynamicJsonDocument doc(2500);
+
+    const long t = millis();
+
+    takeFsMutex();
+    fs::File file = contentFS->open(filename, "w");
+    if (!file) {
+        Serial.println("saveDBBinary: Failed to open file for writing");
+        xSemaphoreGive(fsMutex);
+        return;
+    }
+
+    tagDBBinWriteHeader(file);
+
+    uint8_t* record = nullptr;
+    size_t recordSize = 0;
+    for (size_t c = 0; c < tagDB.size(); c++) {
+        const tagRecord* taginfo = tagDB.at(c);
+        if (taginfo->version != 0) continue;
+
+        doc.clear();
+        JsonObject tag = doc.to<JsonObject>();
+        fillNode(tag, taginfo);
+        const size_t len = measureMsgPack(doc);
+        if (len == 0 || len > TAGDB_BIN_MAX_RECORD) {
+            char hexmac[17];
+            mac2hex(taginfo->mac, hexmac);
+            logLine("saveDBBinary: skipped tag " + String(hexmac) + ", record too large");
+            continue;
+        }
+        if (len > recordSize) {
+            free(record);
+            record = (uint8_t*)malloc(len);
+            recordSize = record ? len : 0;
+            if (!record) break;
+        }
+        serializeMsgPack(doc, record, len);
+        tagDBBinWriteRecord(file, record, len, esp_rom_crc32_le);
+    }
+    free(record);
+
+    file.close();
+    xSemaphoreGive(fsMutex);
+    Serial.println("DB saved " + String(millis() - t) + "ms");
+}
+
 bool loadDB(const String& filename) {
     Serial.println("reading DB from " + String(filename));
     const long t = millis();
@@ -185,54 +310,23 @@ bool loadDB(const String& filename) {
     time(&now);
     bool parsing = true;
 
+    char magic[4];
+    if (readfile.readBytes(magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, TAGDB_BIN_MAGIC, sizeof(magic)) == 0) {
+        readfile.seek(0);
+        const bool result = loadDBBinary(readfile, now);
+        readfile.close();
+        Serial.println("loadDB took " + String(millis() - t) + "ms");
+        return result;
+    }
+    readfile.seek(0);
+
     if (readfile.find("[")) {
         DynamicJsonDocument doc(1000);
         while (parsing) {
             DeserializationError err = deserializeJson(doc, readfile);
             if (!err) {
                 JsonObject tag = doc[0];
-                String dst = tag["mac"].as<String>();
-                uint8_t mac[8];
-                if (hex2mac(dst, mac)) {
-                    tagRecord* taginfo = tagRecord::findByMAC(mac);
-                    if (taginfo == nullptr) {
-                        taginfo = new tagRecord;
-                        memcpy(taginfo->mac, mac, sizeof(taginfo->mac));
-                        tagDB.push_back(taginfo);
-                    }
-                    String md5 = tag["hash"].as<String>();
-                    if (md5.length() >= 32) {
-                        for (uint8_t i = 0; i < 16; i++) {
-                            taginfo->md5[i] = strtoul(md5.substring(i * 2, i * 2 + 2).c_str(), NULL, 16);
-                        }
-                    }
-                    taginfo->lastseen = (uint32_t)tag["lastseen"];
-                    taginfo->nextupdate = (uint32_t)tag["nextupdate"];
-                    taginfo->expectedNextCheckin = (uint32_t)tag["nextcheckin"];
-                    if (taginfo->expectedNextCheckin < now) {
-                        taginfo->expectedNextCheckin = now + 1800;
-                    }
-                    taginfo->pendingCount = 0;
-                    taginfo->alias = tag["alias"].as<String>();
-                    taginfo->contentMode = tag["contentMode"];
-                    taginfo->LQI = tag["LQI"];
-                    taginfo->RSSI = tag["RSSI"];
-                    taginfo->temperature = tag["temperature"];
-                    taginfo->batteryMv = tag["batteryMv"];
-                    taginfo->hwType = (uint8_t)tag["hwType"];
-                    taginfo->wakeupReason = tag["wakeupReason"];
-                    taginfo->capabilities = tag["capabilities"];
-                    taginfo->modeConfigJson = tag["modecfgjson"].as<String>();
-                    taginfo->isExternal = tag["isexternal"].as<bool>();
-                    taginfo->apIp.fromString(tag["apip"].as<String>());
-                    taginfo->rotate = tag["rotate"] | 0;
-                    taginfo->lut = tag["lut"] | 0;
-                    taginfo->invert = tag["invert"] | 0;
-                    taginfo->updateCount = tag["updatecount"] | 0;
-                    taginfo->updateLast = tag["updatelast"] | 0;
-                    taginfo->currentChannel = tag["ch"] | 0;
-                    taginfo->tagSoftwareVersion = tag["ver"] | 0;
-                }
+                loadNode(tag, now);
             } else {
                 Serial.print(F("deserializeJson() failed: "));
                 Serial.println(err.c_str());
@@ -347,7 +441,7 @@ void initAPconfig() {
 }
 
 void saveAPconfig() {
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    takeFsMutex();
     fs::File configFile = contentFS->open("/current/apconfig.json", "w");
     DynamicJsonDocument APconfig(500);
     APconfig["channel"] = config.channel;
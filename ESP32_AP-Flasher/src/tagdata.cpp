@@ -7,6 +7,34 @@
 
 std::unordered_map<size_t, TagData::Parser> TagData::parsers = {};
 
+/// @brief Lay out the fields of a parser once, so parsing does not have to walk the field definitions
+static void compileParser(TagData::Parser& parser) {
+    uint16_t offset = 0;
+    parser.ops.clear();
+    for (const TagData::Field& field : parser.fields) {
+        const TagData::FieldOp op = TagData::compileField(offset, field.type, field.length, field.decimals, field.mult.value_or(1.0));
+        if (op.type == TagData::Type::MAX) {
+            Serial.printf("Error: Float can only be 4 or 8 bytes long (%s)\r\n", field.name.c_str());
+        }
+        parser.ops.push_back(op);
+        offset += field.length;
+    }
+}
+
+/// @brief Look up (and create) the varDB entries of all fields for one tag
+///
+/// varDB entries are never erased and unordered_map keeps its elements in place, so the pointers stay valid
+static std::vector<varStruct*> resolveSlots(const uint8_t src[8], const TagData::Parser& parser) {
+    char buffer[64];
+    const String mac = util::formatString<64>(buffer, "%02X%02X%02X%02X%02X%02X%02X%02X.", src[7], src[6], src[5], src[4], src[3], src[2], src[1], src[0]);
+    std::vector<varStruct*> slots;
+    slots.reserve(parser.fields.size());
+    for (const TagData::Field& field : parser.fields) {
+        slots.push_back(&varDB[(mac + field.name).c_str()]);
+    }
+    return slots;
+}
+
 void TagData::loadParsers(const String& filename) {
     const long start = millis();
 
@@ -56,6 +84,7 @@ void TagData::loadParsers(const String& filename) {
                     }
                 }
 
+                compileParser(parser);
                 parsers.emplace(id.as<uint8_t>(), parser);
             } else {
                 Serial.print(F("deserializeJson() failed: "));
@@ -81,67 +110,44 @@ void TagData::parse(const uint8_t src[8], const size_t id, const uint8_t* data,
         return;
     }
 
-    const String mac = util::formatString<64>(buffer, "%02X%02X%02X%02X%02X%02X%02X%02X.", src[7], src[6], src[5], src[4], src[3], src[2], src[1], src[0]);
+    Parser& parser = it->second;
+    uint64_t macKey;
+    memcpy(&macKey, src, sizeof(macKey));
+    auto slotIt = parser.slots.find(macKey);
+    if (slotIt == parser.slots.end()) {
+        slotIt = parser.slots.emplace(macKey, resolveSlots(src, parser)).first;
+    }
+    const std::vector<varStruct*>& slots = slotIt->second;
 
-    uint16_t offset = 0;
-    for (const Field& field : it->second.fields) {
-        const String& name = field.name;
-        const uint8_t length = field.length;
+    char value[256];
+    for (size_t i = 0; i < parser.ops.size(); i++) {
+        const FieldOp& op = parser.ops[i];
 
-        if (offset + length > len) {
-            const String log = util::formatString<64>(buffer, "Error: Not enough data for field %s", name.c_str());
+        if (op.offset + op.length > len) {
+            const String log = util::formatString<64>(buffer, "Error: Not enough data for field %s", parser.fields[i].name.c_str());
             wsErr(log);
             Serial.println(log);
             return;
         }
 
-        const Type type = field.type;
-        const uint8_t* fieldData = data + offset;
-        offset += length;
-        String value = "";
-        switch (type) {
-            case Type::INT: {
-                const double mult = field.mult.value_or(1.0);
-                value = String(bytesTo<int64_t>(fieldData, length) * mult, (unsigned int)field.decimals);
-            } break;
-            case Type::UINT: {
-                const double mult = field.mult.value_or(1.0f);
-                value = String(bytesTo<uint64_t>(fieldData, length) * mult, (unsigned int)field.decimals);
-            } break;
-            case Type::FLOAT: {
-                const double mult = field.mult.value_or(1.0f);
-
-                if (length == 4) {
-                    value = String(bytesTo<float>(fieldData, length) * mult, (unsigned int)field.decimals);
-                } else if (length == 8) {
-                    value = String(bytesTo<double>(fieldData, length) * mult, (unsigned int)field.decimals);
-                } else {
-                    const String log = "Error: Float can only be 4 or 8 bytes long";
-                    wsErr(log);
-                    Serial.println(log);
-                }
-            } break;
-            case Type::STRING: {
-                value = bytesTo<String>(fieldData, length);
-            } break;
-
-            default:
-                const String log = util::formatString<64>(buffer, "Error: Type %d not implemented", static_cast<uint8_t>(type));
-                wsErr(log);
-                Serial.println(log);
-                break;
+        if (!formatField(op, data + op.offset, value, sizeof(value))) {
+            continue;
         }
 
-        if (value.isEmpty()) {
-            const String log = util::formatString<64>(buffer, "Error: Empty value for field %s", name.c_str());
+        if (value[0] == '\0') {
+            const String log = util::formatString<64>(buffer, "Error: Empty value for field %s", parser.fields[i].name.c_str());
             wsErr(log);
             Serial.println(log);
             continue;
         }
 
-        const std::string varName = (mac + name).c_str();
-        setVarDB(varName, value);
-        Serial.printf("Set %s to %s\r\n", varName.c_str(), value.c_str());
+        // only touch the variable when the value really changed, so unchanged packets don't allocate
+        varStruct* var = slots[i];
+        if (var->value != value) {
+            var->value = value;
+            var->changed = true;
+            Serial.printf("Set %s to %s\r\n", parser.fields[i].name.c_str(), value);
+        }
     }
 }
 
@@ -0,0 +1,148 @@
+#include "telemetry.h"
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <mutex>
+
+#include "storage.h"
+
+#define TELEMETRY_MAGIC 0x4D54454F  // "OETM"
+#define TELEMETRY_VERSION 3
+
+struct telemetryFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bytes;
+    uint16_t rings;
+    uint16_t reserved;
+};
+
+static telemetryRing* rings = nullptr;
+static std::mutex telemetryMutex;
+static bool telemetryDirty = false;
+
+void initTelemetry() {
+#ifdef BOARD_HAS_PSRAM
+    rings = (telemetryRing*)ps_calloc(TELEMETRY_TAGS, sizeof(telemetryRing));
+#else
+    rings = (telemetryRing*)calloc(TELEMETRY_TAGS, sizeof(telemetryRing));
+#endif
+    if (rings == nullptr) {
+        Serial.println("telemetry: could not allocate arena");
+        return;
+    }
+    Serial.printf("telemetry: %d tags, %d bytes per tag\r\n", TELEMETRY_TAGS, sizeof(telemetryRing));
+}
+
+void telemetryAdd(const uint8_t mac[8], const uint32_t now, const uint16_t batteryMv, const int8_t temperature, const int8_t rssi, const uint8_t lqi, const uint8_t wakeupReason) {
+    if (rings == nullptr || now < TELEMETRY_MIN_TIME) return;
+    const std::lock_guard<std::mutex> lock(telemetryMutex);
+    const telemetrySample sample = {now, batteryMv, temperature, rssi, lqi, wakeupReason};
+    if (telemetryStore(rings, TELEMETRY_TAGS, mac, sample)) telemetryDirty = true;
+}
+
+void telemetryAddReturn(const uint8_t mac[8], const uint32_t now, const uint8_t dataType, const uint8_t* data, const uint8_t len) {
+    if (rings == nullptr || now < TELEMETRY_MIN_TIME) return;
+    const std::lock_guard<std::mutex> lock(telemetryMutex);
+    if (telemetryStoreReturn(rings, TELEMETRY_TAGS, mac, now, dataType, data, len)) telemetryDirty = true;
+}
+
+static void sampleToStream(Print& out, const telemetrySample& sample, const bool binary) {
+    if (binary) {
+        out.write((const uint8_t*)&sample, sizeof(sample));
+    } else {
+        out.printf("%u,%u,%d,%d,%u,%u\n", sample.time, sample.batteryMv, sample.temperature, sample.rssi, sample.lqi, sample.wakeupReason);
+    }
+}
+
+static void returnToStream(Print& out, const telemetryReturn& ret, const bool binary) {
+    if (binary) {
+        out.write((const uint8_t*)&ret, sizeof(ret));
+    } else {
+        out.printf("%u,%u,%u,", ret.time, ret.dataType, ret.len);
+        for (uint8_t c = 0; c < ret.len && c < TELEMETRY_RETURN_BYTES; c++) out.printf("%02X", ret.data[c]);
+        out.print("\n");
+    }
+}
+
+void telemetryToStream(Print& out, const uint8_t mac[8], const uint32_t since, const bool binary, const bool returnData) {
+    if (!binary) out.print(returnData ? "time,data_type,len,data\n" : "time,battery_mv,temperature,rssi,lqi,wakeup_reason\n");
+    if (rings == nullptr) return;
+    const std::lock_guard<std::mutex> lock(telemetryMutex);
+    const telemetryRing* ring = telemetryFindRing(rings, TELEMETRY_TAGS, mac, false);
+    if (ring == nullptr) return;
+    telemetryReplay(
+        *ring, since,
+        [&out, binary, returnData](const telemetrySample& sample) {
+            if (!returnData) sampleToStream(out, sample, binary);
+        },
+        [&out, binary, returnData](const telemetryReturn& ret) {
+            if (returnData) returnToStream(out, ret, binary);
+        });
+}
+
+// written ring by ring, so the telemetry lock is never held during a flash write
+void saveTelemetry(const String& filename) {
+    if (rings == nullptr || !telemetryDirty) return;
+    const long t = millis();
+    telemetryRing* chunk = (telemetryRing*)malloc(sizeof(telemetryRing));
+    if (chunk == nullptr) return;
+
+    takeFsMutex();
+    fs::File file = contentFS->open(filename, "w");
+    if (!file) {
+        Serial.println("saveTelemetry: Failed to open file for writing");
+        xSemaphoreGive(fsMutex);
+        free(chunk);
+        return;
+    }
+    telemetryFileHeader header = {TELEMETRY_MAGIC, TELEMETRY_VERSION, TELEMETRY_BYTES, 0, 0};
+    file.write((const uint8_t*)&header, sizeof(header));
+    telemetryDirty = false;
+    for (uint16_t c = 0; c < TELEMETRY_TAGS; c++) {
+        {
+            const std::lock_guard<std::mutex> lock(telemetryMutex);
+            if (rings[c].base.time == 0) continue;
+            memcpy(chunk, &rings[c], sizeof(telemetryRing));
+        }
+        file.write((const uint8_t*)chunk, sizeof(telemetryRing));
+        header.rings++;
+    }
+    file.seek(0);
+    file.write((const uint8_t*)&header, sizeof(header));
+    file.close();
+    xSemaphoreGive(fsMutex);
+    free(chunk);
+    Serial.printf("saveTelemetry: %d tags in %d ms\r\n", header.rings, millis() - t);
+}
+
+void loadTelemetry(const String& filename) {
+    if (rings == nullptr) return;
+    takeFsMutex();
+    fs::File file = contentFS->open(filename, "r");
+    if (!file) {
+        xSemaphoreGive(fsMutex);
+        return;
+    }
+    telemetryFileHeader header;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != TELEMETRY_MAGIC || header.version != TELEMETRY_VERSION || header.bytes != TELEMETRY_BYTES) {
+        // ring size differs between builds with and without PSRAM, start over in that case
+        Serial.println("loadTelemetry: no usable telemetry file");
+        file.close();
+        xSemaphoreGive(fsMutex);
+        return;
+    }
+    const std::lock_guard<std::mutex> lock(telemetryMutex);
+    uint16_t loaded = 0;
+    while (loaded < header.rings && loaded < TELEMETRY_TAGS) {
+        if (file.read((uint8_t*)&rings[loaded], sizeof(telemetryRing)) != sizeof(telemetryRing)) {
+            memset(&rings[loaded], 0, sizeof(telemetryRing));
+            break;
+        }
+        loaded++;
+    }
+    file.close();
+    xSemaphoreGive(fsMutex);
+    Serial.printf("loadTelemetry: %d tags\r\n", loaded);
+}
@@ -2,6 +2,8 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
 
 #include "AsyncUDP.h"
 #include "commstructs.h"
@@ -13,8 +15,28 @@
 #define UDPIP IPAddress(239, 10, 0, 1)
 #define UDPPORT 16033
 
+// events are collected for SYNC_BATCH_DELAY ms before the frame goes out
+#define SYNC_BATCH_DELAY 20
+#define SYNC_MAX_PEERS 16
+// a peer that sent nothing but single event packets for this long no longer keeps the legacy packets going
+#define SYNC_LEGACY_TIMEOUT 600000
+
 UDPcomm udpsync;
 
+struct syncPeer {
+    uint32_t ip;
+    syncSeqState seq;
+    bool batches;  // sent a batch or digest, so it runs firmware that understands them
+    uint32_t lastSeen;
+};
+
+// the frame under construction is shared by all UDPcomm instances
+static SemaphoreHandle_t syncMutex = nullptr;
+static esp_timer_handle_t syncFlushTimer = nullptr;
+static SyncSender* syncSender = nullptr;
+static syncPeer syncPeers[SYNC_MAX_PEERS];
+static uint32_t syncLastRepair[SYNC_DIGEST_SLICES];
+
 extern uint8_t channelList[6];
 extern espSetChannelPower curChannel;
 
@@ -30,7 +52,54 @@ UDPcomm::~UDPcomm() {
     // Destructor
 }
 
+static void flushSyncFrame(void* arg) {
+    AsyncUDP* udp = static_cast<AsyncUDP*>(arg);
+    xSemaphoreTake(syncMutex, portMAX_DELAY);
+    if (syncSender->finish()) udp->writeTo(syncSender->frame(), syncSender->frameLen(), UDPIP, UDPPORT);
+    xSemaphoreGive(syncMutex);
+}
+
+static uint8_t digestSlice(const uint8_t mac[8]) {
+    return mac[0] % SYNC_DIGEST_SLICES;
+}
+
+// order independent hash of the synced user config, per slice of the tagDB
+static void calcDigest(uint32_t slice[SYNC_DIGEST_SLICES]) {
+    memset(slice, 0, SYNC_DIGEST_SLICES * sizeof(uint32_t));
+    for (const tagRecord* taginfo : tagDB) {
+        if (taginfo->version != 0) continue;
+        uint32_t crc = esp_rom_crc32_le(0, taginfo->mac, sizeof(taginfo->mac));
+        crc = esp_rom_crc32_le(crc, (const uint8_t*)taginfo->alias.c_str(), taginfo->alias.length());
+        slice[digestSlice(taginfo->mac)] ^= crc;
+    }
+}
+
+static syncPeer* findPeer(IPAddress senderIP, bool create) {
+    syncPeer* freeSlot = nullptr;
+    for (syncPeer& peer : syncPeers) {
+        if (peer.ip == (uint32_t)senderIP) return &peer;
+        if (!peer.ip && !freeSlot) freeSlot = &peer;
+    }
+    if (create && freeSlot) freeSlot->ip = senderIP;
+    return create ? freeSlot : nullptr;
+}
+
+// peers running firmware from before the batches drop them, they get every event as a single packet as well
+static bool legacyPeers() {
+    for (const syncPeer& peer : syncPeers) {
+        if (peer.ip && !peer.batches && millis() - peer.lastSeen < SYNC_LEGACY_TIMEOUT) return true;
+    }
+    return false;
+}
+
 void UDPcomm::init() {
+    if (!syncMutex) {
+        syncMutex = xSemaphoreCreateMutex();
+        // a random start makes peers notice a restart instead of nacking a huge gap
+        syncSender = new SyncSender(esp_random() & 0x7FFFFFFF);
+        const esp_timer_create_args_t timerArgs = {.callback = flushSyncFrame, .arg = &udpsync.udp, .dispatch_method = ESP_TIMER_TASK, .name = "syncflush"};
+        esp_timer_create(&timerArgs, &syncFlushTimer);
+    }
     if (udp.listenMulticast(UDPIP, UDPPORT)) {
         udp.onPacket([this](AsyncUDPPacket packet) {
             if (packet.remoteIP() != WiFi.localIP()) {
@@ -42,40 +111,23 @@ void UDPcomm::init() {
 }
 
 void UDPcomm::processPacket(AsyncUDPPacket packet) {
-    if (config.runStatus == RUNSTATUS_STOP) {
+    if (config.runStatus == RUNSTATUS_STOP || packet.length() == 0) {
         return;
     }
     IPAddress senderIP = packet.remoteIP();
+    syncPeer* peer = findPeer(senderIP, true);
+    if (peer) peer->lastSeen = millis();
 
     switch (packet.data()[0]) {
-        case PKT_AVAIL_DATA_INFO: {
-            espAvailDataReq adr;
-            memset(&adr, 0, sizeof(espAvailDataReq));
-            memcpy(&adr, &packet.data()[1], std::min(packet.length() - 1, sizeof(espAvailDataReq)));
-            processDataReq(&adr, false, senderIP);
-            break;
-        }
-        case PKT_XFER_COMPLETE: {
-            espXferComplete xfc;
-            memset(&xfc, 0, sizeof(espXferComplete));
-            memcpy(&xfc, &packet.data()[1], std::min(packet.length() - 1, sizeof(espXferComplete)));
-            processXferComplete(&xfc, false);
+        case PKT_SYNC_BATCH:
+            processBatch(packet.data(), packet.length(), senderIP);
             break;
-        }
-        case PKT_XFER_TIMEOUT: {
-            espXferComplete xfc;
-            memset(&xfc, 0, sizeof(espXferComplete));
-            memcpy(&xfc, &packet.data()[1], std::min(packet.length() - 1, sizeof(espXferComplete)));
-            processXferTimeout(&xfc, false);
+        case PKT_SYNC_NACK:
+            processNack(packet.data(), packet.length(), senderIP);
             break;
-        }
-        case PKT_AVAIL_DATA_REQ: {
-            pendingData pending;
-            memset(&pending, 0, sizeof(pendingData));
-            memcpy(&pending, &packet.data()[1], std::min(packet.length() - 1, sizeof(pendingData)));
-            prepareExternalDataAvail(&pending, senderIP);
+        case PKT_SYNC_DIGEST:
+            processDigest(packet.data(), packet.length(), senderIP);
             break;
-        }
         case PKT_APLIST_REQ: {
             APlist APitem;
             APitem.src = WiFi.localIP();
@@ -101,18 +153,133 @@ void UDPcomm::processPacket(AsyncUDPPacket packet) {
             wsSendAPitem(&APreply);
             break;
         }
+        default:
+            // single event packets, as sent by older firmware. Newer peers send them next to their
+            // batches while older APs are around, those copies are skipped
+            if (peer && peer->batches) break;
+            processEvent(packet.data()[0], &packet.data()[1], packet.length() - 1, senderIP);
+    }
+}
+
+void UDPcomm::processEvent(uint8_t pktType, const uint8_t* data, size_t len, IPAddress senderIP) {
+    switch (pktType) {
+        case PKT_AVAIL_DATA_INFO: {
+            espAvailDataReq adr;
+            memset(&adr, 0, sizeof(espAvailDataReq));
+            memcpy(&adr, data, std::min(len, sizeof(espAvailDataReq)));
+            processDataReq(&adr, false, senderIP);
+            break;
+        }
+        case PKT_XFER_COMPLETE: {
+            espXferComplete xfc;
+            memset(&xfc, 0, sizeof(espXferComplete));
+            memcpy(&xfc, data, std::min(len, sizeof(espXferComplete)));
+            processXferComplete(&xfc, false);
+            break;
+        }
+        case PKT_XFER_TIMEOUT: {
+            espXferComplete xfc;
+            memset(&xfc, 0, sizeof(espXferComplete));
+            memcpy(&xfc, data, std::min(len, sizeof(espXferComplete)));
+            processXferTimeout(&xfc, false);
+            break;
+        }
+        case PKT_AVAIL_DATA_REQ: {
+            pendingData pending;
+            memset(&pending, 0, sizeof(pendingData));
+            memcpy(&pending, data, std::min(len, sizeof(pendingData)));
+            prepareExternalDataAvail(&pending, senderIP);
+            break;
+        }
         case PKT_TAGINFO: {
-            uint16_t syncversion = (packet.data()[2] << 8) | packet.data()[1];
+            if (len < sizeof(TagInfo)) break;
+            uint16_t syncversion = (data[1] << 8) | data[0];
             if (syncversion != SYNC_VERSION) {
                 wsErr("Got a packet from " + senderIP.toString() + " with mismatched udp sync version. Update firmware!");
             } else {
-                TagInfo* taginfoitem = (TagInfo*)&packet.data()[1];
-                updateTaginfoitem(taginfoitem, senderIP);
+                TagInfo taginfoitem;
+                memcpy(&taginfoitem, data, sizeof(TagInfo));
+                updateTaginfoitem(&taginfoitem, senderIP);
             }
         }
     }
 }
 
+static void sendNack(AsyncUDP& udp, IPAddress senderIP, const syncGap& gap) {
+    if (!gap.count) return;
+    SyncNack nack;
+    nack.firstSeq = gap.firstSeq;
+    nack.count = gap.count;
+    udp.writeTo((uint8_t*)&nack, sizeof(nack), senderIP, UDPPORT);
+}
+
+void UDPcomm::processBatch(const uint8_t* data, size_t len, IPAddress senderIP) {
+    if (len < sizeof(SyncBatchHeader)) return;
+    SyncBatchHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.syncVersion != SYNC_VERSION) {
+        wsErr("Got a packet from " + senderIP.toString() + " with mismatched udp sync version. Update firmware!");
+        return;
+    }
+
+    syncPeer* peer = findPeer(senderIP, true);
+    if (peer) {
+        peer->batches = true;
+        sendNack(udp, senderIP, syncSeqBatch(peer->seq, header.seq, header.flags & SYNC_BATCH_RETRANSMIT));
+    }
+
+    syncBatchEvents(data, len, [this, senderIP](uint8_t pktType, const uint8_t* event, size_t eventLen) {
+        processEvent(pktType, event, eventLen, senderIP);
+    });
+}
+
+void UDPcomm::processNack(const uint8_t* data, size_t len, IPAddress senderIP) {
+    if (len < sizeof(SyncNack) || !syncSender) return;
+    SyncNack nack;
+    memcpy(&nack, data, sizeof(nack));
+    const uint8_t count = std::min(nack.count, (uint8_t)SYNC_HISTORY);
+    xSemaphoreTake(syncMutex, portMAX_DELAY);
+    for (uint32_t seq = nack.firstSeq; seq != nack.firstSeq + count; seq++) {
+        uint16_t frameLen;
+        const uint8_t* frame = syncSender->retransmit(seq, frameLen);
+        if (frame) udp.writeTo(frame, frameLen, senderIP, UDPPORT);
+    }
+    xSemaphoreGive(syncMutex);
+}
+
+void UDPcomm::processDigest(const uint8_t* data, size_t len, IPAddress senderIP) {
+    if (len < sizeof(SyncDigest)) return;
+    SyncDigest digest;
+    memcpy(&digest, data, sizeof(digest));
+    if (digest.syncVersion != SYNC_VERSION) return;
+
+    syncPeer* peer = findPeer(senderIP, true);
+    if (peer) {
+        peer->batches = true;
+        sendNack(udp, senderIP, syncSeqDigest(peer->seq, digest.lastSeq));
+    }
+
+    // for diverged slices, the AP in control of a tag sends its config again
+    uint32_t slice[SYNC_DIGEST_SLICES];
+    calcDigest(slice);
+    for (uint8_t i = 0; i < SYNC_DIGEST_SLICES; i++) {
+        if (slice[i] == digest.slice[i] || millis() - syncLastRepair[i] < 60000) continue;
+        syncLastRepair[i] = millis();
+        for (const tagRecord* taginfo : tagDB) {
+            if (taginfo->version != 0 || taginfo->contentMode == 12 || digestSlice(taginfo->mac) != i) continue;
+            TagInfo taginfoitem;
+            memset(taginfoitem.reserved, 0, sizeof(taginfoitem.reserved));
+            memcpy(taginfoitem.mac, taginfo->mac, sizeof(taginfoitem.mac));
+            taginfoitem.syncMode = SYNC_USERCFG;
+            taginfoitem.contentMode = taginfo->contentMode;
+            strncpy(taginfoitem.alias, taginfo->alias.c_str(), sizeof(taginfoitem.alias) - 1);
+            taginfoitem.alias[sizeof(taginfoitem.alias) - 1] = '\0';
+            taginfoitem.nextupdate = taginfo->nextupdate;
+            netTaginfo(&taginfoitem);
+        }
+    }
+}
+
 void autoselect(void* pvParameters) {
     // reset channel list
     uint8_t values[] = {11, 15, 20, 25, 26, 27};
@@ -161,37 +328,52 @@ void UDPcomm::getAPList() {
     udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
 }
 
+void UDPcomm::queueEvent(uint8_t pktType, const void* data, uint8_t len) {
+    if (!syncMutex) return;
+    xSemaphoreTake(syncMutex, portMAX_DELAY);
+    if (!syncSender->fits(len)) {
+        xSemaphoreGive(syncMutex);
+        esp_timer_stop(syncFlushTimer);
+        flushSyncFrame(&udpsync.udp);
+        xSemaphoreTake(syncMutex, portMAX_DELAY);
+    }
+    if (syncSender->add(pktType, data, len)) esp_timer_start_once(syncFlushTimer, SYNC_BATCH_DELAY * 1000);
+    xSemaphoreGive(syncMutex);
+
+    if (legacyPeers()) {
+        uint8_t buffer[UINT8_MAX + 1];
+        buffer[0] = pktType;
+        memcpy(buffer + 1, data, len);
+        udp.writeTo(buffer, len + 1, UDPIP, UDPPORT);
+    }
+}
+
 void UDPcomm::netProcessDataReq(struct espAvailDataReq* eadr) {
-    uint8_t buffer[sizeof(struct espAvailDataReq) + 1];
-    buffer[0] = PKT_AVAIL_DATA_INFO;
-    memcpy(buffer + 1, eadr, sizeof(struct espAvailDataReq));
-    udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
+    queueEvent(PKT_AVAIL_DATA_INFO, eadr, sizeof(struct espAvailDataReq));
 }
 
 void UDPcomm::netProcessXferComplete(struct espXferComplete* xfc) {
-    uint8_t buffer[sizeof(struct espXferComplete) + 1];
-    buffer[0] = PKT_XFER_COMPLETE;
-    memcpy(buffer + 1, xfc, sizeof(struct espXferComplete));
-    udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
+    queueEvent(PKT_XFER_COMPLETE, xfc, sizeof(struct espXferComplete));
 }
 
 void UDPcomm::netProcessXferTimeout(struct espXferComplete* xfc) {
-    uint8_t buffer[sizeof(struct espXferComplete) + 1];
-    buffer[0] = PKT_XFER_TIMEOUT;
-    memcpy(buffer + 1, xfc, sizeof(struct espXferComplete));
-    udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
+    queueEvent(PKT_XFER_TIMEOUT, xfc, sizeof(struct espXferComplete));
 }
 
 void UDPcomm::netSendDataAvail(struct pendingData* pending) {
-    uint8_t buffer[sizeof(struct pendingData) + 1];
-    buffer[0] = PKT_AVAIL_DATA_REQ;
-    memcpy(buffer + 1, pending, sizeof(struct pendingData));
-    udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
+    queueEvent(PKT_AVAIL_DATA_REQ, pending, sizeof(struct pendingData));
 }
 
 void UDPcomm::netTaginfo(struct TagInfo* taginfoitem) {
-    uint8_t buffer[sizeof(struct TagInfo) + 1];
-    buffer[0] = PKT_TAGINFO;
-    memcpy(buffer + 1, taginfoitem, sizeof(struct TagInfo));
-    udp.writeTo(buffer, sizeof(buffer), UDPIP, UDPPORT);
+    queueEvent(PKT_TAGINFO, taginfoitem, sizeof(struct TagInfo));
+}
+
+void UDPcomm::netSendDigest() {
+    if (!syncMutex) return;
+    SyncDigest digest;
+    calcDigest(digest.slice);
+    xSemaphoreTake(syncMutex, portMAX_DELAY);
+    digest.lastSeq = syncSender->lastSeq();
+    xSemaphoreGive(syncMutex);
+    udp.writeTo((uint8_t*)&digest, sizeof(digest), UDPIP, UDPPORT);
 }
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <esp_rom_crc.h>
 
 #include "usbflasher.h"
 
@@ -13,6 +14,7 @@ USBCDC USBSerial;
 
 // #include "esp32-hal-tinyusb.h"
 #include "flasher.h"
+#include "flasherwindow.h"
 #include "leds.h"
 #include "powermgt.h"
 #include "settings.h"
@@ -214,6 +216,12 @@ void flasherDataHandler(uint8_t* data, size_t len, uint8_t transportType) {
                 } else {
                     if (transportType == TRANSPORT_USB) {
                         BaseType_t queuestatus = xQueueSend(flasherCmdQueue, &cmd, 0);
+                        if (queuestatus != pdTRUE) {
+                            // the host sent more than fits in the window; it will time out and resend
+                            if (cmd->data != nullptr) free(cmd->data);
+                            delete cmd;
+                        }
+                        cmd = nullptr;
                     } else {
                         processFlasherCommand(cmd, TRANSPORT_TCP);
                     }
@@ -317,13 +325,15 @@ typedef enum {
     CMD_READ_FLASH = 81,
     CMD_WRITE_INFOPAGE = 82,
     CMD_WRITE_FLASH = 83,
+    CMD_WRITE_FLASH_WINDOW = 84,
+    CMD_WRITE_INFOPAGE_WINDOW = 85,
     CMD_AUTOFLASH = 87,
     CMD_COMPLETE = 88,
 
     CMD_WRITE_ERROR = 99,
 
 } ZBS_UART_PROTO;
-uint32_t FLASHER_VERSION = 0x00000031;
+uint32_t FLASHER_VERSION = 0x00000032;
 
 #define CONTROLLER_ZBS243 0
 #define CONTROLLER_NRF82511 1
@@ -333,6 +343,77 @@ uint32_t currentFlasherOffset;
 flasher* zbsflasherp = nullptr;
 nrfswd* nrfflasherp = nullptr;
 
+// windowed writes: next sequence number we expect to write
+uint32_t windowExpectedSeq = 0;
+
+// writes one chunk at currentFlasherOffset, returns the command to answer with, or 0 for no answer
+uint8_t writeFlasherChunk(uint8_t* data, uint32_t len, bool infopage) {
+    uint8_t answer = infopage ? CMD_WRITE_INFOPAGE : CMD_WRITE_FLASH;
+    if (selectedController == CONTROLLER_NRF82511) {
+        if (nrfflasherp == nullptr) return 0;
+        uint32_t size = infopage ? 4096 : nrfflasherp->nrf_info.flash_size;
+        if (currentFlasherOffset >= size) return CMD_COMPLETE;
+        if (!infopage) {
+            for (uint32_t c = currentFlasherOffset; c < (currentFlasherOffset + len);) {
+                // very ugly and naive way to find out what page we're in, and erase all relevant pages before writing
+                if (c % nrfflasherp->nrf_info.codepage_size == 0) {
+                    nrfflasherp->erase_page(c);
+                    Serial.printf("Erasing page %lu\r\n", c);
+                    c += nrfflasherp->nrf_info.codepage_size;
+                } else {
+                    c++;
+                }
+            }
+        }
+        uint8_t result = nrfflasherp->nrf_write_bank((infopage ? 0x10001000 : 0) + currentFlasherOffset, (uint32_t*)data, len);
+        Serial.printf("wrote %s offset %lu to nrf\r\n", infopage ? "infopage" : "page", currentFlasherOffset);
+        currentFlasherOffset += len;
+        if (result == 3) return CMD_WRITE_ERROR;
+    } else if (selectedController == CONTROLLER_ZBS243) {
+        if (zbsflasherp == nullptr) return 0;
+        if (currentFlasherOffset >= (infopage ? 1024 : 65536)) return CMD_COMPLETE;
+        zbsflasherp->writeBlock(currentFlasherOffset, data, len, infopage);
+        currentFlasherOffset += len;
+    } else {
+        return 0;
+    }
+    return answer;
+}
+
+// windowed write, see flasherwindow.h. The host keeps several of these in flight; every one is answered
+// with its seq, or with CMD_WRITE_ERROR + the seq to resend from
+void processWindowedWrite(struct flasherCommand* cmd, uint8_t transportType) {
+    uint8_t temp_buff[4];
+    bool infopage = (cmd->command == CMD_WRITE_INFOPAGE_WINDOW);
+    flasherWindowChunk chunk;
+    if (!parseWindowChunk(cmd->data, cmd->len, chunk)) {
+        sendFlasherAnswer(CMD_WRITE_ERROR, NULL, 0, transportType);
+        return;
+    }
+
+    switch (windowAction(chunk, esp_rom_crc32_le(0, chunk.data, chunk.len), windowExpectedSeq)) {
+        case WINDOW_WRITE: {
+            uint8_t answer = writeFlasherChunk(chunk.data, chunk.len, infopage);
+            if (answer == 0) return;
+            if (answer != CMD_WRITE_FLASH && answer != CMD_WRITE_INFOPAGE) {
+                sendFlasherAnswer(answer, NULL, 0, transportType);
+                return;
+            }
+            windowExpectedSeq++;
+            break;
+        }
+        case WINDOW_GO_BACK:
+            // ask for everything from the expected one again
+            windowPutSeq(temp_buff, windowExpectedSeq);
+            sendFlasherAnswer(CMD_WRITE_ERROR, temp_buff, 4, transportType);
+            return;
+        case WINDOW_ACK_AGAIN:
+            break;
+    }
+    windowPutSeq(temp_buff, chunk.seq);
+    sendFlasherAnswer(cmd->command, temp_buff, 4, transportType);
+}
+
 void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
     uint8_t* tempbuffer;
     uint8_t temp_buff[16];
@@ -340,6 +421,7 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
     uint8_t powerPinCount = 1;
     static uint32_t curspeed = 0;
     uint8_t numPowerPins;
+    uint8_t answer;
 
 #ifdef HAS_RGB_LED
     shortBlink(CRGB::White);
@@ -424,6 +506,7 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
             temp_buff[0] = zbsflasherp->connectTag(selectedFlasherPort);
             sendFlasherAnswer(CMD_SELECT_ZBS243, temp_buff, 1, transportType);
             currentFlasherOffset = 0;
+            windowExpectedSeq = 0;
             selectedController = CONTROLLER_ZBS243;
             break;
         case CMD_SELECT_NRF82511:
@@ -449,6 +532,7 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
             temp_buff[0] = (nrfflasherp->isConnected && !nrfflasherp->isLocked);
             sendFlasherAnswer(CMD_SELECT_NRF82511, temp_buff, 1, transportType);
             currentFlasherOffset = 0;
+            windowExpectedSeq = 0;
             selectedController = CONTROLLER_NRF82511;
             break;
         case CMD_READ_FLASH:
@@ -517,67 +601,17 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
             break;
         case CMD_WRITE_FLASH:
             Serial.println("> write flash");
-            if (selectedController == CONTROLLER_NRF82511) {
-                if (nrfflasherp == nullptr) return;
-                if (currentFlasherOffset >= nrfflasherp->nrf_info.flash_size) {
-                    sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
-                } else {
-                    for (uint32_t c = currentFlasherOffset; c < (currentFlasherOffset + cmd->len);) {
-                        // very ugly and naive way to find out what page we're in, and erase all relevant pages before writing
-                        if (c % nrfflasherp->nrf_info.codepage_size == 0) {
-                            nrfflasherp->erase_page(c);
-                            Serial.printf("Erasing page %lu\r\n", c);
-                            c += nrfflasherp->nrf_info.codepage_size;
-                        } else {
-                            c++;
-                        }
-                    }
-                    uint8_t result = nrfflasherp->nrf_write_bank(currentFlasherOffset, (uint32_t*)cmd->data, cmd->len);
-                    Serial.printf("wrote page offset %lu to nrf\r\n", currentFlasherOffset);
-                    currentFlasherOffset += cmd->len;
-                    if (result == 3) {
-                        sendFlasherAnswer(CMD_WRITE_ERROR, NULL, 0, transportType);
-                        return;
-                    }
-                    sendFlasherAnswer(CMD_WRITE_FLASH, NULL, 0, transportType);
-                }
-            } else if (selectedController == CONTROLLER_ZBS243) {
-                if (zbsflasherp == nullptr) return;
-                if (currentFlasherOffset >= 65536) {
-                    sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
-                } else {
-                    zbsflasherp->writeBlock(currentFlasherOffset, cmd->data, cmd->len, false);
-                    currentFlasherOffset += cmd->len;
-                    sendFlasherAnswer(CMD_WRITE_FLASH, NULL, 0, transportType);
-                }
-            }
+            answer = writeFlasherChunk(cmd->data, cmd->len, false);
+            if (answer) sendFlasherAnswer(answer, temp_buff, answer == CMD_COMPLETE ? 1 : 0, transportType);
             break;
         case CMD_WRITE_INFOPAGE:
             wsSerial("> write infopage");
-            if (selectedController == CONTROLLER_NRF82511) {
-                if (nrfflasherp == nullptr) return;
-                if (currentFlasherOffset >= 4096) {
-                    sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
-                } else {
-                    uint8_t result =  nrfflasherp->nrf_write_bank(0x10001000 + currentFlasherOffset, (uint32_t*)cmd->data, cmd->len);
-                    Serial.printf("wrote infopage to nrf\r\n");
-                    currentFlasherOffset += cmd->len;
-                    if (result == 3) {
-                        sendFlasherAnswer(CMD_WRITE_ERROR, NULL, 0, transportType);
-                        return;
-                    }
-                    sendFlasherAnswer(CMD_WRITE_INFOPAGE, NULL, 0, transportType);
-                }
-            } else if (selectedController == CONTROLLER_ZBS243) {
-                if (zbsflasherp == nullptr) return;
-                if (currentFlasherOffset >= 1024) {
-                    sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
-                } else {
-                    zbsflasherp->writeBlock(currentFlasherOffset, cmd->data, cmd->len, true);
-                    currentFlasherOffset += cmd->len;
-                    sendFlasherAnswer(CMD_WRITE_INFOPAGE, NULL, 0, transportType);
-                }
-            }
+            answer = writeFlasherChunk(cmd->data, cmd->len, true);
+            if (answer) sendFlasherAnswer(answer, temp_buff, answer == CMD_COMPLETE ? 1 : 0, transportType);
+            break;
+        case CMD_WRITE_FLASH_WINDOW:
+        case CMD_WRITE_INFOPAGE_WINDOW:
+            processWindowedWrite(cmd, transportType);
             break;
         case CMD_PASS_THROUGH:
             wsSerial("> pass through");
@@ -680,14 +714,13 @@ void usbFlasherTask(void* parameter) {
             }
             delete cmd;
             cmd = nullptr;
+            // no delay here; with a windowed write the next chunk is usually already queued
         } else {
             if (lastCmdTimeStamp) {
                 if (millis() - lastCmdTimeStamp > USBFLASHER_CONNECTION_TIMEOUT)
                 flasherCommandTimeout();
             }
         }
-
-        vTaskDelay(50 / portTICK_PERIOD_MS);
     }
 }
 #endif
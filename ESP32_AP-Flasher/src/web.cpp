@@ -10,6 +10,7 @@
 #include <WiFi.h>
 
 #include <algorithm>
+#include <memory>
 
 #include "AsyncJson.h"
 #include "LittleFS.h"
@@ -17,6 +18,7 @@
 #include "commstructs.h"
 #include "language.h"
 #include "leds.h"
+#include "metrics.h"
 #include "newproto.h"
 #include "ota.h"
 #include "serialap.h"
@@ -24,6 +26,7 @@
 #include "storage.h"
 #include "system.h"
 #include "tag_db.h"
+#include "telemetry.h"
 #include "udp.h"
 #include "wifimanager.h"
 
@@ -241,6 +244,32 @@ uint8_t wsClientCount() {
     return ws.count();
 }
 
+// Streams a file from contentFS, holding fsMutex only for the open and for every single read, so a
+// slow client doesn't block the other file users. The file is closed when the request goes away.
+static void sendContentFile(AsyncWebServerRequest *request, const String &filename) {
+    takeFsMutex();
+    File *opened = contentFS->exists(filename) ? new File(contentFS->open(filename, "r")) : nullptr;
+    xSemaphoreGive(fsMutex);
+    if (opened == nullptr || !*opened) {
+        delete opened;
+        request->send(404, "text/plain", "File not found");
+        return;
+    }
+    std::shared_ptr<File> file(opened, [](File *f) {
+        takeFsMutex();
+        f->close();
+        xSemaphoreGive(fsMutex);
+        delete f;
+    });
+    AsyncWebServerResponse *response = request->beginResponse("application/octet-stream", file->size(), [file](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        takeFsMutex();
+        const size_t len = file->read(buffer, maxLen);
+        xSemaphoreGive(fsMutex);
+        return len;
+    });
+    request->send(response);
+}
+
 void init_web() {
     wsMutex = xSemaphoreCreateMutex();
     WiFi.mode(WIFI_STA);
@@ -295,6 +324,20 @@ void init_web() {
         request->send(200, "application/json", json);
     });
 
+    server.on("/telemetry", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint8_t mac[8];
+        if (!request->hasParam("mac") || !hex2mac(request->getParam("mac")->value(), mac)) {
+            request->send(400, "text/plain", "malformatted parameter");
+            return;
+        }
+        const uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), nullptr, 10) : 0;
+        const bool binary = request->hasParam("format") && request->getParam("format")->value() == "bin";
+        const bool returnData = request->hasParam("returndata");
+        AsyncResponseStream *response = request->beginResponseStream(binary ? "application/octet-stream" : "text/csv");
+        telemetryToStream(*response, mac, since, binary, returnData);
+        request->send(response);
+    });
+
     server.on("/getdata", HTTP_GET, [](AsyncWebServerRequest *request) {
         if (request->hasParam("mac")) {
             String dst = request->getParam("mac")->value();
@@ -312,15 +355,9 @@ void init_web() {
                                 return;
                             } 
                             if (queueItem->data == nullptr) {
-                                fs::File file = contentFS->open(queueItem->filename);
-                                if (file) {
-                                    queueItem->data = getDataForFile(file);
-                                    Serial.println("Reading file " + String(queueItem->filename));
-                                    file.close();
-                                } else {
-                                    request->send(404, "text/plain", "File not found");
-                                    return;
-                                }
+                                // stream from the file, instead of keeping the whole image in memory
+                                sendContentFile(request, queueItem->filename);
+                                return;
                             }
                             request->send_P(200, "application/octet-stream", queueItem->data, queueItem->len);
                             return;
@@ -328,13 +365,8 @@ void init_web() {
                     } else {
                         // older version without queue
                         if (taginfo->data == nullptr) {
-                            fs::File file = contentFS->open(taginfo->filename);
-                            if (!file) {
-                                request->send(404, "text/plain", "File not found");
-                                return;
-                            }
-                            taginfo->data = getDataForFile(file);
-                            file.close();
+                            sendContentFile(request, taginfo->filename);
+                            return;
                         }
                         request->send_P(200, "application/octet-stream", taginfo->data, taginfo->len);
                         return;
@@ -740,6 +772,7 @@ void init_web() {
             contentFS->remove("/current/tagDB.json");
             contentFS->remove("/current/tagDB.json.bak");
             contentFS->remove("/current/tagDBrestored.json");
+            contentFS->remove("/current/tagDBrestored.bin");
             contentFS->remove("/current/apconfig.json");
             delay(100);
             esp_deep_sleep_start();
@@ -758,6 +791,11 @@ void init_web() {
     // end of setup
 
     server.on("/backup_db", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (request->hasParam("format") && request->getParam("format")->value() == "bin") {
+            saveDBBinary("/current/tagDB.bin");
+            request->send(*contentFS, "/current/tagDB.bin", "application/octet-stream", true);
+            return;
+        }
         saveDB("/current/tagDB.json");
         request->send(*contentFS, "/current/tagDB.json", String(), true);
     });
@@ -770,6 +808,11 @@ void init_web() {
     // OTA related calls
 
     server.on("/sysinfo", HTTP_GET, handleSysinfoRequest);
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        metricsToStream(*response);
+        request->send(response);
+    });
     server.on("/check_file", HTTP_GET, handleCheckFile);
     server.on("/rollback", HTTP_POST, handleRollback);
     server.on("/update_c6", HTTP_POST, handleUpdateC6);
@@ -848,7 +891,7 @@ void doImageUpload(AsyncWebServerRequest *request, String filename, size_t index
                 memcpy(&uploadInfo->buffer[uploadInfo->bufferSize], data, len);
                 uploadInfo->bufferSize += len;
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                takeFsMutex();
                 File file = contentFS->open("/temp/" + uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
@@ -866,7 +909,7 @@ void doImageUpload(AsyncWebServerRequest *request, String filename, size_t index
 
         if (final) {
             if (uploadInfo->bufferSize > 0) {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                takeFsMutex();
                 File file = contentFS->open("/temp/" + uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
@@ -931,7 +974,7 @@ void doJsonUpload(AsyncWebServerRequest *request) {
         String dst = request->getParam("mac", true)->value();
         uint8_t mac[8];
         if (hex2mac(dst, mac)) {
-            xSemaphoreTake(fsMutex, portMAX_DELAY);
+            takeFsMutex();
             File file = LittleFS.open("/current/" + dst + ".json", "w");
             if (!file) {
                 request->send(400, "text/plain", "Failed to create file");
@@ -964,17 +1007,20 @@ void doJsonUpload(AsyncWebServerRequest *request) {
 void dotagDBUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
     if (!index) {
         logLine("restore tagDB");
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
-        request->_tempFile = contentFS->open("/current/tagDBrestored.json", "w");
+        // a backup from /backup_db?format=bin starts with the binary tagDB magic
+        const bool binary = len >= 4 && memcmp(data, "OEDB", 4) == 0;
+        takeFsMutex();
+        request->_tempFile = contentFS->open(binary ? "/current/tagDBrestored.bin" : "/current/tagDBrestored.json", "w");
     }
     if (len) {
         request->_tempFile.write(data, len);
     }
     if (final) {
+        const String restored = request->_tempFile.path();
         request->_tempFile.close();
         xSemaphoreGive(fsMutex);
         destroyDB();
-        loadDB("/current/tagDBrestored.json");
+        loadDB(restored);
         request->send(200, "text/plain", "Ok, restored.");
     }
 }
\ No newline at end of file
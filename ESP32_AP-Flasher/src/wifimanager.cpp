@@ -4,6 +4,7 @@
 #include <WiFi.h>
 #include <esp_wifi.h>
 
+#include "metrics.h"
 #include "newproto.h"
 #include "system.h"
 #include "tag_db.h"
@@ -13,20 +14,20 @@
 #include "tag_db.h"
 
 uint8_t WifiManager::apClients = 0;
+volatile bool WifiManager::_linkLost = false;
 uint8_t x_buffer[100];
 uint8_t x_position = 0;
+bool improvProvisioning = false;
 
-WifiManager::WifiManager() {
-    _reconnectIntervalCheck = 5000;
-    _retryIntervalCheck = 5 * 60000;
-    _connectionTimeout = 15000;
+static void improvConnected(String ssid, String pass);
+static void improvFailed();
 
-    _nextReconnectCheck = 0;
+WifiManager::WifiManager() {
+    _scanRunning = false;
     _connected = false;
     _savewhensuccessfull = false;
     _ssid = "";
     _APstarted = false;
-    wifiStatus = NOINIT;
 
     WiFi.onEvent(WiFiEvent);
     WiFiEventId_t eventID = WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) {
@@ -43,27 +44,47 @@ void WifiManager::terminalLog(String text) {
 }
 
 void WifiManager::poll() {
-    if (wifiStatus == AP && millis() > _nextReconnectCheck && _ssid != "") {
-        if (apClients == 0) {
-            terminalLog("Attempting to reconnect to WiFi.");
-            logLine("Attempting to reconnect to WiFi.");
-            _APstarted = false;
-            wifiStatus = NOINIT;
-            connectToWifi();
-        } else {
-            _nextReconnectCheck = millis() + _retryIntervalCheck;
-        }
-    }
+    const bool linkLost = _linkLost;
+    _linkLost = false;
+    switch (_connection.poll(millis(), WiFi.status() == WL_CONNECTED, linkLost)) {
+        case WIFI_ESTABLISHED:
+            connectionEstablished();
+            break;
 
-    if (wifiStatus == CONNECTED && millis() > _nextReconnectCheck) {
-        if (WiFi.status() != WL_CONNECTED) {
+        case WIFI_LOST:
             _connected = false;
+            metricInc(METRIC_WIFI_LOST);
             terminalLog("WiFi connection lost. Attempting to reconnect.");
             logLine("WiFi connection lost. Attempting to reconnect.");
             WiFi.reconnect();
-            waitForConnection();
+            break;
+
+        case WIFI_RECONNECT:
+            terminalLog("Attempting to reconnect to WiFi.");
+            WiFi.reconnect();
+            break;
+
+        case WIFI_BACKOFF:
+            terminalLog("WiFi reconnect failed, retrying in " + String(_connection.backoff / 1000) + "s");
+            break;
+
+        case WIFI_FAILED:
+            connectionFailed();
+            break;
+
+        default:
+            break;
+    }
+
+    if (_connection.status == AP && millis() > _connection.nextCheck && _ssid != "") {
+        if (apClients == 0) {
+            terminalLog("Attempting to reconnect to WiFi.");
+            logLine("Attempting to reconnect to WiFi.");
+            _APstarted = false;
+            _connection.status = NOINIT;
+            connectToWifi();
         } else {
-            _nextReconnectCheck = millis() + _reconnectIntervalCheck;
+            _connection.nextCheck = millis() + _connection.retryInterval;
         }
     }
 
@@ -101,6 +122,7 @@ void WifiManager::poll() {
     }
 #endif
 
+    pollScan();
     pollSerial();
 }
 
@@ -131,8 +153,7 @@ bool WifiManager::connectToWifi() {
         }
     }
 
-    _connected = connectToWifi(_ssid, _pass, false);
-    return _connected;
+    return connectToWifi(_ssid, _pass, false);
 }
 
 bool WifiManager::connectToWifi(String ssid, String pass, bool savewhensuccessfull) {
@@ -172,23 +193,23 @@ bool WifiManager::connectToWifi(String ssid, String pass, bool savewhensuccessfu
     // logLine("Connecting to WiFi...");
     WiFi.persistent(savewhensuccessfull);
     WiFi.begin(_ssid.c_str(), _pass.c_str());
-    _connected = waitForConnection();
-    return _connected;
+    // the connection is completed from poll(), so neither the caller nor the loop task waits for it
+    _connected = false;
+    _linkLost = false;
+    _connection.start(millis());
+    return true;
 }
 
-bool WifiManager::waitForConnection() {
-    unsigned long timeout = millis() + _connectionTimeout;
-    wifiStatus = WAIT_CONNECTING;
+void WifiManager::connectionFailed() {
+    terminalLog("!Unable to connect to WiFi");
+    logLine("Unable to connect to WiFi");
+    startManagementServer();
+    if (improvProvisioning) improvFailed();
+}
 
-    while (WiFi.status() != WL_CONNECTED) {
-        if (millis() > timeout) {
-            terminalLog("!Unable to connect to WiFi");
-            logLine("Unable to connect to WiFi");
-            startManagementServer();
-            return false;
-        }
-        vTaskDelay(250 / portTICK_PERIOD_MS);
-    }
+void WifiManager::connectionEstablished() {
+    metricObserve(METRIC_WIFI_CONNECT_MS, _connection.connectMs);
+    _connected = true;
 
     if (_savewhensuccessfull) {
         Preferences preferences;
@@ -203,9 +224,7 @@ bool WifiManager::waitForConnection() {
     IPAddress IP = WiFi.localIP();
     terminalLog("Connected!");
     // logLine("Connected!");
-    _nextReconnectCheck = millis() + _reconnectIntervalCheck;
-    wifiStatus = CONNECTED;
-    return true;
+    if (improvProvisioning) improvConnected(_ssid, _pass);
 }
 
 void WifiManager::startManagementServer() {
@@ -220,8 +239,8 @@ void WifiManager::startManagementServer() {
         IPAddress IP = WiFi.softAPIP();
         terminalLog("Connect to it, visit http://" + String(IP.toString().c_str()) + "/setup");
         _APstarted = true;
-        _nextReconnectCheck = millis() + _retryIntervalCheck;
-        wifiStatus = AP;
+        _connection.nextCheck = millis() + _connection.retryInterval;
+        _connection.status = AP;
     }
 }
 
@@ -266,6 +285,7 @@ void WifiManager::WiFiEvent(WiFiEvent_t event) {
             break;
         case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
             // eventname = "Disconnected from WiFi access point";
+            _linkLost = true;
             break;
         case ARDUINO_EVENT_WIFI_STA_AUTHMODE_CHANGE:
             eventname = "Authentication mode of access point has changed";
@@ -352,22 +372,9 @@ bool onCommandCallback(improv::ImprovCommand cmd) {
             saveDB("/current/tagDB.json");
             ws.closeAll();
             delay(100);
-            if (wm.connectToWifi(String(cmd.ssid.c_str()), String(cmd.password.c_str()), true)) {
-                Preferences preferences;
-                preferences.begin("wifi", false);
-                preferences.putString("ssid", cmd.ssid.c_str());
-                preferences.putString("pw", cmd.password.c_str());
-                preferences.end();
-                ws.enable(true);
-
-                set_state(improv::STATE_PROVISIONED);
-                std::vector<uint8_t> data = improv::build_rpc_response(improv::WIFI_SETTINGS, getLocalUrl(), false);
-                send_response(data);
-            } else {
-                set_state(improv::STATE_STOPPED);
-                set_error(improv::Error::ERROR_UNABLE_TO_CONNECT);
-            }
-
+            // the result is reported from improvConnected / improvFailed once the connection attempt is done
+            improvProvisioning = true;
+            wm.connectToWifi(String(cmd.ssid.c_str()), String(cmd.password.c_str()), true);
             break;
         }
 
@@ -400,14 +407,54 @@ bool onCommandCallback(improv::ImprovCommand cmd) {
     return true;
 }
 
+static void improvConnected(String ssid, String pass) {
+    improvProvisioning = false;
+    Preferences preferences;
+    preferences.begin("wifi", false);
+    preferences.putString("ssid", ssid);
+    preferences.putString("pw", pass);
+    preferences.end();
+    ws.enable(true);
+
+    set_state(improv::STATE_PROVISIONED);
+    std::vector<uint8_t> data = improv::build_rpc_response(improv::WIFI_SETTINGS, getLocalUrl(), false);
+    send_response(data);
+}
+
+static void improvFailed() {
+    improvProvisioning = false;
+    set_state(improv::STATE_STOPPED);
+    set_error(improv::Error::ERROR_UNABLE_TO_CONNECT);
+}
+
 void getAvailableWifiNetworks() {
-    int networkNum = WiFi.scanNetworks();
+    wm.startScan();
+}
+
+void WifiManager::startScan() {
+    if (_scanRunning) return;
+    // async scan, the results are sent from pollScan()
+    if (WiFi.scanNetworks(true) == WIFI_SCAN_FAILED) {
+        sendAvailableWifiNetworks(0);
+        return;
+    }
+    _scanRunning = true;
+}
+
+void WifiManager::pollScan() {
+    if (!_scanRunning) return;
+    int16_t networkNum = WiFi.scanComplete();
+    if (networkNum == WIFI_SCAN_RUNNING) return;
+    _scanRunning = false;
+    sendAvailableWifiNetworks(networkNum > 0 ? networkNum : 0);
+    WiFi.scanDelete();
+}
 
+void sendAvailableWifiNetworks(int networkNum) {
     for (int id = 0; id < networkNum; ++id) {
         std::vector<uint8_t> data = improv::build_rpc_response(
             improv::GET_WIFI_NETWORKS, {WiFi.SSID(id), String(WiFi.RSSI(id)), (WiFi.encryptionType(id) == WIFI_AUTH_OPEN ? "NO" : "YES")}, false);
         send_response(data);
-        delay(1);
     }
     // final response
     std::vector<uint8_t> data =
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int gpio_set_level(int gpio_num, uint32_t level);
+int gpio_get_level(int gpio_num);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define SPI2_HOST 1
+
+typedef struct spi_device_t* spi_device_handle_t;
+
+typedef struct {
+    uint32_t flags;
+    size_t length;  // in bits
+    size_t rxlength;
+    const void* tx_buffer;
+    void* rx_buffer;
+} spi_transaction_t;
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t* trans_desc);
+
+#ifdef __cplusplus
+}
+#endif
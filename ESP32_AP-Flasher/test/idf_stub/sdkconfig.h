@@ -0,0 +1,11 @@
+#pragma once
+
+// Just enough of ESP-IDF to build the radio code of the C6 AP on the host, see test_subghz_rx.
+// The functions are implemented by the test.
+
+#define CONFIG_OEPL_SUBGIG_SUPPORT 1
+#define CONFIG_SPI2_HOST 1
+#define CONFIG_CSN_GPIO 10
+#define CONFIG_MISO_GPIO 11
+#define CONFIG_GDO0_GPIO 12
+#define CONFIG_GDO2_GPIO 13
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <string>
+
+// the radio AP core as the C6 and H2 build it, with a fake platform around it. It is C, where {0}
+// is the usual way to zero a struct.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#include "ap_core.c"
+#pragma GCC diagnostic pop
+
+static uint32_t now;
+static std::string uart;  // everything the core sent to the ESP32
+static bool reset;
+static size_t ackBeforeSwitch;  // uart.size() when the channel was switched
+static uint8_t channel;
+
+static uint32_t fakeMillis(void) {
+    return now;
+}
+static void fakeDelay(int ms) {
+    now += ms;
+}
+static void fakeUartTx(uint8_t data) {
+    uart += (char)data;
+}
+static void fakeLog(const char*) {}
+static void fakeNotifyAPInfo(void) {
+    uart += "TYP>";
+}
+static void fakeSwitchSpeed(int) {}
+static bool fakeSetChannelPower(const struct espSetChannelPower* scp, void (*ack)(void)) {
+    if (scp->channel != 11 && scp->channel != 25) return false;
+    ack();
+    ackBeforeSwitch = uart.size();
+    channel = scp->channel;
+    return true;
+}
+static void fakeReset(void) {
+    reset = true;
+}
+
+static const struct apPlatform fakePlatform = {fakeMillis, fakeDelay, fakeUartTx, fakeLog, fakeNotifyAPInfo, fakeSwitchSpeed, fakeSetChannelPower, fakeReset};
+
+static void serial(const void* data, size_t len) {
+    for (size_t c = 0; c < len; c++) processSerial(((const uint8_t*)data)[c]);
+}
+static void serial(const char* str) {
+    serial(str, strlen(str));
+}
+
+static struct pendingData pendingFor(uint8_t tag, uint8_t dataType) {
+    struct pendingData pd = {};
+    pd.availdatainfo.dataVer = 0x1000 + tag;
+    pd.availdatainfo.dataType = dataType;
+    pd.availdatainfo.nextCheckIn = 2;
+    pd.attemptsLeft = 3;
+    pd.targetMac[0] = tag;
+    pd.targetMac[7] = 0x44;
+    addCRC(&pd.availdatainfo, sizeof(pd.availdatainfo));
+    addCRC(&pd, sizeof(pd));
+    return pd;
+}
+
+static void sendSDA(struct pendingData pd) {
+    serial("SDA>");
+    serial(&pd, sizeof(pd));
+}
+
+static std::string notified;
+static void recordTimeOut(const uint8_t* mac) {
+    notified += (char)mac[0];
+}
+
+void setUp(void) {
+    apCoreInit(&fakePlatform);
+    clearPendingData();
+    now = 100000;
+    uart.clear();
+    notified.clear();
+    reset = false;
+    ackBeforeSwitch = 0;
+    channel = 0;
+    requestedData = {};
+    blockStartTimer = 0;
+    memset(lastBlockMac, 0, sizeof(lastBlockMac));
+    lastBlockRequest = 0;
+}
+void tearDown(void) {}
+
+void test_crc(void) {
+    uint8_t packet[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 250};
+    addCRC(packet, sizeof(packet));
+    TEST_ASSERT_EQUAL(30, packet[0]);  // the sum wraps around
+    TEST_ASSERT_TRUE(checkCRC(packet, sizeof(packet)));
+    packet[4]++;
+    TEST_ASSERT_FALSE(checkCRC(packet, sizeof(packet)));
+}
+
+void test_sda_queues_and_replaces(void) {
+    sendSDA(pendingFor(1, 0x20));
+    sendSDA(pendingFor(2, 0x20));
+    TEST_ASSERT_EQUAL_STRING("ACK>ACK>", uart.c_str());
+    TEST_ASSERT_EQUAL(0, findSlotForMac(pendingFor(1, 0).targetMac));
+    TEST_ASSERT_EQUAL(1, findSlotForMac(pendingFor(2, 0).targetMac));
+
+    struct pendingData update = pendingFor(1, 0x21);
+    sendSDA(update);
+    TEST_ASSERT_EQUAL(0, findSlotForMac(update.targetMac));  // same slot, new data
+    TEST_ASSERT_EQUAL(0x21, getPendingDataInfo(update.targetMac)->dataType);
+
+    struct pendingData broken = pendingFor(3, 0x20);
+    broken.attemptsLeft++;
+    uart.clear();
+    sendSDA(broken);
+    TEST_ASSERT_EQUAL_STRING("NOK>", uart.c_str());
+    TEST_ASSERT_NULL(getPendingDataInfo(broken.targetMac));
+}
+
+void test_full_table_answers_noq(void) {
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        struct pendingData pd = pendingFor(c & 0xff, 0x20);
+        pd.targetMac[1] = c >> 8;
+        TEST_ASSERT_TRUE(queuePendingData(&pd));
+    }
+    TEST_ASSERT_EQUAL(MAX_PENDING_MACS - 1, findSlotForMac(pendingFor(MAX_PENDING_MACS - 1, 0).targetMac));  // past int8_t
+    sendSDA(pendingFor(251, 0x20));
+    TEST_ASSERT_EQUAL_STRING("NOQ>", uart.c_str());
+}
+
+void test_cancel_deletes_all_for_mac(void) {
+    sendSDA(pendingFor(5, 0x20));
+    uart.clear();
+    serial("CXD>");
+    struct pendingData pd = pendingFor(5, 0);
+    serial(&pd, sizeof(pd));
+    TEST_ASSERT_EQUAL_STRING("ACK>", uart.c_str());
+    TEST_ASSERT_EQUAL(-1, findSlotForMac(pd.targetMac));
+}
+
+// the ESP32 waits for the ACK, it has to go out before the radio is switched
+void test_scp_acks_before_switching(void) {
+    struct espSetChannelPower scp = {};
+    scp.channel = 25;
+    scp.power = 10;
+    addCRC(&scp, sizeof(scp));
+    serial("SCP>");
+    serial(&scp, sizeof(scp));
+    TEST_ASSERT_EQUAL_STRING("ACK>", uart.c_str());
+    TEST_ASSERT_EQUAL(4, ackBeforeSwitch);
+    TEST_ASSERT_EQUAL(25, channel);
+
+    scp.channel = 12;
+    addCRC(&scp, sizeof(scp));
+    uart.clear();
+    serial("SCP>");
+    serial(&scp, sizeof(scp));
+    TEST_ASSERT_EQUAL_STRING("NOK>", uart.c_str());
+    TEST_ASSERT_EQUAL(25, channel);
+}
+
+void test_commands(void) {
+    serial("RDY?");
+    TEST_ASSERT_EQUAL_STRING("ACK>", uart.c_str());
+    serial("NFO?");
+    TEST_ASSERT_EQUAL_STRING("ACK>ACK>TYP>", uart.c_str());
+    TEST_ASSERT_FALSE(reset);
+    serial("RSET");
+    TEST_ASSERT_TRUE(reset);
+    TEST_ASSERT_EQUAL_STRING("ACK>ACK>TYP>ACK>", uart.c_str());
+}
+
+// a half received command is dropped after a second of silence
+void test_uart_timeout(void) {
+    serial("SDA>");
+    serial("\x01\x02\x03");
+    now += 1001;
+    serial("RDY?");
+    TEST_ASSERT_EQUAL_STRING("ACK>", uart.c_str());
+}
+
+void test_housekeeping_expires_slots(void) {
+    struct pendingData update = pendingFor(1, 0x20);
+    queuePendingData(&update);
+    struct pendingData noUpdate = pendingFor(2, DATATYPE_NOUPDATE);
+    noUpdate.attemptsLeft = 1;
+    queuePendingData(&noUpdate);
+    countSlots();
+    TEST_ASSERT_EQUAL(1, curPendingData);
+    TEST_ASSERT_EQUAL(1, curNoUpdate);
+
+    pendingDataHousekeeping(recordTimeOut);  // no timeout message for a slot without data
+    TEST_ASSERT_EQUAL_STRING("", notified.c_str());
+    TEST_ASSERT_EQUAL(1, getPendingDataInfo(pendingFor(1, 0).targetMac)->nextCheckIn);
+    pendingDataHousekeeping(recordTimeOut);
+    pendingDataHousekeeping(recordTimeOut);
+    TEST_ASSERT_EQUAL_STRING("\x01", notified.c_str());
+    countSlots();
+    TEST_ASSERT_EQUAL(0, curPendingData + curNoUpdate);
+}
+
+void test_block_request_admission(void) {
+    struct pendingData a = pendingFor(1, 0x20), b = pendingFor(2, 0x20);
+    queuePendingData(&a);
+    queuePendingData(&b);
+    struct blockRequest br = {};
+    br.ver = 0x1001;
+    br.blockId = 1;
+    uint16_t wait = 0;
+
+    TEST_ASSERT_EQUAL(BLOCKREQ_FETCH, blockRequestAdmit(a.targetMac, &br, 0, &wait));
+    TEST_ASSERT_EQUAL(550, wait);
+    now += 100;
+    TEST_ASSERT_EQUAL(BLOCKREQ_CANCEL, blockRequestAdmit(b.targetMac, &br, 0, &wait));  // busy with tag 1
+    TEST_ASSERT_EQUAL_STRING("BUSY!\n", uart.c_str());
+    TEST_ASSERT_EQUAL(BLOCKREQ_ACK, blockRequestAdmit(a.targetMac, &br, 0, &wait));  // already in the buffer
+    TEST_ASSERT_EQUAL(30, wait);
+
+    now += CONCURRENT_REQUEST_DELAY + 1;
+    struct pendingData unknown = pendingFor(9, 0x20);
+    TEST_ASSERT_EQUAL(BLOCKREQ_CANCEL, blockRequestAdmit(unknown.targetMac, &br, 0, &wait));  // no data for it
+}
+
+void test_avail_data_req_fixup(void) {
+    uint8_t buffer[128];
+    memset(buffer, 0xAA, sizeof(buffer));
+    TEST_ASSERT_TRUE(fixupAvailDataReq(buffer, PKT_AVAIL_DATA_SHORTREQ, 18));
+    TEST_ASSERT_EQUAL(0, buffer[1 + sizeof(struct MacFrameBcast)]);
+    TEST_ASSERT_FALSE(fixupAvailDataReq(buffer, PKT_AVAIL_DATA_SHORTREQ, 19));
+    TEST_ASSERT_TRUE(fixupAvailDataReq(buffer, PKT_AVAIL_DATA_REQ, 40));
+    TEST_ASSERT_FALSE(fixupAvailDataReq(buffer, PKT_AVAIL_DATA_REQ, 30));
+}
+
+// The slot lookups are linear over MAX_PENDING_MACS and run for every check-in and every SDA.
+void test_benchmark_full_table(void) {
+    for (uint16_t c = 0; c < MAX_PENDING_MACS; c++) {
+        struct pendingData pd = pendingFor(c & 0xff, 0x20);
+        pd.targetMac[1] = c >> 8;
+        queuePendingData(&pd);
+    }
+    const int runs = 2000;
+    volatile int found = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        struct pendingData pd = pendingFor(i % MAX_PENDING_MACS, 0x20);
+        found += getPendingDataInfo(pd.targetMac) != NULL;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    uart.clear();
+    for (int i = 0; i < runs; i++) sendSDA(pendingFor(i % MAX_PENDING_MACS, 0x21));
+    auto t2 = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL(runs, found);
+    TEST_ASSERT_EQUAL(runs * 4, uart.size());
+
+    char message[160];
+    snprintf(message, sizeof(message), "%d slots: %lld ns per lookup, %lld ns per SDA over the uart parser",
+             MAX_PENDING_MACS, (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / runs,
+             (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / runs);
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc);
+    RUN_TEST(test_sda_queues_and_replaces);
+    RUN_TEST(test_full_table_answers_noq);
+    RUN_TEST(test_cancel_deletes_all_for_mac);
+    RUN_TEST(test_scp_acks_before_switching);
+    RUN_TEST(test_commands);
+    RUN_TEST(test_uart_timeout);
+    RUN_TEST(test_housekeeping_expires_slots);
+    RUN_TEST(test_block_request_admission);
+    RUN_TEST(test_avail_data_req_fixup);
+    RUN_TEST(test_benchmark_full_table);
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+#include <string.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "dither.h"
+
+// The golden values below were produced by the spr2color loop as it was before the dithering
+// moved into dither.h, on the same test image.
+
+static const std::vector<Color> bw = {Color(255, 255, 255), Color(0, 0, 0)};
+static const std::vector<Color> bwr = {Color(255, 255, 255), Color(0, 0, 0), Color(255, 0, 0)};
+static const std::vector<Color> bwry = {Color(255, 255, 255), Color(0, 0, 0), Color(255, 0, 0), Color(255, 255, 0)};
+
+// gradients in red and green, some noise in blue
+static uint16_t testPixel(long x, long y) {
+    const uint8_t r = x * 255 / 36, g = y * 255 / 22, b = (x * y * 7) & 0xff;
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+static uint32_t fnv1a(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// spr2color without rotation: one bit plane, black or red
+static void testPlane(long bufw, long bufh, const std::vector<Color>& palette, uint8_t dither, uint8_t* buffer, size_t buffer_size, bool is_red) {
+    bool hasRed = false;
+    ditherPlane([](int32_t x, int32_t y) { return testPixel(x, y); }, bufw, bufh, 0, palette, palette.size(), dither, buffer, buffer_size, is_red, hasRed);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_golden_planes(void) {
+    struct {
+        const std::vector<Color>* palette;
+        uint8_t dither;
+        uint32_t black;
+        uint32_t red;
+    } const goldens[] = {
+        {&bw, 0, 0x74CB8A76, 0xC08FDE17},
+        {&bw, 1, 0xB1BCDBC3, 0xC08FDE17},
+        {&bw, 2, 0x19C84928, 0xC08FDE17},
+        {&bwr, 0, 0x84495037, 0xFA708C1B},
+        {&bwr, 1, 0x195048FB, 0x50382781},
+        {&bwr, 2, 0x736F1CDC, 0x8A0B078C},
+        {&bwry, 0, 0x87D6007F, 0xCC638164},
+        {&bwry, 1, 0x760F4C3C, 0xF7E1CA35},
+        {&bwry, 2, 0x999E3B43, 0xC20995FA},
+    };
+    uint8_t buffer[37 * 23 / 8 + 1];
+    for (const auto& golden : goldens) {
+        testPlane(37, 23, *golden.palette, golden.dither, buffer, sizeof(buffer), false);
+        TEST_ASSERT_EQUAL_HEX32(golden.black, fnv1a(buffer, sizeof(buffer)));
+        testPlane(37, 23, *golden.palette, golden.dither, buffer, sizeof(buffer), true);
+        TEST_ASSERT_EQUAL_HEX32(golden.red, fnv1a(buffer, sizeof(buffer)));
+    }
+}
+
+void test_golden_bytes(void) {
+    uint8_t buffer[8];
+    const uint8_t burkes[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xDB, 0xFE, 0xFE};
+    testPlane(16, 4, bw, 1, buffer, sizeof(buffer), false);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(burkes, buffer, sizeof(buffer));
+    const uint8_t ordered[8] = {0xFF, 0xFF, 0xFF, 0xDD, 0xFF, 0xFF, 0x75, 0x55};
+    testPlane(16, 4, bw, 2, buffer, sizeof(buffer), false);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(ordered, buffer, sizeof(buffer));
+}
+
+void test_ordered_grey_is_half_black(void) {
+    ditherError errors[8] = {};
+    int black = 0;
+    for (long y = 0; y < 4; y++) {
+        for (uint16_t x = 0; x < 4; x++) {
+            if (ditherPixel(Color(128, 128, 128), bw, 2, 2, x, x, y, errors, errors + 4) == 1) black++;
+        }
+    }
+    TEST_ASSERT_EQUAL(8, black);
+}
+
+void test_exact_match_has_no_error(void) {
+    ditherError old[6] = {}, next[6] = {};
+    TEST_ASSERT_EQUAL(2, ditherPixel(Color(255, 0, 0), bwr, 3, 1, 1, 1, 0, old, next));
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(0, old[i].r);
+        TEST_ASSERT_EQUAL(0, next[i].r);
+    }
+}
+
+void test_error_is_clamped(void) {
+    ditherError error = {1000, -1000, 10};
+    colorDistance(Color(0, 0, 0), Color(0, 0, 0), error);
+    TEST_ASSERT_EQUAL(255, error.r);
+    TEST_ASSERT_EQUAL(-255, error.g);
+    TEST_ASSERT_EQUAL(10, error.b);
+}
+
+void test_color_from_rgb565(void) {
+    const Color white(static_cast<uint16_t>(0xFFFF));
+    TEST_ASSERT_EQUAL(255, white.r);
+    TEST_ASSERT_EQUAL(255, white.g);
+    TEST_ASSERT_EQUAL(255, white.b);
+    const Color red(static_cast<uint16_t>(0xF800));
+    TEST_ASSERT_EQUAL(255, red.r);
+    TEST_ASSERT_EQUAL(0, red.g);
+    TEST_ASSERT_EQUAL(0, red.b);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_golden_planes);
+    RUN_TEST(test_golden_bytes);
+    RUN_TEST(test_ordered_grey_is_half_black);
+    RUN_TEST(test_exact_match_has_no_error);
+    RUN_TEST(test_error_is_clamped);
+    RUN_TEST(test_color_from_rgb565);
+    return UNITY_END();
+}
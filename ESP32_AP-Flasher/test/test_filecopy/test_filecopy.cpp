@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "filecopy.h"
+
+typedef std::vector<uint8_t> bytes;
+
+// fs::File stand-ins that count the calls and check that every access happens with the lock held
+static bool locked;
+static uint32_t calls;
+
+struct memReader {
+    const bytes& data;
+    size_t pos;
+    size_t read(uint8_t* buf, size_t len) {
+        TEST_ASSERT_TRUE(locked);
+        calls++;
+        const size_t n = std::min(len, data.size() - pos);
+        if (n) memcpy(buf, data.data() + pos, n);
+        pos += n;
+        return n;
+    }
+};
+
+struct memWriter {
+    bytes data;
+    size_t room;  // the filesystem is full after this many bytes
+    size_t write(const uint8_t* buf, size_t len) {
+        TEST_ASSERT_TRUE(locked);
+        calls++;
+        const size_t n = std::min(len, room - data.size());
+        data.insert(data.end(), buf, buf + n);
+        return n;
+    }
+};
+
+static bytes testData(size_t len) {
+    bytes data(len);
+    for (size_t c = 0; c < len; c++) data[c] = (c * 31 + (c >> 8)) & 0xFF;
+    return data;
+}
+
+static uint32_t locks;
+static auto lock = []() {
+    TEST_ASSERT_FALSE(locked);
+    locked = true;
+    locks++;
+};
+static auto unlock = []() {
+    TEST_ASSERT_TRUE(locked);
+    locked = false;
+};
+
+static size_t copy(const bytes& source, memWriter& out, size_t bufSize, std::vector<size_t>* progress = nullptr) {
+    memReader in = {source, 0};
+    bytes buf(bufSize);
+    return copyInChunks(in, out, buf.data(), buf.size(), lock, unlock, [progress](size_t copied) {
+        TEST_ASSERT_FALSE(locked);
+        if (progress) progress->push_back(copied);
+    });
+}
+
+void setUp(void) {
+    locked = false;
+    calls = 0;
+    locks = 0;
+}
+void tearDown(void) {}
+
+void test_copies_every_size(void) {
+    for (size_t len : {0, 1, 511, 512, 513, 8192, 100000}) {
+        const bytes source = testData(len);
+        memWriter out = {{}, SIZE_MAX};
+        TEST_ASSERT_EQUAL(len, copy(source, out, 512));
+        TEST_ASSERT_EQUAL(len, out.data.size());
+        TEST_ASSERT_TRUE(out.data == source);
+        TEST_ASSERT_FALSE(locked);
+    }
+}
+
+// the lock is taken once per chunk, plus once for the read that finds the end
+void test_lock_per_chunk(void) {
+    const bytes source = testData(20000);
+    memWriter out = {{}, SIZE_MAX};
+    std::vector<size_t> progress;
+    copy(source, out, 8192, &progress);
+    TEST_ASSERT_EQUAL(4, locks);
+    TEST_ASSERT_EQUAL(3, progress.size());
+    TEST_ASSERT_EQUAL(8192, progress[0]);
+    TEST_ASSERT_EQUAL(20000, progress[2]);
+}
+
+void test_stops_at_short_write(void) {
+    const bytes source = testData(5000);
+    memWriter out = {{}, 3000};
+    TEST_ASSERT_EQUAL(3000, copy(source, out, 1024));
+    TEST_ASSERT_TRUE(std::equal(out.data.begin(), out.data.end(), source.begin()));
+    TEST_ASSERT_FALSE(locked);
+}
+
+// Calls and lock holds for a firmware pack sized file with the old 64 byte stack buffer, the smallest
+// heap buffer copyChunks settles for and the default. On the SD card every call is a SPI transaction
+// with its own command overhead, so the call count is what the copy time follows; the lock hold is
+// what other tasks may have to wait for.
+void test_benchmark_chunk_sizes(void) {
+    const bytes source = testData(600 * 1024);
+    uint32_t calls64 = 0;
+    for (size_t bufSize : {64, 512, 8192}) {
+        setUp();
+        memWriter out = {{}, SIZE_MAX};
+        TEST_ASSERT_EQUAL(source.size(), copy(source, out, bufSize));
+        if (bufSize == 64) calls64 = calls;
+        char message[120];
+        snprintf(message, sizeof(message), "%u byte chunks: %u read/write calls, %u lock holds of at most %u bytes",
+                 (unsigned)bufSize, (unsigned)calls, (unsigned)locks, (unsigned)bufSize);
+        TEST_MESSAGE(message);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(calls64 / 100, calls);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_copies_every_size);
+    RUN_TEST(test_lock_per_chunk);
+    RUN_TEST(test_stops_at_short_write);
+    RUN_TEST(test_benchmark_chunk_sizes);
+    return UNITY_END();
+}
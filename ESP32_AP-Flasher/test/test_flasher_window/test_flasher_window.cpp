@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <deque>
+#include <vector>
+
+#include "flasherwindow.h"
+
+typedef std::vector<uint8_t> bytes;
+
+#define CMD_WRITE_FLASH_WINDOW 84
+#define CMD_WRITE_ERROR 99
+#define FLASHER_QUEUE 10  // flasherCmdQueue
+#define HOST_TIMEOUT_US 3000000  // wait_for_command_ser
+#define WINDOW_MAX_RETRIES 10
+
+// zlib's crc32, what OEPL-Flasher.py sends and esp_rom_crc32_le(0, ...) computes
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t c = 0; c < len; c++) {
+        crc ^= data[c];
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t rng = 1;
+static uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+static bool chance(uint32_t perMille) {
+    return nextRandom() % 1000 < perMille;
+}
+
+// Loopback of OEPL-Flasher.py's write_windowed against the flasher side, on a simulated clock in us.
+// Frames take `latency` each way. The flasher queues at most FLASHER_QUEUE commands and drops the
+// rest, like flasherDataHandler; usbFlasherTask takes one at a time, `writeUs` for a chunk that gets
+// written, and sleeps `postDelayUs` after every command (the old 50 ms).
+struct usbLink {
+    // the channel
+    uint32_t latency = 1000;
+    uint32_t writeUs = 3000;
+    uint32_t postDelayUs = 0;
+    uint32_t dropPerMille = 0;     // frames lost to the frame checksum, both ways
+    uint32_t swapPerMille = 0;     // two data bytes swapped, which the additive frame checksum misses
+    uint8_t window = 8;
+
+    // flasher
+    struct frame {
+        uint64_t arrival;
+        bytes payload;
+    };
+    std::deque<frame> inTransit, queue;
+    uint64_t flasherFree = 0;
+    uint32_t expectedSeq = 0;
+    bytes flash;
+    uint32_t writes = 0, queueDrops = 0;
+
+    // host
+    struct answer {
+        uint64_t arrival;
+        uint8_t cmd;
+        uint32_t seq;
+    };
+    std::deque<answer> inbox;
+    uint64_t now = 0;
+    uint32_t sent = 0, timeouts = 0;
+
+    void send(uint32_t seq, const bytes& chunk) {
+        bytes payload(FLASHER_WINDOW_HEADER);
+        windowPutSeq(payload.data(), seq);
+        windowPutSeq(payload.data() + 4, crc32(chunk.data(), chunk.size()));
+        payload.insert(payload.end(), chunk.begin(), chunk.end());
+        sent++;
+        now += payload.size();  // ~1 MB/s on the USB CDC
+        if (chance(dropPerMille)) return;
+        if (chance(swapPerMille) && payload.size() > FLASHER_WINDOW_HEADER + 1) {
+            const size_t at = FLASHER_WINDOW_HEADER + nextRandom() % (payload.size() - FLASHER_WINDOW_HEADER - 1);
+            std::swap(payload[at], payload[at + 1]);
+        }
+        inTransit.push_back({now + latency, payload});
+    }
+
+    // processWindowedWrite, with writeFlasherChunk appending to flash
+    void process(frame& cmd) {
+        const uint64_t start = flasherFree > cmd.arrival ? flasherFree : cmd.arrival;
+        flasherWindowChunk chunk;
+        TEST_ASSERT_TRUE(parseWindowChunk(cmd.payload.data(), cmd.payload.size(), chunk));
+        answer reply = {0, CMD_WRITE_FLASH_WINDOW, chunk.seq};
+        uint64_t done = start + 50;
+        switch (windowAction(chunk, crc32(chunk.data, chunk.len), expectedSeq)) {
+            case WINDOW_WRITE:
+                TEST_ASSERT_EQUAL(expectedSeq * 256, flash.size());
+                flash.insert(flash.end(), chunk.data, chunk.data + chunk.len);
+                writes++;
+                expectedSeq++;
+                done = start + writeUs;
+                break;
+            case WINDOW_GO_BACK:
+                reply = {0, CMD_WRITE_ERROR, expectedSeq};
+                break;
+            case WINDOW_ACK_AGAIN:
+                break;
+        }
+        flasherFree = done + postDelayUs;
+        reply.arrival = done + latency;
+        if (!chance(dropPerMille)) inbox.push_back(reply);
+    }
+
+    // runs the flasher up to `until`; frames arrive in the order they were sent, and a worker start
+    // frees its queue slot before a frame arriving at the same time is looked at
+    void runFlasher(uint64_t until) {
+        while (true) {
+            const uint64_t nextStart = queue.empty() ? UINT64_MAX : (flasherFree > queue.front().arrival ? flasherFree : queue.front().arrival);
+            const uint64_t nextArrival = inTransit.empty() ? UINT64_MAX : inTransit.front().arrival;
+            if (nextStart <= nextArrival && nextStart <= until) {
+                frame cmd = queue.front();
+                queue.pop_front();
+                process(cmd);
+            } else if (nextArrival <= until) {
+                if (queue.size() < FLASHER_QUEUE) {
+                    queue.push_back(inTransit.front());
+                } else {
+                    queueDrops++;
+                }
+                inTransit.pop_front();
+            } else {
+                break;
+            }
+        }
+    }
+
+    // wait_for_command
+    bool wait(answer& reply) {
+        runFlasher(now + HOST_TIMEOUT_US);
+        if (inbox.empty() || inbox.front().arrival > now + HOST_TIMEOUT_US) {
+            now += HOST_TIMEOUT_US;
+            timeouts++;
+            return false;
+        }
+        reply = inbox.front();
+        inbox.pop_front();
+        if (reply.arrival > now) now = reply.arrival;
+        return true;
+    }
+
+    // write_windowed
+    bool write(const bytes& image, const size_t chunkSize) {
+        std::vector<bytes> chunks;
+        for (size_t c = 0; c < image.size(); c += chunkSize) {
+            chunks.emplace_back(image.begin() + c, image.begin() + std::min(c + chunkSize, image.size()));
+        }
+        uint32_t base = 0, nextSeq = 0, retries = 0;
+        int64_t resendFrom = -1;
+        while (base < chunks.size()) {
+            while (nextSeq < chunks.size() && nextSeq - base < window) {
+                send(nextSeq, chunks[nextSeq]);
+                nextSeq++;
+            }
+            answer reply;
+            if (!wait(reply)) {
+                resendFrom = -1;
+            } else if (reply.cmd == CMD_WRITE_FLASH_WINDOW) {
+                if (reply.seq >= base) {
+                    base = reply.seq + 1;
+                    retries = 0;
+                }
+                continue;
+            } else {
+                if (reply.seq == resendFrom) continue;
+                resendFrom = reply.seq;
+                base = reply.seq;
+            }
+            if (++retries > WINDOW_MAX_RETRIES) return false;
+            nextSeq = base;
+        }
+        return true;
+    }
+};
+
+static bytes testImage(size_t len) {
+    bytes image(len);
+    for (size_t c = 0; c < len; c++) image[c] = (c * 73 + (c >> 8)) & 0xFF;
+    return image;
+}
+
+void setUp(void) {
+    rng = 1;
+}
+void tearDown(void) {}
+
+void test_crc_is_zlib(void) {
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32((const uint8_t*)"123456789", 9));
+}
+
+void test_window_actions(void) {
+    uint8_t payload[FLASHER_WINDOW_HEADER + 4] = {0, 0, 0, 5};
+    flasherWindowChunk chunk;
+    TEST_ASSERT_FALSE(parseWindowChunk(payload, FLASHER_WINDOW_HEADER - 1, chunk));
+    TEST_ASSERT_FALSE(parseWindowChunk(nullptr, 0, chunk));
+    windowPutSeq(payload + 4, 0xDEADBEEF);
+    TEST_ASSERT_TRUE(parseWindowChunk(payload, sizeof(payload), chunk));
+    TEST_ASSERT_EQUAL(5, chunk.seq);
+    TEST_ASSERT_EQUAL_HEX32(0xDEADBEEF, chunk.crc);
+    TEST_ASSERT_EQUAL(4, chunk.len);
+    TEST_ASSERT_EQUAL_PTR(payload + FLASHER_WINDOW_HEADER, chunk.data);
+
+    TEST_ASSERT_EQUAL(WINDOW_WRITE, windowAction(chunk, 0xDEADBEEF, 5));
+    TEST_ASSERT_EQUAL(WINDOW_GO_BACK, windowAction(chunk, 0x12345678, 5));  // bad CRC
+    TEST_ASSERT_EQUAL(WINDOW_GO_BACK, windowAction(chunk, 0xDEADBEEF, 4));  // 4 is missing
+    TEST_ASSERT_EQUAL(WINDOW_ACK_AGAIN, windowAction(chunk, 0xDEADBEEF, 6));
+    TEST_ASSERT_EQUAL(WINDOW_ACK_AGAIN, windowAction(chunk, 0x12345678, 6));  // written already, a bad resend doesn't matter
+}
+
+void test_clean_link(void) {
+    const bytes image = testImage(65536);
+    usbLink usb;
+    TEST_ASSERT_TRUE(usb.write(image, 256));
+    TEST_ASSERT_TRUE(usb.flash == image);
+    TEST_ASSERT_EQUAL(256, usb.writes);
+    TEST_ASSERT_EQUAL(256, usb.sent);
+    TEST_ASSERT_EQUAL(0, usb.queueDrops);
+    TEST_ASSERT_EQUAL(0, usb.timeouts);
+}
+
+// lost frames both ways and byte swaps the frame checksum lets through: every chunk still gets
+// written exactly once, in order, and nothing corrupted reaches the tag
+void test_lossy_link(void) {
+    const bytes image = testImage(65536 + 100);  // a short last chunk too
+    for (uint32_t seed : {1, 2, 3, 4, 5}) {
+        rng = seed;
+        usbLink usb;
+        usb.dropPerMille = 20;
+        usb.swapPerMille = 20;
+        TEST_ASSERT_TRUE(usb.write(image, 256));
+        TEST_ASSERT_TRUE(usb.flash == image);
+        TEST_ASSERT_EQUAL(257, usb.writes);
+        TEST_ASSERT_GREATER_THAN(257, usb.sent);
+    }
+}
+
+// a window bigger than the command queue overflows it against a slow flasher; go-back-N still
+// recovers the dropped commands
+void test_queue_overflow(void) {
+    const bytes image = testImage(16384);
+    usbLink usb;
+    usb.window = 16;
+    usb.writeUs = 20000;
+    TEST_ASSERT_TRUE(usb.write(image, 256));
+    TEST_ASSERT_TRUE(usb.flash == image);
+    TEST_ASSERT_GREATER_THAN(0, usb.queueDrops);
+}
+
+// A 64 kB ZBS243 image in 256 byte chunks, a chunk write taken as 3 ms: the old stop-and-wait with
+// the 50 ms delay after every command, stop-and-wait without it, and the window of 8.
+void test_benchmark_64k(void) {
+    const bytes image = testImage(65536);
+    usbLink old;
+    old.window = 1;
+    old.postDelayUs = 50000;
+    usbLink noDelay;
+    noDelay.window = 1;
+    usbLink windowed;
+    usbLink lossy;
+    lossy.dropPerMille = 10;
+    lossy.swapPerMille = 10;
+    TEST_ASSERT_TRUE(old.write(image, 256));
+    TEST_ASSERT_TRUE(noDelay.write(image, 256));
+    TEST_ASSERT_TRUE(windowed.write(image, 256));
+    TEST_ASSERT_TRUE(lossy.write(image, 256));
+
+    char message[200];
+    snprintf(message, sizeof(message), "64 kB: stop-and-wait + 50 ms %.2f s, stop-and-wait %.2f s, window 8 %.2f s, window 8 at 1%% loss %.2f s (%u sent, %u timeouts)",
+             old.now / 1e6, noDelay.now / 1e6, windowed.now / 1e6, lossy.now / 1e6, (unsigned)lossy.sent, (unsigned)lossy.timeouts);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(noDelay.now, windowed.now);
+    TEST_ASSERT_LESS_THAN(old.now / 10, windowed.now);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_is_zlib);
+    RUN_TEST(test_window_actions);
+    RUN_TEST(test_clean_link);
+    RUN_TEST(test_lossy_link);
+    RUN_TEST(test_queue_overflow);
+    RUN_TEST(test_benchmark_64k);
+    return UNITY_END();
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "gici_stream.h"
+
+typedef std::vector<uint8_t> bytes;
+
+// compress_image as it was before the stream, minus the queue lookup: it converted the whole image into a buffer
+static uint8_t swapBits(uint8_t num) {
+    uint8_t result = 0;
+    for (int i = 0; i < 8; ++i) {
+        result |= ((num >> i) & 0x01) << (7 - i);
+    }
+    return result;
+}
+
+static uint32_t compress_image(uint16_t giciType, const uint8_t* data, uint32_t dataLen, uint8_t* buffer) {
+    uint8_t screenResolution = (giciType >> 5) & 63;
+    uint8_t availColors = ((giciType >> 1) & 3);
+    uint8_t canDoCompression = (giciType & 0x4000) ? 0 : 1;
+
+    bool extra_color = false;
+    bool mirror_width = false;
+    uint16_t width_display = 104;
+    uint16_t height_display = 212;
+
+    switch (screenResolution) {
+        case 0: width_display = 216; height_display = 104; break;
+        case 1: width_display = 296; height_display = 128; break;
+        case 2: width_display = 300; height_display = 400; break;
+        case 3: width_display = 640; height_display = 384; break;
+        case 4: width_display = 960; height_display = 640; break;
+        case 5: width_display = 250; height_display = 136; break;
+        case 6: width_display = 196; height_display = 96; break;
+        case 7: width_display = 640; height_display = 480; break;
+        case 8: width_display = 250; height_display = 128; break;
+        case 9: width_display = 800; height_display = 480; break;
+        case 10: width_display = 280; height_display = 480; break;
+    }
+    if (giciType & 0x100) mirror_width = true;
+    if (availColors != 0) extra_color = true;
+
+    uint32_t len_compressed = 0;
+    if (canDoCompression) len_compressed = 4;
+    uint32_t curr_input_posi = 0;
+    int byte_per_line = (height_display / 8);
+    if (height_display % 8 != 0) byte_per_line++;
+    uint8_t Mirrorbuffer[81];
+    for (int i = 0; i < width_display; i++) {
+        if (canDoCompression) {
+            buffer[len_compressed++] = 0x75;
+            buffer[len_compressed++] = byte_per_line + 7;
+            buffer[len_compressed++] = byte_per_line;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+        }
+        if (mirror_width) {
+            for (int b = 0; b < byte_per_line; b++) {
+                Mirrorbuffer[b] = ~data[curr_input_posi++];
+            }
+            for (int b = byte_per_line - 1; b >= 0; b--) {
+                buffer[len_compressed++] = swapBits(Mirrorbuffer[b]);
+            }
+        } else {
+            for (int b = 0; b < byte_per_line; b++) {
+                buffer[len_compressed++] = ~data[curr_input_posi++];
+            }
+        }
+    }
+    if (extra_color) {
+        for (int i = 0; i < width_display; i++) {
+            if (canDoCompression) {
+                buffer[len_compressed++] = 0x75;
+                buffer[len_compressed++] = byte_per_line + 7;
+                buffer[len_compressed++] = byte_per_line;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+            }
+            if (mirror_width) {
+                for (int b = 0; b < byte_per_line; b++) {
+                    if (dataLen <= curr_input_posi)
+                        Mirrorbuffer[b] = 0x00;  // Do not anything outside of the buffer!
+                    else
+                        Mirrorbuffer[b] = data[curr_input_posi++];
+                }
+                for (int b = byte_per_line - 1; b >= 0; b--) {
+                    buffer[len_compressed++] = swapBits(Mirrorbuffer[b]);
+                }
+            } else {
+                for (int b = 0; b < byte_per_line; b++) {
+                    if (dataLen <= curr_input_posi) {
+                        buffer[len_compressed++] = 0x00;  // Do not anything outside of the buffer!
+                    } else {
+                        buffer[len_compressed++] = data[curr_input_posi++];
+                    }
+                }
+            }
+        }
+    }
+    if (canDoCompression) {
+        buffer[0] = len_compressed & 0xff;
+        buffer[1] = (len_compressed >> 8) & 0xff;
+        buffer[2] = (len_compressed >> 16) & 0xff;
+        buffer[3] = (len_compressed >> 24) & 0xff;
+    }
+    return len_compressed;
+}
+
+static bytes randomPlanes(size_t len, unsigned seed) {
+    srand(seed);
+    bytes data(len);
+    for (uint8_t& b : data) b = rand() & 0xff;
+    return data;
+}
+
+// reads the stream the way the BLE writer does, in parts of partLen bytes
+static bytes readStream(giciStream& stream, uint32_t partLen) {
+    bytes out(stream.totalLen);
+    for (uint32_t offset = 0; offset < stream.totalLen; offset += partLen) {
+        const uint32_t expected = std::min(partLen, stream.totalLen - offset);
+        TEST_ASSERT_EQUAL(expected, compress_image_read(stream, offset, out.data() + offset, partLen));
+    }
+    return out;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_layouts(void) {
+    giciLayout layout = gici_layout(1 << 5);  // 2.9" 296x128, TFT, BW
+    TEST_ASSERT_EQUAL(296, layout.width);
+    TEST_ASSERT_EQUAL(128, layout.height);
+    TEST_ASSERT_EQUAL(16, layout.bytePerLine);
+    TEST_ASSERT_FALSE(layout.extraColor);
+    TEST_ASSERT_FALSE(layout.mirror);
+    TEST_ASSERT_TRUE(layout.compression);
+
+    layout = gici_layout(0x4000 | 0x100 | (1 << 1));  // 250x128 BWR, mirrored, no compression
+    TEST_ASSERT_EQUAL(8, layout.screenResolution);  // the mirror bit is part of the resolution as well
+    TEST_ASSERT_EQUAL(250, layout.width);
+    TEST_ASSERT_EQUAL(16, layout.bytePerLine);
+    TEST_ASSERT_TRUE(layout.extraColor);
+    TEST_ASSERT_TRUE(layout.mirror);
+    TEST_ASSERT_FALSE(layout.compression);
+
+    layout = gici_layout(20 << 5);  // unknown resolution
+    TEST_ASSERT_EQUAL(104, layout.width);
+    TEST_ASSERT_EQUAL(212, layout.height);
+    TEST_ASSERT_EQUAL(27, layout.bytePerLine);
+}
+
+// every resolution, color count, mirroring and compression setting against the old buffer
+void test_stream_matches_compress_image(void) {
+    static uint8_t expected[4 + 2 * 960 * (7 + 80)];
+    int checked = 0;
+    for (uint16_t resolution = 0; resolution <= 11; resolution++) {
+        for (uint16_t colors = 0; colors < 4; colors++) {
+            for (uint16_t flags : {0x0000, 0x0100, 0x4000, 0x4100}) {
+                const uint16_t giciType = flags | (resolution << 5) | (1 << 3) | (colors << 1);
+                const giciLayout layout = gici_layout(giciType);
+                const size_t planeLen = layout.width * layout.bytePerLine;
+                bytes data = randomPlanes(layout.extraColor ? 2 * planeLen : planeLen, giciType);
+
+                const uint32_t expectedLen = compress_image(giciType, data.data(), data.size(), expected);
+                giciStream stream;
+                compress_image_setup(stream, layout, data.data(), data.size());
+                TEST_ASSERT_EQUAL(expectedLen, stream.totalLen);
+                for (uint32_t partLen : {1u, 7u, 224u, 100000u}) {
+                    const bytes out = readStream(stream, partLen);
+                    TEST_ASSERT_EQUAL_MEMORY(expected, out.data(), expectedLen);
+                }
+                checked++;
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL(12 * 4 * 4, checked);
+}
+
+// a color plane that is cut short is padded, like compress_image did
+void test_short_color_plane(void) {
+    static uint8_t expected[4 + 2 * 296 * (7 + 16)];
+    for (uint16_t resolution : {1, 8}) {  // 296x128, 250x128 mirrored
+        const uint16_t giciType = (resolution << 5) | (1 << 1);
+        const giciLayout layout = gici_layout(giciType);
+        bytes data = randomPlanes(layout.width * layout.bytePerLine * 3 / 2 + 5, 9);
+        const uint32_t expectedLen = compress_image(giciType, data.data(), data.size(), expected);
+        giciStream stream;
+        compress_image_setup(stream, layout, data.data(), data.size());
+        const bytes out = readStream(stream, 224);
+        TEST_ASSERT_EQUAL(expectedLen, out.size());
+        TEST_ASSERT_EQUAL_MEMORY(expected, out.data(), expectedLen);
+    }
+}
+
+void test_read_past_the_end(void) {
+    const giciLayout layout = gici_layout(6 << 5);
+    bytes data = randomPlanes(layout.width * layout.bytePerLine, 1);
+    giciStream stream;
+    compress_image_setup(stream, layout, data.data(), data.size());
+    uint8_t buffer[300];
+    TEST_ASSERT_EQUAL(0, compress_image_read(stream, stream.totalLen, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(10, compress_image_read(stream, stream.totalLen - 10, buffer, sizeof(buffer)));
+}
+
+void test_benchmark_800x480_bwr(void) {
+    static uint8_t expected[4 + 2 * 800 * (7 + 60)];
+    const uint16_t giciType = (9 << 5) | (1 << 1);
+    const giciLayout layout = gici_layout(giciType);
+    bytes data = randomPlanes(2 * layout.width * layout.bytePerLine, 3);
+    bytes out(sizeof(expected));
+    const int runs = 20;
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint32_t expectedLen = 0;
+    for (int i = 0; i < runs; i++) expectedLen = compress_image(giciType, data.data(), data.size(), expected);
+    auto t1 = std::chrono::steady_clock::now();
+    giciStream stream;
+    for (int i = 0; i < runs; i++) {
+        compress_image_setup(stream, layout, data.data(), data.size());
+        for (uint32_t offset = 0; offset < stream.totalLen; offset += 224) compress_image_read(stream, offset, out.data() + offset, 224);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    TEST_ASSERT_EQUAL(expectedLen, stream.totalLen);
+    TEST_ASSERT_EQUAL_MEMORY(expected, out.data(), expectedLen);
+    char message[160];
+    snprintf(message, sizeof(message), "800x480 BWR, %u bytes: compress_image %lld us, stream in 224 byte parts %lld us, %u bytes of column buffer",
+             expectedLen, (long long)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / runs,
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / runs, (unsigned)sizeof(stream.column));
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_layouts);
+    RUN_TEST(test_stream_matches_compress_image);
+    RUN_TEST(test_short_color_plane);
+    RUN_TEST(test_read_past_the_end);
+    RUN_TEST(test_benchmark_800x480_bwr);
+    return UNITY_END();
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "gici_upload.h"
+
+typedef std::vector<uint8_t> bytes;
+
+// A fake GICI tag on the other end of the GATT connection: answers the control writes with the
+// notifies BLE_handleUpload expects, asks for the parts in order and puts the image back together.
+struct fakeTag {
+    uint8_t notify[255] = {};  // length first, like bleUpload::notifyBuffer
+    uint32_t size = 0;
+    uint32_t nextPart = 0;
+    bytes received;
+    bool started = false;
+
+    void setNotify(std::initializer_list<uint8_t> value) {
+        memset(notify, 0, sizeof(notify));
+        notify[0] = value.size();
+        std::copy(value.begin(), value.end(), notify + 1);
+    }
+
+    void askPart(uint32_t part) {
+        setNotify({GICI_UPLOAD_STATE_UPLOAD, 0x00, (uint8_t)part, (uint8_t)(part >> 8), (uint8_t)(part >> 16), (uint8_t)(part >> 24)});
+    }
+
+    void onCtrl(const uint8_t* data, uint32_t len) {
+        TEST_ASSERT_GREATER_THAN(0, len);
+        switch (data[0]) {
+            case 0x01:
+                TEST_ASSERT_EQUAL(1, len);
+                setNotify({GICI_UPLOAD_STATE_SIZE});
+                break;
+            case 0x02:
+                TEST_ASSERT_EQUAL(6, len);
+                size = data[1] | (data[2] << 8) | (data[3] << 16) | ((uint32_t)data[4] << 24);
+                setNotify({GICI_UPLOAD_STATE_START});
+                break;
+            case 0x03:
+                TEST_ASSERT_EQUAL(1, len);
+                TEST_ASSERT_GREATER_THAN(0, size);
+                started = true;
+                askPart(0);
+                break;
+            default:
+                TEST_FAIL_MESSAGE("unknown control write");
+        }
+    }
+
+    void onImg(const uint8_t* data, uint32_t len) {
+        TEST_ASSERT_TRUE(started);
+        TEST_ASSERT_EQUAL(nextPart, data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+        TEST_ASSERT_EQUAL(std::min<uint32_t>(GICI_PART_SIZE, size - received.size()), len - 4);
+        received.insert(received.end(), data + 4, data + len);
+        nextPart++;
+        if (received.size() == size) {
+            setNotify({GICI_UPLOAD_STATE_UPLOAD, GICI_UPLOAD_DONE_MARK});
+        } else {
+            askPart(nextPart);
+        }
+    }
+};
+
+// BLE_handleUpload without the BLE stack: one answer per notify, until the tag is done. Returns the
+// number of write/notify round trips, or 0 on an abort.
+static uint32_t runUpload(giciStream& image, fakeTag& tag) {
+    uint32_t currPart = 0, roundTrips = 0;
+    uint8_t buffer[GICI_PART_SIZE + 4];
+    while (true) {
+        uint32_t len = 0;
+        switch (gici_upload_answer(image, currPart, tag.notify, buffer, len)) {
+            case GICI_WRITE_CTRL:
+                tag.onCtrl(buffer, len);
+                break;
+            case GICI_WRITE_IMG:
+                TEST_ASSERT_LESS_OR_EQUAL(252, len);  // MTU 255 minus the ATT header
+                tag.onImg(buffer, len);
+                break;
+            case GICI_UPLOAD_DONE:
+                return roundTrips;
+            case GICI_UPLOAD_ABORT:
+                return 0;
+        }
+        roundTrips++;
+    }
+}
+
+static bytes randomPlanes(size_t len, unsigned seed) {
+    srand(seed);
+    bytes data(len);
+    for (uint8_t& b : data) b = rand() & 0xff;
+    return data;
+}
+
+static bytes wholeStream(const giciLayout& layout, bytes& data) {
+    giciStream stream;
+    compress_image_setup(stream, layout, data.data(), data.size());
+    bytes out(stream.totalLen);
+    compress_image_read(stream, 0, out.data(), out.size());
+    return out;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// every resolution, with and without the color plane and the compression header
+void test_upload_to_fake_tag(void) {
+    for (uint16_t resolution = 0; resolution <= 11; resolution++) {
+        for (uint16_t flags : {0x0000, 0x0002, 0x4000, 0x4102}) {
+            const uint16_t giciType = flags | (resolution << 5) | (1 << 3);
+            const giciLayout layout = gici_layout(giciType);
+            const size_t planeLen = layout.width * layout.bytePerLine;
+            bytes data = randomPlanes(layout.extraColor ? 2 * planeLen : planeLen, giciType);
+            const bytes expected = wholeStream(layout, data);
+
+            giciStream image;
+            compress_image_setup(image, layout, data.data(), data.size());
+            fakeTag tag;
+            const uint32_t roundTrips = runUpload(image, tag);
+            const uint32_t parts = (expected.size() + GICI_PART_SIZE - 1) / GICI_PART_SIZE;
+            TEST_ASSERT_EQUAL(3 + parts, roundTrips);
+            TEST_ASSERT_EQUAL(expected.size(), tag.size);
+            TEST_ASSERT_TRUE(tag.received == expected);
+        }
+    }
+}
+
+void test_unexpected_notifies(void) {
+    const giciLayout layout = gici_layout(1 << 5);
+    bytes data = randomPlanes(layout.width * layout.bytePerLine, 1);
+    giciStream image;
+    compress_image_setup(image, layout, data.data(), data.size());
+    uint8_t buffer[GICI_PART_SIZE + 4];
+    uint32_t len, currPart = 0;
+    fakeTag tag;
+
+    tag.setNotify({0x42});  // anything unknown starts over
+    TEST_ASSERT_EQUAL(GICI_WRITE_CTRL, gici_upload_answer(image, currPart, tag.notify, buffer, len));
+    TEST_ASSERT_EQUAL(1, len);
+    TEST_ASSERT_EQUAL(0x01, buffer[0]);
+
+    tag.askPart(1);  // a part ahead
+    TEST_ASSERT_EQUAL(GICI_UPLOAD_ABORT, gici_upload_answer(image, currPart, tag.notify, buffer, len));
+    TEST_ASSERT_EQUAL(1, gici_requested_part(tag.notify));
+
+    currPart = (image.totalLen + GICI_PART_SIZE - 1) / GICI_PART_SIZE;  // past the end
+    tag.askPart(currPart);
+    TEST_ASSERT_EQUAL(GICI_UPLOAD_ABORT, gici_upload_answer(image, currPart, tag.notify, buffer, len));
+
+    const uint32_t last = --currPart;  // the short last part
+    tag.askPart(last);
+    TEST_ASSERT_EQUAL(GICI_WRITE_IMG, gici_upload_answer(image, currPart, tag.notify, buffer, len));
+    TEST_ASSERT_EQUAL(4 + image.totalLen - last * GICI_PART_SIZE, len);
+    TEST_ASSERT_EQUAL(last + 1, currPart);
+}
+
+// Upload time for 6 tags of 296x128 BWR, on a clock in ms. Taken as: a write/notify round trip
+// 30 ms (one connection event each way at a 15 ms interval), opening a connection 300 ms, service
+// discovery and MTU 500 ms, and 100 ms for the disconnect. At 244 bytes per event three connections
+// use a small part of the air time, so they don't slow each other down.
+//
+// Before: a pending check every 10 s, delay(4000), then connect and a fixed 5 s wait, one tag at a
+// time, and the task polled every 15 ms, so a part waited 7.5 ms more on average.
+// Now: a new pending item wakes the task, BLE_MAX_UPLOADS slots connect in their own tasks (one
+// connection opening at a time), settle 1 s, and every notify wakes the task.
+void test_benchmark_six_tags(void) {
+    const uint32_t tags = 6, slots = 3;
+    const double roundTrip = 30, open = 300, discovery = 500, closing = 100;
+    const giciLayout layout = gici_layout((1 << 5) | (1 << 3) | (1 << 1));
+    bytes data = randomPlanes(2 * layout.width * layout.bytePerLine, 7);
+    giciStream image;
+    compress_image_setup(image, layout, data.data(), data.size());
+    fakeTag tag;
+    const uint32_t roundTrips = runUpload(image, tag);
+    TEST_ASSERT_TRUE(tag.received.size() == image.totalLen);
+
+    double oldTime = 0, oldTag = 0;
+    for (uint32_t t = 0; t < tags; t++) {
+        const double start = t ? oldTime + 10000 : 0;  // the check after the previous upload
+        oldTag = 4000 + open + 5000 + discovery + roundTrips * (roundTrip + 7.5);
+        oldTime = start + oldTag;
+    }
+
+    double slotFree[slots] = {}, openFree = 0, newTime = 0, newTag = 0;
+    for (uint32_t t = 0; t < tags; t++) {
+        double& slot = *std::min_element(slotFree, slotFree + slots);
+        const double opened = std::max(slot, openFree) + open;
+        openFree = opened;
+        newTag = opened - slot + 1000 + discovery + roundTrips * roundTrip;
+        const double done = slot + newTag;
+        newTime = std::max(newTime, done);
+        slot = done + closing;
+    }
+
+    char message[220];
+    snprintf(message, sizeof(message), "%u tags, %u bytes, %u round trips each: before %.1f s per tag, %.1f s for all; now %.1f s per tag, %.1f s for all, %.1f kB/s",
+             (unsigned)tags, (unsigned)image.totalLen, (unsigned)roundTrips, oldTag / 1000, oldTime / 1000, newTag / 1000, newTime / 1000,
+             tags * image.totalLen / newTime);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL(oldTime / 4, newTime);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_upload_to_fake_tag);
+    RUN_TEST(test_unexpected_notifies);
+    RUN_TEST(test_benchmark_six_tags);
+    return UNITY_END();
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <vector>
+
+#include "dither.h"
+#include "jpgstream.h"
+
+typedef std::vector<uint8_t> bytes;
+
+static const std::vector<Color> bwr = {Color(255, 255, 255), Color(0, 0, 0), Color(255, 0, 0)};
+
+// gradients in red and green, some noise in blue
+static uint16_t testPixel(long x, long y) {
+    const uint8_t r = (x * 255 / 300) & 0xff, g = (y * 255 / 200) & 0xff, b = (x * y * 7) & 0xff;
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+struct imageCase {
+    uint16_t srcw, srch;  // decoded size
+    uint16_t dstw, dsth;  // tag size before rotation
+    uint8_t rotate, rotatebuffer;
+};
+
+// feeds the image to the stream the way TJpgDec does: 16x16 MCU blocks, clipped at the right and bottom edge
+static void decode(JpgStream& stream, uint16_t srcw, uint16_t srch) {
+    std::vector<uint16_t> mcu(16 * 16);
+    for (uint16_t y = 0; y < srch; y += 16) {
+        for (uint16_t x = 0; x < srcw; x += 16) {
+            const uint16_t w = std::min<uint16_t>(16, srcw - x), h = std::min<uint16_t>(16, srch - y);
+            for (uint16_t row = 0; row < h; row++) {
+                for (uint16_t col = 0; col < w; col++) mcu[row * w + col] = testPixel(x + col, y + row);
+            }
+            stream.block(x, y, w, h, mcu.data());
+        }
+    }
+    stream.finish();
+}
+
+// what spr2color makes of the same image, resampled into a sprite first like jpg2buffer did
+static bytes referencePlane(const imageCase& c, uint8_t dither, bool is_red, bool& hasRed) {
+    const long bufw = (c.rotatebuffer % 2) ? c.dsth : c.dstw;
+    const long bufh = (c.rotatebuffer % 2) ? c.dstw : c.dsth;
+    bytes plane(bufw * bufh / 8);
+    auto readPixel = [&c](int32_t x, int32_t y) -> uint16_t {
+        if (x < 0 || x >= c.dstw || y < 0 || y >= c.dsth) return 0xFFFF;
+        return testPixel((uint32_t)x * c.srcw / c.dstw, (uint32_t)y * c.srch / c.dsth);
+    };
+    ditherPlane(readPixel, bufw, bufh, ditherRotation(c.rotate, c.rotatebuffer), bwr, bwr.size(), dither, plane.data(), plane.size(), is_red, hasRed);
+    return plane;
+}
+
+static JpgStream* makeStream(const imageCase& c, uint8_t dither) {
+    const long bufw = (c.rotatebuffer % 2) ? c.dsth : c.dstw;
+    const long bufh = (c.rotatebuffer % 2) ? c.dstw : c.dsth;
+    return new JpgStream(bwr, bwr.size(), dither, c.srcw, c.srch, c.dstw, c.dsth, ditherRotation(c.rotate, c.rotatebuffer), bufw, bufh);
+}
+
+static void streamPlanes(const imageCase& c, uint8_t dither, bytes& black, bytes& red, bool& hasRed) {
+    const size_t size = (size_t)c.dstw * c.dsth / 8;
+    black.assign(size, 0);
+    red.assign(size, 0);
+    JpgStream* stream = makeStream(c, dither);
+    TEST_ASSERT_TRUE(stream->ok());
+    stream->setPlanes(black.data(), red.data());
+    decode(*stream, c.srcw, c.srch);
+    hasRed = stream->hasRed();
+    delete stream;
+}
+
+static bytes streamRows(const imageCase& c, uint8_t dither, bool is_red) {
+    bytes out;
+    JpgStream* stream = makeStream(c, dither);
+    TEST_ASSERT_TRUE(stream->setRows(is_red, [&out](const uint8_t* data, size_t len) { out.insert(out.end(), data, data + len); }));
+    decode(*stream, c.srcw, c.srch);
+    delete stream;
+    return out;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// every rotation against spr2color; Burkes only where the rows run the same way
+void test_planes_match_spr2color(void) {
+    const imageCase cases[] = {
+        {300, 200, 152, 104, 0, 0},
+        {300, 200, 152, 104, 2, 0},
+        {300, 200, 152, 104, 0, 1},
+        {300, 200, 152, 104, 0, 3},
+        {300, 200, 152, 104, 2, 1},
+        {128, 296, 128, 296, 0, 1},  // no resampling
+        {150, 100, 104, 80, 0, 2},
+    };
+    for (const imageCase& c : cases) {
+        for (uint8_t dither : {0, 1, 2}) {
+            if (dither == 1 && ditherRotation(c.rotate, c.rotatebuffer) != 0) continue;
+            bool refRed = false, streamRed = false;
+            const bytes refBlack = referencePlane(c, dither, false, refRed);
+            const bytes refRedPlane = referencePlane(c, dither, true, refRed);
+            bytes black, red;
+            streamPlanes(c, dither, black, red, streamRed);
+            TEST_ASSERT_EQUAL(refRed, streamRed);
+            TEST_ASSERT_EQUAL(refBlack.size(), black.size());
+            TEST_ASSERT_EQUAL_MEMORY(refBlack.data(), black.data(), black.size());
+            TEST_ASSERT_EQUAL_MEMORY(refRedPlane.data(), red.data(), red.size());
+        }
+    }
+}
+
+// rows straight to the file, also with rows that end in the middle of a byte
+void test_rows_match_spr2color(void) {
+    const imageCase cases[] = {
+        {300, 200, 152, 104, 0, 0},
+        {100, 48, 37, 24, 0, 0},
+        {37, 24, 37, 24, 0, 0},
+    };
+    for (const imageCase& c : cases) {
+        for (uint8_t dither : {0, 1, 2}) {
+            for (bool is_red : {false, true}) {
+                bool hasRed = false;
+                const bytes reference = referencePlane(c, dither, is_red, hasRed);
+                const bytes rows = streamRows(c, dither, is_red);
+                TEST_ASSERT_EQUAL(reference.size(), rows.size());
+                TEST_ASSERT_EQUAL_MEMORY(reference.data(), rows.data(), rows.size());
+            }
+        }
+    }
+}
+
+void test_rows_need_unrotated_output(void) {
+    const imageCase c = {300, 200, 152, 104, 0, 1};
+    JpgStream* stream = makeStream(c, 0);
+    TEST_ASSERT_FALSE(stream->setRows(false, [](const uint8_t*, size_t) {}));
+    delete stream;
+}
+
+// a decoder that gives up early still produces a plane of the full size
+void test_truncated_decode_is_padded(void) {
+    const imageCase c = {152, 104, 152, 104, 0, 0};
+    bytes out;
+    JpgStream* stream = makeStream(c, 0);
+    stream->setRows(false, [&out](const uint8_t* data, size_t len) { out.insert(out.end(), data, data + len); });
+    std::vector<uint16_t> mcu(16 * 16, 0x0000);
+    for (uint16_t x = 0; x < c.srcw; x += 16) stream->block(x, 0, std::min<uint16_t>(16, c.srcw - x), 16, mcu.data());
+    stream->finish();
+    delete stream;
+    TEST_ASSERT_EQUAL(152 * 104 / 8, out.size());
+    TEST_ASSERT_EQUAL(0xFF, out[0]);                 // black where the decoder got to
+    TEST_ASSERT_EQUAL(0x00, out[152 * 20 / 8]);      // blank after that
+}
+
+// Peak memory and dither time of the sprite path against the stream, for a BWR tag. The jpeg decode
+// itself is the same TJpgDec in all cases and isn't part of this.
+static void benchmark(uint16_t w, uint16_t h) {
+    const imageCase c = {w, h, w, h, 0, 0};
+    const size_t plane = (size_t)w * h / 8;
+    bool hasRed = false;
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<uint16_t> sprite((size_t)w * h);
+    for (uint16_t y = 0; y < h; y++) {
+        for (uint16_t x = 0; x < w; x++) sprite[y * w + x] = testPixel(x, y);
+    }
+    bytes buffer(plane);
+    auto readPixel = [&sprite, w](int32_t x, int32_t y) { return sprite[y * w + x]; };
+    ditherPlane(readPixel, w, h, 0, bwr, bwr.size(), 1, buffer.data(), plane, false, hasRed);
+    ditherPlane(readPixel, w, h, 0, bwr, bwr.size(), 1, buffer.data(), plane, true, hasRed);
+    auto t1 = std::chrono::steady_clock::now();
+
+    bytes black, red;
+    streamPlanes(c, 1, black, red, hasRed);
+    auto t2 = std::chrono::steady_clock::now();
+
+    size_t written = 0, streamMemory = 0;
+    for (bool is_red : {false, true}) {
+        JpgStream* stream = makeStream(c, 1);
+        stream->setRows(is_red, [&written](const uint8_t*, size_t len) { written += len; });
+        decode(*stream, w, h);
+        streamMemory = stream->memory();
+        delete stream;
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL(2 * plane, written);
+
+    JpgStream* planes = makeStream(c, 1);
+    const size_t planeMemory = planes->memory() + 2 * plane;
+    delete planes;
+
+    auto us = [](std::chrono::steady_clock::duration d) { return (long long)std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+    char message[240];
+    snprintf(message, sizeof(message), "%ux%u BWR: sprite %u bytes %lld us, stream to planes %u bytes %lld us, stream to file %u bytes %lld us",
+             w, h, (unsigned)(sprite.size() * 2 + plane), us(t1 - t0), (unsigned)planeMemory, us(t2 - t1), (unsigned)streamMemory, us(t3 - t2));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL(sprite.size() * 2 / 10, streamMemory);
+}
+
+void test_benchmark_640x384(void) {
+    benchmark(640, 384);
+}
+
+void test_benchmark_800x480(void) {
+    benchmark(800, 480);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_planes_match_spr2color);
+    RUN_TEST(test_rows_match_spr2color);
+    RUN_TEST(test_rows_need_unrotated_output);
+    RUN_TEST(test_truncated_decode_is_padded);
+    RUN_TEST(test_benchmark_640x384);
+    RUN_TEST(test_benchmark_800x480);
+    return UNITY_END();
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <unity.h>
+
+#include <deque>
+#include <vector>
+
+#include "ledtimeline.h"
+
+// The RGB half of ledTask on one color channel, with the clock jumping to wherever the task would
+// wake up next. Records every frame it draws.
+struct step {
+    uint8_t value;
+    uint16_t fadeTime;
+    uint16_t length;
+};
+
+struct frame {
+    uint32_t time;
+    uint8_t value;
+};
+
+struct sequencer {
+    std::deque<step> queue;
+    bool busy = false;
+    step current = {};
+    uint32_t start = 0;
+    uint8_t old = 0;
+    uint8_t shown = 0;
+    uint32_t idlePeriod = 0;
+    uint8_t idleColor = 0;
+    uint32_t wakeups = 0;
+    std::vector<frame> frames;
+
+    void show(uint32_t now, uint8_t value) {
+        if (value == shown) return;
+        shown = value;
+        frames.push_back({now, value});
+    }
+
+    // one pass of the task loop, returns the sleep time
+    uint32_t pass(uint32_t now) {
+        wakeups++;
+        while (true) {
+            if (busy) {
+                if (!ledStepDone(current.fadeTime, current.length, now - start)) break;
+                old = current.value;
+                show(now, old);
+                busy = false;
+            }
+            if (queue.empty()) break;
+            current = queue.front();
+            queue.pop_front();
+            busy = true;
+            start = now;
+            if (current.fadeTime <= 1) show(now, current.value);
+        }
+        if (!busy) {
+            if (idlePeriod == 0 || (idleColor == 0 && shown == 0)) return LED_IDLE_CHECK_MS;
+            show(now, idleColor * ledIdleLevel(now, idlePeriod) / 255);
+            return LED_FRAME_MS;
+        }
+        const uint32_t elapsed = now - start;
+        uint8_t fraction;
+        const uint32_t wait = ledFadeFrame(current.fadeTime, current.length, elapsed, fraction);
+        show(now, elapsed < current.fadeTime ? old + (((int)current.value - old) * fraction >> 8) : current.value);
+        return wait;
+    }
+
+    void run(uint32_t until) {
+        uint32_t now = 0;
+        while (now < until) {
+            const uint32_t wait = pass(now);
+            now += wait ? wait : 1;  // a tick at the least, like pdMS_TO_TICKS() rounded up
+        }
+    }
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// shortBlink: off 3 ms, on 10 ms, off 3 ms; one wakeup per keyframe, none in between
+void test_blink_keyframes(void) {
+    sequencer seq;
+    seq.queue = {{0, 0, 3}, {128, 0, 10}, {0, 0, 3}};
+    seq.run(16);
+    TEST_ASSERT_EQUAL(2, seq.frames.size());
+    TEST_ASSERT_EQUAL(3, seq.frames[0].time);
+    TEST_ASSERT_EQUAL(128, seq.frames[0].value);
+    TEST_ASSERT_EQUAL(13, seq.frames[1].time);
+    TEST_ASSERT_EQUAL(0, seq.frames[1].value);
+    TEST_ASSERT_EQUAL(3, seq.wakeups);
+}
+
+// addFadeColor: 750 ms at the frame interval, rising, ending exactly on the target
+void test_fade_frames(void) {
+    sequencer seq;
+    seq.queue = {{200, 750, 0}};
+    seq.run(800);
+    TEST_ASSERT_GREATER_OR_EQUAL(30, seq.frames.size());
+    for (size_t c = 1; c < seq.frames.size(); c++) {
+        TEST_ASSERT_TRUE(seq.frames[c].value > seq.frames[c - 1].value);
+        TEST_ASSERT_LESS_OR_EQUAL(LED_FRAME_MS, seq.frames[c].time - seq.frames[c - 1].time);
+    }
+    TEST_ASSERT_EQUAL(750, seq.frames.back().time);
+    TEST_ASSERT_EQUAL(200, seq.frames.back().value);
+    TEST_ASSERT_LESS_OR_EQUAL(750 / LED_FRAME_MS + 2 + 800 / LED_IDLE_CHECK_MS + 1, seq.wakeups);
+}
+
+void test_fade_fraction(void) {
+    uint8_t fraction;
+    TEST_ASSERT_EQUAL(LED_FRAME_MS, ledFadeFrame(750, 100, 0, fraction));
+    TEST_ASSERT_EQUAL(0, fraction);
+    TEST_ASSERT_EQUAL(10, ledFadeFrame(750, 100, 740, fraction));
+    TEST_ASSERT_EQUAL(740 * 256 / 750, fraction);
+    TEST_ASSERT_EQUAL(1, ledFadeFrame(750, 100, 749, fraction));
+    TEST_ASSERT_EQUAL(255, fraction);
+    TEST_ASSERT_EQUAL(100, ledFadeFrame(750, 100, 750, fraction));  // now hold the value
+    TEST_ASSERT_EQUAL(0, ledStepLeft(750, 100, 850));
+    TEST_ASSERT_TRUE(ledStepDone(750, 100, 850));
+    TEST_ASSERT_FALSE(ledStepDone(750, 100, 849));
+}
+
+void test_idle_triangle(void) {
+    TEST_ASSERT_EQUAL(0, ledIdleLevel(0, 511));
+    TEST_ASSERT_EQUAL(255, ledIdleLevel(511, 511));
+    TEST_ASSERT_EQUAL(ledIdleLevel(100, 511), ledIdleLevel(1022 - 100, 511));
+    TEST_ASSERT_EQUAL(0, ledIdleLevel(1022, 511));
+}
+
+// Wakeups per second against the old task, which woke every 1 ms tick whatever it was showing.
+void test_benchmark_wakeups(void) {
+    sequencer dark;
+    dark.run(10000);
+    sequencer breathing;
+    breathing.idlePeriod = 511;
+    breathing.idleColor = 255;
+    breathing.run(10000);
+    sequencer pattern;  // showColorPattern, once around
+    pattern.queue = {{0, 0, 600}, {255, 0, 120}, {0, 0, 200}, {128, 0, 120}, {0, 0, 200}, {64, 0, 120}};
+    pattern.run(1360);
+
+    char message[160];
+    snprintf(message, sizeof(message), "wakeups/s: dark idle %.1f, breathing %.1f, color pattern %.1f; 1000 before",
+             dark.wakeups / 10.0, breathing.wakeups / 10.0, pattern.wakeups / 1.36);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL(1000 / LED_IDLE_CHECK_MS, dark.wakeups / 10);
+    TEST_ASSERT_LESS_OR_EQUAL(1000 / LED_FRAME_MS, breathing.wakeups / 10);
+    TEST_ASSERT_LESS_OR_EQUAL(7, pattern.wakeups);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_blink_keyframes);
+    RUN_TEST(test_fade_frames);
+    RUN_TEST(test_fade_fraction);
+    RUN_TEST(test_idle_triangle);
+    RUN_TEST(test_benchmark_wakeups);
+    return UNITY_END();
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <unity.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+// the storage of metrics.cpp, which needs Arduino for the output; the bounds of the first histogram
+// are the block service times
+std::atomic<uint32_t> metricCounters[METRIC_COUNTER_COUNT];
+std::atomic<int32_t> metricGauges[METRIC_GAUGE_COUNT];
+metricHistogramData metricHistograms[METRIC_HISTOGRAM_COUNT];
+const uint32_t metricHistogramBounds[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS] = {
+    {5, 10, 25, 50, 100, 250, 500, 1000},
+};
+
+static void resetMetrics() {
+    for (auto& counter : metricCounters) counter = 0;
+    for (auto& gauge : metricGauges) gauge = 0;
+    for (auto& histogram : metricHistograms) {
+        for (auto& bucket : histogram.buckets) bucket = 0;
+        histogram.sum = 0;
+        histogram.count = 0;
+    }
+}
+
+void setUp(void) {
+    resetMetrics();
+}
+void tearDown(void) {}
+
+void test_histogram_buckets(void) {
+    metricHistogramData& data = metricHistograms[METRIC_BLOCK_SERVICE_MS];
+    for (uint32_t value : {0, 5, 6, 1000, 1001, 50000}) metricObserve(METRIC_BLOCK_SERVICE_MS, value);
+    TEST_ASSERT_EQUAL(2, data.buckets[0].load());  // le 5, inclusive
+    TEST_ASSERT_EQUAL(1, data.buckets[1].load());
+    TEST_ASSERT_EQUAL(1, data.buckets[7].load());  // le 1000
+    TEST_ASSERT_EQUAL(2, data.buckets[METRIC_HISTOGRAM_BUCKETS].load());
+    TEST_ASSERT_EQUAL(6, data.count.load());
+    TEST_ASSERT_EQUAL(52012, data.sum.load());
+}
+
+void test_gauge_and_counter(void) {
+    metricInc(METRIC_RADIO_ACK);
+    metricInc(METRIC_RADIO_ACK, 4);
+    metricSet(METRIC_PENDING_QUEUE, -3);
+    TEST_ASSERT_EQUAL(5, metricCounters[METRIC_RADIO_ACK].load());
+    TEST_ASSERT_EQUAL(0, metricCounters[METRIC_RADIO_NOK].load());
+    TEST_ASSERT_EQUAL(-3, metricGauges[METRIC_PENDING_QUEUE].load());
+}
+
+// nothing gets lost when several tasks count at once
+void test_concurrent_counting(void) {
+    const uint32_t perThread = 200000;
+    std::vector<std::thread> threads;
+    for (uint8_t t = 0; t < 4; t++) {
+        threads.emplace_back([]() {
+            for (uint32_t c = 0; c < perThread; c++) {
+                metricInc(METRIC_BLOCK_REQUESTS);
+                metricObserve(METRIC_BLOCK_SERVICE_MS, c & 63);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    TEST_ASSERT_EQUAL(4 * perThread, metricCounters[METRIC_BLOCK_REQUESTS].load());
+    TEST_ASSERT_EQUAL(4 * perThread, metricHistograms[METRIC_BLOCK_SERVICE_MS].count.load());
+}
+
+// The hot path cost of a counter and a histogram sample against a counter behind a mutex, which is
+// what a sample would cost with a lock. Host numbers; what matters is the ratio, not the value.
+template <typename F>
+static double nsPerCall(F f, uint32_t calls) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t c = 0; c < calls; c++) f(c);
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / calls;
+}
+
+void test_benchmark_hot_path(void) {
+    const uint32_t calls = 2000000;
+    std::mutex mutex;
+    volatile uint32_t locked = 0;
+    const double inc = nsPerCall([](uint32_t) { metricInc(METRIC_BLOCK_REQUESTS); }, calls);
+    const double observe = nsPerCall([](uint32_t c) { metricObserve(METRIC_BLOCK_SERVICE_MS, c & 1023); }, calls);
+    const double withMutex = nsPerCall([&mutex, &locked](uint32_t) {
+        const std::lock_guard<std::mutex> lock(mutex);
+        locked = locked + 1;
+    }, calls);
+    char message[120];
+    snprintf(message, sizeof(message), "metricInc %.1f ns, metricObserve %.1f ns, mutex counter %.1f ns", inc, observe, withMutex);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL(calls, metricCounters[METRIC_BLOCK_REQUESTS].load());
+    TEST_ASSERT_TRUE(inc <= withMutex);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_histogram_buckets);
+    RUN_TEST(test_gauge_and_counter);
+    RUN_TEST(test_concurrent_counting);
+    RUN_TEST(test_benchmark_hot_path);
+    return UNITY_END();
+}
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "ota_delta.h"
+#include "ota_resume.h"
+
+typedef std::vector<uint8_t> bytes;
+
+static void putU32(bytes& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back((value >> (8 * i)) & 0xff);
+}
+
+// Builds a record stream like make_ota_delta.py, plus the image it should produce. Every record
+// takes the old bytes at the current position with a few changed, inserts some new bytes and
+// then seeks somewhere else in the old image, also backwards.
+static void makeDelta(const bytes& oldImage, unsigned seed, bytes& records, bytes& newImage) {
+    srand(seed);
+    int64_t oldPos = 0;
+    records.clear();
+    newImage.clear();
+    for (int r = 0; r < 40; r++) {
+        uint32_t diffLen = rand() % 600;
+        if (oldPos + diffLen > (int64_t)oldImage.size()) diffLen = oldImage.size() - oldPos;
+        const uint32_t extraLen = (rand() % 4 == 0) ? rand() % 200 : 0;
+        const int64_t target = rand() % oldImage.size();
+        const int32_t seek = target - (oldPos + diffLen);
+
+        putU32(records, diffLen);
+        putU32(records, extraLen);
+        putU32(records, seek);
+        for (uint32_t i = 0; i < diffLen; i++) {
+            const uint8_t delta = (rand() % 10 == 0) ? rand() & 0xff : 0;
+            records.push_back(delta);
+            newImage.push_back(oldImage[oldPos + i] + delta);
+        }
+        for (uint32_t i = 0; i < extraLen; i++) {
+            records.push_back(rand() & 0xff);
+            newImage.push_back(records.back());
+        }
+        oldPos = target;
+    }
+}
+
+static bytes makeOldImage(size_t size) {
+    bytes image(size);
+    for (size_t i = 0; i < size; i++) image[i] = (i * 31 + (i >> 7)) & 0xff;
+    return image;
+}
+
+// feeds the records to the patcher in pieces of 1 to maxPiece bytes
+static bool applyDelta(const bytes& oldImage, const bytes& records, uint32_t newSize, size_t maxPiece, bytes& out, bool* complete = nullptr) {
+    out.clear();
+    OtaDeltaPatcher patcher(
+        oldImage.size(), newSize,
+        [&oldImage](uint32_t pos, uint8_t* buffer, size_t len) {
+            if (pos + len > oldImage.size()) return false;
+            memcpy(buffer, oldImage.data() + pos, len);
+            return true;
+        },
+        [&out](const uint8_t* buffer, size_t len) {
+            out.insert(out.end(), buffer, buffer + len);
+            return true;
+        });
+    size_t pos = 0;
+    while (pos < records.size()) {
+        const size_t piece = std::min<size_t>(1 + rand() % maxPiece, records.size() - pos);
+        if (!patcher.write(records.data() + pos, piece)) return false;
+        pos += piece;
+    }
+    if (complete) *complete = patcher.complete();
+    return true;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_apply_random_deltas(void) {
+    const bytes oldImage = makeOldImage(20000);
+    bytes records, newImage, out;
+    for (unsigned seed = 1; seed <= 50; seed++) {
+        makeDelta(oldImage, seed, records, newImage);
+        for (size_t maxPiece : {1, 7, 13, 4096}) {
+            bool complete = false;
+            TEST_ASSERT_TRUE(applyDelta(oldImage, records, newImage.size(), maxPiece, out, &complete));
+            TEST_ASSERT_TRUE(complete);
+            TEST_ASSERT_EQUAL(newImage.size(), out.size());
+            TEST_ASSERT_EQUAL_MEMORY(newImage.data(), out.data(), out.size());
+        }
+    }
+}
+
+void test_seek_applies_after_the_diff(void) {
+    // two records reading the same 8 old bytes: the seek of the first one goes back over its own diff
+    const bytes oldImage = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    bytes records;
+    putU32(records, 8);
+    putU32(records, 0);
+    putU32(records, -8);
+    for (int i = 0; i < 8; i++) records.push_back(0);
+    putU32(records, 8);
+    putU32(records, 0);
+    putU32(records, 0);
+    for (int i = 0; i < 8; i++) records.push_back(1);
+
+    bytes out;
+    bool complete = false;
+    TEST_ASSERT_TRUE(applyDelta(oldImage, records, 16, 3, out, &complete));
+    TEST_ASSERT_TRUE(complete);
+    const uint8_t expected[16] = {1, 2, 3, 4, 5, 6, 7, 8, 2, 3, 4, 5, 6, 7, 8, 9};
+    TEST_ASSERT_EQUAL_MEMORY(expected, out.data(), sizeof(expected));
+}
+
+void test_rejects_reads_outside_the_old_image(void) {
+    const bytes oldImage = makeOldImage(100);
+    bytes records, out;
+    putU32(records, 10);
+    putU32(records, 0);
+    putU32(records, -20);  // to -10
+    records.resize(records.size() + 10, 0);
+    putU32(records, 5);
+    putU32(records, 0);
+    putU32(records, 0);
+    records.resize(records.size() + 5, 0);
+    TEST_ASSERT_FALSE(applyDelta(oldImage, records, 15, 64, out));
+
+    records.clear();
+    putU32(records, 101);  // longer than the old image
+    putU32(records, 0);
+    putU32(records, 0);
+    records.resize(records.size() + 101, 0);
+    TEST_ASSERT_FALSE(applyDelta(oldImage, records, 101, 64, out));
+}
+
+void test_rejects_records_beyond_the_new_size(void) {
+    const bytes oldImage = makeOldImage(1000);
+    bytes records, newImage, out;
+    makeDelta(oldImage, 7, records, newImage);
+    TEST_ASSERT_FALSE(applyDelta(oldImage, records, newImage.size() - 1, 64, out));
+}
+
+void test_truncated_delta_is_not_complete(void) {
+    const bytes oldImage = makeOldImage(5000);
+    bytes records, newImage, out;
+    makeDelta(oldImage, 3, records, newImage);
+    records.resize(records.size() - 1);
+    bool complete = true;
+    TEST_ASSERT_TRUE(applyDelta(oldImage, records, newImage.size(), 64, out, &complete));
+    TEST_ASSERT_FALSE(complete);
+}
+
+// A server that drops the connection every now and then. With honourRange false it answers
+// every request with the whole file, like servers without Range support.
+static bool download(const bytes& file, bool honourRange, unsigned seed, bytes& received, int& requests) {
+    srand(seed);
+    OtaResume resume;
+    received.clear();
+    requests = 0;
+    for (int retries = 0; retries < 100; retries++) {
+        requests++;
+        const size_t start = honourRange ? resume.rangeStart() : 0;
+        if (!resume.begin(start ? 206 : 200, file.size() - start)) return false;
+        size_t pos = start;
+        const size_t dropAt = resume.rangeStart() + rand() % 3000;  // every connection gets a bit further
+        while (resume.wantsMore() && pos < file.size() && pos < dropAt) {
+            uint8_t buffer[512];
+            const size_t len = std::min<size_t>(1 + rand() % sizeof(buffer), file.size() - pos);
+            memcpy(buffer, file.data() + pos, len);
+            pos += len;
+            const size_t fresh = resume.take(buffer, len);
+            received.insert(received.end(), buffer, buffer + fresh);
+        }
+        if (resume.complete()) return true;
+    }
+    return false;
+}
+
+void test_resume_with_range(void) {
+    const bytes file = makeOldImage(30000);
+    bytes received;
+    int requests;
+    TEST_ASSERT_TRUE(download(file, true, 1, received, requests));
+    TEST_ASSERT_GREATER_THAN(1, requests);
+    TEST_ASSERT_EQUAL(file.size(), received.size());
+    TEST_ASSERT_EQUAL_MEMORY(file.data(), received.data(), file.size());
+}
+
+void test_resume_without_range_support(void) {
+    const bytes file = makeOldImage(6000);
+    bytes received;
+    int requests;
+    TEST_ASSERT_TRUE(download(file, false, 2, received, requests));
+    TEST_ASSERT_GREATER_THAN(1, requests);
+    TEST_ASSERT_EQUAL(file.size(), received.size());
+    TEST_ASSERT_EQUAL_MEMORY(file.data(), received.data(), file.size());
+}
+
+void test_resume_rejects_errors(void) {
+    OtaResume resume;
+    TEST_ASSERT_FALSE(resume.begin(404, 0));
+    TEST_ASSERT_FALSE(resume.begin(206, 100));  // partial content without asking for it
+    TEST_ASSERT_TRUE(resume.begin(200, -1));
+    uint8_t buffer[10] = {0};
+    TEST_ASSERT_EQUAL(10, resume.take(buffer, 10));
+    TEST_ASSERT_TRUE(resume.wantsMore());
+    TEST_ASSERT_TRUE(resume.complete());  // unknown size: done when the reply ends
+}
+
+void test_resumed_delta_download(void) {
+    const bytes oldImage = makeOldImage(20000);
+    bytes records, newImage, received, out;
+    makeDelta(oldImage, 11, records, newImage);
+    int requests;
+    TEST_ASSERT_TRUE(download(records, true, 5, received, requests));
+    bool complete = false;
+    TEST_ASSERT_TRUE(applyDelta(oldImage, received, newImage.size(), 4096, out, &complete));
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_EQUAL_MEMORY(newImage.data(), out.data(), newImage.size());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_apply_random_deltas);
+    RUN_TEST(test_seek_applies_after_the_diff);
+    RUN_TEST(test_rejects_reads_outside_the_old_image);
+    RUN_TEST(test_rejects_records_beyond_the_new_size);
+    RUN_TEST(test_truncated_delta_is_not_complete);
+    RUN_TEST(test_resume_with_range);
+    RUN_TEST(test_resume_without_range_support);
+    RUN_TEST(test_resume_rejects_errors);
+    RUN_TEST(test_resumed_delta_download);
+    return UNITY_END();
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "metrics.h"
+#include "renderqueue.h"
+
+// the storage of metrics.cpp, which needs Arduino for the output, with its render wait bounds
+std::atomic<uint32_t> metricCounters[METRIC_COUNTER_COUNT];
+std::atomic<int32_t> metricGauges[METRIC_GAUGE_COUNT];
+metricHistogramData metricHistograms[METRIC_HISTOGRAM_COUNT];
+const uint32_t metricHistogramBounds[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS] = {
+    {5, 10, 25, 50, 100, 250, 500, 1000},                    // METRIC_BLOCK_SERVICE_MS
+    {250, 500, 1000, 2500, 5000, 10000, 25000, 60000},       // METRIC_RENDER_MS
+    {10, 100, 1000, 10000, 50000, 100000, 500000, 1000000},  // METRIC_FSMUTEX_WAIT_US
+    {1, 2, 5, 10, 20, 30, 60, 120},                          // METRIC_CHECKIN_ERROR_S
+    {500, 1000, 2000, 5000, 10000, 15000, 30000, 60000},     // METRIC_WIFI_CONNECT_MS
+    {100, 500, 1000, 5000, 10000, 30000, 60000, 120000}      // METRIC_RENDER_WAIT_MS
+};
+
+static void resetHistogram(metricHistogramData& histogram) {
+    for (auto& bucket : histogram.buckets) bucket = 0;
+    histogram.sum = 0;
+    histogram.count = 0;
+}
+
+void setUp(void) {
+    resetHistogram(metricHistograms[METRIC_RENDER_WAIT_MS]);
+}
+void tearDown(void) {}
+
+void test_choose_render(void) {
+    const uint32_t now = 100000;
+    // not due yet, or already queued
+    TEST_ASSERT_EQUAL(RENDER_SKIP, chooseRender(now, now + 1, now + 600, false, false, 0, 0));
+    TEST_ASSERT_EQUAL(RENDER_SKIP, chooseRender(now, now, now, false, true, 0, 0));
+    TEST_ASSERT_EQUAL(RENDER_SKIP, chooseRender(now, now + 600, now, true, true, 0, 0));
+    // due, and it checks in soon, or a button asks for it
+    TEST_ASSERT_EQUAL(RENDER_FRONT, chooseRender(now, now, now + RENDER_URGENT_WINDOW, false, false, RENDERS_PER_RUN, RENDER_QUEUE_LEN - 1));
+    TEST_ASSERT_EQUAL(RENDER_FRONT, chooseRender(now, now + 600, now + 600, true, false, RENDERS_PER_RUN, RENDER_QUEUE_LEN - 1));
+    // due, checks in later: only RENDERS_PER_RUN of those per pass, and not into the reserved half of the queue
+    TEST_ASSERT_EQUAL(RENDER_BACK, chooseRender(now, now, now + RENDER_URGENT_WINDOW + 1, false, false, RENDERS_PER_RUN - 1, RENDER_BACK_LIMIT - 1));
+    TEST_ASSERT_EQUAL(RENDER_SKIP, chooseRender(now, now, now + RENDER_URGENT_WINDOW + 1, false, false, RENDERS_PER_RUN, 0));
+    TEST_ASSERT_EQUAL(RENDER_SKIP, chooseRender(now, now, now + RENDER_URGENT_WINDOW + 1, false, false, 0, RENDER_BACK_LIMIT));
+}
+
+void test_urgent_order(void) {
+    urgentRenders urgent;
+    const uint32_t checkins[] = {130, 100, 160, 100, 115};
+    uint8_t mac[8] = {};
+    for (uint8_t i = 0; i < 5; i++) {
+        mac[0] = i;
+        urgent.add(checkins[i], mac);
+    }
+    urgent.sort();
+    // sent to the front one after the other, the queue then starts with the earliest check-in
+    std::deque<uint32_t> queue;
+    for (const auto& job : urgent) queue.push_front(checkins[job.mac[0]]);
+    TEST_ASSERT_EQUAL(5, queue.size());
+    TEST_ASSERT_TRUE(std::is_sorted(queue.begin(), queue.end()));
+
+    for (uint8_t i = 0; i < RENDER_QUEUE_LEN; i++) urgent.add(200, mac);
+    TEST_ASSERT_EQUAL(RENDER_QUEUE_LEN, urgent.count);
+}
+
+// contentRunner and the render worker on a clock in ms, 200 tags of mixed content modes from 23:58
+// until 01:00. contentRunner runs every second: it picks up finished renders (which clears
+// renderQueued and sets the next update), then queues with chooseRender, to the front or the back of
+// a queue of RENDER_QUEUE_LEN like the FreeRTOS one. One worker renders in queue order, and records
+// the wait in METRIC_RENDER_WAIT_MS like renderTask. The tags check in every 5 minutes, a check-in
+// between the update and the end of its render gets the old content.
+enum renderPolicy {
+    POLICY_FIFO,       // everything to the back
+    POLICY_TAG_ORDER,  // urgent to the front as contentRunner came across them, the queue shared with the rest
+    POLICY_NOW,        // contentRunner: urgentRenders, and half the queue kept for them
+};
+struct contentKind {
+    uint32_t tags;
+    uint32_t renderMs;  // fetch, draw, dither and compress
+    uint32_t interval;  // s, 0: at midnight
+    bool button;        // redraws on a button press
+};
+static const contentKind kinds[] = {
+    {80, 400, 0, false},      // date
+    {40, 2500, 900, false},   // weather
+    {30, 3000, 900, false},   // calendar
+    {20, 2000, 1800, false},  // RSS
+    {20, 5000, 3600, false},  // image from a URL
+    {10, 600, 0, true},       // timestamp on a button
+};
+#define MIDNIGHT 120
+#define CHECKIN_INTERVAL 300
+
+struct simTag {
+    const contentKind* kind;
+    uint32_t nextupdate;  // s
+    uint32_t checkin;     // s, next check-in
+    uint32_t nextPress;   // s
+    bool redraw;
+    bool queued;
+    int64_t due;  // ms the content changed, -1 if the tag has it
+};
+
+struct renderJob {
+    uint32_t tag;
+    uint32_t queued;
+    uint32_t done;
+};
+
+struct simResult {
+    uint32_t renders;
+    uint32_t staleCheckins;
+    double p95Latency;  // s from the content change until the render is done
+    double midnightDrained;  // s after midnight until every date tag was rendered
+    uint32_t maxJobsPerTag;
+    std::vector<uint32_t> waits;
+};
+
+static uint32_t rng;
+static uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static simResult simulate(const renderPolicy policy) {
+    rng = 4242;
+    std::vector<simTag> tags;
+    for (const contentKind& kind : kinds) {
+        for (uint32_t t = 0; t < kind.tags; t++) {
+            simTag tag = {&kind, 0, nextRandom() % CHECKIN_INTERVAL, 0, false, false, -1};
+            tag.nextupdate = kind.interval ? nextRandom() % kind.interval : kind.button ? UINT32_MAX : MIDNIGHT;
+            tag.nextPress = kind.button ? nextRandom() % 600 : UINT32_MAX;
+            tags.push_back(tag);
+        }
+    }
+
+    std::deque<renderJob> queue;
+    std::vector<renderJob> done;
+    std::vector<uint32_t> jobsPerTag(tags.size());
+    std::vector<double> latencies;
+    renderJob current = {};
+    bool busy = false;
+    uint32_t busyUntil = 0, lastDate = 0;
+    simResult result = {};
+
+    auto startNext = [&](uint32_t at) {
+        if (queue.empty()) return;
+        current = queue.front();
+        queue.pop_front();
+        metricObserve(METRIC_RENDER_WAIT_MS, at - current.queued);
+        result.waits.push_back(at - current.queued);
+        busy = true;
+        busyUntil = at + tags[current.tag].kind->renderMs;
+    };
+
+    for (uint32_t now = 0; now < 62 * 60; now++) {
+        const uint32_t nowMs = now * 1000;
+        while (busy && busyUntil <= nowMs) {
+            current.done = busyUntil;
+            done.push_back(current);
+            busy = false;
+            startNext(busyUntil);
+        }
+
+        for (simTag& tag : tags) {
+            if (tag.due < 0 && now >= tag.nextupdate) tag.due = (int64_t)tag.nextupdate * 1000;
+            if (now >= tag.nextPress) {
+                tag.redraw = true;
+                if (tag.due < 0) tag.due = (int64_t)tag.nextPress * 1000;
+                tag.nextPress += 300 + nextRandom() % 600;
+            }
+            if (now >= tag.checkin) {
+                if (tag.due >= 0) result.staleCheckins++;
+                tag.checkin += CHECKIN_INTERVAL;
+            }
+        }
+
+        // finishRenders
+        for (const renderJob& job : done) {
+            simTag& tag = tags[job.tag];
+            tag.queued = false;
+            jobsPerTag[job.tag]--;
+            tag.redraw = false;
+            if (tag.due >= 0 && job.queued >= tag.due) {
+                latencies.push_back((job.done - tag.due) / 1000.0);
+                tag.due = -1;
+            }
+            if (tag.kind->interval) {
+                tag.nextupdate = job.done / 1000 + tag.kind->interval;
+            } else if (!tag.kind->button) {
+                tag.nextupdate = MIDNIGHT + 86400;
+                lastDate = std::max(lastDate, job.done);
+            }
+            result.renders++;
+        }
+        done.clear();
+
+        auto send = [&](uint32_t t, bool front) {
+            if (queue.size() >= RENDER_QUEUE_LEN) return false;
+            const renderJob job = {t, nowMs, 0};
+            if (front) {
+                queue.push_front(job);
+            } else {
+                queue.push_back(job);
+            }
+            tags[t].queued = true;
+            jobsPerTag[t]++;
+            result.maxJobsPerTag = std::max(result.maxJobsPerTag, jobsPerTag[t]);
+            return true;
+        };
+        uint8_t renders = 0;
+        urgentRenders urgent;
+        for (uint32_t t = 0; t < tags.size(); t++) {
+            simTag& tag = tags[t];
+            const uint8_t waiting = policy == POLICY_NOW ? queue.size() : 0;
+            const renderChoice choice = chooseRender(now, tag.nextupdate, tag.checkin, tag.redraw, tag.queued, renders, waiting);
+            if (choice == RENDER_SKIP) continue;
+            if (choice == RENDER_FRONT && policy == POLICY_NOW) {
+                uint8_t mac[8] = {};
+                memcpy(mac, &t, sizeof(t));
+                urgent.add(tag.redraw ? now : tag.checkin, mac);
+            } else if (send(t, choice == RENDER_FRONT && policy == POLICY_TAG_ORDER) && choice == RENDER_BACK) {
+                renders++;
+            }
+        }
+        urgent.sort();
+        for (const auto& job : urgent) {
+            uint32_t t;
+            memcpy(&t, job.mac, sizeof(t));
+            send(t, true);
+        }
+        if (!busy) startNext(nowMs);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    result.p95Latency = latencies.empty() ? 0 : latencies[latencies.size() * 95 / 100];
+    result.midnightDrained = lastDate / 1000.0 - MIDNIGHT;
+    return result;
+}
+
+void test_simulate_200_tags(void) {
+    const simResult fifo = simulate(POLICY_FIFO);
+    const simResult tagOrder = simulate(POLICY_TAG_ORDER);
+    resetHistogram(metricHistograms[METRIC_RENDER_WAIT_MS]);
+    const simResult urgent = simulate(POLICY_NOW);
+
+    char message[220];
+    const char* names[] = {"all to the back", "urgent to the front in tagDB order", "urgent to the front by check-in"};
+    const simResult* results[] = {&fifo, &tagOrder, &urgent};
+    for (uint8_t i = 0; i < 3; i++) {
+        const simResult* r = results[i];
+        snprintf(message, sizeof(message), "%s: %.1f renders/minute, p95 update to rendered %.1f s, all dates rendered %.0f s after midnight, %u check-ins got old content",
+                 names[i], r->renders / 62.0, r->p95Latency, r->midnightDrained, (unsigned)r->staleCheckins);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_EQUAL(1, r->maxJobsPerTag);
+    }
+    TEST_ASSERT_LESS_THAN(fifo.staleCheckins, urgent.staleCheckins);
+    TEST_ASSERT_LESS_THAN(tagOrder.staleCheckins, urgent.staleCheckins);
+
+    // the histogram has every wait, in the bucket of its bound
+    const metricHistogramData& histogram = metricHistograms[METRIC_RENDER_WAIT_MS];
+    const uint32_t* bounds = metricHistogramBounds[METRIC_RENDER_WAIT_MS];
+    TEST_ASSERT_EQUAL(urgent.waits.size(), histogram.count.load());
+    uint32_t sum = 0, buckets[METRIC_HISTOGRAM_BUCKETS + 1] = {};
+    for (uint32_t wait : urgent.waits) {
+        sum += wait;
+        buckets[std::lower_bound(bounds, bounds + METRIC_HISTOGRAM_BUCKETS, wait) - bounds]++;
+    }
+    TEST_ASSERT_EQUAL(sum, histogram.sum.load());
+    char line[160] = "render wait ms:";
+    for (uint8_t b = 0; b <= METRIC_HISTOGRAM_BUCKETS; b++) {
+        TEST_ASSERT_EQUAL(buckets[b], histogram.buckets[b].load());
+        const size_t len = strlen(line);
+        if (b < METRIC_HISTOGRAM_BUCKETS) {
+            snprintf(line + len, sizeof(line) - len, " le %u: %u,", (unsigned)bounds[b], (unsigned)buckets[b]);
+        } else {
+            snprintf(line + len, sizeof(line) - len, " +Inf: %u", (unsigned)buckets[b]);
+        }
+    }
+    TEST_MESSAGE(line);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_choose_render);
+    RUN_TEST(test_urgent_order);
+    RUN_TEST(test_simulate_200_tags);
+    return UNITY_END();
+}
@@ -0,0 +1,2 @@
+// cc1101_radio.c of the C6 AP, built as C like ESP-IDF does, against the stubs in test/idf_stub
+#include "cc1101_radio.c"
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <deque>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "proto.h"
+#include "sdkconfig.h"
+
+extern "C" {
+#include "cc1101_radio.h"
+}
+
+// A CC1101 in RX behind the SPI and GPIO calls of cc1101_radio.c: the 64 byte RX FIFO fills from the
+// air at the data rate of the AP (38.4 kBaud), GDO0 is high from the sync word to the end of the
+// packet, GDO2 notifies the task at the FIFO threshold and at the end of the packet.
+#define FIFO_SIZE 64
+#define FIFO_THRESHOLD 32  // FIFOTHR = 7
+#define BYTE_US 208
+#define SPI_BYTE_US 2  // 5 MHz, plus some overhead
+
+#define SRES 0x30
+#define SRX 0x34
+#define SIDLE 0x36
+#define SFRX 0x3A
+#define RXFIFO 0x3F
+#define MARCSTATE 0x35
+#define RXBYTES 0x3B
+#define STATE_IDLE 0x01
+#define STATE_RX 0x0D
+
+struct fakeRadio {
+    int64_t now;
+    std::deque<uint8_t> air;  // what is still to arrive of the packet on the air
+    int64_t nextByte;
+    std::deque<uint8_t> fifo;
+    bool overflow;
+    bool gdo0;
+    bool notified;  // a GDO2 interrupt woke the task
+    uint8_t marcState;
+    bool selected;
+    int address;  // header byte of the SPI access, -1 before it
+    uint8_t regs[0x30];
+    uint32_t spiBytes;
+};
+
+static fakeRadio radio;
+
+static bool gdo2() {
+    return radio.fifo.size() >= FIFO_THRESHOLD || (!radio.gdo0 && !radio.fifo.empty());
+}
+
+// lets the air catch up with the clock
+static void advance() {
+    while (!radio.air.empty() && radio.nextByte <= radio.now && radio.marcState == STATE_RX) {
+        const bool before = gdo2();
+        if (radio.fifo.size() == FIFO_SIZE) {
+            radio.overflow = true;
+            radio.gdo0 = false;
+            radio.air.clear();
+            break;
+        }
+        radio.fifo.push_back(radio.air.front());
+        radio.air.pop_front();
+        radio.nextByte += BYTE_US;
+        if (radio.air.size() == 2) {
+            // RSSI and LQI/CRC_OK are appended at the end of the packet, not sent
+            radio.fifo.push_back(radio.air[0]);
+            radio.fifo.push_back(radio.air[1]);
+            radio.air.clear();
+            radio.gdo0 = false;
+            if (radio.fifo.size() > FIFO_SIZE) radio.overflow = true;
+        }
+        if (gdo2() && !before) radio.notified = true;
+    }
+}
+
+// a packet starts arriving now, the sync word was just detected
+static void transmit(const std::vector<uint8_t>& payload, bool crcOk = true, uint8_t lengthByte = 0) {
+    radio.air.clear();
+    radio.air.push_back(lengthByte ? lengthByte : payload.size());
+    radio.air.insert(radio.air.end(), payload.begin(), payload.end());
+    radio.air.push_back(0xD0);                         // RSSI
+    radio.air.push_back((crcOk ? 0x80 : 0x00) | 0x2A);  // CRC_OK, LQI
+    radio.nextByte = radio.now + BYTE_US;
+    radio.gdo0 = true;
+}
+
+static uint8_t spiByte(uint8_t out) {
+    radio.now += SPI_BYTE_US;
+    radio.spiBytes++;
+    advance();
+    if (radio.address < 0) {
+        radio.address = out;
+        const uint8_t reg = out & 0x3F;
+        if (reg >= SRES && reg < RXFIFO && !(out & 0x40)) {
+            switch (reg) {
+                case SRES:
+                case SIDLE:
+                    radio.marcState = STATE_IDLE;
+                    radio.air.clear();
+                    radio.gdo0 = false;
+                    break;
+                case SRX:
+                    radio.marcState = STATE_RX;
+                    break;
+                case SFRX:
+                    radio.fifo.clear();
+                    radio.overflow = false;
+                    break;
+            }
+        }
+        return radio.marcState << 4;
+    }
+    const uint8_t reg = radio.address & 0x3F;
+    if (!(radio.address & 0x80)) {
+        if (reg < 0x30) radio.regs[reg] = out;
+        return 0;
+    }
+    if (reg == RXFIFO) {
+        if (radio.fifo.empty()) return 0;
+        const uint8_t b = radio.fifo.front();
+        radio.fifo.pop_front();
+        return b;
+    }
+    if (reg >= 0x30 && (radio.address & 0x40)) {
+        if (reg == MARCSTATE) return radio.marcState;
+        if (reg == RXBYTES) return (radio.overflow ? 0x80 : 0) | (radio.fifo.size() & 0x7F);
+        return 0;  // FREQEST and the rest
+    }
+    return radio.regs[reg];
+}
+
+extern "C" esp_err_t spi_device_transmit(spi_device_handle_t, spi_transaction_t* trans) {
+    const uint8_t* tx = (const uint8_t*)trans->tx_buffer;
+    uint8_t* rx = (uint8_t*)trans->rx_buffer;
+    for (size_t c = 0; c < trans->length / 8; c++) {
+        const uint8_t in = spiByte(tx ? tx[c] : 0);
+        if (rx) rx[c] = in;
+    }
+    return ESP_OK;
+}
+
+extern "C" int gpio_set_level(int gpio, uint32_t level) {
+    if (gpio == CONFIG_CSN_GPIO) {
+        radio.selected = level == 0;
+        radio.address = -1;
+    }
+    return 0;
+}
+
+extern "C" int gpio_get_level(int gpio) {
+    advance();
+    if (gpio == CONFIG_GDO0_GPIO) return radio.gdo0;
+    if (gpio == CONFIG_GDO2_GPIO) return gdo2();
+    return 0;  // MISO is low as soon as the crystal runs
+}
+
+extern "C" int64_t esp_timer_get_time(void) {
+    return radio.now;
+}
+
+extern "C" void esp_rom_delay_us(uint32_t us) {
+    radio.now += us;
+    advance();
+}
+
+// one tick is 10 ms, the IDF default
+extern "C" uint32_t ulTaskNotifyTake(BaseType_t, TickType_t ticks) {
+    const int64_t deadline = radio.now + ticks * 10000;
+    while (!radio.notified && radio.now < deadline) {
+        radio.now = (!radio.air.empty() && radio.nextByte < deadline) ? radio.nextByte : deadline;
+        advance();
+    }
+    const bool notified = radio.notified;
+    radio.notified = false;
+    return notified;
+}
+
+static std::vector<uint8_t> testPayload(size_t len) {
+    std::vector<uint8_t> payload(len);
+    for (size_t c = 0; c < len; c++) payload[c] = c * 7 + 3;
+    return payload;
+}
+
+// what the RX task does when GDO2 wakes it: waits for the notification, then drains the packet
+static int receive(uint8_t* buffer, size_t size, uint8_t* rssi = nullptr, uint8_t* lqi = nullptr) {
+    ulTaskNotifyTake(pdTRUE, 10);
+    return CC1101_Rx(buffer, size, rssi, lqi);
+}
+
+void setUp(void) {
+    radio = fakeRadio();
+    radio.address = -1;
+    radio.marcState = STATE_RX;
+}
+void tearDown(void) {}
+
+void test_nothing_received(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    TEST_ASSERT_EQUAL(0, CC1101_Rx(buffer, sizeof(buffer), nullptr, nullptr));
+}
+
+void test_short_packet(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    uint8_t rssi = 0, lqi = 0;
+    const std::vector<uint8_t> payload = testPayload(20);
+    transmit(payload);
+    TEST_ASSERT_EQUAL(20, receive(buffer, sizeof(buffer), &rssi, &lqi));
+    TEST_ASSERT_EQUAL_MEMORY(payload.data(), buffer, payload.size());
+    TEST_ASSERT_EQUAL(0xD0, rssi);
+    TEST_ASSERT_EQUAL(0x2A, lqi);
+    TEST_ASSERT_EQUAL(STATE_RX, radio.marcState);
+    TEST_ASSERT_TRUE(radio.fifo.empty());
+}
+
+// longer than the FIFO, so it has to be read while it arrives; up to the longest the AP accepts
+void test_packets_longer_than_the_fifo(void) {
+    for (size_t len : {63, 64, 65, 100, RADIO_MAX_PACKET_LEN + 2}) {
+        setUp();
+        uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+        const std::vector<uint8_t> payload = testPayload(len);
+        transmit(payload);
+        TEST_ASSERT_EQUAL(len, receive(buffer, sizeof(buffer)));
+        TEST_ASSERT_EQUAL_MEMORY(payload.data(), buffer, len);
+        TEST_ASSERT_FALSE(radio.overflow);
+    }
+}
+
+void test_crc_error_is_dropped(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    transmit(testPayload(90), false);
+    TEST_ASSERT_EQUAL(0, receive(buffer, sizeof(buffer)));
+    TEST_ASSERT_TRUE(radio.fifo.empty());
+}
+
+// a length byte beyond the buffer is never read into it
+void test_too_long_is_refused(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2 + 16];
+    memset(buffer, 0xEE, sizeof(buffer));
+    transmit(testPayload(RADIO_MAX_PACKET_LEN + 3));
+    TEST_ASSERT_EQUAL(-1, receive(buffer, RADIO_MAX_PACKET_LEN + 2));
+    TEST_ASSERT_EQUAL(0xEE, buffer[0]);
+    TEST_ASSERT_TRUE(radio.fifo.empty());
+    TEST_ASSERT_EQUAL(STATE_RX, radio.marcState);
+
+    // and the next packet comes through
+    const std::vector<uint8_t> payload = testPayload(30);
+    transmit(payload);
+    TEST_ASSERT_EQUAL(30, receive(buffer, RADIO_MAX_PACKET_LEN + 2));
+    TEST_ASSERT_EQUAL_MEMORY(payload.data(), buffer, payload.size());
+}
+
+// the length byte promises more than arrives before the carrier is gone
+void test_truncated_packet(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    transmit(testPayload(40), true, 80);
+    TEST_ASSERT_EQUAL(-2, receive(buffer, sizeof(buffer)));
+    TEST_ASSERT_TRUE(radio.fifo.empty());
+}
+
+// the task was busy elsewhere (SPI mutex held by a TX) and the FIFO ran over
+void test_overflow(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    transmit(testPayload(100));
+    esp_rom_delay_us(80 * BYTE_US);
+    TEST_ASSERT_TRUE(radio.overflow);
+    TEST_ASSERT_EQUAL(-2, CC1101_Rx(buffer, sizeof(buffer), nullptr, nullptr));
+    TEST_ASSERT_FALSE(radio.overflow);
+    TEST_ASSERT_TRUE(radio.fifo.empty());
+}
+
+// SPI traffic for a full size packet; the air time is 128 * 208 us
+void test_benchmark_full_packet(void) {
+    uint8_t buffer[RADIO_MAX_PACKET_LEN + 2];
+    transmit(testPayload(RADIO_MAX_PACKET_LEN + 2));
+    const int64_t start = radio.now;
+    TEST_ASSERT_EQUAL(RADIO_MAX_PACKET_LEN + 2, receive(buffer, sizeof(buffer)));
+    char message[120];
+    snprintf(message, sizeof(message), "%d byte packet: %u SPI bytes, done %lld us after the sync word",
+             RADIO_MAX_PACKET_LEN + 2, (unsigned)radio.spiBytes, (long long)(radio.now - start));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL((RADIO_MAX_PACKET_LEN + 2 + 3) * BYTE_US + 2000, radio.now - start);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_nothing_received);
+    RUN_TEST(test_short_packet);
+    RUN_TEST(test_packets_longer_than_the_fifo);
+    RUN_TEST(test_crc_error_is_dropped);
+    RUN_TEST(test_too_long_is_refused);
+    RUN_TEST(test_truncated_packet);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_benchmark_full_packet);
+    return UNITY_END();
+}
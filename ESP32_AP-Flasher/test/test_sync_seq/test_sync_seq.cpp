@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "syncproto.h"
+
+#define TEST_EVENT 0x42
+
+struct testEvent {
+    uint8_t origin;
+    uint32_t counter;
+    uint8_t payload[40];  // about the size of the real events
+} __attribute__((packed));
+
+static uint32_t rng = 1;
+static uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_batch_sequence(void) {
+    syncSeqState peer = {0, false};
+    syncGap gap = syncSeqBatch(peer, 100, false);
+    TEST_ASSERT_EQUAL(0, gap.count);  // the first frame only syncs
+    TEST_ASSERT_EQUAL(101, peer.nextSeq);
+
+    gap = syncSeqBatch(peer, 101, false);
+    TEST_ASSERT_EQUAL(0, gap.count);
+
+    gap = syncSeqBatch(peer, 105, false);  // 102..104 lost
+    TEST_ASSERT_EQUAL(102, gap.firstSeq);
+    TEST_ASSERT_EQUAL(3, gap.count);
+    TEST_ASSERT_EQUAL(106, peer.nextSeq);
+
+    gap = syncSeqBatch(peer, 103, true);  // the retransmission doesn't move the sequence
+    TEST_ASSERT_EQUAL(0, gap.count);
+    TEST_ASSERT_EQUAL(106, peer.nextSeq);
+
+    gap = syncSeqBatch(peer, 106 + SYNC_HISTORY, false);  // as much as the sender still has
+    TEST_ASSERT_EQUAL(106, gap.firstSeq);
+    TEST_ASSERT_EQUAL(SYNC_HISTORY, gap.count);
+
+    gap = syncSeqBatch(peer, 5000, false);  // a restart with a new random start
+    TEST_ASSERT_EQUAL(0, gap.count);
+    TEST_ASSERT_EQUAL(5001, peer.nextSeq);
+
+    gap = syncSeqBatch(peer, 7, false);  // or one that went back
+    TEST_ASSERT_EQUAL(0, gap.count);
+    TEST_ASSERT_EQUAL(8, peer.nextSeq);
+
+    peer = {0xFFFFFFFF, true};  // no NACK storm at the wrap
+    gap = syncSeqBatch(peer, 0, false);
+    TEST_ASSERT_EQUAL(0, gap.count);
+    TEST_ASSERT_EQUAL(1, peer.nextSeq);
+}
+
+void test_digest_sequence(void) {
+    syncSeqState peer = {0, false};
+    TEST_ASSERT_EQUAL(0, syncSeqDigest(peer, 10).count);  // nothing to compare with yet
+    TEST_ASSERT_FALSE(peer.synced);
+
+    syncSeqBatch(peer, 10, false);
+    TEST_ASSERT_EQUAL(0, syncSeqDigest(peer, 10).count);  // up to date
+
+    syncGap gap = syncSeqDigest(peer, 12);  // the last two frames of a burst were lost
+    TEST_ASSERT_EQUAL(11, gap.firstSeq);
+    TEST_ASSERT_EQUAL(2, gap.count);
+    TEST_ASSERT_EQUAL(13, peer.nextSeq);
+    TEST_ASSERT_EQUAL(0, syncSeqDigest(peer, 12).count);  // asked only once
+
+    TEST_ASSERT_EQUAL(0, syncSeqDigest(peer, 13 + SYNC_HISTORY).count);  // gone from the history anyway
+    TEST_ASSERT_EQUAL(13, peer.nextSeq);
+    gap = syncSeqDigest(peer, 12 + SYNC_HISTORY);
+    TEST_ASSERT_EQUAL(SYNC_HISTORY, gap.count);
+}
+
+void test_sender_frames(void) {
+    std::unique_ptr<SyncSender> sender(new SyncSender(1000));
+    TEST_ASSERT_TRUE(sender->empty());
+    TEST_ASSERT_FALSE(sender->finish());
+
+    testEvent event;
+    memset(&event, 0, sizeof(event));
+    int added = 0;
+    while (sender->fits(sizeof(event))) {
+        event.counter = added;
+        TEST_ASSERT_EQUAL(added == 0, sender->add(TEST_EVENT, &event, sizeof(event)));
+        added++;
+    }
+    TEST_ASSERT_EQUAL((SYNC_MTU - sizeof(SyncBatchHeader)) / (sizeof(event) + 2), added);
+    TEST_ASSERT_TRUE(sender->finish());
+    TEST_ASSERT_TRUE(sender->empty());
+    TEST_ASSERT_LESS_OR_EQUAL(SYNC_MTU, sender->frameLen());
+    TEST_ASSERT_EQUAL(1000, sender->lastSeq());
+
+    int parsed = 0;
+    TEST_ASSERT_TRUE(syncBatchEvents(sender->frame(), sender->frameLen(), [&parsed](uint8_t pktType, const uint8_t* data, size_t len) {
+        testEvent received;
+        TEST_ASSERT_EQUAL(TEST_EVENT, pktType);
+        TEST_ASSERT_EQUAL(sizeof(received), len);
+        memcpy(&received, data, len);
+        TEST_ASSERT_EQUAL(parsed, received.counter);
+        parsed++;
+    }));
+    TEST_ASSERT_EQUAL(added, parsed);
+
+    // a frame cut short only delivers the complete events
+    parsed = 0;
+    syncBatchEvents(sender->frame(), sender->frameLen() - 1, [&parsed](uint8_t, const uint8_t*, size_t) { parsed++; });
+    TEST_ASSERT_EQUAL(added - 1, parsed);
+
+    uint16_t len = 0;
+    const uint8_t* frame = sender->retransmit(1000, len);
+    TEST_ASSERT_NOT_NULL(frame);
+    TEST_ASSERT_EQUAL(sender->frameLen(), len);
+    SyncBatchHeader header;
+    memcpy(&header, frame, sizeof(header));
+    TEST_ASSERT_EQUAL(1000, header.seq);
+    TEST_ASSERT_TRUE(header.flags & SYNC_BATCH_RETRANSMIT);
+    TEST_ASSERT_NULL(sender->retransmit(999, len));
+
+    for (int i = 0; i < SYNC_HISTORY; i++) {
+        sender->add(TEST_EVENT, &event, sizeof(event));
+        sender->finish();
+    }
+    TEST_ASSERT_NULL(sender->retransmit(1000, len));  // evicted
+    TEST_ASSERT_NOT_NULL(sender->retransmit(1001, len));
+    TEST_ASSERT_NOT_NULL(sender->retransmit(1000 + SYNC_HISTORY, len));
+}
+
+void test_other_version_is_ignored(void) {
+    SyncSender sender(1);
+    const uint8_t payload = 1;
+    sender.add(TEST_EVENT, &payload, 1);
+    sender.finish();
+    uint8_t frame[SYNC_MTU];
+    memcpy(frame, sender.frame(), sender.frameLen());
+    frame[1] ^= 0xFF;
+    int parsed = 0;
+    TEST_ASSERT_FALSE(syncBatchEvents(frame, sender.frameLen(), [&parsed](uint8_t, const uint8_t*, size_t) { parsed++; }));
+    TEST_ASSERT_EQUAL(0, parsed);
+}
+
+// Several APs on a lossy multicast network, doing what udp.cpp does with batches, NACKs and digests.
+#define SIM_APS 5
+
+struct simPacket {
+    uint8_t from;
+    int8_t to;  // -1 for multicast
+    std::vector<uint8_t> data;
+};
+
+struct simResult {
+    uint32_t events;
+    uint32_t missing;  // summed over all receivers
+    uint32_t packets;
+    uint32_t nacks;
+    uint32_t retransmits;
+};
+
+class SimNetwork {
+   public:
+    SimNetwork(uint32_t lossPerMille, bool recover) : lossPerMille(lossPerMille), recover(recover) {
+        for (int i = 0; i < SIM_APS; i++) {
+            senders.emplace_back(new SyncSender(nextRandom() & 0x7FFFFFFF));
+            memset(peers[i], 0, sizeof(peers[i]));
+        }
+    }
+
+    void queueEvent(uint8_t ap) {
+        testEvent event;
+        memset(&event, ap, sizeof(event));
+        event.origin = ap;
+        event.counter = sent[ap]++;
+        if (!senders[ap]->fits(sizeof(event))) flush(ap);
+        senders[ap]->add(TEST_EVENT, &event, sizeof(event));
+        result.events++;
+    }
+
+    // what the SYNC_BATCH_DELAY timer does
+    void flush(uint8_t ap) {
+        if (senders[ap]->finish()) send(ap, -1, senders[ap]->frame(), senders[ap]->frameLen());
+    }
+
+    void digests() {
+        for (uint8_t ap = 0; ap < SIM_APS; ap++) {
+            SyncDigest digest;
+            digest.lastSeq = senders[ap]->lastSeq();
+            memset(digest.slice, 0, sizeof(digest.slice));
+            send(ap, -1, (uint8_t*)&digest, sizeof(digest));
+        }
+    }
+
+    void run() {
+        while (!queue.empty()) {
+            simPacket packet = queue.front();
+            queue.pop_front();
+            for (uint8_t ap = 0; ap < SIM_APS; ap++) {
+                if (ap == packet.from || (packet.to >= 0 && packet.to != ap)) continue;
+                if (nextRandom() % 1000 < lossPerMille) continue;
+                receive(ap, packet);
+            }
+        }
+    }
+
+    simResult finish() {
+        result.missing = 0;
+        for (uint8_t ap = 0; ap < SIM_APS; ap++) {
+            for (uint8_t origin = 0; origin < SIM_APS; origin++) {
+                if (ap == origin) continue;
+                for (uint32_t counter = 0; counter < sent[origin]; counter++) {
+                    if (counter >= received[ap][origin].size() || !received[ap][origin][counter]) result.missing++;
+                }
+            }
+        }
+        return result;
+    }
+
+   private:
+    void send(uint8_t from, int8_t to, const uint8_t* data, size_t len) {
+        queue.push_back({from, to, std::vector<uint8_t>(data, data + len)});
+        result.packets++;
+    }
+
+    void receive(uint8_t ap, const simPacket& packet) {
+        syncSeqState& peer = peers[ap][packet.from];
+        syncGap gap = {0, 0};
+        switch (packet.data[0]) {
+            case PKT_SYNC_BATCH: {
+                SyncBatchHeader header;
+                memcpy(&header, packet.data.data(), sizeof(header));
+                gap = syncSeqBatch(peer, header.seq, header.flags & SYNC_BATCH_RETRANSMIT);
+                syncBatchEvents(packet.data.data(), packet.data.size(), [this, ap](uint8_t, const uint8_t* data, size_t len) {
+                    testEvent event;
+                    memcpy(&event, data, len);
+                    std::vector<bool>& seen = received[ap][event.origin];
+                    if (seen.size() <= event.counter) seen.resize(event.counter + 1);
+                    seen[event.counter] = true;
+                });
+                break;
+            }
+            case PKT_SYNC_DIGEST: {
+                SyncDigest digest;
+                memcpy(&digest, packet.data.data(), sizeof(digest));
+                gap = syncSeqDigest(peer, digest.lastSeq);
+                break;
+            }
+            case PKT_SYNC_NACK: {
+                SyncNack nack;
+                memcpy(&nack, packet.data.data(), sizeof(nack));
+                const uint8_t count = std::min(nack.count, (uint8_t)SYNC_HISTORY);
+                for (uint32_t seq = nack.firstSeq; seq != nack.firstSeq + count; seq++) {
+                    uint16_t len;
+                    const uint8_t* frame = senders[ap]->retransmit(seq, len);
+                    if (frame) {
+                        send(ap, packet.from, frame, len);
+                        result.retransmits++;
+                    }
+                }
+                break;
+            }
+        }
+        if (gap.count && recover) {
+            SyncNack nack;
+            nack.firstSeq = gap.firstSeq;
+            nack.count = gap.count;
+            send(ap, packet.from, (uint8_t*)&nack, sizeof(nack));
+            result.nacks++;
+        }
+    }
+
+    uint32_t lossPerMille;
+    bool recover;
+    std::vector<std::unique_ptr<SyncSender>> senders;
+    syncSeqState peers[SIM_APS][SIM_APS];
+    uint32_t sent[SIM_APS] = {};
+    std::vector<bool> received[SIM_APS][SIM_APS];
+    std::deque<simPacket> queue;
+    simResult result = {};
+};
+
+// every round each AP has a few events, a digest goes out every tenth round
+static simResult simulate(uint32_t lossPerMille, bool recover, uint32_t seed) {
+    rng = seed;
+    SimNetwork network(lossPerMille, recover);
+    for (int round = 0; round < 500; round++) {
+        for (uint8_t ap = 0; ap < SIM_APS; ap++) {
+            const uint32_t events = nextRandom() % 40;
+            for (uint32_t i = 0; i < events; i++) network.queueEvent(ap);
+            network.flush(ap);
+        }
+        network.run();
+        if (round % 10 == 9) {
+            network.digests();
+            network.run();
+        }
+    }
+    network.digests();
+    network.run();
+    return network.finish();
+}
+
+void test_lossless_network(void) {
+    const simResult result = simulate(0, true, 1);
+    TEST_ASSERT_GREATER_THAN(10000, result.events);
+    TEST_ASSERT_EQUAL(0, result.missing);
+    TEST_ASSERT_EQUAL(0, result.nacks);
+    TEST_ASSERT_EQUAL(0, result.retransmits);
+}
+
+void test_lossy_network_recovers(void) {
+    for (uint32_t loss : {10, 50, 100}) {
+        const simResult without = simulate(loss, false, 2);
+        const simResult with = simulate(loss, true, 2);
+        const uint32_t deliveries = with.events * (SIM_APS - 1);
+        char message[160];
+        snprintf(message, sizeof(message), "%u%% loss: %u of %u deliveries missing without NACKs, %u with; %u NACKs, %u retransmits, %u packets",
+                 loss / 10, without.missing, deliveries, with.missing, with.nacks, with.retransmits, with.packets);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_GREATER_THAN(0, with.retransmits);
+        // a frame stays lost only when its NACK or the retransmission is lost as well
+        TEST_ASSERT_LESS_OR_EQUAL(without.missing / 4, with.missing);
+        TEST_ASSERT_LESS_OR_EQUAL(deliveries * loss * 3 / 1000 * loss / 1000 + 50, with.missing);
+    }
+}
+
+void test_benchmark_batches(void) {
+    const int frames = 20000;
+    std::unique_ptr<SyncSender> sender(new SyncSender(0));
+    testEvent event;
+    memset(&event, 0, sizeof(event));
+    size_t events = 0, parsed = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+        while (sender->fits(sizeof(event))) {
+            event.counter = events++;
+            sender->add(TEST_EVENT, &event, sizeof(event));
+        }
+        sender->finish();
+        syncBatchEvents(sender->frame(), sender->frameLen(), [&parsed](uint8_t, const uint8_t*, size_t) { parsed++; });
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL(events, parsed);
+    const long long us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+    char message[100];
+    snprintf(message, sizeof(message), "%d frames with %zu events built and parsed in %lld us", frames, events, us);
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_batch_sequence);
+    RUN_TEST(test_digest_sequence);
+    RUN_TEST(test_sender_frames);
+    RUN_TEST(test_other_version_is_ignored);
+    RUN_TEST(test_lossless_network);
+    RUN_TEST(test_lossy_network_recovers);
+    RUN_TEST(test_benchmark_batches);
+    return UNITY_END();
+}
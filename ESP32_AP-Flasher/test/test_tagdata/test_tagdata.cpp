@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tagdatafield.h"
+
+using namespace TagData;
+
+// counts the heap allocations, to show parsing a packet doesn't allocate
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+// GCC can't tell this new is malloc underneath
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static std::string format(Type type, const std::vector<uint8_t>& bytes, uint8_t decimals = 0, double mult = 1.0) {
+    const FieldOp op = compileField(0, type, bytes.size(), decimals, mult);
+    char value[256];
+    TEST_ASSERT_TRUE(formatField(op, bytes.data(), value, sizeof(value)));
+    return value;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_int(void) {
+    TEST_ASSERT_EQUAL_STRING("-1", format(Type::INT, {0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("127", format(Type::INT, {0x7f}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-2", format(Type::INT, {0xfe, 0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-8388608", format(Type::INT, {0x00, 0x00, 0x80}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-2147483648", format(Type::INT, {0x00, 0x00, 0x00, 0x80}).c_str());
+    TEST_ASSERT_EQUAL_STRING("2147483647", format(Type::INT, {0xff, 0xff, 0xff, 0x7f}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-549755813888", format(Type::INT, {0x00, 0x00, 0x00, 0x00, 0x80}).c_str());
+    TEST_ASSERT_EQUAL_STRING("4294967296", format(Type::INT, {0x00, 0x00, 0x00, 0x00, 0x01, 0x00}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-1", format(Type::INT, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("-256", format(Type::INT, {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}).c_str());
+    // a temperature in hundredths of a degree
+    TEST_ASSERT_EQUAL_STRING("-12.34", format(Type::INT, {0x2e, 0xfb}, 2, 0.01).c_str());
+    TEST_ASSERT_EQUAL_STRING("21.5", format(Type::INT, {0xd7, 0x00}, 1, 0.1).c_str());
+}
+
+void test_uint(void) {
+    TEST_ASSERT_EQUAL_STRING("255", format(Type::UINT, {0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("65534", format(Type::UINT, {0xfe, 0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("8388608", format(Type::UINT, {0x00, 0x00, 0x80}).c_str());
+    TEST_ASSERT_EQUAL_STRING("4294967295", format(Type::UINT, {0xff, 0xff, 0xff, 0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("1099511627775", format(Type::UINT, {0xff, 0xff, 0xff, 0xff, 0xff}).c_str());
+    TEST_ASSERT_EQUAL_STRING("72057594037927936", format(Type::UINT, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01}).c_str());
+    TEST_ASSERT_EQUAL_STRING("2.950", format(Type::UINT, {0x86, 0x0b}, 3, 0.001).c_str());  // battery mV in V
+}
+
+void test_float(void) {
+    uint8_t bytes[8];
+    const float f = -3.25f;
+    memcpy(bytes, &f, 4);
+    TEST_ASSERT_EQUAL_STRING("-3.25", format(Type::FLOAT, std::vector<uint8_t>(bytes, bytes + 4), 2).c_str());
+    TEST_ASSERT_EQUAL_STRING("-6.5", format(Type::FLOAT, std::vector<uint8_t>(bytes, bytes + 4), 1, 2.0).c_str());
+    const double d = 1013.256;
+    memcpy(bytes, &d, 8);
+    TEST_ASSERT_EQUAL_STRING("1013.26", format(Type::FLOAT, std::vector<uint8_t>(bytes, bytes + 8), 2).c_str());
+    TEST_ASSERT_EQUAL_STRING("1013", format(Type::FLOAT, std::vector<uint8_t>(bytes, bytes + 8)).c_str());
+
+    for (uint8_t length : {1, 2, 3, 5, 6, 7}) {
+        const FieldOp op = compileField(0, Type::FLOAT, length, 0, 1.0);
+        TEST_ASSERT_TRUE(op.type == Type::MAX);
+        char value[16];
+        TEST_ASSERT_FALSE(formatField(op, bytes, value, sizeof(value)));
+    }
+}
+
+void test_string(void) {
+    TEST_ASSERT_EQUAL_STRING("kitchen", format(Type::STRING, {'k', 'i', 't', 'c', 'h', 'e', 'n'}).c_str());
+    TEST_ASSERT_EQUAL_STRING("ab", format(Type::STRING, {'a', 'b', 0, 'c'}).c_str());  // padded with zeros
+    const FieldOp op = compileField(0, Type::STRING, 6, 0, 1.0);
+    char value[4];
+    TEST_ASSERT_TRUE(formatField(op, (const uint8_t*)"abcdef", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("abc", value);
+    TEST_ASSERT_EQUAL_STRING("abcdef", bytesTo<std::string>((const uint8_t*)"abcdef", 6).c_str());
+}
+
+// A sensor tag packet: name, temperature, humidity, pressure, battery and a packet counter
+struct benchField {
+    const char* name;
+    Type type;
+    uint8_t length;
+    uint8_t decimals;
+    double mult;
+};
+static const benchField benchFields[] = {
+    {"name", Type::STRING, 8, 0, 1.0},
+    {"temperature", Type::INT, 2, 2, 0.01},
+    {"humidity", Type::UINT, 1, 0, 1.0},
+    {"pressure", Type::FLOAT, 4, 1, 1.0},
+    {"battery", Type::UINT, 2, 3, 0.001},
+    {"counter", Type::UINT, 4, 0, 1.0},
+};
+#define BENCH_FIELDS (sizeof(benchFields) / sizeof(benchFields[0]))
+#define BENCH_TAGS 50
+
+struct benchVar {
+    std::string value;
+    bool changed;
+};
+
+static void benchPacket(uint8_t* packet, uint32_t n) {
+    memcpy(packet, "office\0\0", 8);
+    const int16_t temperature = 2150 + (n / 64) % 8;
+    memcpy(packet + 8, &temperature, 2);
+    packet[10] = 40 + (n / 128) % 4;
+    const float pressure = 1013.2f;
+    memcpy(packet + 11, &pressure, 4);
+    const uint16_t battery = 2950;
+    memcpy(packet + 15, &battery, 2);
+    memcpy(packet + 17, &n, 4);
+}
+
+// Before: a String per field, and setVarDB on the mac + field name key for every one
+static uint32_t parseBefore(std::unordered_map<std::string, benchVar>& varDB, const uint8_t src[8], const uint8_t* data) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%02X%02X%02X%02X%02X%02X%02X%02X.", src[7], src[6], src[5], src[4], src[3], src[2], src[1], src[0]);
+    const std::string mac = buffer;
+    uint16_t offset = 0;
+    uint32_t changes = 0;
+    for (const benchField& field : benchFields) {
+        const FieldOp op = compileField(offset, field.type, field.length, field.decimals, field.mult);
+        offset += field.length;
+        char formatted[256];
+        formatField(op, data + op.offset, formatted, sizeof(formatted));
+        const std::string value = formatted;
+        const std::string varName = mac + field.name;
+        auto it = varDB.find(varName);
+        if (it == varDB.end()) {
+            varDB[varName] = {value, true};
+            changes++;
+        } else if (it->second.value != value) {
+            it->second = {value, true};
+            changes++;
+        }
+    }
+    return changes;
+}
+
+// Now: the compiled ops and the resolved slots of the tag, the value formatted on the stack
+static uint32_t parseNow(const std::vector<FieldOp>& ops, std::vector<benchVar*>& slots, const uint8_t* data) {
+    char value[256];
+    uint32_t changes = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (!formatField(ops[i], data + ops[i].offset, value, sizeof(value))) continue;
+        benchVar* var = slots[i];
+        if (var->value != value) {
+            var->value = value;
+            var->changed = true;
+            changes++;
+        }
+    }
+    return changes;
+}
+
+void test_benchmark_packets(void) {
+    const uint32_t packets = 200000;
+    uint8_t packet[21];
+    uint8_t macs[BENCH_TAGS][8];
+    for (uint32_t t = 0; t < BENCH_TAGS; t++) {
+        for (uint8_t b = 0; b < 8; b++) macs[t][b] = b ? 0x10 + b : t;
+    }
+
+    std::unordered_map<std::string, benchVar> beforeDB;
+    beforeDB.reserve(BENCH_TAGS * BENCH_FIELDS);
+    uint32_t beforeChanges = 0;
+    size_t beforeAllocations = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < packets; n++) {
+        benchPacket(packet, n / BENCH_TAGS);
+        beforeChanges += parseBefore(beforeDB, macs[n % BENCH_TAGS], packet);
+    }
+    const double beforeS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    beforeAllocations = allocations - beforeAllocations;
+
+    // compiled once at load time, the slots once per tag
+    std::vector<FieldOp> ops;
+    uint16_t offset = 0;
+    for (const benchField& field : benchFields) {
+        ops.push_back(compileField(offset, field.type, field.length, field.decimals, field.mult));
+        offset += field.length;
+    }
+    std::unordered_map<std::string, benchVar> nowDB;
+    nowDB.reserve(BENCH_TAGS * BENCH_FIELDS);
+    std::vector<std::vector<benchVar*>> slots(BENCH_TAGS);
+    for (uint32_t t = 0; t < BENCH_TAGS; t++) {
+        for (const benchField& field : benchFields) slots[t].push_back(&nowDB[std::to_string(t) + "." + field.name]);
+    }
+    uint32_t nowChanges = 0;
+    size_t nowAllocations = allocations;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < packets; n++) {
+        benchPacket(packet, n / BENCH_TAGS);
+        nowChanges += parseNow(ops, slots[n % BENCH_TAGS], packet);
+    }
+    const double nowS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    nowAllocations = allocations - nowAllocations;
+
+    char message[220];
+    snprintf(message, sizeof(message), "%u packets of %u fields from %u tags: before %.0f packets/s, %.1f allocations/packet; now %.0f packets/s, %.1f allocations/packet",
+             (unsigned)packets, (unsigned)BENCH_FIELDS, (unsigned)BENCH_TAGS, packets / beforeS, (double)beforeAllocations / packets, packets / nowS,
+             (double)nowAllocations / packets);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL(beforeChanges, nowChanges);
+    TEST_ASSERT_EQUAL(0, nowAllocations);
+    TEST_ASSERT_GREATER_THAN(0, beforeAllocations);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_int);
+    RUN_TEST(test_uint);
+    RUN_TEST(test_float);
+    RUN_TEST(test_string);
+    RUN_TEST(test_benchmark_packets);
+    return UNITY_END();
+}
@@ -0,0 +1,301 @@
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "tagdb_bin.h"
+
+// the parts of fs::File the framing uses, on a memory buffer
+class MemFile {
+   public:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+
+    size_t write(const uint8_t* buf, size_t len) {
+        data.insert(data.begin() + pos, buf, buf + len);
+        pos += len;
+        return len;
+    }
+    size_t read(uint8_t* buf, size_t len) {
+        const size_t n = std::min(len, data.size() - pos);
+        memcpy(buf, data.data() + pos, n);
+        pos += n;
+        return n;
+    }
+    int read() { return pos < data.size() ? data[pos++] : -1; }
+    bool seek(size_t to) {
+        if (to > data.size()) return false;
+        pos = to;
+        return true;
+    }
+    size_t position() const { return pos; }
+};
+
+// CRC-32 as computed by esp_rom_crc32_le(0, ...)
+static uint32_t crc32(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static std::vector<std::vector<uint8_t>> makeRecords(size_t count, unsigned seed) {
+    srand(seed);
+    std::vector<std::vector<uint8_t>> records(count);
+    for (auto& record : records) {
+        record.resize(1 + rand() % 300);
+        for (auto& b : record) b = rand() % 4 ? rand() & 0xff : (rand() % 2 ? 0x7E : 0xDB);  // plenty of fake markers
+    }
+    return records;
+}
+
+static MemFile writeFile(const std::vector<std::vector<uint8_t>>& records, std::vector<size_t>* offsets = nullptr) {
+    MemFile file;
+    tagDBBinWriteHeader(file);
+    for (const auto& record : records) {
+        if (offsets) offsets->push_back(file.position());
+        tagDBBinWriteRecord(file, record.data(), record.size(), crc32);
+    }
+    file.pos = 0;
+    return file;
+}
+
+static std::vector<std::vector<uint8_t>> readFile(MemFile& file, TagDBBinReader<MemFile>*& reader) {
+    static uint8_t record[TAGDB_BIN_MAX_RECORD];
+    std::vector<std::vector<uint8_t>> records;
+    reader = new TagDBBinReader<MemFile>(file, record, crc32);
+    if (!reader->begin()) return records;
+    while (const uint16_t len = reader->next()) records.emplace_back(record, record + len);
+    return records;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_crc_matches_esp_rom(void) {
+    // the CRC-32 check value, what esp_rom_crc32_le(0, "123456789", 9) returns
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32(0, (const uint8_t*)"123456789", 9));
+}
+
+void test_round_trip(void) {
+    const auto records = makeRecords(200, 1);
+    MemFile file = writeFile(records);
+    TEST_ASSERT_EQUAL_MEMORY(TAGDB_BIN_MAGIC, file.data.data(), 4);
+    TagDBBinReader<MemFile>* reader;
+    const auto loaded = readFile(file, reader);
+    TEST_ASSERT_TRUE(loaded == records);
+    TEST_ASSERT_EQUAL(0, reader->badRecords());
+    TEST_ASSERT_FALSE(reader->corrupt());
+    delete reader;
+}
+
+void test_resync_after_corrupt_length(void) {
+    const auto records = makeRecords(50, 2);
+    std::vector<size_t> offsets;
+    MemFile file = writeFile(records, &offsets);
+    // a length far beyond the end of the file: only this record may get lost
+    file.data[offsets[10] + 2] = 0xff;
+    file.data[offsets[10] + 3] = 0x07;
+    TagDBBinReader<MemFile>* reader;
+    auto loaded = readFile(file, reader);
+    auto expected = records;
+    expected.erase(expected.begin() + 10);
+    TEST_ASSERT_TRUE(loaded == expected);
+    TEST_ASSERT_EQUAL(1, reader->badRecords());
+    TEST_ASSERT_FALSE(reader->corrupt());
+    delete reader;
+}
+
+void test_resync_after_corrupt_payload_and_marker(void) {
+    const auto records = makeRecords(50, 3);
+    std::vector<size_t> offsets;
+    MemFile file = writeFile(records, &offsets);
+    file.data[offsets[5] + 7] ^= 0x55;  // bad CRC
+    file.data[offsets[20]] = 0x00;      // bad marker
+    file.data[offsets[30] + 1] = 0x00;  // length 0 is never written
+    file.data[offsets[30] + 2] = 0x00;
+    file.data[offsets[30] + 3] = 0x00;
+    TagDBBinReader<MemFile>* reader;
+    auto loaded = readFile(file, reader);
+    auto expected = records;
+    expected.erase(expected.begin() + 30);
+    expected.erase(expected.begin() + 20);
+    expected.erase(expected.begin() + 5);
+    TEST_ASSERT_TRUE(loaded == expected);
+    TEST_ASSERT_EQUAL(3, reader->badRecords());
+    delete reader;
+}
+
+void test_truncated_file(void) {
+    const auto records = makeRecords(20, 4);
+    MemFile file = writeFile(records);
+    file.data.resize(file.data.size() - 3);
+    TagDBBinReader<MemFile>* reader;
+    auto loaded = readFile(file, reader);
+    TEST_ASSERT_EQUAL(19, loaded.size());
+    TEST_ASSERT_TRUE(std::equal(loaded.begin(), loaded.end(), records.begin()));
+    delete reader;
+}
+
+void test_rejected_record_is_skipped(void) {
+    const auto records = makeRecords(10, 5);
+    MemFile file = writeFile(records);
+    uint8_t record[TAGDB_BIN_MAX_RECORD];
+    TagDBBinReader<MemFile> reader(file, record, crc32);
+    TEST_ASSERT_TRUE(reader.begin());
+    size_t count = 0;
+    while (const uint16_t len = reader.next()) {
+        if (count++ == 3) reader.reject();
+        (void)len;
+    }
+    TEST_ASSERT_EQUAL(10, count);
+    TEST_ASSERT_EQUAL(1, reader.badRecords());
+}
+
+static MemFile writeVersion1(const std::vector<std::vector<uint8_t>>& records, std::vector<size_t>& offsets) {
+    MemFile file;
+    const uint8_t header[8] = {'O', 'E', 'D', 'B', 1, 0, 0, 0};
+    file.write(header, sizeof(header));
+    for (const auto& record : records) {
+        offsets.push_back(file.position());
+        const uint16_t len = record.size();
+        const uint32_t crc = crc32(0, record.data(), len);
+        file.write((const uint8_t*)&len, sizeof(len));
+        file.write(record.data(), len);
+        file.write((const uint8_t*)&crc, sizeof(crc));
+    }
+    file.pos = 0;
+    return file;
+}
+
+void test_version_1(void) {
+    const auto records = makeRecords(10, 6);
+    std::vector<size_t> offsets;
+    MemFile file = writeVersion1(records, offsets);
+    file.data[offsets[2] + 4] ^= 1;  // bad CRC, the length is still good
+    TagDBBinReader<MemFile>* reader;
+    auto loaded = readFile(file, reader);
+    auto expected = records;
+    expected.erase(expected.begin() + 2);
+    TEST_ASSERT_TRUE(loaded == expected);
+    TEST_ASSERT_FALSE(reader->corrupt());
+    delete reader;
+
+    file.pos = 0;
+    file.data[offsets[6]] = 0;  // a length of 0 can't be skipped without markers
+    file.data[offsets[6] + 1] = 0;
+    loaded = readFile(file, reader);
+    TEST_ASSERT_EQUAL(5, loaded.size());
+    TEST_ASSERT_TRUE(reader->corrupt());
+    delete reader;
+}
+
+void test_unsupported_version(void) {
+    MemFile file;
+    const uint8_t header[8] = {'O', 'E', 'D', 'B', TAGDB_BIN_VERSION + 1, 0, 0, 0};
+    file.write(header, sizeof(header));
+    file.pos = 0;
+    uint8_t record[TAGDB_BIN_MAX_RECORD];
+    TagDBBinReader<MemFile> reader(file, record, crc32);
+    TEST_ASSERT_FALSE(reader.begin());
+}
+
+// the keys fillNode writes, with values that depend on n
+static void fillTestNode(JsonObject tag, unsigned n) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "0000%012X", n);
+    tag["mac"] = std::string(buf);
+    snprintf(buf, sizeof(buf), "%032x", n * 2654435761u);
+    tag["hash"] = std::string(buf);
+    tag["lastseen"] = 1700000000u + n;
+    tag["nextupdate"] = 1700000600u + n;
+    tag["nextcheckin"] = 1700000060u + n;
+    tag["pending"] = n % 3;
+    snprintf(buf, sizeof(buf), "tag %u in the hall", n);
+    tag["alias"] = std::string(buf);
+    tag["contentMode"] = n % 30;
+    tag["LQI"] = 100 + n % 100;
+    tag["RSSI"] = -(int)(n % 90);
+    tag["temperature"] = 21 - (int)(n % 30);
+    tag["batteryMv"] = 2600 + n % 400;
+    tag["hwType"] = n % 256;
+    tag["wakeupReason"] = n % 4;
+    tag["capabilities"] = 0x8F;
+    tag["modecfgjson"] = "{\"location\":\"Amsterdam\",\"units\":\"0\",\"interval\":\"15\"}";
+    tag["isexternal"] = n % 7 == 0;
+    tag["apip"] = "192.168.1.23";
+    tag["rotate"] = n % 4;
+    tag["lut"] = 0;
+    tag["invert"] = n % 2;
+    tag["updatecount"] = n * 3;
+    tag["updatelast"] = 1700000000u;
+    tag["ch"] = 11 + n % 16;
+    tag["ver"] = 0x0026;
+}
+
+// exports and imports 2000 tags record by record, the way saveDBBinary and loadDBBinary do
+void test_msgpack_round_trip_2000_tags(void) {
+    const unsigned tags = 2000;
+    DynamicJsonDocument doc(2500);
+    uint8_t record[TAGDB_BIN_MAX_RECORD];
+
+    const auto t0 = std::chrono::steady_clock::now();
+    MemFile file;
+    tagDBBinWriteHeader(file);
+    for (unsigned n = 0; n < tags; n++) {
+        doc.clear();
+        fillTestNode(doc.to<JsonObject>(), n);
+        const size_t len = measureMsgPack(doc);
+        TEST_ASSERT_TRUE(len > 0 && len <= TAGDB_BIN_MAX_RECORD);
+        TEST_ASSERT_EQUAL(len, serializeMsgPack(doc, record, len));
+        tagDBBinWriteRecord(file, record, len, crc32);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+
+    file.pos = 0;
+    TagDBBinReader<MemFile> reader(file, record, crc32);
+    TEST_ASSERT_TRUE(reader.begin());
+    DynamicJsonDocument expected(2500);
+    unsigned n = 0;
+    while (const uint16_t len = reader.next()) {
+        TEST_ASSERT_FALSE(deserializeMsgPack(doc, record, len));
+        expected.clear();
+        fillTestNode(expected.to<JsonObject>(), n);
+        TEST_ASSERT_TRUE(doc.as<JsonObject>() == expected.as<JsonObject>());
+        TEST_ASSERT_EQUAL_STRING(expected["mac"].as<const char*>(), doc["mac"].as<const char*>());
+        TEST_ASSERT_EQUAL(expected["RSSI"].as<int>(), doc["RSSI"].as<int>());
+        n++;
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL(tags, n);
+    TEST_ASSERT_EQUAL(0, reader.badRecords());
+
+    char message[160];
+    snprintf(message, sizeof(message), "%u tags, %u bytes: export %lld us, import %lld us, working memory %u bytes", tags, (unsigned)file.data.size(),
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count(),
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count(),
+             (unsigned)(doc.capacity() + sizeof(record)));
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_matches_esp_rom);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_resync_after_corrupt_length);
+    RUN_TEST(test_resync_after_corrupt_payload_and_marker);
+    RUN_TEST(test_truncated_file);
+    RUN_TEST(test_rejected_record_is_skipped);
+    RUN_TEST(test_version_1);
+    RUN_TEST(test_unsupported_version);
+    RUN_TEST(test_msgpack_round_trip_2000_tags);
+    return UNITY_END();
+}
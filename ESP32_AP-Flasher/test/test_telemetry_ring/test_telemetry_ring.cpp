@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "telemetry_ring.h"
+
+static telemetryRing rings[TELEMETRY_TAGS];
+
+static const uint32_t start = 1700000000;
+
+static void macFor(uint8_t mac[8], uint16_t tag) {
+    memset(mac, 0, 8);
+    mac[0] = tag & 0xff;
+    mac[1] = tag >> 8;
+    mac[7] = 0x44;
+}
+
+static std::vector<telemetrySample> replay(const uint8_t mac[8], uint32_t since = 0, std::vector<telemetryReturn>* returns = nullptr) {
+    std::vector<telemetrySample> samples;
+    const telemetryRing* ring = telemetryFindRing(rings, TELEMETRY_TAGS, mac, false);
+    if (ring) {
+        telemetryReplay(
+            *ring, since, [&samples](const telemetrySample& sample) { samples.push_back(sample); },
+            [returns](const telemetryReturn& ret) {
+                if (returns) returns->push_back(ret);
+            });
+    }
+    return samples;
+}
+
+static void assertSamples(const std::vector<telemetrySample>& expected, const std::vector<telemetrySample>& actual) {
+    TEST_ASSERT_EQUAL(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(expected[i].time, actual[i].time);
+        TEST_ASSERT_EQUAL(expected[i].batteryMv, actual[i].batteryMv);
+        TEST_ASSERT_EQUAL(expected[i].temperature, actual[i].temperature);
+        TEST_ASSERT_EQUAL(expected[i].rssi, actual[i].rssi);
+        TEST_ASSERT_EQUAL(expected[i].lqi, actual[i].lqi);
+        TEST_ASSERT_EQUAL(expected[i].wakeupReason, actual[i].wakeupReason);
+    }
+}
+
+// the replay has to be the newest part of what was stored, and hold at least min samples
+static void assertTail(const std::vector<telemetrySample>& all, const std::vector<telemetrySample>& actual, size_t min) {
+    TEST_ASSERT_GREATER_OR_EQUAL(std::min(min, all.size()), actual.size());
+    TEST_ASSERT_LESS_OR_EQUAL(all.size(), actual.size());
+    assertSamples(std::vector<telemetrySample>(all.end() - actual.size(), all.end()), actual);
+}
+
+// a random walk of check-ins, with long absences and large jumps now and then
+static telemetrySample nextSample(const telemetrySample& previous) {
+    telemetrySample sample = previous;
+    const int r = rand() % 100;
+    if (r < 5) {
+        sample.time += 65536 + rand() % 300000;  // longer than 18 hours away
+    } else {
+        sample.time += TELEMETRY_INTERVAL + rand() % 600;
+    }
+    if (r % 10 == 0) {
+        sample.batteryMv = 1000 + rand() % 32000;  // a new battery, or a reading of a different kind
+        sample.temperature = -128 + rand() % 256;
+    } else {
+        sample.batteryMv += rand() % 21 - 10;
+        sample.temperature += rand() % 3 - 1;
+    }
+    sample.rssi = -(rand() % 100);
+    sample.lqi = rand() & 0xff;
+    sample.wakeupReason = (rand() % 8 == 0) ? rand() % 5 : 0;
+    return sample;
+}
+
+void setUp(void) {
+    memset(rings, 0, sizeof(rings));
+    srand(1);
+}
+void tearDown(void) {}
+
+void test_round_trip_with_eviction(void) {
+    uint8_t mac[8];
+    macFor(mac, 1);
+    std::vector<telemetrySample> all;
+    telemetrySample sample = {start, 3000, 21, -60, 200, 0};
+    for (int i = 0; i < TELEMETRY_BYTES; i++) {
+        TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));
+        all.push_back(sample);
+        if (all.size() == 10) assertSamples(all, replay(mac));  // before the ring is full
+        if (all.size() > 10 && all.size() % 97 == 0) assertTail(all, replay(mac), TELEMETRY_BYTES / 12);
+        sample = nextSample(sample);
+    }
+    // evicted records are folded into base, which stays the oldest sample that is kept
+    assertTail(all, replay(mac), TELEMETRY_BYTES / 12);
+}
+
+// a check-in at the usual interval with a small battery change takes 7 bytes instead of 10
+void test_normal_delta_is_small(void) {
+    uint8_t mac[8];
+    macFor(mac, 7);
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+    for (int i = 0; i < 10; i++) {
+        sample.time += TELEMETRY_INTERVAL + 60;
+        sample.batteryMv -= 3;
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+    }
+    TEST_ASSERT_EQUAL(10 * 7, telemetryFindRing(rings, TELEMETRY_TAGS, mac, false)->used);
+}
+
+void test_return_data(void) {
+    uint8_t mac[8];
+    macFor(mac, 8);
+    uint8_t payload[90];
+    for (uint8_t c = 0; c < sizeof(payload); c++) payload[c] = c * 3;
+    TEST_ASSERT_FALSE(telemetryStoreReturn(rings, TELEMETRY_TAGS, mac, start, 0x21, payload, 4));  // never checked in
+
+    std::vector<telemetrySample> all;
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    uint32_t returnTime = 0;
+    for (int i = 0; i < 5; i++) {
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+        all.push_back(sample);
+        if (i == 2) {
+            returnTime = sample.time + 70000;  // a long gap in a return data record as well
+            TEST_ASSERT_TRUE(telemetryStoreReturn(rings, TELEMETRY_TAGS, mac, returnTime, 0x21, payload, 4));
+            TEST_ASSERT_TRUE(telemetryStoreReturn(rings, TELEMETRY_TAGS, mac, returnTime + 1, 0x22, payload, sizeof(payload)));
+            sample.time = returnTime + 100;
+        }
+        sample = nextSample(sample);
+    }
+    std::vector<telemetryReturn> returns;
+    assertSamples(all, replay(mac, 0, &returns));
+    TEST_ASSERT_EQUAL(2, returns.size());
+    TEST_ASSERT_EQUAL_UINT32(returnTime, returns[0].time);
+    TEST_ASSERT_EQUAL(0x21, returns[0].dataType);
+    TEST_ASSERT_EQUAL(4, returns[0].len);
+    TEST_ASSERT_EQUAL_MEMORY(payload, returns[0].data, 4);
+    TEST_ASSERT_EQUAL(0, returns[0].data[4]);
+    TEST_ASSERT_EQUAL_UINT32(returnTime + 1, returns[1].time);
+    TEST_ASSERT_EQUAL(sizeof(payload), returns[1].len);  // cut to TELEMETRY_RETURN_BYTES, but the length is kept
+    TEST_ASSERT_EQUAL_MEMORY(payload, returns[1].data, TELEMETRY_RETURN_BYTES);
+
+    returns.clear();
+    replay(mac, returnTime + 1, &returns);
+    TEST_ASSERT_EQUAL(1, returns.size());
+}
+
+// return data evicted from the front of the ring still moves the clock of the records after it
+void test_evicted_return_data_keeps_time(void) {
+    uint8_t mac[8];
+    macFor(mac, 9);
+    uint8_t payload[TELEMETRY_RETURN_BYTES] = {1, 2, 3};
+    std::vector<telemetrySample> all;
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    for (int i = 0; i < TELEMETRY_BYTES / 4; i++) {
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+        all.push_back(sample);
+        if (i % 3 == 0) telemetryStoreReturn(rings, TELEMETRY_TAGS, mac, sample.time + 1000 + rand() % 100000, 0x30, payload, sizeof(payload));
+        sample = nextSample(sample);
+        sample.time = telemetryFindRing(rings, TELEMETRY_TAGS, mac, false)->lastTime + TELEMETRY_INTERVAL + rand() % 600;
+    }
+    assertTail(all, replay(mac), TELEMETRY_BYTES / (12 + 5 + 2 + TELEMETRY_RETURN_BYTES));
+}
+
+void test_long_gaps_stay_exact(void) {
+    uint8_t mac[8];
+    macFor(mac, 2);
+    std::vector<telemetrySample> all;
+    telemetrySample sample = {start, 2900, 20, -50, 100, 0};
+    for (uint32_t gap : {70000u, 86400u * 3, 300u, 86400u * 40, 0xFFFFFFFFu - start - 86400u * 45}) {
+        TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));
+        all.push_back(sample);
+        sample.time += gap;
+    }
+    assertSamples(all, replay(mac));
+}
+
+void test_unset_clock_is_skipped(void) {
+    uint8_t mac[8];
+    macFor(mac, 3);
+    const telemetrySample early = {TELEMETRY_MIN_TIME - 1, 3000, 20, -50, 100, 0};
+    TEST_ASSERT_FALSE(telemetryStore(rings, TELEMETRY_TAGS, mac, early));
+    TEST_ASSERT_NULL(telemetryFindRing(rings, TELEMETRY_TAGS, mac, false));  // no ring taken for it either
+}
+
+void test_interval_and_wakeup_reason(void) {
+    uint8_t mac[8];
+    macFor(mac, 4);
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));
+    sample.time += TELEMETRY_INTERVAL - 1;
+    TEST_ASSERT_FALSE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));  // too soon
+    sample.wakeupReason = 3;
+    TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));  // but a new wakeup reason is kept
+    sample.time += TELEMETRY_INTERVAL;
+    TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));
+    TEST_ASSERT_EQUAL(3, replay(mac).size());
+}
+
+void test_clock_stepped_back_restarts(void) {
+    uint8_t mac[8];
+    macFor(mac, 5);
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    for (int i = 0; i < 5; i++) {
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+        sample.time += TELEMETRY_INTERVAL;
+    }
+    const telemetrySample back = {start - 3600, 2950, 19, -40, 90, 1};
+    TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, back));
+    assertSamples({back}, replay(mac));
+}
+
+void test_since_filter(void) {
+    uint8_t mac[8];
+    macFor(mac, 6);
+    std::vector<telemetrySample> all;
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    for (int i = 0; i < 20; i++) {
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+        all.push_back(sample);
+        sample = nextSample(sample);
+    }
+    const uint32_t since = all[12].time;
+    assertSamples(std::vector<telemetrySample>(all.begin() + 12, all.end()), replay(mac, since));
+    TEST_ASSERT_EQUAL(0, replay(mac, all.back().time + 1).size());
+}
+
+void test_least_recent_tag_is_replaced(void) {
+    uint8_t mac[8];
+    for (uint16_t tag = 0; tag < TELEMETRY_TAGS; tag++) {
+        macFor(mac, tag);
+        // tag 3 checked in the longest ago
+        const telemetrySample sample = {start + (tag == 3 ? 0 : 1000 + tag), 3000, 20, -50, 100, 0};
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+    }
+    macFor(mac, TELEMETRY_TAGS);
+    const telemetrySample sample = {start + 5000, 2800, 18, -70, 50, 0};
+    TEST_ASSERT_TRUE(telemetryStore(rings, TELEMETRY_TAGS, mac, sample));
+    assertSamples({sample}, replay(mac));
+    macFor(mac, 3);
+    TEST_ASSERT_NULL(telemetryFindRing(rings, TELEMETRY_TAGS, mac, false));
+    macFor(mac, 4);
+    TEST_ASSERT_EQUAL(1, replay(mac).size());
+}
+
+void test_benchmark_insert(void) {
+    const int perTag = TELEMETRY_BYTES;
+    std::vector<telemetrySample> samples(TELEMETRY_TAGS);
+    for (uint16_t tag = 0; tag < TELEMETRY_TAGS; tag++) samples[tag] = {start, 3000, 20, -50, 100, 0};
+    uint8_t mac[8];
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < perTag; i++) {
+        for (uint16_t tag = 0; tag < TELEMETRY_TAGS; tag++) {
+            macFor(mac, tag);
+            telemetryStore(rings, TELEMETRY_TAGS, mac, samples[tag]);
+            samples[tag] = nextSample(samples[tag]);
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    size_t replayed = 0;
+    for (uint16_t tag = 0; tag < TELEMETRY_TAGS; tag++) {
+        macFor(mac, tag);
+        replayed += replay(mac).size();
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(TELEMETRY_TAGS * (TELEMETRY_BYTES / 12), replayed);
+
+    // a day of check-ins at the usual interval, with the small battery and temperature changes of nextSample
+    memset(rings, 0, sizeof(rings));
+    macFor(mac, 0);
+    telemetrySample sample = {start, 3000, 20, -50, 100, 0};
+    uint32_t day = 0;
+    for (uint32_t end = start + 86400; sample.time < end; day++) {
+        telemetryStore(rings, TELEMETRY_TAGS, mac, sample);
+        sample.time += TELEMETRY_INTERVAL + rand() % 60;
+        sample.batteryMv -= rand() % 3;
+        sample.temperature += rand() % 3 - 1;
+    }
+    // the smaller ring without PSRAM doesn't hold a whole day, so count from what it does hold
+    const uint16_t used = telemetryFindRing(rings, TELEMETRY_TAGS, mac, false)->used;
+    const double perCheckIn = (double)used / (replay(mac).size() - 1);
+
+    char message[240];
+    snprintf(message, sizeof(message), "%d tags: %lld ns per insert; %.1f bytes per check-in, %u a day take %u bytes per tag, %u as plain samples; ring %u bytes per tag",
+             TELEMETRY_TAGS, (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / (perTag * TELEMETRY_TAGS),
+             perCheckIn, (unsigned)day, (unsigned)(perCheckIn * day), (unsigned)(day * sizeof(telemetrySample)), (unsigned)sizeof(telemetryRing));
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_with_eviction);
+    RUN_TEST(test_normal_delta_is_small);
+    RUN_TEST(test_return_data);
+    RUN_TEST(test_evicted_return_data_keeps_time);
+    RUN_TEST(test_long_gaps_stay_exact);
+    RUN_TEST(test_unset_clock_is_skipped);
+    RUN_TEST(test_interval_and_wakeup_reason);
+    RUN_TEST(test_clock_stepped_back_restarts);
+    RUN_TEST(test_since_filter);
+    RUN_TEST(test_least_recent_tag_is_replaced);
+    RUN_TEST(test_benchmark_insert);
+    return UNITY_END();
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "textwrap.h"
+
+// A made up proportional font: every glyph has a different advance, the ink is one pixel narrower
+// than the advance, and 'j' hangs one pixel to the left like it does in the VLW fonts.
+static glyphMetric testMetric(uint16_t unicode) {
+    if (unicode == ' ') return {4, 4, 0};
+    if (unicode == 'j') return {4, 3, 1};
+    if (unicode < 0x80) {
+        const int16_t advance = 5 + (unicode % 5);
+        return {advance, static_cast<int16_t>(advance - 1), 0};
+    }
+    return {9, 9, 0};  // anything outside ASCII: not in the font, spaceWidth + 1 like TFT_eSPI
+}
+
+// TFT_eSPI::textWidth() for the test font
+static int32_t oldTextWidth(const std::string& s) {
+    int32_t width = 0;
+    uint16_t index = 0;
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(s.c_str());
+    while (index < s.length()) {
+        const uint16_t unicode = TextWrapper::decodeUTF8(buf, &index, s.length() - index);
+        const glyphMetric glyph = testMetric(unicode);
+        if (width == 0) width += glyph.lead;
+        width += (index < s.length()) ? glyph.advance : glyph.extent;
+    }
+    return width;
+}
+
+// drawTextBox before the single pass wrapper, measuring every growing substring
+static std::vector<std::string> oldWrap(const std::string& content, int32_t boxwidth) {
+    std::vector<std::string> lines;
+    const size_t length = content.length();
+    size_t startPos = 0;
+    while (startPos < length) {
+        size_t endPos = startPos;
+        bool hasspace = false;
+        while (endPos < length && oldTextWidth(content.substr(startPos, endPos + 1 - startPos)) <= boxwidth && content[endPos] != '\n') {
+            if (content[endPos] == ' ' || content[endPos] == '-') hasspace = true;
+            endPos++;
+        }
+        while (endPos < length && endPos > startPos && hasspace == true && content[endPos - 1] != ' ' && content[endPos - 1] != '-' && content[endPos] != '\n') {
+            endPos--;
+        }
+        lines.push_back(content.substr(startPos, endPos - startPos));
+        if (content[endPos] == '\n') endPos++;
+        startPos = endPos;
+        while (startPos < length && content[startPos] == ' ') startPos++;
+    }
+    return lines;
+}
+
+static std::string trim(const std::string& s) {
+    const size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) return "";
+    return s.substr(first, s.find_last_not_of(" \t\r\n") + 1 - first);
+}
+
+// the string assembly of drawTextBox on top of TextWrapper
+static std::vector<std::string> newWrap(const std::string& content, int32_t boxwidth, size_t maxLines = 0, bool ellipsis = false, std::vector<int32_t>* widths = nullptr) {
+    std::vector<std::string> lines;
+    TextWrapper wrapper(reinterpret_cast<const uint8_t*>(content.c_str()), content.length(), boxwidth, testMetric);
+    while (!wrapper.done() && (maxLines == 0 || lines.size() < maxLines)) {
+        const textLine wrapped = wrapper.next(ellipsis && lines.size() + 1 == maxLines);
+        std::string line = content.substr(wrapped.start, wrapped.end - wrapped.start);
+        if (wrapped.ellipsis) line = trim(line) + "...";
+        if (wrapped.hyphenate) line += "-";
+        for (size_t pos; (pos = line.find("\xC2\xAD")) != std::string::npos;) line.erase(pos, 2);
+        lines.push_back(line);
+        if (widths) widths->push_back(wrapped.width);
+    }
+    return lines;
+}
+
+static std::string randomText(size_t length, unsigned seed) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzjjj       --\n";
+    srand(seed);
+    std::string text;
+    while (text.length() < length) text += alphabet[rand() % (sizeof(alphabet) - 1)];
+    return text;
+}
+
+static void assertLines(const std::vector<std::string>& expected, const std::vector<std::string>& actual) {
+    TEST_ASSERT_EQUAL(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), actual[i].c_str());
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_matches_old_wrapping(void) {
+    for (unsigned seed = 1; seed <= 200; seed++) {
+        const std::string text = randomText(40 + seed * 3, seed);
+        for (int32_t boxwidth = 12; boxwidth <= 200; boxwidth += 17) {
+            assertLines(oldWrap(text, boxwidth), newWrap(text, boxwidth));
+        }
+    }
+}
+
+void test_golden_paragraph(void) {
+    const std::string text = "The quick brown fox jumps over the lazy dog.\nWell-known pangram";
+    assertLines({"The quick ", "brown fox ", "jumps over ", "the lazy dog.", "Well-known ", "pangram"}, newWrap(text, 90));
+    assertLines(oldWrap(text, 90), newWrap(text, 90));
+}
+
+void test_long_word_is_split(void) {
+    assertLines({"abcdefg", "hijklmn", "opq"}, newWrap("abcdefghijklmnopq", 50));
+}
+
+void test_soft_hyphen(void) {
+    const std::string text = "extra\xC2\xAD" "ordinary thing";
+    assertLines({"extra-", "ordinary ", "thing"}, newWrap(text, 60));
+    // when the whole word fits, the soft hyphen is not drawn
+    assertLines({"extraordinary ", "thing"}, newWrap(text, 120));
+}
+
+void test_ellipsis(void) {
+    const std::string text = "one two three four five six";
+    assertLines({"one two ", "three fo..."}, newWrap(text, 70, 2, true));
+    assertLines({"one two ", "three ", "four fiv..."}, newWrap(text, 70, 3, true));
+    // no ellipsis when the text ends on the last line
+    assertLines({"one two ", "three ", "four five ", "six"}, newWrap(text, 70, 4, true));
+}
+
+void test_utf8(void) {
+    // 9 pixels per non ASCII glyph, multi byte sequences are never split
+    assertLines({"\xC3\xA9\xC3\xA9\xC3\xA9", "\xE2\x82\xAC\xE2\x82\xAC"}, newWrap("\xC3\xA9\xC3\xA9\xC3\xA9 \xE2\x82\xAC\xE2\x82\xAC", 30));
+}
+
+void test_widths_for_alignment(void) {
+    std::vector<int32_t> widths;
+    const std::vector<std::string> lines = newWrap("jab cd", 25, 0, false, &widths);
+    assertLines({"jab ", "cd"}, lines);
+    // the trailing space doesn't count, and the width matches what textWidth() reports
+    TEST_ASSERT_EQUAL(oldTextWidth("jab"), widths[0]);
+    TEST_ASSERT_EQUAL(oldTextWidth("cd"), widths[1]);
+}
+
+void test_benchmark_4k(void) {
+    const std::string text = randomText(4096, 42);
+    const int32_t boxwidth = 280;
+
+    auto t0 = std::chrono::steady_clock::now();
+    const std::vector<std::string> before = oldWrap(text, boxwidth);
+    auto t1 = std::chrono::steady_clock::now();
+    const std::vector<std::string> after = newWrap(text, boxwidth);
+    auto t2 = std::chrono::steady_clock::now();
+
+    assertLines(before, after);
+    char message[100];
+    snprintf(message, sizeof(message), "4 KB, %u lines: substring measuring %lld us, single pass %lld us", (unsigned)after.size(),
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count(),
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count());
+    TEST_MESSAGE(message);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_old_wrapping);
+    RUN_TEST(test_golden_paragraph);
+    RUN_TEST(test_long_word_is_split);
+    RUN_TEST(test_soft_hyphen);
+    RUN_TEST(test_ellipsis);
+    RUN_TEST(test_utf8);
+    RUN_TEST(test_widths_for_alignment);
+    RUN_TEST(test_benchmark_4k);
+    return UNITY_END();
+}
@@ -0,0 +1,2 @@
+// checkin.c of the TLSR tags, against the SDK stub in test/tlsr_stub
+#include "../../../ARM_Tag_FW/OpenEPaperLink_TLSR/src/checkin.c"
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+extern "C" {
+#include "../../../ARM_Tag_FW/OpenEPaperLink_TLSR/src/powermgt.h"
+extern uint16_t dataReqAttemptArr[POWER_SAVING_SMOOTHING];
+extern uint8_t dataReqAttemptArrayIndex;
+}
+
+void setUp(void) {
+    initPowerSaving(INTERVAL_BASE);
+    dataReqAttemptArrayIndex = 0;
+    nextCheckInFromAP = 0;
+}
+void tearDown(void) {}
+
+static void checkinWith(uint8_t attempt) {
+    dataReqLastAttempt = attempt;
+    addAverageValue();
+}
+
+void test_seconds_hint(void) {
+    nextCheckInFromAP = CHECKIN_HINT_SECONDS | 5;  // the AP has more queued
+    TEST_ASSERT_EQUAL(5000, getNextCheckinMs());
+    nextCheckInFromAP = CHECKIN_HINT_SECONDS | 0;
+    TEST_ASSERT_EQUAL(CHECKIN_MIN_SECONDS * 1000, getNextCheckinMs());
+    for (uint8_t c = 0; c < POWER_SAVING_SMOOTHING; c++) checkinWith(DATA_REQ_MAX_ATTEMPTS);
+    nextCheckInFromAP = CHECKIN_HINT_SECONDS | 5;  // even on a bad link
+    TEST_ASSERT_EQUAL(5000, getNextCheckinMs());
+}
+
+void test_link_interval(void) {
+    TEST_ASSERT_EQUAL(INTERVAL_BASE * 1000, getNextCheckinMs());
+    for (uint8_t c = 0; c < POWER_SAVING_SMOOTHING; c++) checkinWith(DATA_REQ_MAX_ATTEMPTS);
+    TEST_ASSERT_EQUAL(INTERVAL_AT_MAX_ATTEMPTS * 1000, getNextCheckinMs());
+    checkinWith(0);  // one good check-in moves the average back by an eighth
+    TEST_ASSERT_EQUAL((7 * INTERVAL_AT_MAX_ATTEMPTS + INTERVAL_BASE) / 8 * 1000, getNextCheckinMs());
+}
+
+void test_minute_hint(void) {
+    nextCheckInFromAP = 5;
+    TEST_ASSERT_EQUAL(5 * 60000, getNextCheckinMs());
+    nextCheckInFromAP = 0x7FFF;  // capped at a day
+    TEST_ASSERT_EQUAL(INTERVAL_3_TIME * 1000, getNextCheckinMs());
+    for (uint8_t c = 0; c < POWER_SAVING_SMOOTHING; c++) checkinWith(DATA_REQ_MAX_ATTEMPTS);
+    nextCheckInFromAP = 1;  // a bad link stays slower than the hint
+    TEST_ASSERT_EQUAL(INTERVAL_AT_MAX_ATTEMPTS * 1000, getNextCheckinMs());
+}
+
+// Energy model of a TLSR8258 tag, per the datasheet figures: deep sleep with retention 1.5 uA; a wakeup
+// 4 ms at 3 mA; a data request attempt is the TX and the DATA_REQ_RX_WINDOW_SIZE window, 6 ms at 5.5 mA;
+// an image download 3 s at 5.5 mA and the refresh 15 s at 1.5 mA.
+#define SLEEP_UA 1.5
+#define WAKE_UAS (4 * 3000.0 / 1000)
+#define ATTEMPT_MS 6
+#define ATTEMPT_UAS (ATTEMPT_MS * 5500.0 / 1000)
+#define UPDATE_MS 3000
+#define UPDATE_UAS (3 * 5500.0 + 15 * 1500.0)
+#define AIR_MS 1  // the data request on air; two that overlap are both lost
+
+// 500 tags against one AP for a day, on a clock in ms. 60% of the tags show scheduled content that
+// changes on the hour, so the AP knows the next change and sends the minutes until then, the way
+// contentRunner's prepareIdleReq does (only for more than a minute). The others change at random
+// times, about every 4 hours, which the AP can't announce. One tag in ten has a poor link that loses
+// 30% of the packets. While the AP sends images it misses half of the other requests, its
+// one radio is sending blocks the other half of the time. Before: a fixed 40 s after
+// every check-in.
+struct simTag {
+    bool scheduled;
+    uint32_t lossPerMille;
+    int64_t changedAt;   // content change the tag hasn't picked up yet, or -1
+    int64_t nextChange;  // next content change on the AP
+    uint16_t attempts[POWER_SAVING_SMOOTHING];
+    uint8_t attemptIndex;
+};
+
+struct simResult {
+    double awakeMah;    // per tag and day, the check-ins
+    double checkinMah;  // with the sleep current
+    double totalMah;    // with the image updates
+    double checkinsPerDay;
+    double failedShare;
+    double meanLatency[2], p95Latency[2];  // s from the content change on the AP until the tag has it; unscheduled, scheduled
+    uint32_t updates, missed;  // missed: scheduled changes overwritten before the tag got them
+};
+
+static uint32_t rng;
+static uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static simResult simulate(bool controller) {
+    const int64_t day = 86400000LL;
+    const uint32_t tagCount = 500;
+    rng = 12345;
+    std::vector<simTag> tags(tagCount);
+    typedef std::pair<int64_t, uint32_t> wakeup;
+    std::priority_queue<wakeup, std::vector<wakeup>, std::greater<wakeup>> wakeups;
+    for (uint32_t t = 0; t < tagCount; t++) {
+        simTag& tag = tags[t];
+        tag.scheduled = t % 5 < 3;
+        tag.lossPerMille = t % 10 == 9 ? 300 : 10;
+        tag.changedAt = -1;
+        tag.nextChange = tag.scheduled ? 3600000 : nextRandom() % (8 * 3600000);
+        for (uint16_t& a : tag.attempts) a = INTERVAL_BASE;
+        tag.attemptIndex = 0;
+        wakeups.push({nextRandom() % 40000, t});
+    }
+
+    std::vector<int64_t> onAir;  // request times of the last second
+    std::vector<double> latencies[2];
+    std::vector<int64_t> transfers;  // end times of the image downloads
+    double awakeUas = 0, updateUas = 0;
+    uint64_t checkins = 0, failed = 0;
+    simResult result = {};
+
+    while (!wakeups.empty()) {
+        const int64_t now = wakeups.top().first;
+        simTag& tag = tags[wakeups.top().second];
+        wakeups.pop();
+        if (now >= day) continue;
+
+        // content changes on the AP up to now
+        while (tag.nextChange <= now) {
+            if (tag.changedAt < 0) {
+                tag.changedAt = tag.nextChange;
+            } else if (tag.scheduled) {
+                result.missed++;  // the hint made the tag sleep past a whole change
+            }
+            tag.nextChange += tag.scheduled ? 3600000 : 1 + nextRandom() % (8 * 3600000);
+        }
+
+        // getAvailDataInfo
+        checkins++;
+        awakeUas += WAKE_UAS;
+        uint8_t attempt = 0;
+        for (; attempt < DATA_REQ_MAX_ATTEMPTS; attempt++) {
+            const int64_t tx = now + attempt * ATTEMPT_MS;
+            awakeUas += ATTEMPT_UAS;
+            const bool collided = std::any_of(onAir.begin(), onAir.end(), [tx](int64_t other) { return other > tx - AIR_MS && other < tx + AIR_MS; });
+            onAir.push_back(tx);
+            const bool apMissed = std::any_of(transfers.begin(), transfers.end(), [tx](int64_t end) { return end > tx; }) && (nextRandom() & 1);
+            if (collided || apMissed || nextRandom() % 1000 < tag.lossPerMille) continue;
+            if (nextRandom() % 1000 < tag.lossPerMille) continue;  // the answer
+            break;
+        }
+        onAir.erase(std::remove_if(onAir.begin(), onAir.end(), [now](int64_t t) { return t < now - 1000; }), onAir.end());
+        transfers.erase(std::remove_if(transfers.begin(), transfers.end(), [now](int64_t end) { return end < now; }), transfers.end());
+
+        memcpy(dataReqAttemptArr, tag.attempts, sizeof(tag.attempts));
+        dataReqAttemptArrayIndex = tag.attemptIndex;
+        dataReqLastAttempt = attempt;
+        addAverageValue();
+        if (attempt == DATA_REQ_MAX_ATTEMPTS) {
+            failed++;
+            nextCheckInFromAP = 0;
+        } else {
+            const int64_t answered = now + attempt * ATTEMPT_MS;
+            if (tag.changedAt >= 0) {
+                latencies[tag.scheduled].push_back((answered - tag.changedAt) / 1000.0);
+                tag.changedAt = -1;
+                result.updates++;
+                updateUas += UPDATE_UAS;
+                transfers.push_back(answered + UPDATE_MS);
+            }
+            const int64_t minutes = tag.scheduled ? (tag.nextChange - answered) / 60000 : 0;
+            nextCheckInFromAP = minutes > 1 ? std::min<int64_t>(minutes, 0x7FFF) : 0;
+        }
+        const uint32_t sleep = controller ? getNextCheckinMs() : 40000;
+        memcpy(tag.attempts, dataReqAttemptArr, sizeof(tag.attempts));
+        tag.attemptIndex = dataReqAttemptArrayIndex;
+        wakeups.push({now + sleep + (nextRandom() & 0xff), (uint32_t)(&tag - tags.data())});
+    }
+
+    for (uint8_t s = 0; s < 2; s++) {
+        std::vector<double>& l = latencies[s];
+        std::sort(l.begin(), l.end());
+        double sum = 0;
+        for (double v : l) sum += v;
+        result.meanLatency[s] = l.empty() ? 0 : sum / l.size();
+        result.p95Latency[s] = l.empty() ? 0 : l[l.size() * 95 / 100];
+    }
+    const double sleepUas = SLEEP_UA * 86400.0 * tagCount;
+    result.awakeMah = awakeUas / 3600.0 / 1000 / tagCount;
+    result.checkinMah = result.awakeMah + sleepUas / 3600.0 / 1000 / tagCount;
+    result.totalMah = result.checkinMah + updateUas / 3600.0 / 1000 / tagCount;
+    result.checkinsPerDay = (double)checkins / tagCount;
+    result.failedShare = (double)failed / checkins;
+    return result;
+}
+
+void test_simulate_500_tags(void) {
+    const simResult fixed = simulate(false);
+    const simResult adaptive = simulate(true);
+    char message[300];
+    for (const simResult* r : {&fixed, &adaptive}) {
+        snprintf(message, sizeof(message),
+                 "%s: %.4f mAh/day awake for check-ins, %.4f with sleep, %.4f with the updates; %.0f check-ins/day, %.2f%% failed, %u updates; "
+                 "latency scheduled mean %.1f s p95 %.1f s, unscheduled mean %.1f s p95 %.1f s",
+                 r == &fixed ? "fixed 40 s" : "AP hint + link", r->awakeMah, r->checkinMah, r->totalMah, r->checkinsPerDay, r->failedShare * 100,
+                 (unsigned)r->updates, r->meanLatency[1], r->p95Latency[1], r->meanLatency[0], r->p95Latency[0]);
+        TEST_MESSAGE(message);
+    }
+    TEST_ASSERT_EQUAL(0, adaptive.missed);
+    TEST_ASSERT_LESS_OR_EQUAL(fixed.awakeMah / 2, adaptive.awakeMah);
+    TEST_ASSERT_GREATER_OR_EQUAL(fixed.updates * 0.99, adaptive.updates);
+    // the hint wakes a scheduled tag less than a minute before the change, then the link interval applies
+    TEST_ASSERT_LESS_OR_EQUAL(fixed.p95Latency[1] + 60, adaptive.p95Latency[1]);
+    // unscheduled content waits for the link interval, which only grows on a poor link
+    TEST_ASSERT_LESS_OR_EQUAL(INTERVAL_AT_MAX_ATTEMPTS, adaptive.p95Latency[0]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_seconds_hint);
+    RUN_TEST(test_link_interval);
+    RUN_TEST(test_minute_hint);
+    RUN_TEST(test_simulate_500_tags);
+    return UNITY_END();
+}
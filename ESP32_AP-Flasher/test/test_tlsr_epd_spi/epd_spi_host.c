@@ -0,0 +1,2 @@
+// epd_spi.c of the TLSR tags, against the SDK stub in test/tlsr_stub
+#include "../../../ARM_Tag_FW/OpenEPaperLink_TLSR/src/epd_spi.c"
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "tl_common.h"
+
+extern "C" {
+#include "../../../ARM_Tag_FW/OpenEPaperLink_TLSR/src/epd_spi.h"
+#include "../../../ARM_Tag_FW/OpenEPaperLink_TLSR/src/main.h"
+}
+
+// A logic analyzer on the EPD pins: decodes what the controller would latch on every rising CLK edge
+// while CS is low, and counts the pin writes and busy waits that keep the tag awake.
+struct spiByte {
+    bool data;  // DC high
+    uint8_t value;
+};
+
+static bool cs, clk, mosi, dc;
+static uint8_t shift, bits;
+static std::vector<spiByte> latched;
+static uint32_t pinWrites, waitedUs, csCycles;
+
+extern "C" void gpio_write(uint32_t pin, uint32_t value) {
+    const bool level = value != 0;
+    pinWrites++;
+    if (pin == EPD_CS) {
+        if (!level && cs) csCycles++;
+        if (level) TEST_ASSERT_EQUAL_MESSAGE(0, bits, "CS raised in the middle of a byte");
+        cs = level;
+    } else if (pin == EPD_DC) {
+        if (!cs) TEST_ASSERT_EQUAL(0, bits);
+        dc = level;
+    } else if (pin == EPD_MOSI) {
+        mosi = level;
+    } else if (pin == EPD_CLK) {
+        if (level && !clk && !cs) {
+            shift = (shift << 1) | mosi;
+            if (++bits == 8) {
+                latched.push_back({dc, shift});
+                bits = 0;
+            }
+        }
+        clk = level;
+    }
+}
+extern "C" uint32_t gpio_read(uint32_t) {
+    return 1;
+}
+extern "C" void gpio_set_func(uint32_t, uint32_t) {}
+extern "C" void gpio_set_output_en(uint32_t, uint32_t) {}
+extern "C" void gpio_set_input_en(uint32_t, uint32_t) {}
+extern "C" void gpio_setup_up_down_resistor(uint32_t, uint32_t) {}
+extern "C" void gpio_shutdown(uint32_t) {}
+extern "C" void WaitUs(uint32_t us) {
+    waitedUs += us;
+}
+extern "C" void WaitMs(uint32_t ms) {
+    waitedUs += ms * 1000;
+}
+extern "C" uint32_t clock_time(void) {
+    return 0;
+}
+
+static void resetTrace() {
+    cs = clk = true;
+    mosi = dc = false;
+    shift = bits = 0;
+    latched.clear();
+    pinWrites = waitedUs = csCycles = 0;
+}
+
+static std::vector<uint8_t> testImage(size_t len) {
+    std::vector<uint8_t> image(len);
+    for (size_t c = 0; c < len; c++) image[c] = (c * 73 + (c >> 5)) & 0xFF;
+    image[0] = 0x00;
+    image[1] = 0xFF;
+    image[2] = 0x80;
+    image[3] = 0x01;
+    return image;
+}
+
+// the byte by byte loop EPD_LoadImage had before the bursts
+static void loadImageByByte(unsigned char* image, int size, uint8_t cmd) {
+    EPD_WriteCmd(cmd);
+    for (int i = 0; i < size; i++) EPD_WriteData(image[i]);
+    WaitMs(2);
+}
+
+void setUp(void) {
+    resetTrace();
+}
+void tearDown(void) {}
+
+void test_burst_latches_the_same_bytes(void) {
+    std::vector<uint8_t> image = testImage(4000);
+    loadImageByByte(image.data(), image.size(), 0x10);
+    const std::vector<spiByte> reference = latched;
+
+    resetTrace();
+    EPD_LoadImage(image.data(), image.size(), 0x10);
+    TEST_ASSERT_EQUAL(image.size() + 1, latched.size());
+    TEST_ASSERT_EQUAL(reference.size(), latched.size());
+    TEST_ASSERT_FALSE(latched[0].data);
+    TEST_ASSERT_EQUAL(0x10, latched[0].value);
+    for (size_t c = 0; c < latched.size(); c++) {
+        TEST_ASSERT_EQUAL(reference[c].data, latched[c].data);
+        TEST_ASSERT_EQUAL(reference[c].value, latched[c].value);
+    }
+    TEST_ASSERT_EQUAL(2, csCycles);  // the command and one burst
+    TEST_ASSERT_TRUE(cs);
+}
+
+void test_empty_and_single_byte_bursts(void) {
+    const uint8_t one = 0xA5;
+    EPD_WriteDataBuf(&one, 0);
+    TEST_ASSERT_EQUAL(0, latched.size());
+    EPD_WriteDataBuf(&one, 1);
+    TEST_ASSERT_EQUAL(1, latched.size());
+    TEST_ASSERT_TRUE(latched[0].data);
+    TEST_ASSERT_EQUAL(0xA5, latched[0].value);
+}
+
+// Pin writes and busy waits for both planes of the 3.5" BWR panel (384x184). At 24 MHz a gpio_write
+// call is taken as 0.25 us; the waits are exact.
+void test_benchmark_bwr_350_frame(void) {
+    const int plane = 384 * 184 / 8;
+    std::vector<uint8_t> image = testImage(plane);
+    loadImageByByte(image.data(), plane, 0x10);
+    loadImageByByte(image.data(), plane, 0x13);
+    const uint32_t oldWrites = pinWrites, oldWaited = waitedUs;
+
+    resetTrace();
+    EPD_LoadImage(image.data(), plane, 0x10);
+    EPD_LoadImage(image.data(), plane, 0x13);
+
+    const double oldMs = oldWaited / 1000.0 + oldWrites * 0.25 / 1000;
+    const double newMs = waitedUs / 1000.0 + pinWrites * 0.25 / 1000;
+    char message[200];
+    snprintf(message, sizeof(message), "BWR 3.5\" frame: byte by byte %u pin writes + %u us waits = ~%.0f ms, bursts %u + %u us = ~%.0f ms",
+             (unsigned)oldWrites, (unsigned)oldWaited, oldMs, (unsigned)pinWrites, (unsigned)waitedUs, newMs);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL(2 * (plane + 1), latched.size());
+    TEST_ASSERT_LESS_OR_EQUAL(oldMs / 2, newMs);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_latches_the_same_bytes);
+    RUN_TEST(test_empty_and_single_byte_bursts);
+    RUN_TEST(test_benchmark_bwr_350_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "wificonnection.h"
+
+// A fake WiFi driver as the event source: the access point goes away for the outages in the list.
+// The station drops at the start of one (STA_DISCONNECTED event) and associates once the access point
+// has been back for ASSOC_MS. With setAutoReconnect(true) the Arduino core keeps trying on its own
+// after a drop; reconnect() starts the attempt over, and starting the configuration AP ends it.
+#define ASSOC_MS 2500
+
+struct outage {
+    uint32_t from, to;
+};
+
+struct fakeWifi {
+    std::vector<outage> outages;
+    bool connected = true;
+    bool lostEvent = false;
+    bool trying = false;
+    uint32_t attemptStart = 0;
+    uint32_t lostAt = 0;
+    std::vector<uint32_t> reconnectMs;  // from dropping until connected again
+
+    bool apUp(uint32_t now, uint32_t* upSince = nullptr) const {
+        uint32_t since = 0;
+        for (const outage& o : outages) {
+            if (now >= o.from && now < o.to) return false;
+            if (now >= o.to) since = o.to;
+        }
+        if (upSince) *upSince = since;
+        return true;
+    }
+
+    void reconnect(uint32_t now) {
+        trying = true;
+        attemptStart = now;
+    }
+
+    void stop() {
+        trying = false;
+    }
+
+    void tick(uint32_t now) {
+        uint32_t upSince;
+        if (connected && !apUp(now)) {
+            connected = false;
+            lostEvent = true;
+            lostAt = now;
+            reconnect(now);
+        } else if (!connected && trying && apUp(now, &upSince)) {
+            if (now >= std::max(attemptStart, upSince) + ASSOC_MS) {
+                connected = true;
+                trying = false;
+                reconnectMs.push_back(now - lostAt);
+            }
+        }
+    }
+
+    bool takeLostEvent() {
+        const bool lost = lostEvent;
+        lostEvent = false;
+        return lost;
+    }
+};
+
+// The loop task: wm.poll() reads the Improv UART (pollSerial) at its end, then the rest of the loop
+// runs and it sleeps 100 ms. Records the longest time the UART went unread.
+#define LOOP_WORK_MS 5
+#define LOOP_DELAY_MS 100
+
+struct loopRun {
+    fakeWifi wifi;
+    uint32_t now = 0;
+    uint32_t lastSerial = 0;
+    uint32_t maxSerialGap = 0;
+    uint32_t fallbacks = 0;
+
+    void serial() {
+        maxSerialGap = std::max(maxSerialGap, now - lastSerial);
+        lastSerial = now;
+    }
+
+    void wait(uint32_t ms) {
+        for (uint32_t end = now + ms; now < end; now += 10) wifi.tick(now);
+    }
+};
+
+static void runNow(loopRun& run, uint32_t until) {
+    wifiConnection connection;
+    connection.start(0);
+    while (run.now < until) {
+        run.wifi.tick(run.now);
+        switch (connection.poll(run.now, run.wifi.connected, run.wifi.takeLostEvent())) {
+            case WIFI_LOST:
+            case WIFI_RECONNECT:
+                run.wifi.reconnect(run.now);
+                break;
+            case WIFI_FAILED:
+                run.fallbacks++;
+                run.wifi.stop();
+                connection.status = AP;
+                connection.nextCheck = run.now + connection.retryInterval;
+                break;
+            default:
+                break;
+        }
+        if (connection.status == AP && run.now > connection.nextCheck) {
+            run.wifi.reconnect(run.now);
+            connection.start(run.now);
+        }
+        run.serial();
+        run.wait(LOOP_WORK_MS + LOOP_DELAY_MS);
+    }
+}
+
+// Before: a status check every 5 s, then WiFi.reconnect() and waitForConnection(), which held the
+// loop task in a 250 ms vTaskDelay loop until connected, or for 15 s and started the configuration AP.
+// From there connectToWifi() waited the same way every 5 minutes.
+static void runBefore(loopRun& run, uint32_t until) {
+    uint32_t nextCheck = 5000;
+    bool ap = false;
+    while (run.now < until) {
+        run.wifi.tick(run.now);
+        run.wifi.takeLostEvent();  // only logged
+        if (run.now > nextCheck && (ap || !run.wifi.connected)) {
+            if (ap) run.wait(200);  // the delay(100)s in connectToWifi
+            run.wifi.reconnect(run.now);
+            const uint32_t timeout = run.now + 15000;
+            while (!run.wifi.connected && run.now <= timeout) run.wait(250);
+            ap = !run.wifi.connected;
+            if (ap) {
+                run.fallbacks++;
+                run.wifi.stop();
+            }
+            nextCheck = run.now + (ap ? 5 * 60000 : 5000);
+        } else if (run.now > nextCheck) {
+            nextCheck = run.now + 5000;
+        }
+        run.serial();
+        run.wait(LOOP_WORK_MS + LOOP_DELAY_MS);
+    }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_backoff_then_ap(void) {
+    wifiConnection connection;
+    connection.start(0);
+    TEST_ASSERT_EQUAL(WIFI_ESTABLISHED, connection.poll(100, true, false));
+    TEST_ASSERT_EQUAL(100, connection.connectMs);
+    TEST_ASSERT_EQUAL(WIFI_IDLE, connection.poll(200, true, false));
+    TEST_ASSERT_EQUAL(WIFI_LOST, connection.poll(300, false, true));  // the event, before the 5 s check
+
+    uint32_t now = 300;
+    for (uint32_t backoff : {5000, 10000, 20000, 40000}) {
+        TEST_ASSERT_EQUAL(WIFI_IDLE, connection.poll(now + connection.connectionTimeout, false, false));
+        now += connection.connectionTimeout + 1;
+        TEST_ASSERT_EQUAL(WIFI_BACKOFF, connection.poll(now, false, false));
+        TEST_ASSERT_EQUAL(backoff, connection.backoff);
+        TEST_ASSERT_EQUAL(WIFI_IDLE, connection.poll(now + backoff, false, false));
+        now += backoff + 1;
+        TEST_ASSERT_EQUAL(WIFI_RECONNECT, connection.poll(now, false, false));
+    }
+    now += connection.connectionTimeout + 1;
+    TEST_ASSERT_EQUAL(WIFI_FAILED, connection.poll(now, false, false));
+}
+
+void test_driver_reconnects_during_backoff(void) {
+    wifiConnection connection;
+    connection.start(0);
+    connection.poll(1000, true, false);
+    connection.poll(2000, false, true);
+    TEST_ASSERT_EQUAL(WIFI_BACKOFF, connection.poll(2000 + connection.connectionTimeout + 1, false, false));
+    TEST_ASSERT_EQUAL(WIFI_ESTABLISHED, connection.poll(20000, true, false));
+    TEST_ASSERT_EQUAL(18000, connection.connectMs);
+    TEST_ASSERT_EQUAL(CONNECTED, connection.status);
+    TEST_ASSERT_EQUAL(0, connection.reconnectAttempts);
+}
+
+void test_first_connect_fails_to_ap(void) {
+    wifiConnection connection;
+    connection.start(0);
+    TEST_ASSERT_EQUAL(WIFI_IDLE, connection.poll(connection.connectionTimeout, false, true));
+    TEST_ASSERT_EQUAL(WIFI_FAILED, connection.poll(connection.connectionTimeout + 1, false, false));
+}
+
+// Outages of the access point, each alone in a 20 minute run
+void test_benchmark_outages(void) {
+    const uint32_t lengths[] = {1000, 8000, 30000, 120000};
+    for (uint32_t length : lengths) {
+        loopRun before, now;
+        before.wifi.outages = now.wifi.outages = {{60000, 60000 + length}};
+        runBefore(before, 20 * 60000);
+        runNow(now, 20 * 60000);
+        TEST_ASSERT_EQUAL(1, now.wifi.reconnectMs.size());
+        TEST_ASSERT_EQUAL(1, before.wifi.reconnectMs.size());
+        char message[200];
+        snprintf(message, sizeof(message), "outage %3u s: reconnected after %6.1f s before, %6.1f s now; UART unread for %5u ms before, %3u ms now%s",
+                 (unsigned)(length / 1000), before.wifi.reconnectMs[0] / 1000.0, now.wifi.reconnectMs[0] / 1000.0, (unsigned)before.maxSerialGap,
+                 (unsigned)now.maxSerialGap, before.fallbacks ? ", configuration AP before" : "");
+        TEST_MESSAGE(message);
+        TEST_ASSERT_EQUAL(0, now.fallbacks);
+        TEST_ASSERT_LESS_OR_EQUAL(LOOP_WORK_MS + LOOP_DELAY_MS + 10, now.maxSerialGap);
+        TEST_ASSERT_LESS_OR_EQUAL(before.wifi.reconnectMs[0] + 500, now.wifi.reconnectMs[0]);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_backoff_then_ap);
+    RUN_TEST(test_driver_reconnects_during_backoff);
+    RUN_TEST(test_first_connect_fails_to_ap);
+    RUN_TEST(test_benchmark_outages);
+    return UNITY_END();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// Just enough of the Telink SDK to build the EPD and check-in code of the TLSR tags on the host, see
+// test_tlsr_epd_spi and test_tlsr_checkin. The functions are implemented by the tests.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    GPIO_PA0 = 0x000, GPIO_PA1, GPIO_PA7 = 0x007,
+    GPIO_PB1 = 0x101, GPIO_PB4 = 0x104, GPIO_PB5, GPIO_PB6,
+    GPIO_PC0 = 0x200, GPIO_PC1, GPIO_PC4 = 0x204, GPIO_PC5, GPIO_PC6,
+    GPIO_PD2 = 0x302, GPIO_PD3, GPIO_PD4, GPIO_PD7 = 0x307,
+};
+
+typedef uint32_t GPIO_PinTypeDef;
+
+#define AS_GPIO 0
+#define PM_PIN_PULLUP_1M 1
+#define CLOCK_16M_SYS_TIMER_CLK_1MS 16000
+
+// like the SDK, any value other than 0 drives the pin high
+void gpio_write(uint32_t pin, uint32_t value);
+uint32_t gpio_read(uint32_t pin);
+void gpio_set_func(uint32_t pin, uint32_t func);
+void gpio_set_output_en(uint32_t pin, uint32_t value);
+void gpio_set_input_en(uint32_t pin, uint32_t value);
+void gpio_setup_up_down_resistor(uint32_t pin, uint32_t mode);
+void gpio_shutdown(uint32_t pin);
+void WaitUs(uint32_t us);
+void WaitMs(uint32_t ms);
+uint32_t clock_time(void);
+
+#ifdef __cplusplus
+}
+#endif
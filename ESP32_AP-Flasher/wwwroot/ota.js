@@ -290,6 +290,9 @@ export async function updateESP(fileUrl, showConfirm) {
                 binmd5 = file.md5;
                 binsize = file.size;
                 console.log(`URL for "${file.name}": ${binurl}`);
+                const otaParams = { url: binurl, md5: binmd5, size: binsize };
+                const delta = data.find((entry) => entry.name == env + '.delta');
+                if (delta) otaParams.delta = "http://openepaperlink.eu/getupdate/?url=" + encodeURIComponent(delta.url);
 
                 try {
                     const response = await fetch('update_ota', {
@@ -297,11 +300,7 @@ export async function updateESP(fileUrl, showConfirm) {
                         headers: {
                             'Content-Type': 'application/x-www-form-urlencoded'
                         },
-                        body: new URLSearchParams({
-                            url: binurl,
-                            md5: binmd5,
-                            size: binsize
-                        })
+                        body: new URLSearchParams(otaParams)
                     });
 
                     if (response.ok) {
@@ -6,6 +6,7 @@ from intelhex import IntelHex
 import os.path
 import socket
 import sys
+import zlib
 
 CMD_GET_VERSION = 1
 CMD_RESET_ESP = 2
@@ -33,6 +34,8 @@ CMD_READ_INFOPAGE = 80
 CMD_READ_FLASH = 81
 CMD_WRITE_INFOPAGE = 82
 CMD_WRITE_FLASH = 83
+CMD_WRITE_FLASH_WINDOW = 84
+CMD_WRITE_INFOPAGE_WINDOW = 85
 CMD_AUTOFLASH = 87
 CMD_COMPLETE = 88
 
@@ -41,6 +44,14 @@ CMD_WRITE_ERROR = 99
 TRANSPORT_SER = 0
 TRANSPORT_TCP = 1
 
+# flasher firmware version that accepts windowed writes
+WINDOW_MIN_VERSION = 0x32
+# chunks in flight; must stay below the flasher's command queue depth (10)
+WINDOW_SIZE = 8
+WINDOW_MAX_RETRIES = 10
+
+flasher_version = 0
+
 def read_binary_file(file_path):
     with open(file_path, 'rb') as file:
         binary_data = file.read()
@@ -201,6 +212,53 @@ def read_from_serial(filename, args):
             print("Failed reading block, timeout?")
 
 
+def write_windowed(file_data, chunk_size, write_cmd):
+    # Keeps up to WINDOW_SIZE chunks in flight. Every chunk carries a sequence number and a
+    # CRC-32; the flasher writes them in order and asks to go back to the first one it's missing
+    chunks = [bytes(file_data[i:i + chunk_size])
+              for i in range(0, len(file_data), chunk_size)]
+    base = 0            # oldest chunk not acknowledged yet
+    next_seq = 0        # next chunk to send
+    resend_from = -1    # last go-back point, to ignore the errors of chunks sent before it
+    retries = 0
+    while base < len(chunks):
+        while next_seq < len(chunks) and next_seq - base < WINDOW_SIZE:
+            chunk = chunks[next_seq]
+            send_cmd(write_cmd, to_byte(next_seq) + to_byte(zlib.crc32(chunk)) + chunk)
+            next_seq += 1
+        cmd, answer = wait_for_command()
+        if cmd == write_cmd and len(answer) == 4:
+            seq = int.from_bytes(answer, byteorder='big')
+            if seq >= base:
+                base = seq + 1
+                retries = 0
+                print(f'\rSent {min(base * chunk_size, len(file_data))} bytes', end='', flush=True)
+            continue
+        if cmd == CMD_WRITE_ERROR and len(answer) == 4:
+            expected = int.from_bytes(answer, byteorder='big')
+            if expected == resend_from:
+                continue
+            resend_from = expected
+            base = expected
+        elif cmd is None:
+            # lost a chunk or its answer; start over from the oldest unacknowledged one
+            resend_from = -1
+        elif cmd == CMD_COMPLETE:
+            print('\nTried to write more bytes than we have room for!   \n', end='', flush=True)
+            return False
+        elif cmd == CMD_WRITE_ERROR:
+            print('\nError writing to the tag. Check your connection.   \n', end='', flush=True)
+            return False
+        else:
+            continue
+        retries += 1
+        if retries > WINDOW_MAX_RETRIES:
+            print("\nToo many retries, giving up\n")
+            return False
+        next_seq = base
+    return True
+
+
 def write_to_serial(filename, args):
     if (args.flash):
         print(f"\nErasing flash... ")
@@ -234,6 +292,11 @@ def write_to_serial(filename, args):
     elif filename.endswith('.hex'):
         file_data = read_hex_file(filename)
 
+    if (args.flash or args.infopage) and flasher_version >= WINDOW_MIN_VERSION:
+        if write_windowed(file_data, chunk_size, CMD_WRITE_FLASH_WINDOW if args.flash else CMD_WRITE_INFOPAGE_WINDOW):
+            print('\rAll done writing! ', end='', flush=True)
+        return
+
     for i in range(0, len(file_data), chunk_size):
         chunk = file_data[i:i + chunk_size]
         if (args.flash):
@@ -344,8 +407,10 @@ def main():
         send_cmd(CMD_GET_VERSION, bytearray([]))
         cmd, answer = wait_for_command()
         if (cmd == CMD_GET_VERSION):
+            global flasher_version
+            flasher_version = answer[0] << 24 | answer[1] << 16 | answer[2] << 8 | answer[3]
             print("Connection with the flasher established. Version: " +
-                  str(answer[0] << 24 | answer[1] << 16 | answer[2] << 8 | answer[3]))
+                  str(flasher_version))
         else:
             print(
                 "Couldn't establish a connection with the flasher, did you select the correct serial port?")
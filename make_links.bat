@@ -64,4 +64,15 @@ mklink /H zbs243_AP_FW\lut.h zbs243_shared\lut.h
 mklink /H zbs243_AP_FW\printf.h zbs243_shared\printf.h
 mklink /H zbs243_AP_FW\proto.h zbs243_shared\proto.h
 mklink /H zbs243_AP_FW\sleep.h zbs243_shared\sleep.h
-mklink /H zbs243_AP_FW\wdt.h zbs243_shared\wdt.h
\ No newline at end of file
+mklink /H zbs243_AP_FW\wdt.h zbs243_shared\wdt.h
+
+REM ARM AP_FW (the Arduino sketches can only compile files in their own folder, their committed copies of ap_core are kept in sync through these links)
+rm ARM_Tag_FW\Arduino_OpenEPaperLink_C6_AP\ap_core.c
+rm ARM_Tag_FW\Arduino_OpenEPaperLink_C6_AP\ap_core.h
+rm ARM_Tag_FW\Arduino_OpenEPaperLink_H2_AP\ap_core.c
+rm ARM_Tag_FW\Arduino_OpenEPaperLink_H2_AP\ap_core.h
+
+mklink /H ARM_Tag_FW\Arduino_OpenEPaperLink_C6_AP\ap_core.c ARM_Tag_FW\ap_shared\ap_core.c
+mklink /H ARM_Tag_FW\Arduino_OpenEPaperLink_C6_AP\ap_core.h ARM_Tag_FW\ap_shared\ap_core.h
+mklink /H ARM_Tag_FW\Arduino_OpenEPaperLink_H2_AP\ap_core.c ARM_Tag_FW\ap_shared\ap_core.c
+mklink /H ARM_Tag_FW\Arduino_OpenEPaperLink_H2_AP\ap_core.h ARM_Tag_FW\ap_shared\ap_core.h
\ No newline at end of file